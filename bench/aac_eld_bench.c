@@ -0,0 +1,263 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * AAC-ELD decode benchmark: encodes a few seconds of synthetic stereo audio with the vendored
+ * fdk-aac encoder, in the format AirPlay mirroring uses (AAC-ELD, 44100 Hz, 480 samples per
+ * frame, raw access units), then decodes the stream repeatedly with the fdk-aac decoder, as
+ * the audio renderers do, and reports the CPU time per frame and how many streams one core
+ * could decode in real time. -sbr encodes with low-delay SBR instead.
+ *
+ * The output also has a checksum of the decoded PCM: builds of fdk-aac with and without the
+ * x86 SIMD kernels (FDK_AAC_SIMD) must print the same one. For the default length it is compared
+ * with the checksum of the C build stored below, for other lengths -x gives the one to expect;
+ * the run fails if it differs. fdk_kernel_check tests the single kernels.
+ *
+ * Usage: aac_eld_bench [-s seconds] [-r rounds] [-sbr] [-x checksum]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <aacenc_lib.h>
+#include <aacdecoder_lib.h>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#define AUDIO_RATE 44100
+#define AUDIO_SPF 480
+#define MAX_FRAME_BYTES 1536
+
+/* pcm checksums of the C build for the default stream length */
+#define DEFAULT_SECONDS 10
+#define REFERENCE_CHECKSUM "27e886cac4ff10bc"
+#define REFERENCE_CHECKSUM_SBR "6081015cb52220a8"
+
+typedef struct eld_stream_s {
+    unsigned char conf[64];
+    UINT conf_len;
+    unsigned char *data;
+    int *sizes;
+    int frames;
+} eld_stream_t;
+
+static uint64_t thread_cpu_time() {
+#ifdef WIN32
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+        return 0;
+    }
+    return ((((uint64_t) kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) +
+            (((uint64_t) user.dwHighDateTime << 32) | user.dwLowDateTime)) * 100;
+#else
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) < 0) {
+        return 0;
+    }
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+/* A chord with a slow tremolo, different in both channels, and some noise: every band has content */
+static void make_pcm(INT_PCM *pcm, int frame) {
+    static const double tones[] = { 220.0, 277.2, 329.6, 1760.0, 5274.0 };
+    static uint32_t seed = 1;
+    for (int i = 0; i < AUDIO_SPF; i++) {
+        double t = (double) (frame * AUDIO_SPF + i) / AUDIO_RATE;
+        double left = 0, right = 0;
+        for (int k = 0; k < 5; k++) {
+            double tone = sin(2 * M_PI * tones[k] * t) / (k + 1);
+            left += tone;
+            right += tone * (0.5 + 0.5 * sin(2 * M_PI * 0.5 * t + k));
+        }
+        seed = seed * 1103515245 + 12345;
+        int noise = (int) (seed >> 22) - 512;
+        pcm[2 * i] = (INT_PCM) (5000.0 * left + noise);
+        pcm[2 * i + 1] = (INT_PCM) (5000.0 * right - noise);
+    }
+}
+
+static int encode_stream(eld_stream_t *stream, int seconds, int sbr) {
+    HANDLE_AACENCODER encoder;
+    if (aacEncOpen(&encoder, 0, 2) != AACENC_OK) {
+        return -1;
+    }
+    int ok = aacEncoder_SetParam(encoder, AACENC_AOT, AOT_ER_AAC_ELD) == AACENC_OK &&
+             aacEncoder_SetParam(encoder, AACENC_SBR_MODE, sbr) == AACENC_OK &&
+             aacEncoder_SetParam(encoder, AACENC_SAMPLERATE, AUDIO_RATE) == AACENC_OK &&
+             aacEncoder_SetParam(encoder, AACENC_CHANNELMODE, MODE_2) == AACENC_OK &&
+             aacEncoder_SetParam(encoder, AACENC_GRANULE_LENGTH, AUDIO_SPF) == AACENC_OK &&
+             aacEncoder_SetParam(encoder, AACENC_BITRATE, sbr ? 64000 : 128000) == AACENC_OK &&
+             aacEncoder_SetParam(encoder, AACENC_TRANSMUX, TT_MP4_RAW) == AACENC_OK &&
+             aacEncEncode(encoder, NULL, NULL, NULL, NULL) == AACENC_OK;
+    AACENC_InfoStruct info;
+    if (!ok || aacEncInfo(encoder, &info) != AACENC_OK || info.confSize > sizeof(stream->conf)) {
+        aacEncClose(&encoder);
+        return -1;
+    }
+    memcpy(stream->conf, info.confBuf, info.confSize);
+    stream->conf_len = info.confSize;
+
+    /* the encoder works in frames of its own size with SBR, so feed it AUDIO_SPF samples at a time */
+    int max_frames = seconds * AUDIO_RATE / AUDIO_SPF;
+    stream->data = malloc((size_t) max_frames * MAX_FRAME_BYTES);
+    stream->sizes = malloc(max_frames * sizeof(int));
+    stream->frames = 0;
+    for (int frame = 0; frame < max_frames; frame++) {
+        INT_PCM pcm[AUDIO_SPF * 2];
+        make_pcm(pcm, frame);
+        void *in_ptr = pcm, *out_ptr = stream->data + (size_t) stream->frames * MAX_FRAME_BYTES;
+        int in_id = IN_AUDIO_DATA, in_size = sizeof(pcm), in_el = sizeof(INT_PCM);
+        int out_id = OUT_BITSTREAM_DATA, out_size = MAX_FRAME_BYTES, out_el = 1;
+        AACENC_BufDesc in_buf = { 1, &in_ptr, &in_id, &in_size, &in_el };
+        AACENC_BufDesc out_buf = { 1, &out_ptr, &out_id, &out_size, &out_el };
+        AACENC_InArgs in_args;
+        AACENC_OutArgs out_args;
+        memset(&in_args, 0, sizeof(in_args));
+        memset(&out_args, 0, sizeof(out_args));
+        in_args.numInSamples = AUDIO_SPF * 2;
+        if (aacEncEncode(encoder, &in_buf, &out_buf, &in_args, &out_args) != AACENC_OK) {
+            aacEncClose(&encoder);
+            return -1;
+        }
+        if (out_args.numOutBytes > 0) {
+            stream->sizes[stream->frames++] = out_args.numOutBytes;
+        }
+    }
+    aacEncClose(&encoder);
+    return stream->frames > 0 ? 0 : -1;
+}
+
+/* Decodes the whole stream with a new decoder; returns the CPU time (ns) and adds the PCM to checksum (FNV-1a) */
+static int64_t decode_stream(eld_stream_t *stream, uint64_t *checksum, int *samples_per_frame) {
+    HANDLE_AACDECODER decoder = aacDecoder_Open(TT_MP4_RAW, 1);
+    if (!decoder) {
+        return -1;
+    }
+    UCHAR *conf = stream->conf;
+    if (aacDecoder_ConfigRaw(decoder, &conf, &stream->conf_len) != AAC_DEC_OK) {
+        aacDecoder_Close(decoder);
+        return -1;
+    }
+
+    INT_PCM pcm[2048 * 2];
+    uint64_t start = thread_cpu_time();
+    for (int i = 0; i < stream->frames; i++) {
+        UCHAR *data = stream->data + (size_t) i * MAX_FRAME_BYTES;
+        UINT size = stream->sizes[i], valid = size;
+        if (aacDecoder_Fill(decoder, &data, &size, &valid) != AAC_DEC_OK ||
+            aacDecoder_DecodeFrame(decoder, pcm, sizeof(pcm) / sizeof(INT_PCM), 0) != AAC_DEC_OK) {
+            aacDecoder_Close(decoder);
+            return -1;
+        }
+        CStreamInfo *info = aacDecoder_GetStreamInfo(decoder);
+        int samples = info->frameSize * info->numChannels;
+        *samples_per_frame = info->frameSize;
+        for (int n = 0; n < samples; n++) {
+            *checksum = (*checksum ^ (uint16_t) pcm[n]) * 0x100000001b3ull;
+        }
+    }
+    uint64_t elapsed = thread_cpu_time() - start;
+    aacDecoder_Close(decoder);
+    return (int64_t) elapsed;
+}
+
+static int compare_int64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-s seconds] [-r rounds] [-sbr] [-x checksum]\n", name);
+    fprintf(stderr, "  -s seconds   length of the encoded stream (default 10)\n");
+    fprintf(stderr, "  -r rounds    times the stream is decoded, the median is reported (default 5)\n");
+    fprintf(stderr, "  -sbr         AAC-ELD with low-delay SBR\n");
+    fprintf(stderr, "  -x checksum  fail if the decoded PCM has another checksum (default: the stored one\n");
+    fprintf(stderr, "               of the C build if the stream has the default length)\n");
+}
+
+int main(int argc, char *argv[]) {
+    int seconds = DEFAULT_SECONDS, rounds = 5, sbr = 0;
+    const char *expected = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0 && i < argc - 1) {
+            seconds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-r") == 0 && i < argc - 1) {
+            rounds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-sbr") == 0) {
+            sbr = 1;
+        } else if (strcmp(argv[i], "-x") == 0 && i < argc - 1) {
+            expected = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (seconds <= 0 || rounds <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!expected && seconds == DEFAULT_SECONDS) {
+        expected = sbr ? REFERENCE_CHECKSUM_SBR : REFERENCE_CHECKSUM;
+    }
+
+    eld_stream_t stream;
+    memset(&stream, 0, sizeof(stream));
+    if (encode_stream(&stream, seconds, sbr) < 0) {
+        fprintf(stderr, "Could not encode the AAC-ELD%s stream\n", sbr ? " (SBR)" : "");
+        return 1;
+    }
+
+    int64_t *times = malloc(rounds * sizeof(int64_t));
+    uint64_t checksum = 0;
+    int samples_per_frame = 0;
+    for (int round = 0; round < rounds; round++) {
+        uint64_t round_checksum = 0xcbf29ce484222325ull;
+        times[round] = decode_stream(&stream, &round_checksum, &samples_per_frame);
+        if (times[round] < 0) {
+            fprintf(stderr, "Could not decode the stream\n");
+            return 1;
+        }
+        checksum = round_checksum;
+    }
+    qsort(times, rounds, sizeof(int64_t), compare_int64);
+    double ns_per_frame = (double) times[rounds / 2] / stream.frames;
+    double audio_ns = 1e9 * samples_per_frame / AUDIO_RATE;
+
+    char checksum_text[17];
+    snprintf(checksum_text, sizeof(checksum_text), "%016llx", (unsigned long long) checksum);
+    printf("AAC-ELD%s, %d frames of %d samples\n", sbr ? " with SBR" : "", stream.frames, samples_per_frame);
+    printf("%-24s %10.1f\n", "us per frame", ns_per_frame / 1000);
+    printf("%-24s %10.1f\n", "real-time streams/core", audio_ns / ns_per_frame);
+    printf("%-24s %10s\n", "pcm checksum", checksum_text);
+
+    free(times);
+    free(stream.data);
+    free(stream.sizes);
+    if (expected && strcmp(expected, checksum_text) != 0) {
+        fprintf(stderr, "Checksum differs from %s: the decoder output is not bit-exact\n", expected);
+        return 2;
+    }
+    return 0;
+}
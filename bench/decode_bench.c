@@ -0,0 +1,367 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Decode benchmark: replays a recorded Annex-B H264 stream (e.g. one written with
+ * DUMP_H264 in raop_rtp_mirror.c) through the ffmpeg decoder once per decode profile,
+ * as fast as possible, and reports the per-frame decode latency (from sending an
+ * access unit to receiving its picture) and the achieved frame rate.
+ *
+ * With "vui" instead of profiles, the stream is decoded as recorded and with the SPS
+ * rewritten by h264_params (num_reorder_frames = 0, as the renderers pass it on), by a
+ * single threaded decoder that takes the reordering delay from the stream, and the
+ * output delay of each is reported in access units: the number sent before the first
+ * picture came out, and how many later ones a picture was held back for on average.
+ * Exits with 1 if the first picture does not come out earlier with the rewritten SPS (so
+ * the stream has to be one with reordering, e.g. High profile from iOS); sps_check tests
+ * the rewrite itself without a stream.
+ *
+ * Usage: decode_bench file.h264 [profile ...]
+ *        decode_bench file.h264 vui
+ *        profiles: latency, throughput, weak (default: all three)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/time.h>
+
+#include "decode_profile.h"
+#include "h264_params.h"
+
+typedef struct access_unit_s {
+    uint8_t *data;
+    int size;
+} access_unit_t;
+
+typedef struct bench_result_s {
+    int frames;
+    double fps;
+    double p50, p90, p99, max;   /* decode latency in ms */
+} bench_result_t;
+
+typedef struct delay_result_s {
+    int frames;
+    int first;     /* access units sent when the first picture came out */
+    double mean;   /* access units sent after the one of a picture, before the picture came out */
+} delay_result_t;
+
+static uint8_t *read_file(const char *path, int *size) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long len = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t *data = av_mallocz(len + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (data && fread(data, 1, len, file) != (size_t) len) {
+        av_free(data);
+        data = NULL;
+    }
+    fclose(file);
+    *size = (int) len;
+    return data;
+}
+
+/* Split the stream into access units with the h264 parser, so that every profile decodes the same packets */
+static access_unit_t *split_access_units(uint8_t *data, int size, int *count) {
+    AVCodecParserContext *parser = av_parser_init(AV_CODEC_ID_H264);
+    AVCodecContext *ctx = avcodec_alloc_context3(avcodec_find_decoder(AV_CODEC_ID_H264));
+    access_unit_t *units = NULL;
+    int allocated = 0;
+    *count = 0;
+    if (!parser || !ctx) {
+        goto done;
+    }
+
+    int offset = 0;
+    while (1) {
+        uint8_t *out;
+        int out_size;
+        int remaining = size - offset;
+        int used = av_parser_parse2(parser, ctx, &out, &out_size, remaining ? data + offset : NULL, remaining,
+                                    AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+        offset += used;
+        if (out_size > 0) {
+            if (*count == allocated) {
+                allocated = allocated ? allocated * 2 : 256;
+                units = realloc(units, allocated * sizeof(access_unit_t));
+            }
+            units[*count].data = av_mallocz(out_size + AV_INPUT_BUFFER_PADDING_SIZE);
+            memcpy(units[*count].data, out, out_size);
+            units[*count].size = out_size;
+            (*count)++;
+        }
+        if (remaining == 0 && out_size == 0) {
+            break;
+        }
+    }
+
+done:
+    av_parser_close(parser);
+    avcodec_free_context(&ctx);
+    return units;
+}
+
+static int compare_int64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *) a;
+    int64_t y = *(const int64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(int64_t *sorted, int count, int percent) {
+    int index = (count * percent + 99) / 100 - 1;
+    if (index < 0) index = 0;
+    return sorted[index] / 1000.0;
+}
+
+static void receive_frames(AVCodecContext *ctx, AVFrame *frame, int64_t *sent, int64_t *latency, int *frames) {
+    while (avcodec_receive_frame(ctx, frame) == 0) {
+        // pts carries the index of the access unit the picture came from
+        if (frame->pts >= 0) {
+            latency[(*frames)++] = av_gettime_relative() - sent[frame->pts];
+        }
+        av_frame_unref(frame);
+    }
+}
+
+static int run_profile(decode_profile_t profile, access_unit_t *units, int count, bench_result_t *result) {
+    const AVCodec *codec = avcodec_find_decoder(AV_CODEC_ID_H264);
+    AVCodecContext *ctx = avcodec_alloc_context3(codec);
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    int64_t *sent = calloc(count, sizeof(int64_t));
+    int64_t *latency = calloc(count, sizeof(int64_t));
+    int ret = -1;
+
+    if (!ctx || !packet || !frame || !sent || !latency) {
+        goto done;
+    }
+    decode_profile_apply(ctx, profile, false);
+    if (avcodec_open2(ctx, codec, NULL) < 0) {
+        goto done;
+    }
+
+    int frames = 0;
+    int64_t start = av_gettime_relative();
+    for (int i = 0; i < count; i++) {
+        packet->data = units[i].data;
+        packet->size = units[i].size;
+        packet->pts = i;
+        sent[i] = av_gettime_relative();
+        avcodec_send_packet(ctx, packet);
+        receive_frames(ctx, frame, sent, latency, &frames);
+    }
+    avcodec_send_packet(ctx, NULL);
+    receive_frames(ctx, frame, sent, latency, &frames);
+    int64_t elapsed = av_gettime_relative() - start;
+
+    memset(result, 0, sizeof(bench_result_t));
+    result->frames = frames;
+    if (frames > 0) {
+        qsort(latency, frames, sizeof(int64_t), compare_int64);
+        result->fps = frames * 1000000.0 / elapsed;
+        result->p50 = percentile(latency, frames, 50);
+        result->p90 = percentile(latency, frames, 90);
+        result->p99 = percentile(latency, frames, 99);
+        result->max = latency[frames - 1] / 1000.0;
+    }
+    ret = 0;
+
+done:
+    free(sent);
+    free(latency);
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    avcodec_free_context(&ctx);
+    return ret;
+}
+
+/* Copy of the access units with every SPS rewritten the way the renderers pass it on */
+static access_unit_t *rewrite_vui(access_unit_t *units, int count) {
+    logger_t *logger = logger_init();
+    h264_params_t *params = h264_params_init(logger, true);
+    access_unit_t *rewritten = calloc(count, sizeof(access_unit_t));
+    if (!params || !rewritten) {
+        free(rewritten);
+        rewritten = NULL;
+        goto done;
+    }
+    for (int i = 0; i < count; i++) {
+        int size;
+        uint8_t *data = h264_params_process(params, units[i].data, units[i].size, &size);
+        rewritten[i].data = av_mallocz(size + AV_INPUT_BUFFER_PADDING_SIZE);
+        memcpy(rewritten[i].data, data, size);
+        rewritten[i].size = size;
+    }
+
+done:
+    h264_params_destroy(params);
+    logger_destroy(logger);
+    return rewritten;
+}
+
+static void receive_delayed(AVCodecContext *ctx, AVFrame *frame, int sent, int64_t *held, delay_result_t *result) {
+    while (avcodec_receive_frame(ctx, frame) == 0) {
+        if (frame->pts >= 0) {
+            if (result->frames++ == 0) {
+                result->first = sent;
+            }
+            *held += sent - 1 - frame->pts;
+        }
+        av_frame_unref(frame);
+    }
+}
+
+static int run_delay(access_unit_t *units, int count, delay_result_t *result) {
+    const AVCodec *codec = avcodec_find_decoder(AV_CODEC_ID_H264);
+    AVCodecContext *ctx = avcodec_alloc_context3(codec);
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    int ret = -1;
+
+    if (!ctx || !packet || !frame) {
+        goto done;
+    }
+    // No frame threads and no AV_CODEC_FLAG_LOW_DELAY: only the stream tells how long pictures are held back
+    ctx->thread_count = 1;
+    if (avcodec_open2(ctx, codec, NULL) < 0) {
+        goto done;
+    }
+
+    int64_t held = 0;
+    memset(result, 0, sizeof(delay_result_t));
+    for (int i = 0; i < count; i++) {
+        packet->data = units[i].data;
+        packet->size = units[i].size;
+        packet->pts = i;
+        avcodec_send_packet(ctx, packet);
+        receive_delayed(ctx, frame, i + 1, &held, result);
+    }
+    avcodec_send_packet(ctx, NULL);
+    receive_delayed(ctx, frame, count, &held, result);
+    if (result->frames > 0) {
+        result->mean = (double) held / result->frames;
+    }
+    ret = 0;
+
+done:
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    avcodec_free_context(&ctx);
+    return ret;
+}
+
+static int bench_vui(access_unit_t *units, int count) {
+    access_unit_t *rewritten = rewrite_vui(units, count);
+    delay_result_t recorded, patched;
+    int ret = 0;
+
+    if (!rewritten || run_delay(units, count, &recorded) < 0 || run_delay(rewritten, count, &patched) < 0) {
+        fprintf(stderr, "Could not open the decoder\n");
+        ret = 1;
+    } else {
+        printf("%-16s %8s %14s %14s\n", "sps", "frames", "first after", "mean held");
+        printf("%-16s %8d %14d %14.2f\n", "as recorded", recorded.frames, recorded.first, recorded.mean);
+        printf("%-16s %8d %14d %14.2f\n", "vui rewritten", patched.frames, patched.first, patched.mean);
+        if (patched.frames == 0 || patched.first >= recorded.first) {
+            printf("\nFAIL: first picture not earlier with the rewritten SPS\n");
+            ret = 1;
+        } else {
+            printf("\nfirst picture %d access unit(s) earlier with the rewritten SPS\n", recorded.first - patched.first);
+        }
+    }
+    if (rewritten) {
+        for (int i = 0; i < count; i++) {
+            av_free(rewritten[i].data);
+        }
+        free(rewritten);
+    }
+    return ret;
+}
+
+int main(int argc, char *argv[]) {
+    decode_profile_t profiles[] = {DECODE_PROFILE_LOWEST_LATENCY, DECODE_PROFILE_THROUGHPUT, DECODE_PROFILE_WEAK_CPU};
+    int profile_count = sizeof(profiles) / sizeof(profiles[0]);
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s file.h264 [latency|throughput|weak ...]\n       %s file.h264 vui\n", argv[0], argv[0]);
+        return 1;
+    }
+    bool vui = (argc == 3 && !strcmp(argv[2], "vui"));
+    if (argc > 2 && !vui) {
+        profile_count = 0;
+        for (int i = 2; i < argc && profile_count < 3; i++) {
+            if (!strcmp(argv[i], "latency")) {
+                profiles[profile_count++] = DECODE_PROFILE_LOWEST_LATENCY;
+            } else if (!strcmp(argv[i], "throughput")) {
+                profiles[profile_count++] = DECODE_PROFILE_THROUGHPUT;
+            } else if (!strcmp(argv[i], "weak")) {
+                profiles[profile_count++] = DECODE_PROFILE_WEAK_CPU;
+            } else {
+                fprintf(stderr, "Unknown profile \"%s\"\n", argv[i]);
+                return 1;
+            }
+        }
+    }
+
+    int size;
+    uint8_t *data = read_file(argv[1], &size);
+    if (!data) {
+        fprintf(stderr, "Could not read %s\n", argv[1]);
+        return 1;
+    }
+    int count;
+    access_unit_t *units = split_access_units(data, size, &count);
+    av_free(data);
+    if (count == 0) {
+        fprintf(stderr, "No access units found in %s\n", argv[1]);
+        return 1;
+    }
+    printf("%s: %d access units\n\n", argv[1], count);
+    if (vui) {
+        int ret = bench_vui(units, count);
+        for (int i = 0; i < count; i++) {
+            av_free(units[i].data);
+        }
+        free(units);
+        return ret;
+    }
+    printf("%-16s %8s %10s %10s %10s %10s %10s\n", "profile", "frames", "fps", "p50 ms", "p90 ms", "p99 ms", "max ms");
+
+    int ret = 0;
+    for (int i = 0; i < profile_count; i++) {
+        bench_result_t result;
+        if (run_profile(profiles[i], units, count, &result) < 0) {
+            fprintf(stderr, "Could not open the decoder for the %s profile\n", decode_profile_name(profiles[i]));
+            ret = 1;
+            continue;
+        }
+        printf("%-16s %8d %10.1f %10.2f %10.2f %10.2f %10.2f\n", decode_profile_name(profiles[i]), result.frames,
+               result.fps, result.p50, result.p90, result.p99, result.max);
+    }
+
+    for (int i = 0; i < count; i++) {
+        av_free(units[i].data);
+    }
+    free(units);
+    return ret;
+}
@@ -0,0 +1,316 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * fdk-aac kernel check: runs the fdk-aac functions that have x86 SIMD versions (FDK_AAC_SIMD)
+ * on pseudo-random input and compares a checksum (FNV-1a) of their output per kernel with the
+ * one the C code gives, stored below. Builds with and without the SIMD kernels must all pass;
+ * exits with 1 if a checksum differs. The inputs come from a fixed seed, so a failure can be
+ * reproduced and narrowed down with the C build.
+ *
+ * adjustTimeSlot_EldGrid() is static in env_calc.cpp, so that file is compiled into this one,
+ * with the same SIMD options as the library.
+ *
+ * Usage: fdk_kernel_check
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "dct.h"
+#include "fft.h"
+#include "scale.h"
+#include "qmf.h"
+#include "ldfiltbank.h"
+#include "env_calc.cpp"
+
+typedef struct kernel_check_s {
+    const char *name;
+    uint64_t (*run)();
+    uint64_t reference; /* checksum of the C code */
+} kernel_check_t;
+
+static uint32_t random_state;
+
+/* xorshift32, the full 32 bits are used */
+static FIXP_DBL random_dbl(int headroom) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return (FIXP_DBL) ((INT) random_state >> headroom);
+}
+
+static void random_fill(FIXP_DBL *p, int n, int headroom) {
+    for (int i = 0; i < n; i++) {
+        p[i] = random_dbl(headroom);
+    }
+}
+
+static void random_fill(SHORT *p, int n, int headroom) {
+    for (int i = 0; i < n; i++) {
+        p[i] = (SHORT) (random_dbl(headroom) >> 16);
+    }
+}
+
+static void hash(uint64_t *checksum, const FIXP_DBL *p, int n) {
+    for (int i = 0; i < n; i++) {
+        *checksum = (*checksum ^ (uint32_t) p[i]) * 0x100000001b3ull;
+    }
+}
+
+static void hash(uint64_t *checksum, const SHORT *p, int n) {
+    for (int i = 0; i < n; i++) {
+        *checksum = (*checksum ^ (uint16_t) p[i]) * 0x100000001b3ull;
+    }
+}
+
+/* All lengths of the tables in dct_getTables() with an FFT of half the length */
+static uint64_t check_dct_iv() {
+    static const int lengths[] = { 16, 24, 32, 40, 48, 64, 96, 120, 128, 160, 192, 240, 256, 384, 480, 512, 768, 960, 1024 };
+    uint64_t checksum = 0xcbf29ce484222325ull;
+    random_state = 4;
+    for (unsigned int l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+        for (int headroom = 1; headroom <= 9; headroom += 4) {
+            C_AALLOC_STACK_START(data, FIXP_DBL, 1024)
+            int exponent = 0;
+            random_fill(data, lengths[l], headroom);
+            dct_IV(data, lengths[l], &exponent);
+            hash(&checksum, data, lengths[l]);
+            hash(&checksum, (FIXP_DBL *) &exponent, 1);
+            C_AALLOC_STACK_END(data, FIXP_DBL, 1024)
+        }
+    }
+    return checksum;
+}
+
+/* All lengths fft() has, 120 and 240 have x86 versions */
+static uint64_t check_fft() {
+    static const int lengths[] = { 2, 3, 4, 5, 6, 8, 10, 12, 15, 16, 20, 24, 32, 48, 60, 64, 80, 96, 120, 128,
+                                   192, 240, 256, 384, 480, 512 };
+    uint64_t checksum = 0xcbf29ce484222325ull;
+    random_state = 5;
+    for (unsigned int l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+        for (int headroom = 1; headroom <= 9; headroom += 4) {
+            C_AALLOC_STACK_START(data, FIXP_DBL, 2 * 512)
+            INT scalefactor = 0;
+            random_fill(data, 2 * lengths[l], headroom);
+            fft(lengths[l], data, &scalefactor);
+            hash(&checksum, data, 2 * lengths[l]);
+            hash(&checksum, (FIXP_DBL *) &scalefactor, 1);
+            C_AALLOC_STACK_END(data, FIXP_DBL, 2 * 512)
+        }
+    }
+    return checksum;
+}
+
+/* The three versions with x86 code: in place, FIXP_DBL to FIXP_DBL and FIXP_DBL to FIXP_SGL, for
+ * lengths with and without a tail after the vectors, unaligned, and scales up to past the clamp */
+static uint64_t check_scale_values_saturate() {
+    uint64_t checksum = 0xcbf29ce484222325ull;
+    random_state = 6;
+    for (int len = 0; len <= 37; len++) {
+        for (int scale = -34; scale <= 34; scale += 2) {
+            FIXP_DBL src[40], dst[40], in_place[40];
+            FIXP_SGL dst_sgl[40];
+            int offset = len & 1;
+            random_fill(src, 40, (len >> 1) % 24);
+            memcpy(in_place, src, sizeof(src));
+            scaleValuesSaturate(in_place + offset, len, scale);
+            scaleValuesSaturate(dst + offset, src + offset, len, scale);
+            scaleValuesSaturate(dst_sgl + offset, src + offset, len, scale);
+            hash(&checksum, in_place + offset, len);
+            hash(&checksum, dst + offset, len);
+            hash(&checksum, dst_sgl + offset, len);
+        }
+    }
+    return checksum;
+}
+
+/* The low delay synthesis filterbank (DCT-IV, scaling and windowing) for the frame lengths of AAC-LD
+ * and AAC-ELD, over a few frames so that the overlap is used */
+static uint64_t check_ld_filterbank() {
+    static const int lengths[] = { 120, 128, 160, 240, 256, 480, 512 };
+    uint64_t checksum = 0xcbf29ce484222325ull;
+    random_state = 7;
+    for (unsigned int l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+        int n = lengths[l];
+        FIXP_DBL overlap[3 * 512];
+        PCM_DEC out[512];
+        memset(overlap, 0, sizeof(overlap));
+        for (int frame = 0; frame < 8; frame++) {
+            C_AALLOC_STACK_START(spectrum, FIXP_DBL, 512)
+            random_fill(spectrum, n, 2 + frame % 4);
+            InvMdctTransformLowDelay_fdk(spectrum, frame % 3, out, overlap, n);
+            hash(&checksum, out, n);
+            C_AALLOC_STACK_END(spectrum, FIXP_DBL, 512)
+        }
+    }
+    return checksum;
+}
+
+#define QMF_CHECK_SLOTS 48
+
+static const int qmf_bands[] = { 8, 16, 32, 64 };
+
+/* CLDFB analysis of 16 bit (INT_PCM, SHORT states) or 32 bit (LONG, FIXP_DBL states) input */
+template <class PCM, class STATE>
+static void qmf_analysis(uint64_t *checksum, int bands, int flags, int headroom) {
+    QMF_FILTER_BANK qmf;
+    STATE states[2 * QMF_NO_POLY * QMF_MAX_SYNTHESIS_BANDS];
+    FIXP_DBL real[QMF_MAX_SYNTHESIS_BANDS], imag[QMF_MAX_SYNTHESIS_BANDS];
+    PCM in[QMF_MAX_SYNTHESIS_BANDS];
+    C_AALLOC_STACK_START(work, FIXP_DBL, 2 * QMF_MAX_SYNTHESIS_BANDS)
+
+    qmfInitAnalysisFilterBank(&qmf, states, 1, bands, bands, bands, flags);
+    for (int slot = 0; slot < QMF_CHECK_SLOTS; slot++) {
+        random_fill(in, bands, headroom);
+        memset(imag, 0, sizeof(imag));
+        qmfAnalysisFilteringSlot(&qmf, real, imag, in, 1, work);
+        hash(checksum, real, bands);
+        hash(checksum, imag, bands);
+    }
+    C_AALLOC_STACK_END(work, FIXP_DBL, 2 * QMF_MAX_SYNTHESIS_BANDS)
+}
+
+/* CLDFB synthesis to 16 bit (INT_PCM) or 32 bit (LONG) output, with an output scale and gain */
+template <class PCM>
+static void qmf_synthesis(uint64_t *checksum, int bands, int flags, int out_scale, FIXP_DBL gain) {
+    QMF_FILTER_BANK qmf;
+    FIXP_QSS states[(2 * QMF_NO_POLY - 1) * QMF_MAX_SYNTHESIS_BANDS];
+    FIXP_DBL real[QMF_MAX_SYNTHESIS_BANDS], imag[QMF_MAX_SYNTHESIS_BANDS];
+    PCM out[QMF_MAX_SYNTHESIS_BANDS];
+    C_AALLOC_STACK_START(work, FIXP_DBL, 2 * QMF_MAX_SYNTHESIS_BANDS)
+
+    memset(&qmf, 0, sizeof(qmf));
+    qmfInitSynthesisFilterBank(&qmf, states, 1, bands, bands, bands, flags);
+    qmfChangeOutScalefactor(&qmf, out_scale);
+    qmfChangeOutGain(&qmf, gain, 0);
+    for (int slot = 0; slot < QMF_CHECK_SLOTS; slot++) {
+        random_fill(real, bands, 2);
+        random_fill(imag, bands, 2);
+        qmfSynthesisFilteringSlot(&qmf, real, imag, 0, 0, out, 1, work);
+        hash(checksum, out, bands);
+    }
+    C_AALLOC_STACK_END(work, FIXP_DBL, 2 * QMF_MAX_SYNTHESIS_BANDS)
+}
+
+/* LP and HQ, with 16 and 32 bit PCM */
+static uint64_t check_qmf_analysis() {
+    uint64_t checksum = 0xcbf29ce484222325ull;
+    random_state = 1;
+    for (int b = 0; b < 4; b++) {
+        for (int lp = 0; lp < 2; lp++) {
+            int flags = QMF_FLAG_CLDFB | (lp ? QMF_FLAG_LP : 0);
+            qmf_analysis<INT_PCM, FIXP_QAS>(&checksum, qmf_bands[b], flags, 0);
+            qmf_analysis<LONG, FIXP_DBL>(&checksum, qmf_bands[b], flags, 4);
+            qmf_analysis<LONG, FIXP_DBL>(&checksum, qmf_bands[b], flags, 8);
+        }
+    }
+    return checksum;
+}
+
+/* LP and HQ, with 16 and 32 bit PCM; the output scales and gains include ones that saturate */
+static uint64_t check_qmf_synthesis() {
+    static const int out_scales[] = { -6, -1, 0, 3, 12 };
+    static const FIXP_DBL gains[] = { (FIXP_DBL) MINVAL_DBL, FL2FXCONST_DBL(0.7071f) };
+    uint64_t checksum = 0xcbf29ce484222325ull;
+    random_state = 2;
+    for (int b = 0; b < 4; b++) {
+        for (int lp = 0; lp < 2; lp++) {
+            int flags = QMF_FLAG_CLDFB | (lp ? QMF_FLAG_LP : 0);
+            for (int s = 0; s < 5; s++) {
+                for (int g = 0; g < 2; g++) {
+                    qmf_synthesis<INT_PCM>(&checksum, qmf_bands[b], flags, out_scales[s], gains[g]);
+                    qmf_synthesis<LONG>(&checksum, qmf_bands[b], flags, out_scales[s], gains[g]);
+                }
+            }
+        }
+    }
+    return checksum;
+}
+
+/* Random SBR ranges, tone densities from none to every band (more than 16 tones), up to the top
+ * band, and phase indices that wrap around SBR_NF_NO_RANDOM_VAL */
+static uint64_t check_adjust_eld_grid() {
+    static const int tone_densities[] = { 0, 1, 4, 16 };
+    uint64_t checksum = 0xcbf29ce484222325ull;
+    random_state = 3;
+    for (int n = 0; n < 4000; n++) {
+        ENV_CALC_NRGS nrgs;
+        FIXP_DBL real[QMF_MAX_SYNTHESIS_BANDS + 1];
+        int low_subband = 1 + (int) ((UINT) random_dbl(0) % 40);
+        int max_subbands = fMin(MAX_FREQ_COEFFS, 64 - low_subband);
+        int no_subbands = 1 + (int) ((UINT) random_dbl(0) % max_subbands);
+        int density = tone_densities[n & 3];
+        UCHAR harm_index = (UCHAR) (n >> 2 & 3);
+        int phase_index = (int) ((UINT) random_dbl(0) % SBR_NF_NO_RANDOM_VAL);
+        int scale_change = (n >> 4) % 5;
+        int no_noise = (n >> 6 & 3) == 0;
+        int scale_diff_low = (n >> 8) % 7 - 3;
+
+        memset(&nrgs, 0, sizeof(nrgs));
+        random_fill(real, QMF_MAX_SYNTHESIS_BANDS + 1, 1);
+        random_fill(nrgs.nrgGain, no_subbands, 1);
+        random_fill(nrgs.noiseLevel, no_subbands, 3);
+        for (int k = 0; k < no_subbands; k++) {
+            FIXP_DBL level = random_dbl(4);
+            if (density > 0 && (UINT) random_dbl(0) % 16 < (UINT) density) {
+                nrgs.nrgSine[k] = level;
+            }
+        }
+        adjustTimeSlot_EldGrid(&real[low_subband], &nrgs, &harm_index, low_subband, no_subbands,
+                               scale_change, no_noise, &phase_index, scale_diff_low);
+        hash(&checksum, real, QMF_MAX_SYNTHESIS_BANDS + 1);
+        FIXP_DBL state[2] = { (FIXP_DBL) harm_index, (FIXP_DBL) phase_index };
+        hash(&checksum, state, 2);
+    }
+    return checksum;
+}
+
+static const kernel_check_t kernel_checks[] = {
+    { "dct_IV", check_dct_iv, 0xa02bfed2bdb84d5dull },
+    { "fft", check_fft, 0x339dfa62f2529596ull },
+    { "scaleValuesSaturate", check_scale_values_saturate, 0x62dc47b6d5377eebull },
+    { "ld synthesis filterbank", check_ld_filterbank, 0xd27dc67d0aed4f32ull },
+    { "qmf cldfb analysis", check_qmf_analysis, 0x774d4715c25fdc0full },
+    { "qmf cldfb synthesis", check_qmf_synthesis, 0x8bb57aa735064b6dull },
+    { "adjustTimeSlot_EldGrid", check_adjust_eld_grid, 0x1f7666f45dd88e04ull },
+};
+
+int main(int argc, char *argv[]) {
+    int failures = 0;
+#if defined(FDK_SIMD_X86)
+    printf("fdk-aac x86 SIMD kernels, %d lanes\n", FDK_SIMD_LANES);
+#else
+    printf("fdk-aac C kernels\n");
+#endif
+    for (unsigned int i = 0; i < sizeof(kernel_checks) / sizeof(kernel_checks[0]); i++) {
+        uint64_t checksum = kernel_checks[i].run();
+        int ok = checksum == kernel_checks[i].reference;
+        printf("%-28s %016llx %s\n", kernel_checks[i].name, (unsigned long long) checksum, ok ? "ok" : "FAIL");
+        if (!ok) {
+            failures++;
+        }
+    }
+    if (failures) {
+        fprintf(stderr, "%d kernel(s) differ from the C code\n", failures);
+    }
+    return failures ? 1 : 0;
+}
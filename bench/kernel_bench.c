@@ -0,0 +1,682 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Kernel benchmarks: times the hot functions of the receive path one by one, on synthetic but
+ * realistically sized input: mirror and audio decryption, the audio buffer under loss patterns,
+ * the NAL rewrite loop, RTSP request parsing, SETUP bplist parsing, the NTP offset filter and
+ * the audio rtp clock.
+ *
+ * Every kernel runs in batches of at least -t seconds, five times; the median time per operation
+ * is reported. Results are CSV (kernel,ns_per_op,mb_per_s) on stdout, and written to a file with
+ * -o. With -b, each kernel is compared with the same kernel in an earlier results file, and the
+ * run fails (exit status 2) if any is slower than there by more than -r percent.
+ *
+ * Usage: kernel_bench [-t seconds] [-f filter] [-o results.csv] [-b baseline.csv] [-r percent]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "raop.h"
+#include "raop_ntp.h"
+#include "raop_rtp.h"
+#include "raop_rtp_mirror.h"
+#include "raop_buffer.h"
+#include "mirror_buffer.h"
+#include "http_request.h"
+#include "netutils.h"
+#include "reactor.h"
+#include "logger.h"
+#include "trace.h"
+#include <plist/plist.h>
+
+#define BENCH_ROUNDS 5
+#define BENCH_MAX_RESULTS 64
+#define BENCH_AUDIO_PAYLOAD 256   /* bytes of an AAC-ELD packet, roughly */
+#define BENCH_AUDIO_CYCLE 1000    /* packets in one cycle of a loss pattern */
+
+typedef void (*kernel_fn_t)(void *ctx, long iterations);
+
+typedef struct bench_result_s {
+    char name[48];
+    double ns_per_op;
+    double mb_per_s;    /* 0 if the kernel has no byte size */
+} bench_result_t;
+
+typedef struct bench_s {
+    double min_seconds;
+    const char *filter;
+    bench_result_t results[BENCH_MAX_RESULTS];
+    int count;
+} bench_t;
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+/* Times fn in growing batches until one takes min_seconds, then takes the median of BENCH_ROUNDS such batches */
+static void bench_run(bench_t *bench, const char *name, int bytes_per_op, kernel_fn_t fn, void *ctx) {
+    if (bench->filter && !strstr(name, bench->filter)) {
+        return;
+    }
+    if (bench->count == BENCH_MAX_RESULTS) {
+        fprintf(stderr, "too many kernels, %s not run\n", name);
+        return;
+    }
+    uint64_t min_ns = (uint64_t) (bench->min_seconds * 1e9);
+    long iterations = 1;
+    while (1) {
+        uint64_t start = trace_now();
+        fn(ctx, iterations);
+        uint64_t elapsed = trace_now() - start;
+        if (elapsed >= min_ns) {
+            break;
+        }
+        /* aim a little above the minimum, at most 100 times the last batch */
+        double scale = elapsed ? 1.2 * min_ns / elapsed : 100;
+        iterations = (long) (iterations * (scale > 100 ? 100 : scale < 2 ? 2 : scale));
+    }
+    double ns[BENCH_ROUNDS];
+    for (int i = 0; i < BENCH_ROUNDS; i++) {
+        uint64_t start = trace_now();
+        fn(ctx, iterations);
+        ns[i] = (double) (trace_now() - start) / iterations;
+    }
+    qsort(ns, BENCH_ROUNDS, sizeof(double), compare_double);
+
+    bench_result_t *result = &bench->results[bench->count++];
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    result->ns_per_op = ns[BENCH_ROUNDS / 2];
+    result->mb_per_s = bytes_per_op ? bytes_per_op / result->ns_per_op * 1e3 : 0;
+    fprintf(stderr, "%-32s %12.1f ns/op", name, result->ns_per_op);
+    if (bytes_per_op) {
+        fprintf(stderr, " %10.1f MB/s", result->mb_per_s);
+    }
+    fprintf(stderr, "\n");
+}
+
+static void fill_random(unsigned char *data, int len, unsigned int seed) {
+    for (int i = 0; i < len; i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (unsigned char) (seed >> 16);
+    }
+}
+
+static void put_be32(unsigned char *b, uint32_t value) {
+    b[0] = value >> 24;
+    b[1] = value >> 16;
+    b[2] = value >> 8;
+    b[3] = value;
+}
+
+/* mirror_buffer_decrypt: AES-CTR over video payloads */
+
+typedef struct mirror_ctx_s {
+    mirror_buffer_t *buffer;
+    unsigned char *input;
+    unsigned char *output;
+    int size;
+} mirror_ctx_t;
+
+static void kernel_mirror_decrypt(void *ctx, long iterations) {
+    mirror_ctx_t *c = ctx;
+    for (long i = 0; i < iterations; i++) {
+        mirror_buffer_decrypt(c->buffer, c->input, c->output, c->size);
+    }
+}
+
+static void bench_mirror_decrypt(bench_t *bench, logger_t *logger) {
+    const int sizes[] = { 1024, 16384, 65536, 262144 };
+    unsigned char key[16];
+    uint64_t stream_connection_id = 0x1234567890abcdefull;
+    fill_random(key, sizeof(key), 1);
+
+    mirror_ctx_t c;
+    c.buffer = mirror_buffer_init(logger, key);
+    mirror_buffer_init_aes(c.buffer, &stream_connection_id);
+    c.input = malloc(sizes[3]);
+    c.output = malloc(sizes[3]);
+    fill_random(c.input, sizes[3], 2);
+    for (int i = 0; i < 4; i++) {
+        char name[48];
+        snprintf(name, sizeof(name), "mirror_decrypt/%dk", sizes[i] / 1024);
+        c.size = sizes[i];
+        bench_run(bench, name, c.size, kernel_mirror_decrypt, &c);
+    }
+    free(c.input);
+    free(c.output);
+    mirror_buffer_destroy(c.buffer);
+}
+
+/* raop_buffer: decryption, and enqueue/dequeue as raop_rtp_process_data does it */
+
+typedef struct audio_ctx_s {
+    raop_buffer_t *buffer;
+    unsigned char packet[12 + BENCH_AUDIO_PAYLOAD];
+    unsigned char output[BENCH_AUDIO_PAYLOAD];
+    int arrivals[BENCH_AUDIO_CYCLE];   /* offsets of the packets in arrival order, -1 for none */
+    long position;      /* packets handled so far, across batches */
+    int resend_requests;
+} audio_ctx_t;
+
+static int resend_callback(void *opaque, unsigned short seqnum, unsigned short count) {
+    audio_ctx_t *c = opaque;
+    c->resend_requests += count;
+    return 0;
+}
+
+static void kernel_audio_decrypt(void *ctx, long iterations) {
+    audio_ctx_t *c = ctx;
+    unsigned int outputlen;
+    for (long i = 0; i < iterations; i++) {
+        raop_buffer_decrypt(c->buffer, c->packet, c->output, BENCH_AUDIO_PAYLOAD, &outputlen);
+    }
+}
+
+static void kernel_audio_buffer(void *ctx, long iterations) {
+    audio_ctx_t *c = ctx;
+    for (long i = 0; i < iterations; i++, c->position++) {
+        int n = c->position % BENCH_AUDIO_CYCLE;
+        if (c->arrivals[n] >= 0) {
+            unsigned short seqnum = (unsigned short) (c->position - n + c->arrivals[n]);
+            c->packet[2] = seqnum >> 8;
+            c->packet[3] = seqnum;
+            put_be32(c->packet + 4, (uint32_t) seqnum * 480);
+            raop_buffer_enqueue(c->buffer, c->packet, sizeof(c->packet), (uint64_t) seqnum * 480, 1);
+
+            refbuf_t *payload;
+            unsigned int payload_size;
+            uint64_t timestamp;
+            unsigned short dequeued;
+            while ((payload = raop_buffer_dequeue(c->buffer, &payload_size, &timestamp, &dequeued, 0))) {
+                refbuf_unref(payload);
+            }
+            raop_buffer_handle_resends(c->buffer, resend_callback, c);
+        }
+    }
+}
+
+static void bench_audio(bench_t *bench, logger_t *logger) {
+    unsigned char key[16], iv[16];
+    fill_random(key, sizeof(key), 3);
+    fill_random(iv, sizeof(iv), 4);
+
+    audio_ctx_t *c = calloc(1, sizeof(audio_ctx_t));
+    c->buffer = raop_buffer_init(logger, key, iv);
+    fill_random(c->packet, sizeof(c->packet), 5);
+    c->packet[0] = 0x80;
+    c->packet[1] = 0x60;
+    bench_run(bench, "audio_decrypt", BENCH_AUDIO_PAYLOAD, kernel_audio_decrypt, c);
+
+    /* patterns: in order; every 100th packet lost and never resent; every 20th packet 4 packets late */
+    const char *names[] = { "audio_buffer/in_order", "audio_buffer/loss_1pct", "audio_buffer/late_5pct" };
+    for (int pattern = 0; pattern < 3; pattern++) {
+        for (int i = 0; i < BENCH_AUDIO_CYCLE; i++) {
+            c->arrivals[i] = i;
+            if (pattern == 1 && i % 100 == 50) {
+                c->arrivals[i] = -1;
+            }
+        }
+        if (pattern == 2) {
+            for (int i = 10; i + 4 < BENCH_AUDIO_CYCLE; i += 20) {
+                int late = c->arrivals[i];
+                memmove(&c->arrivals[i], &c->arrivals[i + 1], 4 * sizeof(int));
+                c->arrivals[i + 4] = late;
+            }
+        }
+        raop_buffer_flush(c->buffer, -1);
+        c->position = 0;
+        bench_run(bench, names[pattern], BENCH_AUDIO_PAYLOAD, kernel_audio_buffer, c);
+    }
+    raop_buffer_destroy(c->buffer);
+    free(c);
+}
+
+/* raop_rtp_mirror_rewrite_nals on the access units of a mirror stream */
+
+#define BENCH_MAX_NALS 8
+
+typedef struct nal_ctx_s {
+    logger_t *logger;
+    unsigned char *data;
+    int size;
+    bool avcc;
+    int nal_count;
+    int offsets[BENCH_MAX_NALS];
+    int lengths[BENCH_MAX_NALS];
+} nal_ctx_t;
+
+static void kernel_nal_rewrite(void *ctx, long iterations) {
+    nal_ctx_t *c = ctx;
+    int nal_count, frame_type;
+    for (long i = 0; i < iterations; i++) {
+        raop_rtp_mirror_rewrite_nals(c->logger, c->data, c->size, c->avcc, &nal_count, &frame_type);
+        if (!c->avcc) {
+            /* restore the length prefixes the start codes replaced */
+            for (int n = 0; n < c->nal_count; n++) {
+                put_be32(c->data + c->offsets[n], c->lengths[n]);
+            }
+        }
+    }
+}
+
+/* An access unit of nal_count NAL units in AVCC layout: a SEI, then slices of the given type sharing size */
+static void make_access_unit(nal_ctx_t *c, int size, int nal_count, unsigned char slice_header) {
+    c->data = malloc(size);
+    c->size = size;
+    c->nal_count = nal_count;
+    fill_random(c->data, size, 6);
+    int offset = 0;
+    for (int n = 0; n < nal_count; n++) {
+        int length = n == 0 ? 24 : (size - 28 - offset) / (nal_count - n) - 4;
+        if (n == nal_count - 1) {
+            length = size - offset - 4;
+        }
+        c->offsets[n] = offset;
+        c->lengths[n] = length;
+        put_be32(c->data + offset, length);
+        c->data[offset + 4] = n == 0 ? 0x06 : slice_header;
+        offset += 4 + length;
+    }
+}
+
+static void bench_nal_rewrite(bench_t *bench, logger_t *logger) {
+    nal_ctx_t c;
+    memset(&c, 0, sizeof(c));
+    c.logger = logger;
+
+    /* a large IDR frame in four slices, and a typical P frame in one */
+    make_access_unit(&c, 131072, 5, 0x65);
+    c.avcc = false;
+    bench_run(bench, "nal_rewrite/idr_annexb", 0, kernel_nal_rewrite, &c);
+    c.avcc = true;
+    bench_run(bench, "nal_rewrite/idr_avcc", 0, kernel_nal_rewrite, &c);
+    free(c.data);
+
+    make_access_unit(&c, 16384, 2, 0x41);
+    c.avcc = false;
+    bench_run(bench, "nal_rewrite/p_annexb", 0, kernel_nal_rewrite, &c);
+    free(c.data);
+}
+
+/* http_request_add_data on the RTSP requests of a session, and parsing the SETUP bplists */
+
+typedef struct rtsp_ctx_s {
+    char *request;
+    int len;
+    int chunk;          /* bytes per http_request_add_data call, as they would arrive from TCP */
+    char *body;
+    uint32_t body_len;
+    bool stream;
+} rtsp_ctx_t;
+
+static void kernel_http_request(void *ctx, long iterations) {
+    rtsp_ctx_t *c = ctx;
+    for (long i = 0; i < iterations; i++) {
+        http_request_t *request = http_request_init();
+        for (int offset = 0; offset < c->len; offset += c->chunk) {
+            int len = c->len - offset < c->chunk ? c->len - offset : c->chunk;
+            http_request_add_data(request, c->request + offset, len);
+        }
+        if (!http_request_is_complete(request)) {
+            fprintf(stderr, "RTSP request not complete\n");
+            exit(1);
+        }
+        http_request_destroy(request);
+    }
+}
+
+static void kernel_bplist_setup(void *ctx, long iterations) {
+    rtsp_ctx_t *c = ctx;
+    for (long i = 0; i < iterations; i++) {
+        plist_t root = NULL;
+        plist_from_bin(c->body, c->body_len, &root);
+        if (c->stream) {
+            plist_t streams = plist_dict_get_item(root, "streams");
+            int count = plist_array_get_size(streams);
+            for (int n = 0; n < count; n++) {
+                plist_t stream = plist_array_get_item(streams, n);
+                uint64_t type, stream_connection_id;
+                plist_get_uint_val(plist_dict_get_item(stream, "type"), &type);
+                plist_get_uint_val(plist_dict_get_item(stream, "streamConnectionID"), &stream_connection_id);
+            }
+        } else {
+            char *ekey = NULL, *eiv = NULL;
+            uint64_t ekey_len = 0, eiv_len = 0, timing_port;
+            plist_get_data_val(plist_dict_get_item(root, "ekey"), &ekey, &ekey_len);
+            plist_get_data_val(plist_dict_get_item(root, "eiv"), &eiv, &eiv_len);
+            plist_get_uint_val(plist_dict_get_item(root, "timingPort"), &timing_port);
+            free(ekey);
+            free(eiv);
+        }
+        plist_free(root);
+    }
+}
+
+/* The first SETUP of a mirroring session (keys and timing), or the one of the mirror stream */
+static void make_setup_body(rtsp_ctx_t *c, bool stream) {
+    plist_t root = plist_new_dict();
+    if (stream) {
+        plist_t streams = plist_new_array();
+        plist_t mirror = plist_new_dict();
+        plist_dict_set_item(mirror, "type", plist_new_uint(110));
+        plist_dict_set_item(mirror, "streamConnectionID", plist_new_uint(0x1234567890abcdefull));
+        plist_dict_set_item(mirror, "latencyMs", plist_new_uint(90));
+        plist_dict_set_item(mirror, "usingScreen", plist_new_bool(1));
+        plist_dict_set_item(mirror, "supportsDynamicStreamID", plist_new_bool(1));
+        plist_t timestamp_info = plist_new_array();
+        const char *stamps[] = { "SubSu", "BePxT", "AfPxT", "BefEn", "EmEnc" };
+        for (int i = 0; i < 5; i++) {
+            plist_t stamp = plist_new_dict();
+            plist_dict_set_item(stamp, "name", plist_new_string(stamps[i]));
+            plist_array_append_item(timestamp_info, stamp);
+        }
+        plist_dict_set_item(mirror, "timestampInfo", timestamp_info);
+        plist_array_append_item(streams, mirror);
+        plist_dict_set_item(root, "streams", streams);
+    } else {
+        char ekey[72], eiv[16];
+        fill_random((unsigned char *) ekey, sizeof(ekey), 7);
+        fill_random((unsigned char *) eiv, sizeof(eiv), 8);
+        plist_dict_set_item(root, "ekey", plist_new_data(ekey, sizeof(ekey)));
+        plist_dict_set_item(root, "eiv", plist_new_data(eiv, sizeof(eiv)));
+        plist_dict_set_item(root, "timingPort", plist_new_uint(54321));
+        plist_dict_set_item(root, "timingProtocol", plist_new_string("NTP"));
+        plist_dict_set_item(root, "et", plist_new_uint(32));
+        plist_dict_set_item(root, "isScreenMirroringSession", plist_new_bool(1));
+        plist_dict_set_item(root, "deviceID", plist_new_string("11:22:33:44:55:66"));
+        plist_dict_set_item(root, "macAddress", plist_new_string("11:22:33:44:55:67"));
+        plist_dict_set_item(root, "model", plist_new_string("iPhone14,2"));
+        plist_dict_set_item(root, "name", plist_new_string("iPhone"));
+        plist_dict_set_item(root, "osName", plist_new_string("iPhone OS"));
+        plist_dict_set_item(root, "osVersion", plist_new_string("16.6"));
+        plist_dict_set_item(root, "osBuildVersion", plist_new_string("20G75"));
+        plist_dict_set_item(root, "sourceVersion", plist_new_string("690.7.1"));
+        plist_dict_set_item(root, "sessionUUID", plist_new_string("4F1B0C2E-6A7D-4E1B-9C3A-2D5E8F7A6B90"));
+        plist_dict_set_item(root, "timingPeerInfo", plist_new_dict());
+    }
+    plist_to_bin(root, &c->body, &c->body_len);
+    plist_free(root);
+    c->stream = stream;
+}
+
+static void make_request(rtsp_ctx_t *c, const char *header, const char *body, int body_len) {
+    int header_len = (int) strlen(header);
+    c->request = malloc(header_len + body_len);
+    memcpy(c->request, header, header_len);
+    if (body_len) {
+        memcpy(c->request + header_len, body, body_len);
+    }
+    c->len = header_len + body_len;
+}
+
+static void bench_rtsp(bench_t *bench) {
+    rtsp_ctx_t c;
+    char header[1024];
+    const char *common = "DACP-ID: 14413BE4996FEA4D\r\nActive-Remote: 2543110914\r\n"
+                         "User-Agent: AirPlay/690.7.1\r\nX-Apple-ProtocolVersion: 1\r\n";
+
+    memset(&c, 0, sizeof(c));
+    make_setup_body(&c, false);
+    snprintf(header, sizeof(header), "SETUP rtsp://192.168.1.10/1234567890 RTSP/1.0\r\nContent-Length: %u\r\n"
+             "Content-Type: application/x-apple-binary-plist\r\nCSeq: 4\r\n%s\r\n", c.body_len, common);
+    make_request(&c, header, c.body, c.body_len);
+    c.chunk = c.len;
+    bench_run(bench, "http_request/setup", c.len, kernel_http_request, &c);
+    c.chunk = 64;
+    bench_run(bench, "http_request/setup_64b_chunks", c.len, kernel_http_request, &c);
+    bench_run(bench, "bplist/setup_session", c.body_len, kernel_bplist_setup, &c);
+    free(c.request);
+    free(c.body);
+
+    memset(&c, 0, sizeof(c));
+    make_setup_body(&c, true);
+    bench_run(bench, "bplist/setup_stream", c.body_len, kernel_bplist_setup, &c);
+    free(c.body);
+
+    memset(&c, 0, sizeof(c));
+    const char *volume = "volume\r\n";
+    snprintf(header, sizeof(header), "GET_PARAMETER rtsp://192.168.1.10/1234567890 RTSP/1.0\r\nContent-Length: %d\r\n"
+             "Content-Type: text/parameters\r\nCSeq: 12\r\n%s\r\n", (int) strlen(volume), common);
+    make_request(&c, header, volume, (int) strlen(volume));
+    c.chunk = c.len;
+    bench_run(bench, "http_request/get_parameter", c.len, kernel_http_request, &c);
+    free(c.request);
+
+    snprintf(header, sizeof(header), "POST /feedback RTSP/1.0\r\nCSeq: 15\r\n%s\r\n", common);
+    make_request(&c, header, NULL, 0);
+    c.chunk = c.len;
+    bench_run(bench, "http_request/feedback", c.len, kernel_http_request, &c);
+    free(c.request);
+}
+
+/* The NTP offset filter, and the audio rtp clock */
+
+typedef struct clock_ctx_s {
+    raop_ntp_t *ntp;
+    raop_rtp_t *rtp;
+    int64_t t;
+    uint32_t rtp32;
+    volatile uint64_t sink;
+} clock_ctx_t;
+
+static void kernel_ntp_sample(void *ctx, long iterations) {
+    clock_ctx_t *c = ctx;
+    for (long i = 0; i < iterations; i++) {
+        /* one request every 3 s, a 2 to 9 ms round trip, the client clock 1234 s ahead */
+        int64_t t0 = c->t;
+        int64_t delay = 2000 + (i % 8) * 1000;
+        int64_t t1 = t0 + 1234000000 + delay / 2;
+        int64_t t2 = t1 + 50;
+        int64_t t3 = t0 + delay + 50;
+        raop_ntp_add_sample(c->ntp, t0, t1, t2, t3);
+        c->t += 3000000;
+    }
+}
+
+static void kernel_rtp64_time(void *ctx, long iterations) {
+    clock_ctx_t *c = ctx;
+    for (long i = 0; i < iterations; i++) {
+        /* AAC-ELD: 480 samples per packet, wrapping around the 32-bit timestamp */
+        c->rtp32 += 480;
+        c->sink = rtp64_time(c->rtp, &c->rtp32);
+    }
+}
+
+static void kernel_sync_clock(void *ctx, long iterations) {
+    clock_ctx_t *c = ctx;
+    for (long i = 0; i < iterations; i++) {
+        /* a sync packet about once a second */
+        c->rtp32 += 44100;
+        c->t += 1000000;
+        raop_rtp_sync_clock(c->rtp, (uint64_t) c->t, rtp64_time(c->rtp, &c->rtp32), 0);
+    }
+}
+
+static void bench_clocks(bench_t *bench, logger_t *logger) {
+    raop_callbacks_t callbacks;
+    memset(&callbacks, 0, sizeof(callbacks));
+    reactor_t *reactor = reactor_init(logger, 1);
+    if (!reactor) {
+        fprintf(stderr, "could not start the reactor, skipping the clock kernels\n");
+        return;
+    }
+    const unsigned char remote[4] = { 127, 0, 0, 1 };
+    unsigned char key[16], iv[16];
+    fill_random(key, sizeof(key), 9);
+    fill_random(iv, sizeof(iv), 10);
+
+    /* NTP is never started, the samples are added directly */
+    clock_ctx_t c;
+    memset(&c, 0, sizeof(c));
+    c.ntp = raop_ntp_init(logger, &callbacks, reactor, remote, sizeof(remote), 0);
+    c.rtp = raop_rtp_init(logger, &callbacks, reactor, c.ntp, remote, sizeof(remote), key, iv);
+    c.t = 1000000000;
+    c.rtp32 = 0xfff00000;
+    bench_run(bench, "ntp_sample", 0, kernel_ntp_sample, &c);
+    bench_run(bench, "rtp64_time", 0, kernel_rtp64_time, &c);
+    bench_run(bench, "rtp_sync_clock", 0, kernel_sync_clock, &c);
+
+    raop_rtp_destroy(c.rtp);
+    raop_ntp_destroy(c.ntp);
+    reactor_destroy(reactor);
+}
+
+/* Results: "kernel,ns_per_op,mb_per_s" lines after a header line */
+
+static void write_results(FILE *file, bench_t *bench) {
+    fprintf(file, "kernel,ns_per_op,mb_per_s\n");
+    for (int i = 0; i < bench->count; i++) {
+        fprintf(file, "%s,%.2f,%.2f\n", bench->results[i].name, bench->results[i].ns_per_op, bench->results[i].mb_per_s);
+    }
+}
+
+static int read_results(const char *path, bench_result_t *results, int max) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+    char line[256];
+    int count = 0;
+    while (count < max && fgets(line, sizeof(line), file)) {
+        char *comma = strchr(line, ',');
+        if (!comma || comma - line >= (int) sizeof(results[count].name)) {
+            continue;
+        }
+        if (sscanf(comma + 1, "%lf,%lf", &results[count].ns_per_op, &results[count].mb_per_s) < 1) {
+            continue;   /* the header */
+        }
+        memcpy(results[count].name, line, comma - line);
+        results[count].name[comma - line] = '\0';
+        count++;
+    }
+    fclose(file);
+    return count;
+}
+
+/* Returns the number of kernels slower than in the baseline by more than threshold percent */
+static int compare_results(bench_t *bench, bench_result_t *baseline, int baseline_count, double threshold) {
+    int regressions = 0;
+    printf("kernel,ns_per_op,baseline_ns_per_op,change_pct,status\n");
+    for (int i = 0; i < bench->count; i++) {
+        bench_result_t *result = &bench->results[i];
+        bench_result_t *base = NULL;
+        for (int j = 0; j < baseline_count; j++) {
+            if (!strcmp(baseline[j].name, result->name)) {
+                base = &baseline[j];
+                break;
+            }
+        }
+        if (!base || base->ns_per_op <= 0) {
+            printf("%s,%.2f,,,new\n", result->name, result->ns_per_op);
+            continue;
+        }
+        double change = (result->ns_per_op / base->ns_per_op - 1) * 100;
+        const char *status = change > threshold ? "slower" : change < -threshold ? "faster" : "same";
+        if (change > threshold) {
+            regressions++;
+        }
+        printf("%s,%.2f,%.2f,%+.1f,%s\n", result->name, result->ns_per_op, base->ns_per_op, change, status);
+    }
+    return regressions;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-t seconds] [-f filter] [-o results.csv] [-b baseline.csv] [-r percent]\n", name);
+    fprintf(stderr, "  -t seconds   minimum time of each of the five timed batches of a kernel (default 0.1)\n");
+    fprintf(stderr, "  -f filter    only run the kernels whose name contains filter\n");
+    fprintf(stderr, "  -o file      write the results to file, to be used as a baseline later\n");
+    fprintf(stderr, "  -b file      compare with the results in file, fail if a kernel got slower\n");
+    fprintf(stderr, "  -r percent   slowdown against the baseline that counts as a regression (default 10)\n");
+}
+
+int main(int argc, char *argv[]) {
+    bench_t bench;
+    memset(&bench, 0, sizeof(bench));
+    bench.min_seconds = 0.1;
+    const char *output_path = NULL;
+    const char *baseline_path = NULL;
+    double threshold = 10;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0 && i < argc - 1) {
+            bench.min_seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-f") == 0 && i < argc - 1) {
+            bench.filter = argv[++i];
+        } else if (strcmp(argv[i], "-o") == 0 && i < argc - 1) {
+            output_path = argv[++i];
+        } else if (strcmp(argv[i], "-b") == 0 && i < argc - 1) {
+            baseline_path = argv[++i];
+        } else if (strcmp(argv[i], "-r") == 0 && i < argc - 1) {
+            threshold = atof(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (bench.min_seconds <= 0 || threshold < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    bench_result_t baseline[BENCH_MAX_RESULTS];
+    int baseline_count = 0;
+    if (baseline_path && (baseline_count = read_results(baseline_path, baseline, BENCH_MAX_RESULTS)) < 0) {
+        fprintf(stderr, "could not read the baseline %s\n", baseline_path);
+        return 1;
+    }
+
+    if (netutils_init() < 0) {
+        return 1;
+    }
+    logger_t *logger = logger_init();
+    logger_set_level(logger, LOGGER_ERR);
+
+    bench_mirror_decrypt(&bench, logger);
+    bench_audio(&bench, logger);
+    bench_nal_rewrite(&bench, logger);
+    bench_rtsp(&bench);
+    bench_clocks(&bench, logger);
+
+    if (output_path) {
+        FILE *file = fopen(output_path, "w");
+        if (!file) {
+            fprintf(stderr, "could not write %s\n", output_path);
+            return 1;
+        }
+        write_results(file, &bench);
+        fclose(file);
+    }
+    int regressions = 0;
+    if (baseline_path) {
+        regressions = compare_results(&bench, baseline, baseline_count, threshold);
+        if (regressions) {
+            fprintf(stderr, "%d kernel(s) slower than in %s by more than %.0f%%\n", regressions, baseline_path, threshold);
+        }
+    } else {
+        write_results(stdout, &bench);
+    }
+
+    logger_destroy(logger);
+    netutils_cleanup();
+    return regressions ? 2 : 0;
+}
@@ -0,0 +1,392 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Replay benchmark: sends a session captured with "rpiplay -cap file" (see lib/raop_capture.h)
+ * through the receive paths of the library, without a client: the mirror stream over TCP to
+ * raop_rtp_mirror, the audio datagrams over UDP to raop_rtp, both on the loopback interface.
+ * Decryption, NAL parsing and the audio buffer run exactly as in a live session, with the
+ * callbacks only counting what they receive, so runs are repeatable and can be compared.
+ *
+ * Records are sent with their captured timing (scaled by -x), or as fast as possible with
+ * -x 0. With -s, the first seconds are sent as fast as possible: AES-CTR decryption of the
+ * mirror stream depends on all preceding bytes, so nothing can be skipped.
+ * One session is replayed: the first one of the capture, or the one given with -n (a capture
+ * of several connections has their records interleaved, each tagged with its session id).
+ * NTP timing is not replayed, so timestamps passed to the callbacks are the client's own.
+ *
+ * Usage: raop_replay [-x speed] [-s seconds] [-n session] [-d] file.cap
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "raop.h"
+#include "raop_ntp.h"
+#include "raop_rtp.h"
+#include "raop_rtp_mirror.h"
+#include "raop_capture.h"
+#include "netutils.h"
+#include "logger.h"
+#include "compat.h"
+
+#define SEC 1000000
+
+typedef struct replay_counters_s {
+    /* written by the mirror thread */
+    int frames;
+    int corrupt_frames;
+    int formats;
+    uint64_t video_bytes;
+    /* written by the audio thread */
+    int audio_packets;
+    uint64_t audio_bytes;
+} replay_counters_t;
+
+typedef struct replay_record_s {
+    uint64_t time;
+    int type;
+    int session_id;
+    unsigned char *data;
+    int len;
+} replay_record_t;
+
+static uint64_t get_le(const unsigned char *b, int len) {
+    uint64_t value = 0;
+    for (int i = len - 1; i >= 0; i--) {
+        value = (value << 8) | b[i];
+    }
+    return value;
+}
+
+/* Reads the next record into rec->data (reallocated as needed); returns false at the end of the records */
+static bool read_record(FILE *file, replay_record_t *rec, int *size) {
+    unsigned char header[RAOP_CAPTURE_RECORD_LEN];
+    if (fread(header, RAOP_CAPTURE_RECORD_LEN, 1, file) != 1) {
+        return false;
+    }
+    rec->time = get_le(header, 8);
+    rec->type = header[8];
+    rec->session_id = (int) get_le(header + 12, 4);
+    rec->len = (int) get_le(header + 16, 4);
+    if (rec->type == RAOP_CAPTURE_INDEX || rec->len < 0) {
+        return false;
+    }
+    if (rec->len > *size) {
+        unsigned char *data = realloc(rec->data, rec->len);
+        if (!data) {
+            return false;
+        }
+        rec->data = data;
+        *size = rec->len;
+    }
+    return rec->len == 0 || fread(rec->data, rec->len, 1, file) == 1;
+}
+
+/* Duration of the capture from its index, or 0 if the capture was not closed properly */
+static uint64_t read_duration(FILE *file) {
+    unsigned char footer[RAOP_CAPTURE_FOOTER_LEN];
+    unsigned char header[RAOP_CAPTURE_RECORD_LEN];
+    unsigned char entry[16];
+    uint64_t first, last;
+    long start = ftell(file);
+    uint64_t duration = 0;
+    if (fseek(file, -RAOP_CAPTURE_FOOTER_LEN, SEEK_END) == 0 &&
+        fread(footer, RAOP_CAPTURE_FOOTER_LEN, 1, file) == 1 && memcmp(footer, "RAOPIDX", 8) == 0 &&
+        fseek(file, (long) get_le(footer + 8, 8), SEEK_SET) == 0 &&
+        fread(header, RAOP_CAPTURE_RECORD_LEN, 1, file) == 1 && header[8] == RAOP_CAPTURE_INDEX) {
+        int count = (int) get_le(header + 16, 4) / 16;
+        if (count > 0 && fread(entry, 16, 1, file) == 1) {
+            first = get_le(entry, 8);
+            if (count == 1 || (fseek(file, (count - 2) * 16, SEEK_CUR) == 0 && fread(entry, 16, 1, file) == 1)) {
+                last = get_le(entry, 8);
+                duration = last - first;
+            }
+        }
+    }
+    fseek(file, start, SEEK_SET);
+    return duration;
+}
+
+static void video_process(void *cls, raop_ntp_t *ntp, h264_decode_struct *data) {
+    replay_counters_t *counters = cls;
+    if (data->validity == H264_DATA_CORRUPT) {
+        counters->corrupt_frames++;
+        return;
+    }
+    counters->frames++;
+    counters->video_bytes += data->data_len;
+}
+
+static void video_format_changed(void *cls, raop_ntp_t *ntp, h264_format_struct *format) {
+    replay_counters_t *counters = cls;
+    counters->formats++;
+}
+
+static void audio_process(void *cls, raop_ntp_t *ntp, audio_decode_struct *data) {
+    replay_counters_t *counters = cls;
+    counters->audio_packets++;
+    counters->audio_bytes += data->data_len;
+}
+
+static void log_callback(void *cls, int level, const char *msg) {
+    fprintf(stderr, "%s\n", msg);
+}
+
+static int connect_local(unsigned short port, int type) {
+    struct sockaddr_in addr;
+    int fd = socket(AF_INET, type, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        closesocket(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool send_all(int fd, const unsigned char *data, int len) {
+    while (len > 0) {
+        int ret = send(fd, (const char *) data, len, 0);
+        if (ret <= 0) {
+            return false;
+        }
+        data += ret;
+        len -= ret;
+    }
+    return true;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-x speed] [-s seconds] [-n session] [-d] file\n", name);
+    fprintf(stderr, "  -x speed    replay speed relative to the capture, 0 for as fast as possible (default 1)\n");
+    fprintf(stderr, "  -s seconds  send the first seconds as fast as possible, then at the replay speed\n");
+    fprintf(stderr, "  -n session  replay the session with this id (default: the first one)\n");
+    fprintf(stderr, "  -d          debug logging\n");
+}
+
+int main(int argc, char *argv[]) {
+    double speed = 1.0;
+    double start_seconds = 0.0;
+    int session_id = 0;
+    bool debug = false;
+    const char *path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-x") == 0 && i < argc - 1) {
+            speed = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0 && i < argc - 1) {
+            start_seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-n") == 0 && i < argc - 1) {
+            session_id = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-d") == 0) {
+            debug = true;
+        } else if (argv[i][0] != '-' && !path) {
+            path = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!path || speed < 0 || session_id < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FILE *file = fopen(path, "rb");
+    unsigned char header[RAOP_CAPTURE_HEADER_LEN];
+    if (!file || fread(header, RAOP_CAPTURE_HEADER_LEN, 1, file) != 1 || memcmp(header, "RAOPCAP", 8) != 0) {
+        fprintf(stderr, "%s is not a capture file\n", path);
+        return 1;
+    }
+    if (get_le(header + 8, 4) != RAOP_CAPTURE_VERSION) {
+        fprintf(stderr, "%s: unsupported capture version %d\n", path, (int) get_le(header + 8, 4));
+        return 1;
+    }
+    uint64_t duration = read_duration(file);
+
+    if (netutils_init() < 0) {
+        return 1;
+    }
+    logger_t *logger = logger_init();
+    logger_set_callback(logger, log_callback, NULL);
+    logger_set_level(logger, debug ? LOGGER_DEBUG : LOGGER_WARNING);
+
+    replay_counters_t counters;
+    memset(&counters, 0, sizeof(counters));
+    raop_callbacks_t callbacks;
+    memset(&callbacks, 0, sizeof(callbacks));
+    callbacks.cls = &counters;
+    callbacks.video_process = video_process;
+    callbacks.video_format_changed = video_format_changed;
+    callbacks.audio_process = audio_process;
+
+    reactor_t *reactor = reactor_init(logger, 0);
+    if (!reactor) {
+        return 1;
+    }
+
+    /* NTP is never started: the local clock is used as is */
+    const unsigned char remote[4] = { 127, 0, 0, 1 };
+    raop_ntp_t *ntp = raop_ntp_init(logger, &callbacks, reactor, remote, sizeof(remote), 0);
+    raop_rtp_t *rtp = NULL;
+    raop_rtp_mirror_t *mirror = NULL;
+    int mirror_fd = -1, data_fd = -1, control_fd = -1;
+    unsigned char keys[RAOP_AESKEY_LEN + RAOP_AESIV_LEN];
+    bool have_keys = false;
+
+    replay_record_t rec;
+    memset(&rec, 0, sizeof(rec));
+    int rec_size = 0;
+    uint64_t first_time = 0, wall_start = 0;
+    uint64_t mirror_bytes = 0, audio_datagrams = 0;
+    int records = 0;
+
+    while (read_record(file, &rec, &rec_size)) {
+        if (records++ == 0) {
+            first_time = rec.time;
+        }
+        if (rec.type == RAOP_CAPTURE_SESSION && !have_keys && (session_id == 0 || rec.session_id == session_id)) {
+            if (rec.len != sizeof(keys)) {
+                break;
+            }
+            memcpy(keys, rec.data, sizeof(keys));
+            session_id = rec.session_id;
+            have_keys = true;
+            continue;
+        }
+        /* the records of other sessions */
+        if (!have_keys || rec.session_id != session_id) {
+            continue;
+        }
+        if (rec.type == RAOP_CAPTURE_SESSION) {
+            logger_log(logger, LOGGER_WARNING, "raop_replay: session %d starts again, stopping", session_id);
+            break;
+        }
+
+        /* pacing */
+        uint64_t offset = rec.time - first_time;
+        if (speed > 0 && offset >= (uint64_t) (start_seconds * SEC)) {
+            uint64_t now = raop_ntp_get_local_time(NULL);
+            if (!wall_start) {
+                wall_start = now - (uint64_t) (offset / speed);
+            }
+            uint64_t target = wall_start + (uint64_t) (offset / speed);
+            if (target > now + 1000) {
+                sleepms((int) ((target - now) / 1000));
+            }
+        }
+
+        switch (rec.type) {
+            case RAOP_CAPTURE_MIRROR_SETUP: {
+                if (mirror || rec.len != 8) {
+                    break;
+                }
+                uint64_t stream_connection_id = get_le(rec.data, 8);
+                unsigned short dport = 0;
+                mirror = raop_rtp_mirror_init(logger, &callbacks, reactor, ntp, remote, sizeof(remote), keys);
+                raop_rtp_init_mirror_aes(mirror, &stream_connection_id);
+                raop_rtp_start_mirror(mirror, 0, &dport, 0, 0, 0, 0);
+                mirror_fd = connect_local(dport, SOCK_STREAM);
+                if (mirror_fd < 0) {
+                    logger_log(logger, LOGGER_ERR, "raop_replay: could not connect to the mirror port %d", dport);
+                }
+                break;
+            }
+            case RAOP_CAPTURE_AUDIO_SETUP: {
+                if (rtp || rec.len != 1) {
+                    break;
+                }
+                unsigned short cport = 0, dport = 0;
+                rtp = raop_rtp_init(logger, &callbacks, reactor, ntp, remote, sizeof(remote), keys, keys + RAOP_AESKEY_LEN);
+                raop_rtp_start_audio(rtp, 0, 0, &cport, &dport, rec.data[0]);
+                control_fd = connect_local(cport, SOCK_DGRAM);
+                data_fd = connect_local(dport, SOCK_DGRAM);
+                break;
+            }
+            case RAOP_CAPTURE_MIRROR:
+                if (mirror_fd >= 0 && send_all(mirror_fd, rec.data, rec.len)) {
+                    mirror_bytes += rec.len;
+                }
+                break;
+            case RAOP_CAPTURE_AUDIO_DATA:
+            case RAOP_CAPTURE_AUDIO_CONTROL: {
+                int fd = (rec.type == RAOP_CAPTURE_AUDIO_DATA ? data_fd : control_fd);
+                if (fd >= 0 && send(fd, (const char *) rec.data, rec.len, 0) == rec.len) {
+                    audio_datagrams++;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    if (!wall_start) {
+        wall_start = raop_ntp_get_local_time(NULL);
+    }
+
+    /* let the receive threads finish what was sent before stopping them */
+    if (mirror_fd >= 0) {
+        shutdown(mirror_fd, SHUT_WR);
+    }
+    replay_counters_t last;
+    int unchanged = 0;
+    memcpy(&last, &counters, sizeof(last));
+    while (unchanged < 5) {
+        sleepms(100);
+        unchanged = (memcmp(&last, &counters, sizeof(last)) == 0 ? unchanged + 1 : 0);
+        memcpy(&last, &counters, sizeof(last));
+    }
+    uint64_t elapsed = raop_ntp_get_local_time(NULL) - wall_start - (unchanged * 100000);
+
+    raop_rtp_mirror_destroy(mirror);
+    raop_rtp_destroy(rtp);
+    if (mirror_fd >= 0) closesocket(mirror_fd);
+    if (control_fd >= 0) closesocket(control_fd);
+    if (data_fd >= 0) closesocket(data_fd);
+    raop_ntp_destroy(ntp);
+    reactor_destroy(reactor);
+    logger_destroy(logger);
+    free(rec.data);
+    fclose(file);
+
+    if (!have_keys) {
+        if (session_id > 0) {
+            fprintf(stderr, "%s: no session %d in the capture\n", path, session_id);
+        } else {
+            fprintf(stderr, "%s: no session found in the capture\n", path);
+        }
+        return 1;
+    }
+    double seconds = elapsed > 0 ? (double) elapsed / SEC : 1e-6;
+    printf("capture:  %.1f s, %d records, %.1f MB mirror stream, %llu audio datagrams\n",
+           (double) duration / SEC, records, mirror_bytes / 1e6, (unsigned long long) audio_datagrams);
+    printf("replayed: session %d, %.3f s at %s\n", session_id, seconds, speed > 0 ? "capture timing" : "maximum speed");
+    printf("video:    %d frames (%d corrupt), %d format changes, %.1f frames/s, %.1f MB/s\n",
+           counters.frames, counters.corrupt_frames, counters.formats, counters.frames / seconds,
+           mirror_bytes / 1e6 / seconds);
+    printf("audio:    %d packets, %.1f packets/s\n", counters.audio_packets, counters.audio_packets / seconds);
+    return 0;
+}
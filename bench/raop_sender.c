@@ -0,0 +1,1291 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Loopback sender: runs a receiver (raop_t) in this process and N emulated AirPlay senders
+ * against it over 127.0.0.1, so the whole receive side can be loaded and timed without Apple
+ * hardware. Each sender goes through the RTSP sequence (GET /info, SETUP of the session and
+ * of streams 110 and 96, RECORD, SET_PARAMETER, TEARDOWN), answers the receiver's NTP timing
+ * requests, and streams AES-CTR encrypted H264 on the mirror connection and AES-CBC encrypted
+ * AAC-ELD (from the vendored fdk-aac encoder) with RTP sync packets over UDP.
+ *
+ * FairPlay cannot be emulated: the library must be built with -DTEST_KEY_EXCHANGE=ON, which
+ * makes SETUP accept a tagged, unencrypted key (see RAOP_TEST_EKEY_TAG in lib/global.h).
+ *
+ * Every video frame carries an SEI NAL unit with the sender, the frame number and the time it
+ * was sent; audio frames are recognized by a hash of their content. The receiver callbacks
+ * look these up, so the report gives the send-to-callback latency of both streams, per sender.
+ * The video is synthetic (valid SPS/PPS, slices of filler data of the requested bit rate)
+ * unless an Annex-B file is given with -v, which is then looped.
+ *
+ * Each connection is a session of the receiver (session_init); with -dec every session decodes
+ * its video with its own ffmpeg decoder, as a renderer would. -sweep runs rounds with 1 to n
+ * senders and reports the receiver's CPU time (the process minus the sender threads) and
+ * resident memory, and what each added session costs.
+ *
+ * Usage: raop_sender [-n senders] [-t seconds] [-fps n] [-b kbit/s] [-g gop] [-s WxH]
+ *                    [-v file.h264] [-na] [-dec] [-sweep] [-d]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <plist/plist.h>
+#include <aacenc_lib.h>
+#include <libavcodec/avcodec.h>
+#ifdef WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#endif
+
+#include "raop.h"
+#include "dnssd.h"
+#include "raop_ntp.h"
+#include "mirror_buffer.h"
+#include "crypto.h"
+#include "byteutils.h"
+#include "utils.h"
+#include "global.h"
+#include "logger.h"
+#include "compat.h"
+
+#ifndef RAOP_TEST_KEY_EXCHANGE
+#error "raop_sender needs the library built with -DTEST_KEY_EXCHANGE=ON"
+#endif
+
+#define SEC 1000000
+#define MAX_SENDERS 16
+#define AUDIO_SPF 480
+#define AUDIO_RATE 44100
+#define AUDIO_CT_AAC_ELD 8
+#define AUDIO_FORMAT_AAC_ELD_44100_2 0x1000000
+#define AUDIO_TABLE_SIZE 65536
+#define RTSP_BUFFER_SIZE 65536
+#define MIRROR_HEADER_LEN 128
+
+/* user_data_unregistered SEI: uuid followed by "ss ffffffff tttttttttttttttt" */
+static const unsigned char sei_uuid[16] = {
+    'r', 'a', 'o', 'p', '_', 's', 'e', 'n', 'd', 'e', 'r', '_', 's', 't', 'm', 'p'
+};
+#define SEI_TEXT_LEN 28
+
+typedef struct sender_config_s {
+    int senders;
+    int seconds;
+    int fps;
+    int kbps;
+    int gop;
+    int width;
+    int height;
+    bool audio;
+    bool decode;
+} sender_config_t;
+
+typedef struct latency_log_s {
+    int64_t *values;
+    int count;
+    int size;
+} latency_log_t;
+
+typedef struct access_unit_s {
+    unsigned char *data;     /* AVCC: NAL units with 4-byte length prefixes */
+    int len;
+    bool idr;
+} access_unit_t;
+
+typedef struct video_source_s {
+    unsigned char *sps, *pps;
+    int sps_len, pps_len;
+    access_unit_t *units;    /* NULL: synthetic slices */
+    int unit_count;
+} video_source_t;
+
+typedef struct sender_s {
+    int index;
+    const sender_config_t *config;
+    const video_source_t *video;
+    unsigned short raop_port;
+    thread_handle_t thread;
+    thread_handle_t ntp_thread;
+    bool ok;
+
+    /* RTSP */
+    int rtsp_fd;
+    int cseq;
+
+    /* timing */
+    int ntp_fd;
+    unsigned short timing_port;
+    volatile bool ntp_running;
+
+    /* streams */
+    unsigned char session_key[16];
+    unsigned char aesiv[16];
+    int mirror_fd, audio_fd, control_fd;
+    mirror_buffer_t *mirror;
+    aes_ctx_t *audio_aes;
+    HANDLE_AACENCODER aac;
+    uint32_t rng;
+
+    /* sent */
+    int frames_sent;
+    uint64_t video_bytes_sent;
+    int audio_sent;
+
+    /* received, under stats_mutex */
+    latency_log_t video_latency;
+    latency_log_t audio_latency;
+
+    uint64_t cpu_time;       /* us, used by the thread of the sender */
+} sender_t;
+
+/* receiver side of a connection */
+typedef struct session_s {
+    AVCodecContext *decoder;
+    AVPacket *packet;
+    AVFrame *frame;
+} session_t;
+
+typedef struct round_stats_s {
+    uint64_t receiver_cpu;   /* us */
+    uint64_t sender_cpu;
+    uint64_t rss;            /* bytes, 0 if unknown */
+} round_stats_t;
+
+typedef struct audio_entry_s {
+    uint64_t hash;
+    uint64_t time;
+    int sender;
+} audio_entry_t;
+
+static sender_t senders[MAX_SENDERS];
+static int sender_count;
+static mutex_handle_t stats_mutex;
+static audio_entry_t *audio_table;
+static logger_t *logger;
+static int video_decode_errors;
+
+/* ---- resource usage ---- */
+
+static uint64_t thread_cpu_time() {
+#ifdef WIN32
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+        return 0;
+    }
+    return ((((uint64_t) kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) +
+            (((uint64_t) user.dwHighDateTime << 32) | user.dwLowDateTime)) / 10;
+#else
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) < 0) {
+        return 0;
+    }
+    return (uint64_t) ts.tv_sec * SEC + ts.tv_nsec / 1000;
+#endif
+}
+
+static uint64_t process_cpu_time() {
+#ifdef WIN32
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) {
+        return 0;
+    }
+    return ((((uint64_t) kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) +
+            (((uint64_t) user.dwHighDateTime << 32) | user.dwLowDateTime)) / 10;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) < 0) {
+        return 0;
+    }
+    return (uint64_t) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * SEC + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+#endif
+}
+
+static uint64_t process_rss() {
+#if defined(WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0;
+    }
+    return counters.WorkingSetSize;
+#elif defined(__linux__)
+    unsigned long size, resident;
+    FILE *file = fopen("/proc/self/statm", "r");
+    if (!file) {
+        return 0;
+    }
+    int ret = fscanf(file, "%lu %lu", &size, &resident);
+    fclose(file);
+    return ret == 2 ? (uint64_t) resident * sysconf(_SC_PAGESIZE) : 0;
+#else
+    return 0;
+#endif
+}
+
+static void put_be32(unsigned char *b, int offset, uint32_t value) {
+    b[offset] = (unsigned char) (value >> 24);
+    b[offset + 1] = (unsigned char) (value >> 16);
+    b[offset + 2] = (unsigned char) (value >> 8);
+    b[offset + 3] = (unsigned char) value;
+}
+
+/* ---- latency bookkeeping, called from the receiver threads ---- */
+
+static void latency_add(latency_log_t *log, int64_t value) {
+    if (log->count == log->size) {
+        int size = log->size ? log->size * 2 : 1024;
+        int64_t *values = realloc(log->values, size * sizeof(int64_t));
+        if (!values) {
+            return;
+        }
+        log->values = values;
+        log->size = size;
+    }
+    log->values[log->count++] = value;
+}
+
+static int compare_int64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static double latency_percentile(latency_log_t *log, double p) {
+    if (!log->count) {
+        return 0.0;
+    }
+    int i = (int) (p * (log->count - 1) + 0.5);
+    return log->values[i] / 1000.0;
+}
+
+static void *session_init(void *cls, int session_id, const unsigned char *remote, int remote_len) {
+    const sender_config_t *config = cls;
+    session_t *session = calloc(1, sizeof(session_t));
+    if (!session || !config->decode) {
+        return session;
+    }
+    const AVCodec *codec = avcodec_find_decoder(AV_CODEC_ID_H264);
+    session->decoder = avcodec_alloc_context3(codec);
+    session->packet = av_packet_alloc();
+    session->frame = av_frame_alloc();
+    if (!session->decoder || !session->packet || !session->frame || avcodec_open2(session->decoder, codec, NULL) < 0) {
+        logger_log(logger, LOGGER_ERR, "session %d: could not open the H264 decoder", session_id);
+        avcodec_free_context(&session->decoder);
+    }
+    return session;
+}
+
+static void session_destroy(void *cls, void *ptr) {
+    session_t *session = ptr;
+    avcodec_free_context(&session->decoder);
+    av_packet_free(&session->packet);
+    av_frame_free(&session->frame);
+    free(session);
+}
+
+static void session_decode(session_t *session, h264_decode_struct *data) {
+    if (av_new_packet(session->packet, data->data_len) < 0) {
+        return;
+    }
+    memcpy(session->packet->data, data->data, data->data_len);
+    int ret = avcodec_send_packet(session->decoder, session->packet);
+    av_packet_unref(session->packet);
+    while (ret >= 0) {
+        ret = avcodec_receive_frame(session->decoder, session->frame);
+    }
+    if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
+        MUTEX_LOCK(stats_mutex);
+        video_decode_errors++;
+        MUTEX_UNLOCK(stats_mutex);
+    }
+}
+
+static void video_process(void *cls, raop_ntp_t *ntp, h264_decode_struct *data) {
+    session_t *session = cls;
+    if (session && session->decoder) {
+        session_decode(session, data);
+    }
+    uint64_t now = raop_ntp_get_local_time(NULL);
+    int len = data->data_len < 512 ? data->data_len : 512;
+    for (int i = 0; i + 16 + SEI_TEXT_LEN <= len; i++) {
+        if (data->data[i] != sei_uuid[0] || memcmp(data->data + i, sei_uuid, 16)) {
+            continue;
+        }
+        char text[SEI_TEXT_LEN + 1];
+        int index;
+        unsigned int frame;
+        unsigned long long sent;
+        memcpy(text, data->data + i + 16, SEI_TEXT_LEN);
+        text[SEI_TEXT_LEN] = '\0';
+        if (sscanf(text, "%d %u %llu", &index, &frame, &sent) == 3 && index >= 0 && index < sender_count) {
+            MUTEX_LOCK(stats_mutex);
+            latency_add(&senders[index].video_latency, (int64_t) (now - sent));
+            MUTEX_UNLOCK(stats_mutex);
+        }
+        return;
+    }
+}
+
+static void audio_process(void *cls, raop_ntp_t *ntp, audio_decode_struct *data) {
+    uint64_t now = raop_ntp_get_local_time(NULL);
+    uint64_t hash = utils_hash_data(data->data, data->data_len);
+    MUTEX_LOCK(stats_mutex);
+    audio_entry_t *entry = &audio_table[hash % AUDIO_TABLE_SIZE];
+    if (entry->hash == hash && entry->time) {
+        latency_add(&senders[entry->sender].audio_latency, (int64_t) (now - entry->time));
+        entry->time = 0;
+    }
+    MUTEX_UNLOCK(stats_mutex);
+}
+
+static void log_callback(void *cls, int level, const char *msg) {
+    fprintf(stderr, "%s\n", msg);
+}
+
+/* ---- video source ---- */
+
+typedef struct bit_writer_s {
+    unsigned char data[64];
+    int bits;
+} bit_writer_t;
+
+static void put_bits(bit_writer_t *bw, uint32_t value, int n) {
+    for (int i = n - 1; i >= 0; i--) {
+        if ((value >> i) & 1) {
+            bw->data[bw->bits / 8] |= 0x80 >> (bw->bits % 8);
+        }
+        bw->bits++;
+    }
+}
+
+static void put_ue(bit_writer_t *bw, uint32_t value) {
+    int len = 0;
+    for (uint32_t v = value + 1; v > 1; v >>= 1) {
+        len++;
+    }
+    put_bits(bw, 0, len);
+    put_bits(bw, value + 1, len + 1);
+}
+
+/* rbsp trailing bits, then emulation prevention into a new buffer */
+static unsigned char *finish_nal(bit_writer_t *bw, int *len) {
+    put_bits(bw, 1, 1);
+    int rbsp_len = (bw->bits + 7) / 8;
+    unsigned char *nal = malloc(rbsp_len * 3 / 2 + 1);
+    int zeros = 0;
+    *len = 0;
+    for (int i = 0; i < rbsp_len; i++) {
+        if (zeros == 2 && bw->data[i] <= 3) {
+            nal[(*len)++] = 3;
+            zeros = 0;
+        }
+        nal[(*len)++] = bw->data[i];
+        zeros = bw->data[i] ? 0 : zeros + 1;
+    }
+    return nal;
+}
+
+/* Baseline profile parameter sets for the given size (a multiple of 16) */
+static void make_parameter_sets(video_source_t *video, int width, int height) {
+    bit_writer_t bw;
+    memset(&bw, 0, sizeof(bw));
+    put_bits(&bw, 0x67, 8);      /* nal_ref_idc 3, SPS */
+    put_bits(&bw, 66, 8);        /* profile_idc: baseline */
+    put_bits(&bw, 0xc0, 8);      /* constraint_set0/1 */
+    put_bits(&bw, 40, 8);        /* level 4.0 */
+    put_ue(&bw, 0);              /* seq_parameter_set_id */
+    put_ue(&bw, 0);              /* log2_max_frame_num_minus4 */
+    put_ue(&bw, 2);              /* pic_order_cnt_type */
+    put_ue(&bw, 1);              /* max_num_ref_frames */
+    put_bits(&bw, 0, 1);         /* gaps_in_frame_num_value_allowed_flag */
+    put_ue(&bw, width / 16 - 1);
+    put_ue(&bw, height / 16 - 1);
+    put_bits(&bw, 1, 1);         /* frame_mbs_only_flag */
+    put_bits(&bw, 1, 1);         /* direct_8x8_inference_flag */
+    put_bits(&bw, 0, 1);         /* frame_cropping_flag */
+    put_bits(&bw, 0, 1);         /* vui_parameters_present_flag */
+    video->sps = finish_nal(&bw, &video->sps_len);
+
+    memset(&bw, 0, sizeof(bw));
+    put_bits(&bw, 0x68, 8);      /* nal_ref_idc 3, PPS */
+    put_ue(&bw, 0);              /* pic_parameter_set_id */
+    put_ue(&bw, 0);              /* seq_parameter_set_id */
+    put_bits(&bw, 0, 1);         /* entropy_coding_mode_flag */
+    put_bits(&bw, 0, 1);         /* bottom_field_pic_order_in_frame_present_flag */
+    put_ue(&bw, 0);              /* num_slice_groups_minus1 */
+    put_ue(&bw, 0);              /* num_ref_idx_l0_default_active_minus1 */
+    put_ue(&bw, 0);              /* num_ref_idx_l1_default_active_minus1 */
+    put_bits(&bw, 0, 3);         /* weighted_pred_flag, weighted_bipred_idc */
+    put_ue(&bw, 0);              /* pic_init_qp_minus26 (se 0) */
+    put_ue(&bw, 0);              /* pic_init_qs_minus26 (se 0) */
+    put_ue(&bw, 0);              /* chroma_qp_index_offset (se 0) */
+    put_bits(&bw, 1, 1);         /* deblocking_filter_control_present_flag */
+    put_bits(&bw, 0, 2);         /* constrained_intra_pred_flag, redundant_pic_cnt_present_flag */
+    video->pps = finish_nal(&bw, &video->pps_len);
+}
+
+static void append_nal(access_unit_t *unit, const unsigned char *nal, int len) {
+    unit->data = realloc(unit->data, unit->len + 4 + len);
+    put_be32(unit->data, unit->len, len);
+    memcpy(unit->data + unit->len + 4, nal, len);
+    unit->len += 4 + len;
+}
+
+/* Split an Annex-B stream into access units, keeping the first SPS and PPS */
+static bool load_video(video_source_t *video, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    unsigned char *data = malloc(size);
+    if (!data || fread(data, 1, size, file) != (size_t) size) {
+        fclose(file);
+        free(data);
+        return false;
+    }
+    fclose(file);
+
+    int allocated = 0;
+    bool have_vcl = false;
+    long pos = 0;
+    while (pos + 3 <= size) {
+        if (data[pos] || data[pos + 1] || data[pos + 2] != 1) {
+            pos++;
+            continue;
+        }
+        long start = pos + 3, end = start;
+        while (end + 3 <= size && (data[end] || data[end + 1] || data[end + 2] != 1)) {
+            end++;
+        }
+        if (end + 3 > size) {
+            end = size;
+        }
+        pos = end;
+        while (end > start && !data[end - 1]) {
+            end--;
+        }
+        int len = (int) (end - start);
+        if (len < 2) {
+            continue;
+        }
+        int type = data[start] & 0x1f;
+        if (type == 7 || type == 8) {
+            unsigned char **ps = (type == 7 ? &video->sps : &video->pps);
+            int *ps_len = (type == 7 ? &video->sps_len : &video->pps_len);
+            if (!*ps) {
+                *ps = malloc(len);
+                memcpy(*ps, data + start, len);
+                *ps_len = len;
+            }
+            continue;
+        }
+        if (type == 9) {
+            continue;
+        }
+        bool vcl = (type == 1 || type == 5);
+        /* a new access unit starts with a non-VCL NAL unit or a slice with first_mb_in_slice = 0 */
+        if (!video->unit_count || (have_vcl && (!vcl || (data[start + 1] & 0x80)))) {
+            if (video->unit_count == allocated) {
+                allocated = allocated ? allocated * 2 : 256;
+                video->units = realloc(video->units, allocated * sizeof(access_unit_t));
+            }
+            memset(&video->units[video->unit_count++], 0, sizeof(access_unit_t));
+            have_vcl = false;
+        }
+        access_unit_t *unit = &video->units[video->unit_count - 1];
+        append_nal(unit, data + start, len);
+        if (type == 5) {
+            unit->idr = true;
+        }
+        have_vcl = have_vcl || vcl;
+    }
+    free(data);
+    return video->sps && video->pps && video->unit_count;
+}
+
+/* ---- RTSP ---- */
+
+static int connect_local(unsigned short port, int type) {
+    struct sockaddr_in addr;
+    int fd = socket(AF_INET, type, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        closesocket(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static unsigned short local_port(int fd) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    if (getsockname(fd, (struct sockaddr *) &addr, &len) < 0) {
+        return 0;
+    }
+    return ntohs(addr.sin_port);
+}
+
+static bool send_all(int fd, const unsigned char *data, int len) {
+    while (len > 0) {
+        int ret = send(fd, (const char *) data, len, 0);
+        if (ret <= 0) {
+            return false;
+        }
+        data += ret;
+        len -= ret;
+    }
+    return true;
+}
+
+/* Sends a request and waits for the response; returns the status code, or -1 */
+static int rtsp_request(sender_t *sender, const char *method, const char *url, const char *content_type,
+                        const unsigned char *body, int body_len, plist_t *response_plist) {
+    char header[512];
+    int header_len = snprintf(header, sizeof(header),
+                              "%s %s RTSP/1.0\r\nCSeq: %d\r\nUser-Agent: AirPlay/550.10\r\n", method, url, ++sender->cseq);
+    if (content_type) {
+        header_len += snprintf(header + header_len, sizeof(header) - header_len,
+                               "Content-Type: %s\r\nContent-Length: %d\r\n", content_type, body_len);
+    }
+    header_len += snprintf(header + header_len, sizeof(header) - header_len, "\r\n");
+    if (!send_all(sender->rtsp_fd, (unsigned char *) header, header_len) ||
+        (body_len && !send_all(sender->rtsp_fd, body, body_len))) {
+        return -1;
+    }
+
+    char *buffer = malloc(RTSP_BUFFER_SIZE + 1);
+    int received = 0, status = -1;
+    char *end = NULL;
+    while (!end && received < RTSP_BUFFER_SIZE) {
+        int ret = recv(sender->rtsp_fd, buffer + received, RTSP_BUFFER_SIZE - received, 0);
+        if (ret <= 0) {
+            free(buffer);
+            return -1;
+        }
+        received += ret;
+        buffer[received] = '\0';
+        end = strstr(buffer, "\r\n\r\n");
+    }
+    if (end && sscanf(buffer, "RTSP/1.0 %d", &status) == 1) {
+        int content_length = 0;
+        char *field = strstr(buffer, "Content-Length:");
+        if (field && field < end) {
+            content_length = atoi(field + 15);
+        }
+        int body_start = (int) (end + 4 - buffer);
+        if (body_start + content_length > RTSP_BUFFER_SIZE) {
+            status = -1;
+        }
+        while (status > 0 && received < body_start + content_length) {
+            int ret = recv(sender->rtsp_fd, buffer + received, body_start + content_length - received, 0);
+            if (ret <= 0) {
+                status = -1;
+                break;
+            }
+            received += ret;
+        }
+        if (status > 0 && response_plist) {
+            *response_plist = NULL;
+            if (content_length) {
+                plist_from_bin(buffer + body_start, content_length, response_plist);
+            }
+        }
+    }
+    free(buffer);
+    return status;
+}
+
+static int rtsp_request_plist(sender_t *sender, const char *method, const char *url, plist_t request,
+                              plist_t *response) {
+    char *bin = NULL;
+    uint32_t bin_len = 0;
+    plist_to_bin(request, &bin, &bin_len);
+    plist_free(request);
+    int status = rtsp_request(sender, method, url, "application/x-apple-binary-plist",
+                              (unsigned char *) bin, (int) bin_len, response);
+    free(bin);
+    return status;
+}
+
+static uint64_t plist_stream_port(plist_t response, const char *key) {
+    uint64_t value = 0;
+    plist_t streams = plist_dict_get_item(response, "streams");
+    if (streams && plist_array_get_size(streams) > 0) {
+        plist_get_uint_val(plist_dict_get_item(plist_array_get_item(streams, 0), key), &value);
+    }
+    return value;
+}
+
+/* ---- timing ---- */
+
+static THREAD_RETVAL ntp_thread(void *arg) {
+    sender_t *sender = arg;
+    unsigned char request[128], reply[32];
+    while (sender->ntp_running) {
+        fd_set rfds;
+        struct timeval tv = { 0, 100000 };
+        FD_ZERO(&rfds);
+        FD_SET(sender->ntp_fd, &rfds);
+        if (select(sender->ntp_fd + 1, &rfds, NULL, NULL, &tv) <= 0) {
+            continue;
+        }
+        struct sockaddr_storage saddr;
+        socklen_t saddr_len = sizeof(saddr);
+        int len = recvfrom(sender->ntp_fd, (char *) request, sizeof(request), 0, (struct sockaddr *) &saddr, &saddr_len);
+        if (len < 32) {
+            continue;
+        }
+        uint64_t received = raop_ntp_get_local_time(NULL);
+        memset(reply, 0, sizeof(reply));
+        reply[0] = 0x80;
+        reply[1] = 0xd3;
+        reply[3] = 0x07;
+        memcpy(reply + 8, request + 24, 8);     /* origin: the receiver's transmit time */
+        byteutils_put_ntp_timestamp(reply, 16, received);
+        byteutils_put_ntp_timestamp(reply, 24, raop_ntp_get_local_time(NULL));
+        sendto(sender->ntp_fd, (char *) reply, sizeof(reply), 0, (struct sockaddr *) &saddr, saddr_len);
+    }
+    return 0;
+}
+
+/* ---- streaming ---- */
+
+static uint32_t next_random(sender_t *sender) {
+    sender->rng = sender->rng * 1664525 + 1013904223;
+    return sender->rng;
+}
+
+static void put_mirror_time(unsigned char *header, uint64_t time) {
+    /* seconds in the upper half, no 1900 epoch: see raop_ntp_timestamp_to_micro_seconds(..., false) */
+    uint64_t ntp = ((time / SEC) << 32) | (((time % SEC) << 32) / SEC);
+    for (int i = 0; i < 8; i++) {
+        header[8 + i] = (unsigned char) (ntp >> (8 * i));
+    }
+}
+
+static void put_float(unsigned char *b, int offset, float value) {
+    memcpy(b + offset, &value, sizeof(float));
+}
+
+static bool send_parameter_sets(sender_t *sender, uint64_t time) {
+    const video_source_t *video = sender->video;
+    int len = 11 + video->sps_len + video->pps_len;
+    unsigned char *packet = calloc(1, MIRROR_HEADER_LEN + len);
+    unsigned char *avcc = packet + MIRROR_HEADER_LEN;
+    packet[0] = (unsigned char) len;         /* little endian */
+    packet[1] = (unsigned char) (len >> 8);
+    packet[4] = 0x01;
+    packet[6] = 0x01;
+    packet[7] = 0x16;
+    put_mirror_time(packet, time);
+    put_float(packet, 16, (float) sender->config->width);
+    put_float(packet, 20, (float) sender->config->height);
+    put_float(packet, 40, (float) sender->config->width);
+    put_float(packet, 44, (float) sender->config->height);
+    put_float(packet, 56, (float) sender->config->width);
+    put_float(packet, 60, (float) sender->config->height);
+    avcc[0] = 1;
+    avcc[1] = video->sps[1];
+    avcc[2] = video->sps[2];
+    avcc[3] = video->sps[3];
+    avcc[4] = 0xff;
+    avcc[5] = 0xe1;
+    avcc[6] = (unsigned char) (video->sps_len >> 8);
+    avcc[7] = (unsigned char) video->sps_len;
+    memcpy(avcc + 8, video->sps, video->sps_len);
+    avcc[8 + video->sps_len] = 1;
+    avcc[9 + video->sps_len] = (unsigned char) (video->pps_len >> 8);
+    avcc[10 + video->sps_len] = (unsigned char) video->pps_len;
+    memcpy(avcc + 11 + video->sps_len, video->pps, video->pps_len);
+    bool ok = send_all(sender->mirror_fd, packet, MIRROR_HEADER_LEN + len);
+    free(packet);
+    return ok;
+}
+
+static bool send_video_frame(sender_t *sender, int frame, bool after_parameter_sets) {
+    const video_source_t *video = sender->video;
+    const sender_config_t *config = sender->config;
+    uint64_t time = raop_ntp_get_local_time(NULL);
+
+    unsigned char sei[3 + 16 + SEI_TEXT_LEN + 2];
+    char text[SEI_TEXT_LEN + 1];
+    snprintf(text, sizeof(text), "%02d %08u %016llu", sender->index, (unsigned int) frame, (unsigned long long) time);
+    sei[0] = 0x06;
+    sei[1] = 0x05;                   /* user_data_unregistered */
+    sei[2] = 16 + SEI_TEXT_LEN;
+    memcpy(sei + 3, sei_uuid, 16);
+    memcpy(sei + 19, text, SEI_TEXT_LEN);
+    sei[19 + SEI_TEXT_LEN] = 0x80;
+
+    access_unit_t unit;
+    memset(&unit, 0, sizeof(unit));
+    append_nal(&unit, sei, 20 + SEI_TEXT_LEN);
+    if (video->units) {
+        const access_unit_t *source = &video->units[frame % video->unit_count];
+        unit.data = realloc(unit.data, unit.len + source->len);
+        memcpy(unit.data + unit.len, source->data, source->len);
+        unit.len += source->len;
+    } else {
+        bool idr = (frame % config->gop == 0);
+        int len = config->kbps * 1000 / 8 / config->fps;
+        if (idr) len *= 3;
+        if (len < 16) len = 16;
+        unsigned char *slice = malloc(len);
+        slice[0] = idr ? 0x65 : 0x41;
+        slice[1] = 0x88;             /* first_mb_in_slice = 0 */
+        for (int i = 2; i < len; i++) {
+            slice[i] = (unsigned char) (next_random(sender) >> 24) | 0x01;
+        }
+        append_nal(&unit, slice, len);
+        free(slice);
+    }
+
+    unsigned char *packet = malloc(MIRROR_HEADER_LEN + unit.len);
+    memset(packet, 0, MIRROR_HEADER_LEN);
+    for (int i = 0; i < 4; i++) {
+        packet[i] = (unsigned char) (unit.len >> (8 * i));    /* little endian */
+    }
+    packet[5] = after_parameter_sets ? 0x10 : 0x00;
+    put_mirror_time(packet, time);
+    mirror_buffer_decrypt(sender->mirror, unit.data, packet + MIRROR_HEADER_LEN, unit.len);   /* CTR: encrypts */
+    bool ok = send_all(sender->mirror_fd, packet, MIRROR_HEADER_LEN + unit.len);
+    if (ok) {
+        sender->frames_sent++;
+        sender->video_bytes_sent += unit.len;
+    }
+    free(packet);
+    free(unit.data);
+    return ok;
+}
+
+static bool open_audio_encoder(sender_t *sender) {
+    if (aacEncOpen(&sender->aac, 0, 2) != AACENC_OK) {
+        return false;
+    }
+    return aacEncoder_SetParam(sender->aac, AACENC_AOT, AOT_ER_AAC_ELD) == AACENC_OK &&
+           aacEncoder_SetParam(sender->aac, AACENC_SAMPLERATE, AUDIO_RATE) == AACENC_OK &&
+           aacEncoder_SetParam(sender->aac, AACENC_CHANNELMODE, MODE_2) == AACENC_OK &&
+           aacEncoder_SetParam(sender->aac, AACENC_GRANULE_LENGTH, AUDIO_SPF) == AACENC_OK &&
+           aacEncoder_SetParam(sender->aac, AACENC_BITRATE, 64000) == AACENC_OK &&
+           aacEncoder_SetParam(sender->aac, AACENC_TRANSMUX, TT_MP4_RAW) == AACENC_OK &&
+           aacEncEncode(sender->aac, NULL, NULL, NULL, NULL) == AACENC_OK;
+}
+
+static bool send_audio_frame(sender_t *sender, int frame) {
+    /* a tone per sender, with some noise so that no two frames are the same */
+    INT_PCM pcm[AUDIO_SPF * 2];
+    double step = 2.0 * 3.14159265358979 * (330.0 + 110.0 * sender->index) / AUDIO_RATE;
+    for (int i = 0; i < AUDIO_SPF; i++) {
+        double t = (double) frame * AUDIO_SPF + i;
+        int value = (int) (8000.0 * sin(step * t)) + (int) (next_random(sender) >> 25) - 64;
+        pcm[2 * i] = pcm[2 * i + 1] = (INT_PCM) value;
+    }
+    unsigned char packet[12 + 2048];
+    unsigned char aac[2048];
+    void *in_ptr = pcm, *out_ptr = aac;
+    int in_id = IN_AUDIO_DATA, in_size = sizeof(pcm), in_el = sizeof(INT_PCM);
+    int out_id = OUT_BITSTREAM_DATA, out_size = sizeof(aac), out_el = 1;
+    AACENC_BufDesc in_buf = { 1, &in_ptr, &in_id, &in_size, &in_el };
+    AACENC_BufDesc out_buf = { 1, &out_ptr, &out_id, &out_size, &out_el };
+    AACENC_InArgs in_args;
+    AACENC_OutArgs out_args;
+    memset(&in_args, 0, sizeof(in_args));
+    memset(&out_args, 0, sizeof(out_args));
+    in_args.numInSamples = AUDIO_SPF * 2;
+    if (aacEncEncode(sender->aac, &in_buf, &out_buf, &in_args, &out_args) != AACENC_OK) {
+        return false;
+    }
+    int len = out_args.numOutBytes;
+    if (len <= 0) {
+        return true;                 /* encoder delay */
+    }
+
+    uint16_t seqnum = (uint16_t) frame;
+    uint32_t rtp_time = (uint32_t) frame * AUDIO_SPF;
+    packet[0] = 0x80;
+    packet[1] = 0x60;
+    packet[2] = (unsigned char) (seqnum >> 8);
+    packet[3] = (unsigned char) seqnum;
+    put_be32(packet, 4, rtp_time);
+    put_be32(packet, 8, 0);
+    int encrypted = len / 16 * 16;
+    aes_cbc_encrypt(sender->audio_aes, aac, packet + 12, encrypted);
+    aes_cbc_reset(sender->audio_aes);
+    memcpy(packet + 12 + encrypted, aac + encrypted, len - encrypted);
+
+    uint64_t hash = utils_hash_data(aac, len);
+    MUTEX_LOCK(stats_mutex);
+    audio_entry_t *entry = &audio_table[hash % AUDIO_TABLE_SIZE];
+    entry->hash = hash;
+    entry->time = raop_ntp_get_local_time(NULL);
+    entry->sender = sender->index;
+    MUTEX_UNLOCK(stats_mutex);
+
+    if (send(sender->audio_fd, (char *) packet, 12 + len, 0) != 12 + len) {
+        return false;
+    }
+    sender->audio_sent++;
+    return true;
+}
+
+static void send_audio_sync(sender_t *sender, int frame, bool first) {
+    unsigned char packet[20];
+    uint32_t rtp_time = (uint32_t) frame * AUDIO_SPF;
+    packet[0] = first ? 0x90 : 0x80;
+    packet[1] = 0xd4;
+    packet[2] = 0x00;
+    packet[3] = 0x04;
+    put_be32(packet, 4, rtp_time);
+    byteutils_put_ntp_timestamp(packet, 8, raop_ntp_get_local_time(NULL));
+    put_be32(packet, 16, rtp_time + 7497);
+    send(sender->control_fd, (char *) packet, sizeof(packet), 0);
+}
+
+/* ---- sender session ---- */
+
+static bool sender_setup(sender_t *sender) {
+    plist_t response = NULL;
+    plist_t request;
+
+    sender->rtsp_fd = connect_local(sender->raop_port, SOCK_STREAM);
+    if (sender->rtsp_fd < 0 || rtsp_request(sender, "GET", "/info", NULL, NULL, 0, &response) != 200) {
+        logger_log(logger, LOGGER_ERR, "sender %d: GET /info failed", sender->index);
+        return false;
+    }
+    plist_free(response);
+
+    /* session: keys and timing */
+    unsigned char key[16], ekey[72], hash[64];
+    for (int i = 0; i < 16; i++) {
+        key[i] = (unsigned char) (next_random(sender) >> 24);
+        sender->aesiv[i] = (unsigned char) (next_random(sender) >> 24);
+    }
+    memset(ekey, 0, sizeof(ekey));
+    memcpy(ekey, RAOP_TEST_EKEY_TAG, sizeof(RAOP_TEST_EKEY_TAG));
+    memcpy(ekey + 16, key, 16);
+    /* without pair-verify, the receiver hashes the key with an all-zero ECDH secret */
+    unsigned char ecdh_secret[32];
+    memset(ecdh_secret, 0, sizeof(ecdh_secret));
+    sha_ctx_t *sha = sha_init();
+    sha_update(sha, key, 16);
+    sha_update(sha, ecdh_secret, 32);
+    sha_final(sha, hash, NULL);
+    sha_destroy(sha);
+    memcpy(sender->session_key, hash, 16);
+
+    sender->ntp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (sender->ntp_fd < 0 || bind(sender->ntp_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        return false;
+    }
+    sender->timing_port = local_port(sender->ntp_fd);
+    sender->ntp_running = true;
+    THREAD_CREATE(sender->ntp_thread, ntp_thread, sender);
+
+    request = plist_new_dict();
+    plist_dict_set_item(request, "ekey", plist_new_data((char *) ekey, sizeof(ekey)));
+    plist_dict_set_item(request, "eiv", plist_new_data((char *) sender->aesiv, 16));
+    plist_dict_set_item(request, "et", plist_new_uint(32));
+    plist_dict_set_item(request, "timingProtocol", plist_new_string("NTP"));
+    plist_dict_set_item(request, "timingPort", plist_new_uint(sender->timing_port));
+    plist_dict_set_item(request, "isScreenMirroringSession", plist_new_bool(1));
+    plist_dict_set_item(request, "model", plist_new_string("raop_sender"));
+    if (rtsp_request_plist(sender, "SETUP", "rtsp://127.0.0.1/test", request, &response) != 200) {
+        logger_log(logger, LOGGER_ERR, "sender %d: SETUP of the session failed", sender->index);
+        return false;
+    }
+    plist_free(response);
+
+    /* mirror stream */
+    uint64_t stream_connection_id = ((uint64_t) next_random(sender) << 32) | next_random(sender);
+    request = plist_new_dict();
+    plist_t streams = plist_new_array();
+    plist_t stream = plist_new_dict();
+    plist_dict_set_item(stream, "type", plist_new_uint(110));
+    plist_dict_set_item(stream, "streamConnectionID", plist_new_uint(stream_connection_id));
+    plist_array_append_item(streams, stream);
+    plist_dict_set_item(request, "streams", streams);
+    if (rtsp_request_plist(sender, "SETUP", "rtsp://127.0.0.1/test", request, &response) != 200) {
+        logger_log(logger, LOGGER_ERR, "sender %d: SETUP of the mirror stream failed", sender->index);
+        return false;
+    }
+    unsigned short mirror_port = (unsigned short) plist_stream_port(response, "dataPort");
+    plist_free(response);
+    sender->mirror = mirror_buffer_init(logger, sender->session_key);
+    mirror_buffer_init_aes(sender->mirror, &stream_connection_id);
+    sender->mirror_fd = connect_local(mirror_port, SOCK_STREAM);
+    if (sender->mirror_fd < 0) {
+        logger_log(logger, LOGGER_ERR, "sender %d: could not connect to mirror port %d", sender->index, mirror_port);
+        return false;
+    }
+
+    /* audio stream */
+    if (sender->config->audio) {
+        if (!open_audio_encoder(sender)) {
+            logger_log(logger, LOGGER_ERR, "sender %d: could not open the AAC-ELD encoder", sender->index);
+            return false;
+        }
+        request = plist_new_dict();
+        streams = plist_new_array();
+        stream = plist_new_dict();
+        plist_dict_set_item(stream, "type", plist_new_uint(96));
+        plist_dict_set_item(stream, "ct", plist_new_uint(AUDIO_CT_AAC_ELD));
+        plist_dict_set_item(stream, "spf", plist_new_uint(AUDIO_SPF));
+        plist_dict_set_item(stream, "sr", plist_new_uint(AUDIO_RATE));
+        plist_dict_set_item(stream, "audioFormat", plist_new_uint(AUDIO_FORMAT_AAC_ELD_44100_2));
+        plist_dict_set_item(stream, "usingScreen", plist_new_bool(1));
+        plist_dict_set_item(stream, "isMedia", plist_new_bool(0));
+        plist_dict_set_item(stream, "controlPort", plist_new_uint(0));
+        plist_array_append_item(streams, stream);
+        plist_dict_set_item(request, "streams", streams);
+        if (rtsp_request_plist(sender, "SETUP", "rtsp://127.0.0.1/test", request, &response) != 200) {
+            logger_log(logger, LOGGER_ERR, "sender %d: SETUP of the audio stream failed", sender->index);
+            return false;
+        }
+        unsigned short data_port = (unsigned short) plist_stream_port(response, "dataPort");
+        unsigned short control_port = (unsigned short) plist_stream_port(response, "controlPort");
+        plist_free(response);
+        sender->audio_aes = aes_cbc_init(sender->session_key, sender->aesiv, AES_ENCRYPT);
+        sender->audio_fd = connect_local(data_port, SOCK_DGRAM);
+        sender->control_fd = connect_local(control_port, SOCK_DGRAM);
+        if (sender->audio_fd < 0 || sender->control_fd < 0) {
+            return false;
+        }
+    }
+
+    const char volume[] = "volume: -15.000000\r\n";
+    if (rtsp_request(sender, "RECORD", "rtsp://127.0.0.1/test", NULL, NULL, 0, NULL) != 200 ||
+        rtsp_request(sender, "SET_PARAMETER", "rtsp://127.0.0.1/test", "text/parameters",
+                     (const unsigned char *) volume, strlen(volume), NULL) != 200) {
+        logger_log(logger, LOGGER_ERR, "sender %d: RECORD or SET_PARAMETER failed", sender->index);
+        return false;
+    }
+    return true;
+}
+
+static void sender_stream(sender_t *sender) {
+    const sender_config_t *config = sender->config;
+    uint64_t start = raop_ntp_get_local_time(NULL);
+    uint64_t end = start + (uint64_t) config->seconds * SEC;
+    uint64_t video_interval = SEC / config->fps;
+    double audio_interval = (double) AUDIO_SPF * SEC / AUDIO_RATE;
+    int frame = 0, audio_frame = 0;
+    uint64_t next_sync = start;
+
+    while (1) {
+        uint64_t next_video = start + frame * video_interval;
+        uint64_t next_audio = start + (uint64_t) (audio_frame * audio_interval);
+        uint64_t next = (config->audio && next_audio < next_video) ? next_audio : next_video;
+        if (next >= end) {
+            break;
+        }
+        uint64_t now = raop_ntp_get_local_time(NULL);
+        if (next > now + 1000) {
+            sleepms((int) ((next - now) / 1000));
+        }
+        if (next == next_video) {
+            bool parameter_sets = sender->video->units ? sender->video->units[frame % sender->video->unit_count].idr
+                                                       : (frame % config->gop == 0);
+            if ((parameter_sets && !send_parameter_sets(sender, raop_ntp_get_local_time(NULL))) ||
+                !send_video_frame(sender, frame, parameter_sets)) {
+                logger_log(logger, LOGGER_ERR, "sender %d: mirror connection lost", sender->index);
+                break;
+            }
+            frame++;
+        } else {
+            if (next_audio >= next_sync) {
+                send_audio_sync(sender, audio_frame, next_sync == start);
+                next_sync += SEC;
+            }
+            send_audio_frame(sender, audio_frame);
+            audio_frame++;
+        }
+    }
+}
+
+static void sender_teardown(sender_t *sender) {
+    if (sender->rtsp_fd >= 0) {
+        rtsp_request_plist(sender, "TEARDOWN", "rtsp://127.0.0.1/test", plist_new_dict(), NULL);
+        closesocket(sender->rtsp_fd);
+    }
+    if (sender->ntp_running) {
+        sender->ntp_running = false;
+        THREAD_JOIN(sender->ntp_thread);
+    }
+    if (sender->ntp_fd >= 0) closesocket(sender->ntp_fd);
+    if (sender->mirror_fd >= 0) closesocket(sender->mirror_fd);
+    if (sender->audio_fd >= 0) closesocket(sender->audio_fd);
+    if (sender->control_fd >= 0) closesocket(sender->control_fd);
+    if (sender->mirror) mirror_buffer_destroy(sender->mirror);
+    if (sender->audio_aes) aes_cbc_destroy(sender->audio_aes);
+    if (sender->aac) aacEncClose(&sender->aac);
+}
+
+static THREAD_RETVAL sender_thread(void *arg) {
+    sender_t *sender = arg;
+    sender->ok = sender_setup(sender);
+    if (sender->ok) {
+        sender_stream(sender);
+    }
+    /* give the receiver time to deliver what is in flight before tearing down */
+    sleepms(500);
+    sender_teardown(sender);
+    sender->cpu_time = thread_cpu_time();
+    return 0;
+}
+
+/* Runs count senders at once; returns the number that failed */
+static int run_round(sender_config_t *config, const video_source_t *video, unsigned short port, int count,
+                     round_stats_t *stats) {
+    for (int i = 0; i < sender_count; i++) {
+        free(senders[i].video_latency.values);
+        free(senders[i].audio_latency.values);
+    }
+    memset(senders, 0, sizeof(senders));
+    memset(audio_table, 0, AUDIO_TABLE_SIZE * sizeof(audio_entry_t));
+    sender_count = count;
+
+    uint64_t cpu_start = process_cpu_time();
+    for (int i = 0; i < sender_count; i++) {
+        sender_t *sender = &senders[i];
+        sender->index = i;
+        sender->config = config;
+        sender->video = video;
+        sender->raop_port = port;
+        sender->rtsp_fd = sender->ntp_fd = sender->mirror_fd = sender->audio_fd = sender->control_fd = -1;
+        sender->rng = 0x9e3779b9u * (i + 1);
+        THREAD_CREATE(sender->thread, sender_thread, sender);
+    }
+    /* memory is sampled while all sessions are streaming */
+    sleepms(config->seconds * 750);
+    stats->rss = process_rss();
+    for (int i = 0; i < sender_count; i++) {
+        THREAD_JOIN(senders[i].thread);
+    }
+
+    /* what the senders used themselves is not the receiver's */
+    uint64_t sender_cpu = 0;
+    int failed = 0;
+    for (int i = 0; i < sender_count; i++) {
+        sender_cpu += senders[i].cpu_time;
+        failed += !senders[i].ok;
+    }
+    uint64_t cpu = process_cpu_time() - cpu_start;
+    stats->receiver_cpu = cpu > sender_cpu ? cpu - sender_cpu : 0;
+    stats->sender_cpu = sender_cpu;
+    return failed;
+}
+
+static void print_round(const sender_config_t *config, const video_source_t *video, const char *video_path,
+                        const round_stats_t *stats) {
+    printf("%d sender(s), %d s, %dx%d at %d fps, %s video%s%s\n", sender_count, config->seconds, config->width,
+           config->height, config->fps, video_path ? video_path : "synthetic", config->audio ? ", AAC-ELD audio" : "",
+           config->decode ? ", decoded" : "");
+    printf("sender  video sent/recv   p50     p99     max (ms)  audio sent/recv   p50     p99     max (ms)\n");
+    uint64_t total_bytes = 0;
+    int total_frames = 0;
+    MUTEX_LOCK(stats_mutex);
+    for (int i = 0; i < sender_count; i++) {
+        sender_t *sender = &senders[i];
+        latency_log_t *v = &sender->video_latency, *a = &sender->audio_latency;
+        qsort(v->values, v->count, sizeof(int64_t), compare_int64);
+        qsort(a->values, a->count, sizeof(int64_t), compare_int64);
+        printf("%6d  %5d/%-5d %9.2f %7.2f %7.2f       %5d/%-5d %9.2f %7.2f %7.2f%s\n", i,
+               sender->frames_sent, v->count, latency_percentile(v, 0.5), latency_percentile(v, 0.99),
+               latency_percentile(v, 1.0), sender->audio_sent, a->count, latency_percentile(a, 0.5),
+               latency_percentile(a, 0.99), latency_percentile(a, 1.0), sender->ok ? "" : "  (setup failed)");
+        total_bytes += sender->video_bytes_sent;
+        total_frames += v->count;
+    }
+    MUTEX_UNLOCK(stats_mutex);
+    printf("total: %.1f Mbit/s video, %.1f frames/s received\n",
+           total_bytes * 8.0 / 1e6 / config->seconds, (double) total_frames / config->seconds);
+    printf("receiver: %.1f%% of a CPU, %.1f MB resident (senders: %.1f%% of a CPU)\n",
+           stats->receiver_cpu / (config->seconds * 10000.0), stats->rss / 1048576.0,
+           stats->sender_cpu / (config->seconds * 10000.0));
+    if (video_decode_errors) {
+        printf("%d decoding errors%s\n", video_decode_errors, video->units ? "" : " (synthetic slices cannot be decoded, use -v)");
+    }
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-n senders] [-t seconds] [-fps n] [-b kbit/s] [-g gop] [-s WxH] [-v file.h264] [-na]\n"
+                    "       [-dec] [-sweep] [-d]\n", name);
+    fprintf(stderr, "  -n senders   concurrent senders, 1 to %d (default 1)\n", MAX_SENDERS);
+    fprintf(stderr, "  -t seconds   streaming time (default 10)\n");
+    fprintf(stderr, "  -fps n       video frame rate (default 30)\n");
+    fprintf(stderr, "  -b kbit/s    synthetic video bit rate (default 8000)\n");
+    fprintf(stderr, "  -g gop       synthetic video IDR interval in frames (default 60)\n");
+    fprintf(stderr, "  -s WxH       video size (default 1280x720)\n");
+    fprintf(stderr, "  -v file      loop the access units of an Annex-B H264 file instead of synthetic video\n");
+    fprintf(stderr, "  -na          no audio stream\n");
+    fprintf(stderr, "  -dec         decode the video of each session with its own ffmpeg decoder (use with -v)\n");
+    fprintf(stderr, "  -sweep       run with 1, 2, ... n senders and report CPU and memory per added session\n");
+    fprintf(stderr, "  -d           debug logging\n");
+}
+
+int main(int argc, char *argv[]) {
+    sender_config_t config = { 1, 10, 30, 8000, 60, 1280, 720, true, false };
+    const char *video_path = NULL;
+    bool debug = false;
+    bool sweep = false;
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        bool has_value = (i < argc - 1);
+        if (!strcmp(arg, "-n") && has_value) {
+            config.senders = atoi(argv[++i]);
+        } else if (!strcmp(arg, "-t") && has_value) {
+            config.seconds = atoi(argv[++i]);
+        } else if (!strcmp(arg, "-fps") && has_value) {
+            config.fps = atoi(argv[++i]);
+        } else if (!strcmp(arg, "-b") && has_value) {
+            config.kbps = atoi(argv[++i]);
+        } else if (!strcmp(arg, "-g") && has_value) {
+            config.gop = atoi(argv[++i]);
+        } else if (!strcmp(arg, "-s") && has_value) {
+            if (sscanf(argv[++i], "%dx%d", &config.width, &config.height) != 2) {
+                config.width = 0;
+            }
+        } else if (!strcmp(arg, "-v") && has_value) {
+            video_path = argv[++i];
+        } else if (!strcmp(arg, "-na")) {
+            config.audio = false;
+        } else if (!strcmp(arg, "-dec")) {
+            config.decode = true;
+        } else if (!strcmp(arg, "-sweep")) {
+            sweep = true;
+        } else if (!strcmp(arg, "-d")) {
+            debug = true;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (config.senders < 1 || config.senders > MAX_SENDERS || config.seconds < 1 || config.fps < 1 ||
+        config.gop < 1 || config.width < 16 || config.height < 16 || (config.width % 16) || (config.height % 16)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    video_source_t video;
+    memset(&video, 0, sizeof(video));
+    if (video_path) {
+        if (!load_video(&video, video_path)) {
+            fprintf(stderr, "%s: no SPS, PPS and access units found\n", video_path);
+            return 1;
+        }
+    } else {
+        make_parameter_sets(&video, config.width, config.height);
+    }
+
+    logger = logger_init();
+    logger_set_callback(logger, log_callback, NULL);
+    logger_set_level(logger, debug ? LOGGER_DEBUG : LOGGER_WARNING);
+    MUTEX_CREATE(stats_mutex);
+    audio_table = calloc(AUDIO_TABLE_SIZE, sizeof(audio_entry_t));
+
+    /* the receiver, with a session (and a decoder with -dec) per connection */
+    raop_callbacks_t callbacks;
+    memset(&callbacks, 0, sizeof(callbacks));
+    callbacks.cls = &config;
+    callbacks.video_process = video_process;
+    callbacks.audio_process = audio_process;
+    callbacks.session_init = session_init;
+    callbacks.session_destroy = session_destroy;
+    raop_t *raop = raop_init(2 * config.senders + 1, &callbacks);
+    if (!raop) {
+        fprintf(stderr, "could not initialize the receiver\n");
+        return 1;
+    }
+    raop_set_log_callback(raop, log_callback, NULL);
+    raop_set_log_level(raop, debug ? RAOP_LOG_DEBUG : RAOP_LOG_WARNING);
+    const char hw_addr[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+    dnssd_t *dnssd = dnssd_init("raop_sender", 11, hw_addr, sizeof(hw_addr), NULL);
+    if (!dnssd) {
+        fprintf(stderr, "could not initialize dnssd\n");
+        return 1;
+    }
+    raop_set_dnssd(raop, dnssd);
+    unsigned short port = 0;
+    if (raop_start(raop, &port) < 0) {
+        fprintf(stderr, "could not start the receiver\n");
+        return 1;
+    }
+
+    int failed = 0;
+    round_stats_t stats;
+    if (sweep) {
+        /* each round adds a session; the increments are what one more session costs */
+        round_stats_t previous;
+        memset(&previous, 0, sizeof(previous));
+        previous.rss = process_rss();
+        printf("sessions  receiver CPU %%  +CPU %%   RSS MB   +RSS MB  frames/s\n");
+        printf("%8d  %14.1f  %6s  %7.1f  %8s  %8s\n", 0, 0.0, "", previous.rss / 1048576.0, "", "");
+        for (int n = 1; n <= config.senders; n++) {
+            failed += run_round(&config, &video, port, n, &stats);
+            int frames = 0;
+            for (int i = 0; i < n; i++) {
+                frames += senders[i].video_latency.count;
+            }
+            printf("%8d  %14.1f  %+6.1f  %7.1f  %+8.1f  %8.1f\n", n, stats.receiver_cpu / (config.seconds * 10000.0),
+                   ((double) stats.receiver_cpu - (double) previous.receiver_cpu) / (config.seconds * 10000.0),
+                   stats.rss / 1048576.0, ((double) stats.rss - (double) previous.rss) / 1048576.0,
+                   (double) frames / config.seconds);
+            fflush(stdout);
+            previous = stats;
+        }
+    } else {
+        failed = run_round(&config, &video, port, config.senders, &stats);
+        print_round(&config, &video, video_path, &stats);
+    }
+    raop_stop(raop);
+
+    raop_destroy(raop);
+    dnssd_destroy(dnssd);
+    for (int i = 0; i < sender_count; i++) {
+        free(senders[i].video_latency.values);
+        free(senders[i].audio_latency.values);
+    }
+    for (int i = 0; i < video.unit_count; i++) {
+        free(video.units[i].data);
+    }
+    free(video.units);
+    free(video.sps);
+    free(video.pps);
+    free(audio_table);
+    MUTEX_DESTROY(stats_mutex);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,200 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * SPS rewrite check: fixed SPS NAL units are passed through h264_params the way the renderers
+ * do (in an Annex-B access unit and in an avcC record), and the SPS that comes out is parsed
+ * again. It must signal bitstream_restriction_flag = 1 and num_reorder_frames = 0, so that
+ * decoders output each picture as soon as it is decoded, and keep the picture size and the
+ * rest of the VUI. No stream or ffmpeg is needed; exits with 1 if a check fails.
+ *
+ * Usage: sps_check
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "h264_params.h"
+#include "h264-bitstream/h264_stream.h"
+
+typedef struct sps_case_s {
+    const char *name;
+    const unsigned char *sps;
+    int sps_len;
+    int width;
+    int height;
+} sps_case_t;
+
+/* High profile 1920x1080 (cropped from 1088), VUI with colour and timing info but no bitstream
+ * restriction, like the SPS that iOS sends; contains emulation prevention bytes */
+static const unsigned char sps_high_1080[] = {
+    0x67, 0x64, 0x00, 0x28, 0xac, 0xb4, 0x03, 0xc0, 0x11, 0x3f, 0x2c, 0xd4, 0x04, 0x04, 0x05, 0x00,
+    0x00, 0x03, 0x00, 0x01, 0x00, 0x00, 0x03, 0x00, 0x78, 0x04
+};
+
+/* Constrained baseline 1280x720 without VUI */
+static const unsigned char sps_baseline_720[] = {
+    0x67, 0x42, 0x40, 0x28, 0xda, 0x01, 0x40, 0x16, 0xe4
+};
+
+static const sps_case_t sps_cases[] = {
+    { "high 1080p, vui", sps_high_1080, sizeof(sps_high_1080), 1920, 1080 },
+    { "baseline 720p, no vui", sps_baseline_720, sizeof(sps_baseline_720), 1280, 720 },
+};
+
+static int failures = 0;
+
+static void check(const char *name, const char *what, bool ok) {
+    if (!ok) {
+        printf("FAIL %s: %s\n", name, what);
+        failures++;
+    }
+}
+
+static int sps_width(sps_t *sps) {
+    int crop_unit_x = sps->chroma_format_idc == 1 || sps->chroma_format_idc == 2 ? 2 : 1;
+    int width = (sps->pic_width_in_mbs_minus1 + 1) * 16;
+    if (sps->frame_cropping_flag) {
+        width -= crop_unit_x * (sps->frame_crop_left_offset + sps->frame_crop_right_offset);
+    }
+    return width;
+}
+
+static int sps_height(sps_t *sps) {
+    int crop_unit_y = (2 - sps->frame_mbs_only_flag) * (sps->chroma_format_idc == 1 ? 2 : 1);
+    int height = (2 - sps->frame_mbs_only_flag) * (sps->pic_height_in_map_units_minus1 + 1) * 16;
+    if (sps->frame_cropping_flag) {
+        height -= crop_unit_y * (sps->frame_crop_top_offset + sps->frame_crop_bottom_offset);
+    }
+    return height;
+}
+
+/* Parse the SPS as it came out of h264_params and compare it with the original */
+static void check_rewritten(const char *name, const sps_case_t *c, unsigned char *sps, int sps_len) {
+    h264_stream_t *original = h264_new();
+    h264_stream_t *rewritten = h264_new();
+
+    if (read_nal_unit(original, (uint8_t *) c->sps, c->sps_len) < 0 ||
+        original->nal->nal_unit_type != NAL_UNIT_TYPE_SPS) {
+        check(name, "original SPS parses", false);
+    } else if (read_nal_unit(rewritten, sps, sps_len) < 0 || rewritten->nal->nal_unit_type != NAL_UNIT_TYPE_SPS) {
+        check(name, "rewritten SPS parses", false);
+    } else {
+        sps_t *before = original->sps;
+        sps_t *after = rewritten->sps;
+        check(name, "vui_parameters_present_flag = 1", after->vui_parameters_present_flag == 1);
+        check(name, "bitstream_restriction_flag = 1", after->vui.bitstream_restriction_flag == 1);
+        check(name, "num_reorder_frames = 0", after->vui.num_reorder_frames == 0);
+        check(name, "max_dec_frame_buffering >= num_ref_frames", after->vui.max_dec_frame_buffering >= after->num_ref_frames);
+        check(name, "width unchanged", sps_width(after) == c->width && sps_width(before) == c->width);
+        check(name, "height unchanged", sps_height(after) == c->height && sps_height(before) == c->height);
+        check(name, "profile and level unchanged",
+              after->profile_idc == before->profile_idc && after->level_idc == before->level_idc);
+        check(name, "num_ref_frames unchanged", after->num_ref_frames == before->num_ref_frames);
+        if (before->vui_parameters_present_flag) {
+            check(name, "timing info unchanged",
+                  after->vui.timing_info_present_flag == before->vui.timing_info_present_flag &&
+                  after->vui.num_units_in_tick == before->vui.num_units_in_tick &&
+                  after->vui.time_scale == before->vui.time_scale);
+            check(name, "colour description unchanged",
+                  after->vui.colour_primaries == before->vui.colour_primaries &&
+                  after->vui.matrix_coefficients == before->vui.matrix_coefficients);
+        }
+    }
+    h264_free(original);
+    h264_free(rewritten);
+}
+
+/* SPS in an Annex-B access unit: start code, SPS */
+static void check_annexb(logger_t *logger, const sps_case_t *c) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s, annex-b", c->name);
+    h264_params_t *params = h264_params_init(logger, true);
+    unsigned char *au = malloc(c->sps_len + 4);
+    if (!params || !au) {
+        check(name, "setup", false);
+    } else {
+        memcpy(au, "\x00\x00\x00\x01", 4);
+        memcpy(au + 4, c->sps, c->sps_len);
+        int out_len;
+        unsigned char *out = h264_params_process(params, au, c->sps_len + 4, &out_len);
+        check(name, "start code kept", out_len > 4 && memcmp(out, "\x00\x00\x00\x01", 4) == 0);
+        if (out_len > 4) {
+            check_rewritten(name, c, out + 4, out_len - 4);
+        }
+    }
+    free(au);
+    h264_params_destroy(params);
+}
+
+/* SPS in an avcC record with one SPS and one (dummy) PPS */
+static void check_avcc(logger_t *logger, const sps_case_t *c) {
+    static const unsigned char pps[] = { 0x68, 0xee, 0x3c, 0x80 };
+    char name[64];
+    snprintf(name, sizeof(name), "%s, avcc", c->name);
+    h264_params_t *params = h264_params_init(logger, true);
+    int avcc_len = 6 + 2 + c->sps_len + 1 + 2 + (int) sizeof(pps);
+    unsigned char *avcc = malloc(avcc_len);
+    if (!params || !avcc) {
+        check(name, "setup", false);
+    } else {
+        unsigned char *p = avcc;
+        *p++ = 1;
+        *p++ = c->sps[1];
+        *p++ = c->sps[2];
+        *p++ = c->sps[3];
+        *p++ = 0xff;
+        *p++ = 0xe1;
+        *p++ = (unsigned char) (c->sps_len >> 8);
+        *p++ = (unsigned char) c->sps_len;
+        memcpy(p, c->sps, c->sps_len);
+        p += c->sps_len;
+        *p++ = 1;
+        *p++ = 0;
+        *p++ = sizeof(pps);
+        memcpy(p, pps, sizeof(pps));
+
+        int out_len;
+        unsigned char *out = h264_params_process_avcc(params, avcc, avcc_len, &out_len);
+        int sps_len = out_len >= 8 ? out[6] << 8 | out[7] : 0;
+        check(name, "record layout", out_len >= 8 && (out[5] & 0x1f) == 1 && sps_len > 0 && 8 + sps_len + 3 <= out_len);
+        if (sps_len > 0 && 8 + sps_len + 3 <= out_len) {
+            check_rewritten(name, c, out + 8, sps_len);
+            int pps_offset = 8 + sps_len;
+            check(name, "pps unchanged", out[pps_offset] == 1 && (out[pps_offset + 1] << 8 | out[pps_offset + 2]) == (int) sizeof(pps) &&
+                  pps_offset + 3 + (int) sizeof(pps) == out_len && memcmp(out + pps_offset + 3, pps, sizeof(pps)) == 0);
+        }
+    }
+    free(avcc);
+    h264_params_destroy(params);
+}
+
+int main(int argc, char *argv[]) {
+    logger_t *logger = logger_init();
+    int count = sizeof(sps_cases) / sizeof(sps_cases[0]);
+    for (int i = 0; i < count; i++) {
+        int before = failures;
+        check_annexb(logger, &sps_cases[i]);
+        check_avcc(logger, &sps_cases[i]);
+        printf("%s %s\n", failures == before ? "ok  " : "FAIL", sps_cases[i].name);
+    }
+    logger_destroy(logger);
+    return failures ? 1 : 0;
+}
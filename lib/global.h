@@ -12,4 +12,10 @@
 
 #define MAX_HWADDR_LEN 6
 
+/* with -DTEST_KEY_EXCHANGE=ON, an ekey starting with this tag carries the AES key unencrypted   *
+ * in bytes 16-31 (for bench/raop_sender; such a build must never be used as a real receiver) */
+#ifdef RAOP_TEST_KEY_EXCHANGE
+#define RAOP_TEST_EKEY_TAG "RAOP-TEST-EKEY"
+#endif
+
 #endif
@@ -0,0 +1,182 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "h264_sps.h"
+
+#include <stdint.h>
+
+/* Reads the RBSP of a NAL unit, dropping emulation prevention bytes (00 00 03) */
+typedef struct {
+    const unsigned char *data;
+    int len;
+    int pos;         /* next byte */
+    int zeros;       /* zero bytes just before pos */
+    uint32_t byte;   /* current byte */
+    int bits_left;   /* bits of the current byte not read yet */
+    bool overrun;
+} sps_reader_t;
+
+static bool
+sps_next_byte(sps_reader_t *reader)
+{
+    if (reader->zeros >= 2 && reader->pos < reader->len && reader->data[reader->pos] == 0x03) {
+        reader->pos++;
+        reader->zeros = 0;
+    }
+    if (reader->pos >= reader->len) {
+        reader->overrun = true;
+        return false;
+    }
+    reader->byte = reader->data[reader->pos++];
+    reader->zeros = reader->byte ? 0 : reader->zeros + 1;
+    reader->bits_left = 8;
+    return true;
+}
+
+static uint32_t
+sps_read_bits(sps_reader_t *reader, int count)
+{
+    uint32_t value = 0;
+    while (count-- > 0) {
+        if (reader->bits_left == 0 && !sps_next_byte(reader)) {
+            return 0;
+        }
+        reader->bits_left--;
+        value = (value << 1) | ((reader->byte >> reader->bits_left) & 1);
+    }
+    return value;
+}
+
+/* Exp-Golomb coded unsigned value */
+static uint32_t
+sps_read_ue(sps_reader_t *reader)
+{
+    int leading_zeros = 0;
+    while (sps_read_bits(reader, 1) == 0) {
+        if (reader->overrun || ++leading_zeros > 31) {
+            reader->overrun = true;
+            return 0;
+        }
+    }
+    return ((1u << leading_zeros) - 1) + sps_read_bits(reader, leading_zeros);
+}
+
+static int32_t
+sps_read_se(sps_reader_t *reader)
+{
+    uint32_t value = sps_read_ue(reader);
+    return (value & 1) ? (int32_t) ((value + 1) / 2) : -(int32_t) (value / 2);
+}
+
+static void
+sps_skip_scaling_list(sps_reader_t *reader, int size)
+{
+    int last_scale = 8;
+    int next_scale = 8;
+    for (int i = 0; i < size && !reader->overrun; i++) {
+        if (next_scale != 0) {
+            next_scale = (last_scale + sps_read_se(reader) + 256) % 256;
+        }
+        last_scale = next_scale == 0 ? last_scale : next_scale;
+    }
+}
+
+bool
+h264_sps_get_size(const unsigned char *sps, int sps_len, int *width, int *height)
+{
+    sps_reader_t reader = { sps, sps_len, 0, 0, 0, 0, false };
+
+    if (sps_len < 4 || (sps[0] & 0x1f) != 7) {
+        return false;
+    }
+    sps_read_bits(&reader, 8);    // NAL unit header
+    uint32_t profile_idc = sps_read_bits(&reader, 8);
+    sps_read_bits(&reader, 16);   // constraint flags, level_idc
+    sps_read_ue(&reader);         // seq_parameter_set_id
+
+    uint32_t chroma_format_idc = 1;
+    bool separate_colour_plane = false;
+    switch (profile_idc) {
+    case 100: case 110: case 122: case 244: case 44: case 83: case 86: case 118: case 128: case 138: case 139:
+    case 134: case 135:
+        chroma_format_idc = sps_read_ue(&reader);
+        if (chroma_format_idc == 3) {
+            separate_colour_plane = sps_read_bits(&reader, 1);
+        }
+        sps_read_ue(&reader);     // bit_depth_luma_minus8
+        sps_read_ue(&reader);     // bit_depth_chroma_minus8
+        sps_read_bits(&reader, 1);    // qpprime_y_zero_transform_bypass_flag
+        if (sps_read_bits(&reader, 1)) {
+            int lists = chroma_format_idc == 3 ? 12 : 8;
+            for (int i = 0; i < lists; i++) {
+                if (sps_read_bits(&reader, 1)) {
+                    sps_skip_scaling_list(&reader, i < 6 ? 16 : 64);
+                }
+            }
+        }
+        break;
+    default:
+        break;
+    }
+
+    sps_read_ue(&reader);         // log2_max_frame_num_minus4
+    uint32_t pic_order_cnt_type = sps_read_ue(&reader);
+    if (pic_order_cnt_type == 0) {
+        sps_read_ue(&reader);     // log2_max_pic_order_cnt_lsb_minus4
+    } else if (pic_order_cnt_type == 1) {
+        sps_read_bits(&reader, 1);    // delta_pic_order_always_zero_flag
+        sps_read_se(&reader);     // offset_for_non_ref_pic
+        sps_read_se(&reader);     // offset_for_top_to_bottom_field
+        uint32_t cycle = sps_read_ue(&reader);
+        for (uint32_t i = 0; i < cycle && !reader.overrun; i++) {
+            sps_read_se(&reader);
+        }
+    }
+    sps_read_ue(&reader);         // max_num_ref_frames
+    sps_read_bits(&reader, 1);    // gaps_in_frame_num_value_allowed_flag
+
+    uint32_t width_in_mbs = sps_read_ue(&reader) + 1;
+    uint32_t height_in_map_units = sps_read_ue(&reader) + 1;
+    uint32_t frame_mbs_only = sps_read_bits(&reader, 1);
+    if (!frame_mbs_only) {
+        sps_read_bits(&reader, 1);    // mb_adaptive_frame_field_flag
+    }
+    sps_read_bits(&reader, 1);    // direct_8x8_inference_flag
+
+    uint32_t crop_left = 0, crop_right = 0, crop_top = 0, crop_bottom = 0;
+    if (sps_read_bits(&reader, 1)) {
+        crop_left = sps_read_ue(&reader);
+        crop_right = sps_read_ue(&reader);
+        crop_top = sps_read_ue(&reader);
+        crop_bottom = sps_read_ue(&reader);
+    }
+    if (reader.overrun || width_in_mbs > 1024 || height_in_map_units > 1024) {
+        return false;
+    }
+
+    int crop_unit_x = 1;
+    int crop_unit_y = 2 - frame_mbs_only;
+    if (!separate_colour_plane && chroma_format_idc == 1) {
+        crop_unit_x = 2;
+        crop_unit_y *= 2;
+    } else if (!separate_colour_plane && chroma_format_idc == 2) {
+        crop_unit_x = 2;
+    }
+    int w = (int) width_in_mbs * 16 - crop_unit_x * (int) (crop_left + crop_right);
+    int h = (2 - (int) frame_mbs_only) * (int) height_in_map_units * 16 - crop_unit_y * (int) (crop_top + crop_bottom);
+    if (w <= 0 || h <= 0) {
+        return false;
+    }
+    *width = w;
+    *height = h;
+    return true;
+}
@@ -0,0 +1,31 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * Minimal h264 sequence parameter set parser: just enough of the SPS is read to get the
+ * size of the decoded pictures, after cropping. The renderers parse it fully with
+ * h264-bitstream; the library does not depend on that.
+ */
+
+#ifndef H264_SPS_H
+#define H264_SPS_H
+
+#include <stdbool.h>
+
+/**
+ * Get the picture size coded in an SPS
+ * @param sps SPS NAL unit, without start code or length prefix (may contain emulation prevention bytes)
+ * @return false if the SPS could not be parsed
+ */
+bool h264_sps_get_size(const unsigned char *sps, int sps_len, int *width, int *height);
+
+#endif //H264_SPS_H
@@ -49,6 +49,9 @@ struct httpd_s {
     /* Server fds for accepting connections */
     int server_fd4;
     int server_fd6;
+
+    /* Wakes the thread from select when httpd_stop is called */
+    int wake_fd;
 };
 
 httpd_t *
@@ -79,6 +82,13 @@ httpd_init(logger_t *logger, httpd_callbacks_t *callbacks, int max_connections)
     /* Save callback pointers */
     memcpy(&httpd->callbacks, callbacks, sizeof(httpd_callbacks_t));
 
+    httpd->wake_fd = netutils_init_wake_socket();
+    if (httpd->wake_fd == -1) {
+        free(httpd->connections);
+        free(httpd);
+        return NULL;
+    }
+
     /* Initial status joined */
     httpd->running = 0;
     httpd->joined = 1;
@@ -92,6 +102,7 @@ httpd_destroy(httpd_t *httpd)
     if (httpd) {
         httpd_stop(httpd);
 
+        closesocket(httpd->wake_fd);
         free(httpd->connections);
         free(httpd);
     }
@@ -192,7 +203,6 @@ httpd_thread(void *arg)
 
     while (1) {
         fd_set rfds;
-        struct timeval tv;
         int nfds=0;
         int ret;
 
@@ -203,12 +213,10 @@ httpd_thread(void *arg)
         }
         MUTEX_UNLOCK(httpd->run_mutex);
 
-        /* Set timeout value to 5ms */
-        tv.tv_sec = 1;
-        tv.tv_usec = 5000;
-
         /* Get the correct nfds value and set rfds */
         FD_ZERO(&rfds);
+        FD_SET(httpd->wake_fd, &rfds);
+        nfds = httpd->wake_fd+1;
         if (httpd->open_connections < httpd->max_connections) {
             if (httpd->server_fd4 != -1) {
                 FD_SET(httpd->server_fd4, &rfds);
@@ -235,14 +243,16 @@ httpd_thread(void *arg)
             }
         }
 
-        ret = select(nfds, &rfds, NULL, NULL, &tv);
-        if (ret == 0) {
-            /* Timeout happened */
-            continue;
-        } else if (ret == -1) {
+        /* No timeout: httpd_stop wakes the thread up */
+        ret = select(nfds, &rfds, NULL, NULL, NULL);
+        if (ret == -1) {
             logger_log(httpd->logger, LOGGER_ERR, "httpd error in select");
             break;
         }
+        if (FD_ISSET(httpd->wake_fd, &rfds)) {
+            netutils_drain_wake_socket(httpd->wake_fd);
+            continue;
+        }
 
         if (httpd->open_connections < httpd->max_connections &&
             httpd->server_fd4 != -1 && FD_ISSET(httpd->server_fd4, &rfds)) {
@@ -449,6 +459,7 @@ httpd_stop(httpd_t *httpd)
     httpd->running = 0;
     MUTEX_UNLOCK(httpd->run_mutex);
 
+    netutils_wake(httpd->wake_fd);
     THREAD_JOIN(httpd->thread);
 
     MUTEX_LOCK(httpd->run_mutex);
@@ -0,0 +1,511 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "metrics.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <assert.h>
+
+#include "threads.h"
+#include "trace.h"
+
+#if defined(WIN32)
+#define METRICS_ADD(x, v) InterlockedExchangeAdd64((volatile LONG64 *) &(x), (LONG64) (v))
+#define METRICS_LOAD(x) InterlockedCompareExchange64((volatile LONG64 *) &(x), 0, 0)
+#define METRICS_STORE(x, v) InterlockedExchange64((volatile LONG64 *) &(x), (LONG64) (v))
+#else
+#define METRICS_ADD(x, v) __atomic_add_fetch(&(x), (v), __ATOMIC_RELAXED)
+#define METRICS_LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define METRICS_STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+#endif
+
+#define METRICS_SUB_BITS 3
+#define METRICS_SUB_COUNT (1 << METRICS_SUB_BITS)
+#define METRICS_MAX_VALUE 0xffffffffu   /* us, about 71 minutes; larger values go to the last bucket */
+#define METRICS_BUCKETS ((32 - METRICS_SUB_BITS + 1) * METRICS_SUB_COUNT)
+
+typedef struct metrics_histogram_data_s {
+    int64_t buckets[METRICS_BUCKETS];
+    int64_t count;
+    int64_t sum;
+} metrics_histogram_data_t;
+
+struct metrics_session_s {
+    metrics_t *metrics;
+    metrics_session_t *next;
+    int id;
+    int refs;   /* under the registry mutex; 0: closed, to be reused */
+
+    int64_t counters[METRICS_COUNTER_COUNT];
+    int64_t gauges[METRICS_GAUGE_COUNT];
+    metrics_histogram_data_t histograms[METRICS_HISTOGRAM_COUNT];
+};
+
+struct metrics_s {
+    mutex_handle_t mutex;
+    metrics_session_t *sessions;
+    int64_t timing;   /* stages are timed, see metrics_stage_begin */
+};
+
+typedef struct metrics_desc_s {
+    const char *name;
+    const char *labels;   /* besides the session */
+    const char *help;     /* of the family, given with its first member */
+    double scale;         /* from the recorded value to the reported unit */
+} metrics_desc_t;
+
+static const metrics_desc_t metrics_counter_descs[METRICS_COUNTER_COUNT] = {
+    { "raop_video_frames_total", NULL, "Video packets received", 1 },
+    { "raop_video_bytes_total", NULL, "Bytes of video packet payload received", 1 },
+    { "raop_video_dropped_frames_total", NULL, "Video frames dropped for latency or skipped after corrupt data", 1 },
+    { "raop_video_corrupt_frames_total", NULL, "Video frames with corrupt data", 1 },
+    { "raop_audio_packets_total", NULL, "Audio packets received", 1 },
+    { "raop_audio_bytes_total", NULL, "Bytes of audio packets received", 1 },
+    { "raop_audio_resend_requests_total", NULL, "Audio packets asked for again", 1 },
+    { "raop_audio_resent_packets_total", NULL, "Audio packets the client sent again", 1 },
+    { "raop_ntp_requests_total", NULL, "NTP requests sent to the client", 1 },
+    { "raop_ntp_timeouts_total", NULL, "NTP requests the client did not answer in time", 1 },
+    { "raop_video_decode_level_changes_total", NULL, "Changes of the video decode level", 1 },
+};
+
+static const metrics_desc_t metrics_gauge_descs[METRICS_GAUGE_COUNT] = {
+    { "raop_ntp_dispersion_seconds", NULL, "Dispersion of the clock offset to the client", 1e-6 },
+    { "raop_ntp_delay_seconds", NULL, "Round trip delay of the NTP requests", 1e-6 },
+    { "raop_audio_queue_packets", NULL, "Packets in the audio buffer", 1 },
+    { "raop_video_decode_queue_frames", NULL, "Video frames waiting for the decoder", 1 },
+    { "raop_video_decode_lag_seconds", NULL, "Smoothed lag of decoded video frames behind their timestamp", 1e-6 },
+    { "raop_video_decode_level", NULL,
+      "Video decode level: 0 full, 1 no deblocking, 2 no non-reference frames, 3 key frames only", 1 },
+};
+
+static const metrics_desc_t metrics_histogram_descs[METRICS_HISTOGRAM_COUNT] = {
+    { "raop_stage_duration_seconds", "stream=\"video\",stage=\"receive\"", "Time spent in a stage of the pipeline", 1e-6 },
+    { "raop_stage_duration_seconds", "stream=\"video\",stage=\"decrypt\"", NULL, 1e-6 },
+    { "raop_stage_duration_seconds", "stream=\"video\",stage=\"enqueue\"", NULL, 1e-6 },
+    { "raop_stage_duration_seconds", "stream=\"video\",stage=\"decode\"", NULL, 1e-6 },
+    { "raop_stage_duration_seconds", "stream=\"video\",stage=\"present\"", NULL, 1e-6 },
+    { "raop_stage_duration_seconds", "stream=\"audio\",stage=\"decrypt\"", NULL, 1e-6 },
+    { "raop_stage_duration_seconds", "stream=\"audio\",stage=\"enqueue\"", NULL, 1e-6 },
+    { "raop_video_latency_seconds", "point=\"received\"", "Age of video frames relative to their timestamp from the client", 1e-6 },
+    { "raop_video_latency_seconds", "point=\"presented\"", NULL, 1e-6 },
+};
+
+/* Upper bounds (us) of the histogram buckets reported to Prometheus */
+static const uint64_t metrics_le[] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000
+};
+
+static int
+metrics_msb(uint32_t value)
+{
+    int msb = 0;
+    if (value >= 1u << 16) { value >>= 16; msb += 16; }
+    if (value >= 1u << 8) { value >>= 8; msb += 8; }
+    if (value >= 1u << 4) { value >>= 4; msb += 4; }
+    if (value >= 1u << 2) { value >>= 2; msb += 2; }
+    if (value >= 1u << 1) { msb += 1; }
+    return msb;
+}
+
+/* Values below 2 * METRICS_SUB_COUNT have a bucket each, above that METRICS_SUB_COUNT buckets per power of two */
+static int
+metrics_bucket(uint64_t value)
+{
+    if (value > METRICS_MAX_VALUE) {
+        value = METRICS_MAX_VALUE;
+    }
+    if (value < METRICS_SUB_COUNT) {
+        return (int) value;
+    }
+    int shift = metrics_msb((uint32_t) value) - METRICS_SUB_BITS;
+    return shift * METRICS_SUB_COUNT + (int) (value >> shift);
+}
+
+/* Largest value of a bucket */
+static uint64_t
+metrics_bucket_max(int bucket)
+{
+    if (bucket < 2 * METRICS_SUB_COUNT) {
+        return bucket;
+    }
+    int shift = bucket / METRICS_SUB_COUNT - 1;
+    uint64_t mantissa = bucket % METRICS_SUB_COUNT + METRICS_SUB_COUNT;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+static void
+metrics_session_reset(metrics_session_t *session)
+{
+    /* a renderer of the previous user may still be updating; its last values are lost */
+    for (int i = 0; i < METRICS_COUNTER_COUNT; i++) {
+        METRICS_STORE(session->counters[i], 0);
+    }
+    for (int i = 0; i < METRICS_GAUGE_COUNT; i++) {
+        METRICS_STORE(session->gauges[i], 0);
+    }
+    for (int i = 0; i < METRICS_HISTOGRAM_COUNT; i++) {
+        metrics_histogram_data_t *histogram = &session->histograms[i];
+        for (int j = 0; j < METRICS_BUCKETS; j++) {
+            METRICS_STORE(histogram->buckets[j], 0);
+        }
+        METRICS_STORE(histogram->count, 0);
+        METRICS_STORE(histogram->sum, 0);
+    }
+}
+
+metrics_t *
+metrics_init(void)
+{
+    metrics_t *metrics = calloc(1, sizeof(metrics_t));
+    if (!metrics) {
+        return NULL;
+    }
+    MUTEX_CREATE(metrics->mutex);
+    return metrics;
+}
+
+void
+metrics_destroy(metrics_t *metrics)
+{
+    if (metrics) {
+        while (metrics->sessions) {
+            metrics_session_t *session = metrics->sessions;
+            metrics->sessions = session->next;
+            free(session);
+        }
+        MUTEX_DESTROY(metrics->mutex);
+        free(metrics);
+    }
+}
+
+metrics_session_t *
+metrics_session_open(metrics_t *metrics, int session_id)
+{
+    metrics_session_t *session, *closed = NULL;
+    assert(metrics);
+
+    MUTEX_LOCK(metrics->mutex);
+    for (session = metrics->sessions; session; session = session->next) {
+        if (session->refs > 0 && session->id == session_id) {
+            break;
+        }
+        if (session->refs == 0 && !closed) {
+            closed = session;
+        }
+    }
+    if (!session && closed) {
+        session = closed;
+        metrics_session_reset(session);
+    } else if (!session) {
+        session = calloc(1, sizeof(metrics_session_t));
+        if (session) {
+            session->metrics = metrics;
+            session->next = metrics->sessions;
+            metrics->sessions = session;
+        }
+    }
+    if (session) {
+        session->id = session_id;
+        session->refs++;
+    }
+    MUTEX_UNLOCK(metrics->mutex);
+    return session;
+}
+
+void
+metrics_session_close(metrics_session_t *session)
+{
+    if (session) {
+        MUTEX_LOCK(session->metrics->mutex);
+        assert(session->refs > 0);
+        session->refs--;
+        MUTEX_UNLOCK(session->metrics->mutex);
+    }
+}
+
+void
+metrics_set_timing(metrics_t *metrics, int enabled)
+{
+    assert(metrics);
+    METRICS_STORE(metrics->timing, enabled ? 1 : 0);
+}
+
+void
+metrics_count(metrics_session_t *session, metrics_counter_t counter, uint64_t value)
+{
+    if (session) {
+        METRICS_ADD(session->counters[counter], (int64_t) value);
+    }
+}
+
+void
+metrics_set(metrics_session_t *session, metrics_gauge_t gauge, int64_t value)
+{
+    if (session) {
+        METRICS_STORE(session->gauges[gauge], value);
+    }
+}
+
+void
+metrics_record(metrics_session_t *session, metrics_histogram_t histogram, int64_t value)
+{
+    if (session) {
+        metrics_histogram_data_t *data = &session->histograms[histogram];
+        if (value < 0) {
+            value = 0;
+        }
+        METRICS_ADD(data->buckets[metrics_bucket((uint64_t) value)], 1);
+        METRICS_ADD(data->sum, value);
+        METRICS_ADD(data->count, 1);
+    }
+}
+
+uint64_t
+metrics_stage_begin(metrics_session_t *session)
+{
+    if (!session || !METRICS_LOAD(session->metrics->timing)) {
+        return 0;
+    }
+    return trace_now();
+}
+
+void
+metrics_stage_end(metrics_session_t *session, metrics_histogram_t histogram, uint64_t start)
+{
+    if (start) {
+        metrics_record(session, histogram, (int64_t) ((trace_now() - start) / 1000));
+    }
+}
+
+int
+metrics_get_sessions(metrics_t *metrics, int *session_ids, int max)
+{
+    int count = 0;
+    assert(metrics);
+
+    MUTEX_LOCK(metrics->mutex);
+    for (metrics_session_t *session = metrics->sessions; session; session = session->next) {
+        if (session->refs > 0) {
+            if (count < max) {
+                session_ids[count] = session->id;
+            }
+            count++;
+        }
+    }
+    MUTEX_UNLOCK(metrics->mutex);
+    return count;
+}
+
+metrics_session_t *
+metrics_session_find(metrics_t *metrics, int session_id)
+{
+    metrics_session_t *session;
+    assert(metrics);
+
+    MUTEX_LOCK(metrics->mutex);
+    for (session = metrics->sessions; session; session = session->next) {
+        if (session->refs > 0 && session->id == session_id) {
+            break;
+        }
+    }
+    MUTEX_UNLOCK(metrics->mutex);
+    return session;
+}
+
+uint64_t
+metrics_get_counter(metrics_session_t *session, metrics_counter_t counter)
+{
+    assert(session);
+    return (uint64_t) METRICS_LOAD(session->counters[counter]);
+}
+
+int64_t
+metrics_get_gauge(metrics_session_t *session, metrics_gauge_t gauge)
+{
+    assert(session);
+    return METRICS_LOAD(session->gauges[gauge]);
+}
+
+uint64_t
+metrics_get_count(metrics_session_t *session, metrics_histogram_t histogram)
+{
+    assert(session);
+    return (uint64_t) METRICS_LOAD(session->histograms[histogram].count);
+}
+
+uint64_t
+metrics_get_percentile(metrics_session_t *session, metrics_histogram_t histogram, double fraction)
+{
+    metrics_histogram_data_t *data;
+    int64_t buckets[METRICS_BUCKETS];
+    int64_t count = 0;
+    assert(session);
+
+    /* the buckets are summed up again, count may be behind them while values are recorded */
+    data = &session->histograms[histogram];
+    for (int i = 0; i < METRICS_BUCKETS; i++) {
+        buckets[i] = METRICS_LOAD(data->buckets[i]);
+        count += buckets[i];
+    }
+    if (count == 0) {
+        return 0;
+    }
+    if (fraction < 0.0) fraction = 0.0;
+    if (fraction > 1.0) fraction = 1.0;
+    int64_t rank = (int64_t) (fraction * count + 0.5);
+    if (rank < 1) rank = 1;
+
+    int64_t seen = 0;
+    for (int i = 0; i < METRICS_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return metrics_bucket_max(i);
+        }
+    }
+    return METRICS_MAX_VALUE;
+}
+
+typedef struct metrics_text_s {
+    char *data;
+    int len;
+    int size;
+    int failed;
+} metrics_text_t;
+
+static void
+metrics_printf(metrics_text_t *text, const char *format, ...)
+{
+    va_list args;
+    while (!text->failed) {
+        int space = text->size - text->len;
+        va_start(args, format);
+        int n = vsnprintf(text->data + text->len, space, format, args);
+        va_end(args);
+        if (n >= 0 && n < space) {
+            text->len += n;
+            return;
+        }
+        int size = text->size * 2 + (n > 0 ? n : 0);
+        char *data = realloc(text->data, size);
+        if (!data) {
+            text->failed = 1;
+            return;
+        }
+        text->data = data;
+        text->size = size;
+    }
+}
+
+static void
+metrics_print_header(metrics_text_t *text, const metrics_desc_t *desc, const char *type)
+{
+    if (desc->help) {
+        metrics_printf(text, "# HELP %s %s\n", desc->name, desc->help);
+        metrics_printf(text, "# TYPE %s %s\n", desc->name, type);
+    }
+}
+
+static void
+metrics_print_value(metrics_text_t *text, const metrics_desc_t *desc, const char *suffix, int session_id,
+                    const char *extra, double value)
+{
+    metrics_printf(text, "%s%s{session=\"%d\"%s%s%s%s} %.10g\n", desc->name, suffix, session_id,
+                   desc->labels ? "," : "", desc->labels ? desc->labels : "",
+                   extra ? "," : "", extra ? extra : "", value);
+}
+
+static void
+metrics_print_histogram(metrics_text_t *text, const metrics_desc_t *desc, metrics_session_t *session,
+                        metrics_histogram_data_t *data)
+{
+    int64_t buckets[METRICS_BUCKETS];
+    int64_t count = 0;
+    int bucket = 0;
+    char le[32];
+
+    for (int i = 0; i < METRICS_BUCKETS; i++) {
+        buckets[i] = METRICS_LOAD(data->buckets[i]);
+        count += buckets[i];
+    }
+    if (count == 0) {
+        return;
+    }
+    /* each HDR bucket is counted under the first boundary at or above its largest value */
+    int64_t cumulative = 0;
+    for (int i = 0; i < (int) (sizeof(metrics_le) / sizeof(metrics_le[0])); i++) {
+        while (bucket < METRICS_BUCKETS && metrics_bucket_max(bucket) <= metrics_le[i]) {
+            cumulative += buckets[bucket++];
+        }
+        snprintf(le, sizeof(le), "le=\"%g\"", metrics_le[i] * desc->scale);
+        metrics_print_value(text, desc, "_bucket", session->id, le, (double) cumulative);
+    }
+    metrics_print_value(text, desc, "_bucket", session->id, "le=\"+Inf\"", (double) count);
+    metrics_print_value(text, desc, "_sum", session->id, NULL, METRICS_LOAD(data->sum) * desc->scale);
+    metrics_print_value(text, desc, "_count", session->id, NULL, (double) count);
+}
+
+char *
+metrics_format_prometheus(metrics_t *metrics, int *len)
+{
+    metrics_text_t text;
+    metrics_session_t *session;
+    assert(metrics);
+
+    memset(&text, 0, sizeof(text));
+    text.size = 16384;
+    text.data = malloc(text.size);
+    if (!text.data) {
+        return NULL;
+    }
+    text.data[0] = '\0';
+
+    MUTEX_LOCK(metrics->mutex);
+    for (int i = 0; i < METRICS_COUNTER_COUNT; i++) {
+        metrics_print_header(&text, &metrics_counter_descs[i], "counter");
+        for (session = metrics->sessions; session; session = session->next) {
+            if (session->refs > 0) {
+                metrics_print_value(&text, &metrics_counter_descs[i], "", session->id, NULL,
+                                    (double) METRICS_LOAD(session->counters[i]));
+            }
+        }
+    }
+    for (int i = 0; i < METRICS_GAUGE_COUNT; i++) {
+        metrics_print_header(&text, &metrics_gauge_descs[i], "gauge");
+        for (session = metrics->sessions; session; session = session->next) {
+            if (session->refs > 0) {
+                metrics_print_value(&text, &metrics_gauge_descs[i], "", session->id, NULL,
+                                    METRICS_LOAD(session->gauges[i]) * metrics_gauge_descs[i].scale);
+            }
+        }
+    }
+    for (int i = 0; i < METRICS_HISTOGRAM_COUNT; i++) {
+        metrics_print_header(&text, &metrics_histogram_descs[i], "histogram");
+        for (session = metrics->sessions; session; session = session->next) {
+            if (session->refs > 0) {
+                metrics_print_histogram(&text, &metrics_histogram_descs[i], session, &session->histograms[i]);
+            }
+        }
+    }
+    MUTEX_UNLOCK(metrics->mutex);
+
+    if (text.failed) {
+        free(text.data);
+        return NULL;
+    }
+    if (len) {
+        *len = text.len;
+    }
+    return text.data;
+}
@@ -0,0 +1,122 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * Metrics of the sessions: counters, gauges and latency histograms for the stages of the
+ * receive and render pipeline, read through the functions below or as Prometheus text
+ * (metrics_format_prometheus, served by raop_start_metrics).
+ *
+ * Updating a value takes no lock. Every value is a relaxed atomic, and each counter and
+ * histogram of a session is written by one thread (the strand of its stream, or a renderer
+ * thread), so the updates do not contend. Histograms are HDR-style: log-linear buckets with
+ * 8 sub-buckets per power of two, so any recorded value is known within 12.5%.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum metrics_counter_e {
+    METRICS_VIDEO_FRAMES,           /* video packets received */
+    METRICS_VIDEO_BYTES,
+    METRICS_VIDEO_DROPPED,          /* frames dropped for latency or skipped after corrupt data */
+    METRICS_VIDEO_CORRUPT,
+    METRICS_AUDIO_PACKETS,
+    METRICS_AUDIO_BYTES,
+    METRICS_AUDIO_RESEND_REQUESTS,  /* packets asked for again */
+    METRICS_AUDIO_RESENT,           /* packets the client sent again */
+    METRICS_NTP_REQUESTS,
+    METRICS_NTP_TIMEOUTS,
+    METRICS_VIDEO_DECODE_LEVEL_CHANGES,
+    METRICS_COUNTER_COUNT
+} metrics_counter_t;
+
+typedef enum metrics_gauge_e {
+    METRICS_NTP_DISPERSION,         /* us */
+    METRICS_NTP_DELAY,              /* us, round trip */
+    METRICS_AUDIO_QUEUE,            /* packets in the audio buffer */
+    METRICS_VIDEO_QUEUE,            /* access units waiting for the decoder */
+    METRICS_VIDEO_DECODE_LAG,       /* us, smoothed lag of decoded frames behind their timestamp */
+    METRICS_VIDEO_DECODE_LEVEL,     /* how far decoding is degraded to keep up, 0 = not at all */
+    METRICS_GAUGE_COUNT
+} metrics_gauge_t;
+
+typedef enum metrics_histogram_e {
+    /* time spent in a stage of the pipeline, us */
+    METRICS_VIDEO_RECEIVE,          /* from the first to the last byte of a packet */
+    METRICS_VIDEO_DECRYPT,
+    METRICS_VIDEO_ENQUEUE,          /* handing the frame to the renderer */
+    METRICS_VIDEO_DECODE,
+    METRICS_VIDEO_PRESENT,          /* uploading and showing a decoded frame */
+    METRICS_AUDIO_DECRYPT,
+    METRICS_AUDIO_ENQUEUE,
+    /* age of a frame relative to its timestamp from the client, us */
+    METRICS_VIDEO_LATENCY_RECEIVED,
+    METRICS_VIDEO_LATENCY_PRESENTED,
+    METRICS_HISTOGRAM_COUNT
+} metrics_histogram_t;
+
+typedef struct metrics_s metrics_t;
+typedef struct metrics_session_s metrics_session_t;
+
+metrics_t *metrics_init(void);
+/* All users of the sessions must be gone */
+void metrics_destroy(metrics_t *metrics);
+
+/**
+ * Get the metrics of a session, new ones if no open session has this id; every call must be
+ * matched by metrics_session_close. Closed sessions are not reported anymore and are reused
+ * for later ones, but stay valid memory until metrics_destroy.
+ */
+metrics_session_t *metrics_session_open(metrics_t *metrics, int session_id);
+void metrics_session_close(metrics_session_t *session);
+
+/* Whether the stages are timed (metrics_stage_begin); off until the metrics are served */
+void metrics_set_timing(metrics_t *metrics, int enabled);
+
+/* Updating: session may be NULL */
+void metrics_count(metrics_session_t *session, metrics_counter_t counter, uint64_t value);
+void metrics_set(metrics_session_t *session, metrics_gauge_t gauge, int64_t value);
+/* Negative values are recorded as 0 */
+void metrics_record(metrics_session_t *session, metrics_histogram_t histogram, int64_t value);
+
+/**
+ * Time a stage of the pipeline on a monotonic clock (trace_now): begin returns the start, or 0
+ * without reading the clock if stages are not timed, and end records the time since then (us)
+ * in histogram, if start is not 0.
+ */
+uint64_t metrics_stage_begin(metrics_session_t *session);
+void metrics_stage_end(metrics_session_t *session, metrics_histogram_t histogram, uint64_t start);
+
+/* Reading, for embedders: the ids of up to max open sessions; returns how many are open */
+int metrics_get_sessions(metrics_t *metrics, int *session_ids, int max);
+/* The open session with this id, or NULL */
+metrics_session_t *metrics_session_find(metrics_t *metrics, int session_id);
+uint64_t metrics_get_counter(metrics_session_t *session, metrics_counter_t counter);
+int64_t metrics_get_gauge(metrics_session_t *session, metrics_gauge_t gauge);
+uint64_t metrics_get_count(metrics_session_t *session, metrics_histogram_t histogram);
+/* A value (us) at or above the given fraction (0..1) of the recorded values, 0 if there are none */
+uint64_t metrics_get_percentile(metrics_session_t *session, metrics_histogram_t histogram, double fraction);
+
+/* All open sessions in the Prometheus text format, to be freed by the caller; NULL if out of memory */
+char *metrics_format_prometheus(metrics_t *metrics, int *len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //METRICS_H
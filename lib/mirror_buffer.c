@@ -90,6 +90,14 @@ mirror_buffer_init(logger_t *logger, const unsigned char *aeskey)
 void mirror_buffer_decrypt(mirror_buffer_t *mirror_buffer, unsigned char* input, unsigned char* output, int inputLen) {
     // Start decrypting
     if (mirror_buffer->nextDecryptCount > 0) {//mirror_buffer->nextDecryptCount = 10
+        if (inputLen < mirror_buffer->nextDecryptCount) {
+            // Input is too short to use up the keystream left over from the last call (incremental decryption)
+            for (int i = 0; i < inputLen; i++) {
+                output[i] = (input[i] ^ mirror_buffer->og[(16 - mirror_buffer->nextDecryptCount) + i]);
+            }
+            mirror_buffer->nextDecryptCount -= inputLen;
+            return;
+        }
         for (int i = 0; i < mirror_buffer->nextDecryptCount; i++) {
             output[i] = (input[i] ^ mirror_buffer->og[(16 - mirror_buffer->nextDecryptCount) + i]);
         }
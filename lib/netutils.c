@@ -18,6 +18,10 @@
 
 #include "compat.h"
 
+#ifndef WIN32
+#include <fcntl.h>
+#endif
+
 int
 netutils_init()
 {
@@ -164,6 +168,61 @@ netutils_init_socket(unsigned short *port, int use_ipv6, int use_udp)
     return -1;
 }
 
+int
+netutils_init_wake_socket()
+{
+    struct sockaddr_in saddr;
+    socklen_t socklen = sizeof(saddr);
+    int wake_fd;
+
+    wake_fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (wake_fd == -1) {
+        return -1;
+    }
+
+    /* Bind to an ephemeral loopback port and connect to it, so send and recv need no address */
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sin_family = AF_INET;
+    saddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(wake_fd, (struct sockaddr *)&saddr, sizeof(saddr)) == -1 ||
+        getsockname(wake_fd, (struct sockaddr *)&saddr, &socklen) == -1 ||
+        connect(wake_fd, (struct sockaddr *)&saddr, socklen) == -1) {
+        goto cleanup;
+    }
+
+#ifdef WIN32
+    u_long mode = 1;
+    if (ioctlsocket(wake_fd, FIONBIO, &mode) != 0) {
+        goto cleanup;
+    }
+#else
+    int flags = fcntl(wake_fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(wake_fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        goto cleanup;
+    }
+#endif
+    return wake_fd;
+
+    cleanup:
+    closesocket(wake_fd);
+    return -1;
+}
+
+void
+netutils_wake(int wake_fd)
+{
+    char value = 1;
+    /* if the socket buffer is full, a wake-up is already pending */
+    send(wake_fd, &value, 1, 0);
+}
+
+void
+netutils_drain_wake_socket(int wake_fd)
+{
+    char buffer[16];
+    while (recv(wake_fd, buffer, sizeof(buffer), 0) > 0);
+}
+
 // Src is the ip address
 int
 netutils_parse_address(int family, const char *src, void *dst, int dstlen)
@@ -22,4 +22,10 @@ int netutils_init_socket(unsigned short *port, int use_ipv6, int use_udp);
 unsigned char *netutils_get_address(void *sockaddr, int *length);
 int netutils_parse_address(int family, const char *src, void *dst, int dstlen);
 
+/* A non-blocking loopback UDP socket connected to itself: any thread can wake a select() or poll() *
+ * on it with netutils_wake, the waiting thread reads the wake-ups with netutils_drain_wake_socket */
+int netutils_init_wake_socket();
+void netutils_wake(int wake_fd);
+void netutils_drain_wake_socket(int wake_fd);
+
 #endif
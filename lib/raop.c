@@ -29,6 +29,9 @@
 #include "compat.h"
 #include "raop_rtp_mirror.h"
 #include "raop_ntp.h"
+#include "raop_capture.h"
+#include "reactor.h"
+#include "metrics.h"
 
 struct raop_s {
     /* Callbacks for audio and video */
@@ -41,6 +44,9 @@ struct raop_s {
     pairing_t *pairing;
     httpd_t *httpd;
 
+    /* Sockets and timers of the sessions of all connections */
+    reactor_t *reactor;
+
     dnssd_t *dnssd;
 
     /* local network ports */  
@@ -52,15 +58,30 @@ struct raop_s {
 
     /* configurable plist items: width, height, refreshRate, maxFPS, overscanned *
      * also clientFPSdata, which controls whether video stream info received     *
-     * from the client is shown on terminal monitor.                             */
+     * from the client is shown on terminal monitor, and nalHandoff, which hands *
+     * off each video NAL unit as soon as it is received (low-latency mode), and *
+     * avccPassthrough, which passes on video data without Annex-B rewriting,   *
+     * and maxVideoLatency (ms), beyond which late video frames are dropped.     */
     uint16_t width;
     uint16_t height;
     uint8_t refreshRate;
     uint8_t maxFPS;
     uint8_t overscanned;
     uint8_t clientFPSdata;
+    uint8_t nalHandoff;
+    uint8_t avccPassthrough;
+    int maxVideoLatency;
 
     int max_ntp_timeouts;
+
+    /* capture of the received streams, see raop_set_capture */
+    raop_capture_t *capture;
+
+    /* metrics of the sessions, served by metrics_httpd (see raop_start_metrics) */
+    metrics_t *metrics;
+    httpd_t *metrics_httpd;
+
+    int next_session_id;
 };
 
 struct raop_conn_s {
@@ -77,6 +98,10 @@ struct raop_conn_s {
     unsigned char *remote;
     int remotelen;
 
+    /* raop->callbacks, with cls set to the session returned by session_init */
+    raop_callbacks_t callbacks;
+    int session_id;
+    metrics_session_t *metrics;
 };
 typedef struct raop_conn_s raop_conn_t;
 
@@ -142,8 +167,20 @@ conn_init(void *opaque, unsigned char *local, int locallen, unsigned char *remot
     conn->locallen = locallen;
     conn->remotelen = remotelen;
 
-    if (raop->callbacks.conn_init) {
-        raop->callbacks.conn_init(raop->callbacks.cls);
+    memcpy(&conn->callbacks, &raop->callbacks, sizeof(raop_callbacks_t));
+    conn->session_id = ++raop->next_session_id;
+    /* opened before session_init, so that the renderers of the session can share it */
+    conn->metrics = metrics_session_open(raop->metrics, conn->session_id);
+    if (raop->callbacks.session_init) {
+        void *session = raop->callbacks.session_init(raop->callbacks.cls, conn->session_id, remote, remotelen);
+        if (session) {
+            conn->callbacks.cls = session;
+        }
+    }
+    logger_log(conn->raop->logger, LOGGER_INFO, "Session %d", conn->session_id);
+
+    if (conn->callbacks.conn_init) {
+        conn->callbacks.conn_init(conn->callbacks.cls);
     }
 
     return conn;
@@ -280,8 +317,8 @@ conn_request(void *ptr, http_request_t *request, http_response_t **response) {
 	    }
         }
         plist_free(req_root_node);
-        if (conn->raop->callbacks.conn_teardown) {
-             conn->raop->callbacks.conn_teardown(conn->raop->callbacks.cls, &teardown_96, &teardown_110);
+        if (conn->callbacks.conn_teardown) {
+             conn->callbacks.conn_teardown(conn->callbacks.cls, &teardown_96, &teardown_110);
         }
         logger_log(conn->raop->logger, LOGGER_DEBUG, "TEARDOWN request,  96=%d, 110=%d", teardown_96, teardown_110);
 
@@ -361,8 +398,8 @@ conn_destroy(void *ptr) {
 
     logger_log(conn->raop->logger, LOGGER_INFO, "Destroying connection");
 
-    if (conn->raop->callbacks.conn_destroy) {
-        conn->raop->callbacks.conn_destroy(conn->raop->callbacks.cls);
+    if (conn->callbacks.conn_destroy) {
+        conn->callbacks.conn_destroy(conn->callbacks.cls);
     }
 
     if (conn->raop_rtp) {
@@ -377,9 +414,13 @@ conn_destroy(void *ptr) {
         raop_ntp_destroy(conn->raop_ntp);
     }
 
-    if (conn->raop->callbacks.video_flush) {
-        conn->raop->callbacks.video_flush(conn->raop->callbacks.cls);
+    if (conn->callbacks.video_flush) {
+        conn->callbacks.video_flush(conn->callbacks.cls);
+    }
+    if (conn->raop->callbacks.session_destroy && conn->callbacks.cls != conn->raop->callbacks.cls) {
+        conn->raop->callbacks.session_destroy(conn->raop->callbacks.cls, conn->callbacks.cls);
     }
+    metrics_session_close(conn->metrics);
 
     free(conn->local);
     free(conn->remote);
@@ -438,6 +479,24 @@ raop_init(int max_clients, raop_callbacks_t *callbacks) {
         free(raop);
         return NULL;
     }
+
+    /* Initialize the reactor, with one worker per CPU */
+    raop->reactor = reactor_init(raop->logger, 0);
+    if (!raop->reactor) {
+        httpd_destroy(httpd);
+        pairing_destroy(pairing);
+        free(raop);
+        return NULL;
+    }
+
+    raop->metrics = metrics_init();
+    if (!raop->metrics) {
+        reactor_destroy(raop->reactor);
+        httpd_destroy(httpd);
+        pairing_destroy(pairing);
+        free(raop);
+        return NULL;
+    }
     /* Copy callbacks structure */
     memcpy(&raop->callbacks, callbacks, sizeof(raop_callbacks_t));
     raop->pairing = pairing;
@@ -460,6 +519,15 @@ raop_init(int max_clients, raop_callbacks_t *callbacks) {
     /* initialize switch for display of client's streaming data records */    
     raop->clientFPSdata = 0;
 
+    /* initialize switch for early hand-off of completed NAL units */
+    raop->nalHandoff = 0;
+
+    /* initialize switch for AVCC pass-through of video data */
+    raop->avccPassthrough = 0;
+
+    /* initialize latency budget for dropping late video frames (0: never drop) */
+    raop->maxVideoLatency = 0;
+
     raop->max_ntp_timeouts = 0;
 
     return raop;
@@ -469,8 +537,12 @@ void
 raop_destroy(raop_t *raop) {
     if (raop) {
         raop_stop(raop);
+        raop_capture_close(raop->capture);
         pairing_destroy(raop->pairing);
         httpd_destroy(raop->httpd);
+        httpd_destroy(raop->metrics_httpd);
+        metrics_destroy(raop->metrics);
+        reactor_destroy(raop->reactor);
         logger_destroy(raop->logger);
         free(raop);
 
@@ -516,6 +588,15 @@ int raop_set_plist(raop_t *raop, const char *plist_item, const int value) {
     } else if (strcmp(plist_item, "clientFPSdata") == 0) {
         raop->clientFPSdata = (value ? 1 : 0);
         if ((int) raop->clientFPSdata  != value) retval = 1;
+    } else if (strcmp(plist_item, "nalHandoff") == 0) {
+        raop->nalHandoff = (value ? 1 : 0);
+        if ((int) raop->nalHandoff  != value) retval = 1;
+    } else if (strcmp(plist_item, "avccPassthrough") == 0) {
+        raop->avccPassthrough = (value ? 1 : 0);
+        if ((int) raop->avccPassthrough  != value) retval = 1;
+    } else if (strcmp(plist_item, "maxVideoLatency") == 0) {
+        raop->maxVideoLatency = (value > 0 ? value : 0);
+        if (raop->maxVideoLatency != value) retval = 1;
     } else if (strcmp(plist_item, "max_ntp_timeouts") == 0) {
         raop->max_ntp_timeouts = (value > 0 ? value : 0);
         if (raop->max_ntp_timeouts != value) retval = 1;
@@ -571,11 +652,24 @@ raop_set_dnssd(raop_t *raop, dnssd_t *dnssd) {
     raop->dnssd = dnssd;
 }
 
+int
+raop_set_capture(raop_t *raop, const char *path) {
+    assert(raop);
+    assert(path);
+    raop_capture_close(raop->capture);
+    raop->capture = raop_capture_open(raop->logger, path);
+    return raop->capture ? 0 : -1;
+}
+
 
 int
 raop_start(raop_t *raop, unsigned short *port) {
     assert(raop);
     assert(port);
+#ifdef RAOP_TEST_KEY_EXCHANGE
+    logger_log(raop->logger, LOGGER_WARNING, "Built with TEST_KEY_EXCHANGE: unencrypted session keys are accepted, "
+               "do not use this build as a receiver");
+#endif
     return httpd_start(raop->httpd, port);
 }
 
@@ -583,4 +677,79 @@ void
 raop_stop(raop_t *raop) {
     assert(raop);
     httpd_stop(raop->httpd);
+    if (raop->metrics_httpd) {
+        httpd_stop(raop->metrics_httpd);
+    }
+}
+
+metrics_t *
+raop_get_metrics(raop_t *raop) {
+    assert(raop);
+    return raop->metrics;
+}
+
+/* Metrics server: only answers GET /metrics, and only to the local host */
+static void *
+metrics_conn_init(void *opaque, unsigned char *local, int locallen, unsigned char *remote, int remotelen) {
+    raop_t *raop = opaque;
+    const unsigned char loopback6[16] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 };
+    if ((remotelen == 4 && remote[0] == 127) || (remotelen == 16 && !memcmp(remote, loopback6, 16))) {
+        return raop;
+    }
+    logger_log(raop->logger, LOGGER_WARNING, "metrics: refusing connection from another host");
+    return NULL;
+}
+
+static void
+metrics_conn_request(void *ptr, http_request_t *request, http_response_t **response) {
+    raop_t *raop = ptr;
+    const char *method = http_request_get_method(request);
+    const char *url = http_request_get_url(request);
+
+    if (method && url && !strcmp(method, "GET") && !strcmp(url, "/metrics")) {
+        int len = 0;
+        char *text = metrics_format_prometheus(raop->metrics, &len);
+        if (text) {
+            *response = http_response_init("HTTP/1.1", 200, "OK");
+            http_response_add_header(*response, "Content-Type", "text/plain; version=0.0.4");
+            http_response_finish(*response, text, len);
+            free(text);
+        } else {
+            *response = http_response_init("HTTP/1.1", 500, "Internal Server Error");
+            http_response_finish(*response, NULL, 0);
+        }
+    } else {
+        *response = http_response_init("HTTP/1.1", 404, "Not Found");
+        http_response_finish(*response, NULL, 0);
+    }
+    http_response_set_disconnect(*response, 1);
+}
+
+static void
+metrics_conn_destroy(void *ptr) {
+}
+
+int
+raop_start_metrics(raop_t *raop, unsigned short *port) {
+    httpd_callbacks_t httpd_cbs;
+
+    assert(raop);
+    assert(port);
+    if (!raop->metrics_httpd) {
+        memset(&httpd_cbs, 0, sizeof(httpd_cbs));
+        httpd_cbs.opaque = raop;
+        httpd_cbs.conn_init = &metrics_conn_init;
+        httpd_cbs.conn_request = &metrics_conn_request;
+        httpd_cbs.conn_destroy = &metrics_conn_destroy;
+        raop->metrics_httpd = httpd_init(raop->logger, &httpd_cbs, 4);
+        if (!raop->metrics_httpd) {
+            return -1;
+        }
+    }
+    int ret = httpd_start(raop->metrics_httpd, port);
+    if (ret > 0) {
+        metrics_set_timing(raop->metrics, 1);
+        logger_log(raop->logger, LOGGER_INFO, "metrics: serving http://127.0.0.1:%u/metrics", *port);
+    }
+    return ret;
 }
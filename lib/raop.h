@@ -4,6 +4,7 @@
 #include "dnssd.h"
 #include "stream.h"
 #include "raop_ntp.h"
+#include "metrics.h"
 
 #if defined (WIN32) && defined(DLL_EXPORT)
 # define RAOP_API __declspec(dllexport)
@@ -51,9 +52,22 @@ struct raop_callbacks_s {
     void  (*audio_set_progress)(void *cls, unsigned int start, unsigned int curr, unsigned int end);
     void  (*audio_get_format)(void *cls, unsigned char *ct, unsigned short *spf, bool *usingScreen, bool *isMedia, uint64_t *audioFormat);
     void  (*video_report_size)(void *cls, float *width_source, float *height_source, float *width, float *height);
+    /* Low-latency mode: receives NAL units as they complete, instead of video_process  *
+     * receiving the whole access unit. Only used if the "nalHandoff" plist item is set */
+    void  (*video_process_nal)(void *cls, raop_ntp_t *ntp, h264_nal_struct *data);
+    /* AVCC pass-through: receives the parameter sets, which are then no longer        *
+     * prepended to the video data. Only used if the "avccPassthrough" plist item is set */
+    void  (*video_configure)(void *cls, raop_ntp_t *ntp, h264_config_struct *data);
+    void  (*video_format_changed)(void *cls, raop_ntp_t *ntp, h264_format_struct *format);
+    /* Multiple sessions: called for every new client connection, before conn_init. The returned   *
+     * pointer is passed as cls to all other callbacks of that connection (NULL: cls is kept), so  *
+     * each connection can have its own renderers. session_destroy is called with it when the      *
+     * connection is closed, after its streams have been stopped and the last callback returned.   */
+    void* (*session_init)(void *cls, int session_id, const unsigned char *remote, int remote_len);
+    void  (*session_destroy)(void *cls, void *session);
 };
 typedef struct raop_callbacks_s raop_callbacks_t;
-raop_ntp_t *raop_ntp_init(logger_t *logger, raop_callbacks_t *callbacks, const unsigned char *remote_addr, int remote_addr_len, unsigned short timing_rport);
+raop_ntp_t *raop_ntp_init(logger_t *logger, raop_callbacks_t *callbacks, reactor_t *reactor, const unsigned char *remote_addr, int remote_addr_len, unsigned short timing_rport);
   
 RAOP_API raop_t *raop_init(int max_clients, raop_callbacks_t *callbacks);
 RAOP_API void raop_set_log_level(raop_t *raop, int level);
@@ -68,6 +82,11 @@ RAOP_API int raop_start(raop_t *raop, unsigned short *port);
 RAOP_API int raop_is_running(raop_t *raop);
 RAOP_API void raop_stop(raop_t *raop);
 RAOP_API void raop_set_dnssd(raop_t *raop, dnssd_t *dnssd);
+RAOP_API int raop_set_capture(raop_t *raop, const char *path);
+/* Metrics of the sessions, see metrics.h; raop_start_metrics serves them as Prometheus text *
+ * at http://127.0.0.1:port/metrics (port 0: any free port, returned in port)                */
+RAOP_API metrics_t *raop_get_metrics(raop_t *raop);
+RAOP_API int raop_start_metrics(raop_t *raop, unsigned short *port);
 RAOP_API void raop_destroy(raop_t *raop);
 
 #ifdef __cplusplus
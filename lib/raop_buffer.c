@@ -42,7 +42,7 @@ typedef struct {
 
     /* Payload data */
     unsigned int payload_size;
-    void *payload_data;
+    refbuf_t *payload_data;
 } raop_buffer_entry_t;
 
 struct raop_buffer_s {
@@ -100,7 +100,7 @@ raop_buffer_destroy(raop_buffer_t *raop_buffer)
     for (int i = 0; i < RAOP_BUFFER_LENGTH; i++) {
         raop_buffer_entry_t *entry = &raop_buffer->entries[i];
         if (entry->payload_data != NULL) {
-            free(entry->payload_data);
+            refbuf_unref(entry->payload_data);
         }
     }
 
@@ -251,10 +251,15 @@ raop_buffer_enqueue(raop_buffer_t *raop_buffer, unsigned char *data, unsigned sh
     entry->timestamp = timestamp;
     entry->filled = 1;
 
-    entry->payload_data = malloc(payload_size);
-    int decrypt_ret = raop_buffer_decrypt(raop_buffer, data, entry->payload_data, payload_size, &entry->payload_size);
+    /* refcounted, so that the renderer can keep the payload without copying it */
+    refbuf_unref(entry->payload_data);
+    entry->payload_data = refbuf_alloc(payload_size);
+    int decrypt_ret = raop_buffer_decrypt(raop_buffer, data, entry->payload_data->data, payload_size, &entry->payload_size);
     assert(decrypt_ret >= 0);
     assert(entry->payload_size <= payload_size);
+    entry->payload_data->size = entry->payload_size;
+    /* the decrypted payload can be shorter: the padding after it has to be zero again */
+    memset(entry->payload_data->data + entry->payload_size, 0, REFBUF_PADDING);
 
     /* Update the raop_buffer seqnums */
     if (raop_buffer->is_empty) {
@@ -268,7 +273,7 @@ raop_buffer_enqueue(raop_buffer_t *raop_buffer, unsigned char *data, unsigned sh
     return 1;
 }
 
-void *
+refbuf_t *
 raop_buffer_dequeue(raop_buffer_t *raop_buffer, unsigned int *length, uint64_t *timestamp, unsigned short *seqnum, int no_resend) {
     assert(raop_buffer);
 
@@ -305,7 +310,7 @@ raop_buffer_dequeue(raop_buffer_t *raop_buffer, unsigned int *length, uint64_t *
     *seqnum = entry->seqnum;
     *length = entry->payload_size;
     entry->payload_size = 0;
-    void* data = entry->payload_data;
+    refbuf_t *data = entry->payload_data;
     entry->payload_data = NULL;
     return data;
 }
@@ -332,12 +337,23 @@ void raop_buffer_handle_resends(raop_buffer_t *raop_buffer, raop_resend_cb_t res
     }
 }
 
+int
+raop_buffer_get_depth(raop_buffer_t *raop_buffer) {
+    assert(raop_buffer);
+
+    if (raop_buffer->is_empty) {
+        return 0;
+    }
+    int depth = seqnum_cmp(raop_buffer->last_seqnum, raop_buffer->first_seqnum) + 1;
+    return depth > 0 ? depth : 0;
+}
+
 void raop_buffer_flush(raop_buffer_t *raop_buffer, int next_seq) {
     assert(raop_buffer);
 
     for (int i = 0; i < RAOP_BUFFER_LENGTH; i++) {
         if (raop_buffer->entries[i].payload_data) {
-            free(raop_buffer->entries[i].payload_data);
+            refbuf_unref(raop_buffer->entries[i].payload_data);
             raop_buffer->entries[i].payload_data = NULL;   
             raop_buffer->entries[i].payload_size = 0;
         }
@@ -17,6 +17,7 @@
 
 #include "logger.h"
 #include "raop_rtp.h"
+#include "refbuf.h"
 
 typedef struct raop_buffer_s raop_buffer_t;
 
@@ -26,9 +27,11 @@ raop_buffer_t *raop_buffer_init(logger_t *logger,
                                 const unsigned char *aeskey,
                                 const unsigned char *aesiv);
 int raop_buffer_enqueue(raop_buffer_t *raop_buffer, unsigned char *data, unsigned short datalen, uint64_t timestamp, int use_seqnum);
-void *raop_buffer_dequeue(raop_buffer_t *raop_buffer, unsigned int *length, uint64_t *timestamp,  unsigned short *seqnum, int no_resend);
+refbuf_t *raop_buffer_dequeue(raop_buffer_t *raop_buffer, unsigned int *length, uint64_t *timestamp,  unsigned short *seqnum, int no_resend);
 void raop_buffer_handle_resends(raop_buffer_t *raop_buffer, raop_resend_cb_t resend_cb, void *opaque);
 void raop_buffer_flush(raop_buffer_t *raop_buffer, int next_seq);
+/* Number of packets between the oldest and the newest one buffered */
+int raop_buffer_get_depth(raop_buffer_t *raop_buffer);
 
 int raop_buffer_decrypt(raop_buffer_t *raop_buffer, unsigned char *data, unsigned char* output,
                         unsigned int datalen, unsigned int *outputlen);
@@ -0,0 +1,137 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "raop_capture.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "raop_ntp.h"
+#include "threads.h"
+
+#define SEC 1000000
+
+struct raop_capture_s {
+    logger_t *logger;
+    FILE *file;
+    mutex_handle_t mutex;
+
+    uint64_t offset;            /* of the next record */
+    uint64_t last_index_time;
+    unsigned char *index;       /* { time, offset } pairs */
+    int index_count;
+    int index_size;
+    int records;
+};
+
+static void
+raop_capture_put_le(unsigned char *b, uint64_t value, int len)
+{
+    for (int i = 0; i < len; i++) {
+        b[i] = (unsigned char) (value >> (8 * i));
+    }
+}
+
+static void
+raop_capture_write_record(raop_capture_t *capture, uint64_t time, int session_id, int type,
+                          const unsigned char *data, int len)
+{
+    unsigned char header[RAOP_CAPTURE_RECORD_LEN];
+    raop_capture_put_le(header, time, 8);
+    header[8] = (unsigned char) type;
+    header[9] = header[10] = header[11] = 0;
+    raop_capture_put_le(header + 12, (uint32_t) session_id, 4);
+    raop_capture_put_le(header + 16, (uint32_t) len, 4);
+    fwrite(header, RAOP_CAPTURE_RECORD_LEN, 1, capture->file);
+    if (len > 0) {
+        fwrite(data, len, 1, capture->file);
+    }
+    capture->offset += RAOP_CAPTURE_RECORD_LEN + len;
+    capture->records++;
+}
+
+raop_capture_t *
+raop_capture_open(logger_t *logger, const char *path)
+{
+    raop_capture_t *capture = calloc(1, sizeof(raop_capture_t));
+    if (!capture) {
+        return NULL;
+    }
+    capture->logger = logger;
+    capture->file = fopen(path, "wb");
+    if (!capture->file) {
+        logger_log(logger, LOGGER_ERR, "raop_capture: could not open %s", path);
+        free(capture);
+        return NULL;
+    }
+    unsigned char header[RAOP_CAPTURE_HEADER_LEN];
+    memcpy(header, "RAOPCAP", 8);
+    raop_capture_put_le(header + 8, RAOP_CAPTURE_VERSION, 4);
+    fwrite(header, RAOP_CAPTURE_HEADER_LEN, 1, capture->file);
+    capture->offset = RAOP_CAPTURE_HEADER_LEN;
+    MUTEX_CREATE(capture->mutex);
+    logger_log(logger, LOGGER_INFO, "raop_capture: capturing received streams and session keys to %s", path);
+    return capture;
+}
+
+void
+raop_capture_write(raop_capture_t *capture, int session_id, int type, const unsigned char *data, int len)
+{
+    if (!capture) {
+        return;
+    }
+    uint64_t time = raop_ntp_get_local_time(NULL);
+    MUTEX_LOCK(capture->mutex);
+    if (capture->index_count == 0 || time >= capture->last_index_time + SEC) {
+        if (capture->index_count == capture->index_size) {
+            int size = capture->index_size ? capture->index_size * 2 : 256;
+            unsigned char *index = realloc(capture->index, size * 16);
+            if (index) {
+                capture->index = index;
+                capture->index_size = size;
+            }
+        }
+        if (capture->index_count < capture->index_size) {
+            raop_capture_put_le(capture->index + capture->index_count * 16, time, 8);
+            raop_capture_put_le(capture->index + capture->index_count * 16 + 8, capture->offset, 8);
+            capture->index_count++;
+            capture->last_index_time = time;
+        }
+    }
+    raop_capture_write_record(capture, time, session_id, type, data, len);
+    MUTEX_UNLOCK(capture->mutex);
+}
+
+void
+raop_capture_close(raop_capture_t *capture)
+{
+    if (!capture) {
+        return;
+    }
+    MUTEX_LOCK(capture->mutex);
+    uint64_t index_offset = capture->offset;
+    raop_capture_write_record(capture, raop_ntp_get_local_time(NULL), 0, RAOP_CAPTURE_INDEX,
+                              capture->index, capture->index_count * 16);
+    unsigned char footer[RAOP_CAPTURE_FOOTER_LEN];
+    memcpy(footer, "RAOPIDX", 8);
+    raop_capture_put_le(footer + 8, index_offset, 8);
+    fwrite(footer, RAOP_CAPTURE_FOOTER_LEN, 1, capture->file);
+    fclose(capture->file);
+    logger_log(capture->logger, LOGGER_INFO, "raop_capture: %d records, %llu bytes captured", capture->records - 1,
+               (unsigned long long) capture->offset);
+    MUTEX_UNLOCK(capture->mutex);
+    MUTEX_DESTROY(capture->mutex);
+    free(capture->index);
+    free(capture);
+}
@@ -0,0 +1,58 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * Capture of the raw (still encrypted) mirror and audio streams with their arrival times and
+ * the session keys, so that a session can be replayed without a client (bench/raop_replay.c).
+ * With several connections (-ms), the records of their sessions are interleaved; each record
+ * carries the id of its session (conn->session_id, 0 for the index).
+ *
+ * File layout, all numbers little endian:
+ *   header:  "RAOPCAP" '\0', uint32 version
+ *   records: uint64 time (local us), uint8 type, 3 reserved bytes, uint32 session id,
+ *            uint32 length, data
+ *   an index record (RAOP_CAPTURE_INDEX) of { uint64 time, uint64 file offset } pairs,
+ *   one for the first record of every second
+ *   footer:  "RAOPIDX" '\0', uint64 file offset of the index record
+ */
+
+#ifndef RAOP_CAPTURE_H
+#define RAOP_CAPTURE_H
+
+#include <stdint.h>
+#include "logger.h"
+
+#define RAOP_CAPTURE_VERSION 2
+#define RAOP_CAPTURE_HEADER_LEN 12
+#define RAOP_CAPTURE_RECORD_LEN 20
+#define RAOP_CAPTURE_FOOTER_LEN 16
+
+/* record types */
+#define RAOP_CAPTURE_SESSION       1   /* aeskey (16 bytes, as used for decryption), aesiv (16 bytes) */
+#define RAOP_CAPTURE_MIRROR_SETUP  2   /* streamConnectionID (uint64) */
+#define RAOP_CAPTURE_AUDIO_SETUP   3   /* ct (1 byte) */
+#define RAOP_CAPTURE_MIRROR        4   /* bytes of the TCP mirror stream, as returned by recv */
+#define RAOP_CAPTURE_AUDIO_DATA    5   /* UDP audio data datagram */
+#define RAOP_CAPTURE_AUDIO_CONTROL 6   /* UDP audio control datagram */
+#define RAOP_CAPTURE_INDEX         7
+
+typedef struct raop_capture_s raop_capture_t;
+
+raop_capture_t *raop_capture_open(logger_t *logger, const char *path);
+
+/* Writes the index and closes the file */
+void raop_capture_close(raop_capture_t *capture);
+
+/* Append a record of a session, stamped with the current local time; may be called from any thread */
+void raop_capture_write(raop_capture_t *capture, int session_id, int type, const unsigned char *data, int len);
+
+#endif //RAOP_CAPTURE_H
@@ -379,7 +379,16 @@ raop_handler_setup(raop_conn_t *conn,
         logger_log(conn->raop->logger, LOGGER_DEBUG, "ekey:\n%s", str);
         free (str);
 
-        int ret = fairplay_decrypt(conn->fairplay, (unsigned char*) eaeskey, aeskey);
+        int ret;
+#ifdef RAOP_TEST_KEY_EXCHANGE
+        if (ekey_len == 72 && !memcmp(eaeskey, RAOP_TEST_EKEY_TAG, sizeof(RAOP_TEST_EKEY_TAG))) {
+            /* test builds only: the loopback sender (bench/raop_sender.c) sends the key in the clear */
+            logger_log(conn->raop->logger, LOGGER_WARNING, "Test sender: plaintext AES key accepted without FairPlay");
+            memcpy(aeskey, eaeskey + 16, 16);
+            ret = 0;
+        } else
+#endif
+        ret = fairplay_decrypt(conn->fairplay, (unsigned char*) eaeskey, aeskey);
         logger_log(conn->raop->logger, LOGGER_DEBUG, "fairplay_decrypt ret = %d", ret);
         str = utils_data_to_string(aeskey, 16, 16);
         logger_log(conn->raop->logger, LOGGER_DEBUG, "16 byte aeskey (fairplay-decrypted from ekey):\n%s", str);
@@ -420,11 +429,23 @@ raop_handler_setup(raop_conn_t *conn,
         logger_log(conn->raop->logger, LOGGER_DEBUG, "timing_rport = %llu", timing_rport);
 
         unsigned short timing_lport = conn->raop->timing_lport;
-        conn->raop_ntp = raop_ntp_init(conn->raop->logger, &conn->raop->callbacks, conn->remote, conn->remotelen, timing_rport);
+        conn->raop_ntp = raop_ntp_init(conn->raop->logger, &conn->callbacks, conn->raop->reactor, conn->remote, conn->remotelen, timing_rport);
+        raop_ntp_set_metrics(conn->raop_ntp, conn->metrics);
         raop_ntp_start(conn->raop_ntp, &timing_lport, conn->raop->max_ntp_timeouts);
 
-        conn->raop_rtp = raop_rtp_init(conn->raop->logger, &conn->raop->callbacks, conn->raop_ntp, conn->remote, conn->remotelen, aeskey, aesiv);
-        conn->raop_rtp_mirror = raop_rtp_mirror_init(conn->raop->logger, &conn->raop->callbacks, conn->raop_ntp, conn->remote, conn->remotelen, aeskey);
+        conn->raop_rtp = raop_rtp_init(conn->raop->logger, &conn->callbacks, conn->raop->reactor, conn->raop_ntp, conn->remote, conn->remotelen, aeskey, aesiv);
+        conn->raop_rtp_mirror = raop_rtp_mirror_init(conn->raop->logger, &conn->callbacks, conn->raop->reactor, conn->raop_ntp, conn->remote, conn->remotelen, aeskey);
+        if (conn->raop_rtp) raop_rtp_set_metrics(conn->raop_rtp, conn->metrics);
+        if (conn->raop_rtp_mirror) raop_rtp_mirror_set_metrics(conn->raop_rtp_mirror, conn->metrics);
+
+        if (conn->raop->capture) {
+            unsigned char keys[RAOP_AESKEY_LEN + RAOP_AESIV_LEN];
+            memcpy(keys, aeskey, RAOP_AESKEY_LEN);
+            memcpy(keys + RAOP_AESKEY_LEN, aesiv, RAOP_AESIV_LEN);
+            raop_capture_write(conn->raop->capture, conn->session_id, RAOP_CAPTURE_SESSION, keys, sizeof(keys));
+            if (conn->raop_rtp) raop_rtp_set_capture(conn->raop_rtp, conn->raop->capture, conn->session_id);
+            if (conn->raop_rtp_mirror) raop_rtp_mirror_set_capture(conn->raop_rtp_mirror, conn->raop->capture, conn->session_id);
+        }
 
         plist_t res_event_port_node = plist_new_uint(conn->raop->port);
         plist_t res_timing_port_node = plist_new_uint(timing_lport);
@@ -456,9 +477,19 @@ raop_handler_setup(raop_conn_t *conn,
                     plist_get_uint_val(stream_id_node, &stream_connection_id);
                     logger_log(conn->raop->logger, LOGGER_DEBUG, "streamConnectionID (needed for AES-CTR video decryption key and iv): %llu", stream_connection_id);
 
+                    if (conn->raop->capture) {
+                        unsigned char id[8];
+                        for (int j = 0; j < 8; j++) {
+                            id[j] = (unsigned char) (stream_connection_id >> (8 * j));
+                        }
+                        raop_capture_write(conn->raop->capture, conn->session_id, RAOP_CAPTURE_MIRROR_SETUP, id, sizeof(id));
+                    }
+
                     if (conn->raop_rtp_mirror) {
                         raop_rtp_init_mirror_aes(conn->raop_rtp_mirror, &stream_connection_id);
-                        raop_rtp_start_mirror(conn->raop_rtp_mirror, use_udp, &dport, conn->raop->clientFPSdata);
+                        raop_rtp_start_mirror(conn->raop_rtp_mirror, use_udp, &dport, conn->raop->clientFPSdata,
+                                              conn->raop->nalHandoff, conn->raop->avccPassthrough,
+                                              conn->raop->maxVideoLatency);
                         logger_log(conn->raop->logger, LOGGER_DEBUG, "Mirroring initialized successfully");
                     } else {
                         logger_log(conn->raop->logger, LOGGER_ERR, "Mirroring not initialized at SETUP, playing will fail!");
@@ -487,7 +518,7 @@ raop_handler_setup(raop_conn_t *conn,
                     plist_get_uint_val(req_stream_ct_node, &uint_val);
                     ct = (unsigned char) uint_val;
 
-                    if (conn->raop->callbacks.audio_get_format) {
+                    if (conn->callbacks.audio_get_format) {
 		        /* get additional audio format parameters  */
                         uint64_t audioFormat;
                         unsigned short spf;
@@ -518,9 +549,10 @@ raop_handler_setup(raop_conn_t *conn,
                             usingScreen = false;
                         }
 
-                        conn->raop->callbacks.audio_get_format(conn->raop->callbacks.cls, &ct, &spf, &usingScreen, &isMedia, &audioFormat);
+                        conn->callbacks.audio_get_format(conn->callbacks.cls, &ct, &spf, &usingScreen, &isMedia, &audioFormat);
                     }
 
+                    raop_capture_write(conn->raop->capture, conn->session_id, RAOP_CAPTURE_AUDIO_SETUP, &ct, 1);
                     if (conn->raop_rtp) {
                         raop_rtp_start_audio(conn->raop_rtp, use_udp, remote_cport, &cport, &dport, ct);
                         logger_log(conn->raop->logger, LOGGER_DEBUG, "RAOP initialized success");
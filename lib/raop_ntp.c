@@ -27,6 +27,7 @@
 #include "netutils.h"
 #include "byteutils.h"
 #include "utils.h"
+#include "reactor.h"
 
 #define RAOP_NTP_DATA_COUNT   8
 #define RAOP_NTP_PHI_PPM   15ull                   // PPM
@@ -37,6 +38,9 @@
 
 #define RAOP_NTP_CLOCK_BASE (2208988800ull << 32)
 
+#define RAOP_NTP_INTERVAL 3000   // ms between requests
+#define RAOP_NTP_TIMEOUT  300    // ms to wait for a response
+
 typedef struct raop_ntp_data_s {
     uint64_t time; // The local wall clock time at time of ntp packet arrival
     uint64_t dispersion;
@@ -50,11 +54,17 @@ struct raop_ntp_s {
 
     int max_ntp_timeouts;
 
-    thread_handle_t thread;
+    // Requests are sent and responses received on the reactor
+    reactor_t *reactor;
+    reactor_strand_t *strand;
+    reactor_source_t *source;
     mutex_handle_t run_mutex;
 
-    mutex_handle_t wait_mutex;
-    cond_handle_t wait_cond;
+    // Request state, only used on the strand
+    unsigned char request[32];
+    uint64_t send_time;
+    bool waiting;
+    int timeout_counter;
 
     raop_ntp_data_t data[RAOP_NTP_DATA_COUNT];
     int data_index;
@@ -65,6 +75,9 @@ struct raop_ntp_s {
     int64_t sync_dispersion;
     int64_t sync_delay;
 
+    // Optional metrics of the session, only updated on the strand
+    metrics_session_t *metrics;
+
     // Socket address of the AirPlay client
     struct sockaddr_storage remote_saddr;
     socklen_t remote_saddr_len;
@@ -76,9 +89,8 @@ struct raop_ntp_s {
     unsigned short timing_lport;
 
     /* MUTEX LOCKED VARIABLES START */
-    /* These variables only edited mutex locked */
-    int running;
-    int joined;
+    /* These variables only edited mutex locked; running is also read without it by the handler */
+    long running;
 
     // UDP socket
     int tsock;
@@ -129,12 +141,13 @@ raop_ntp_parse_remote_address(raop_ntp_t *raop_ntp, const unsigned char *remote_
     return 0;
 }
 
-raop_ntp_t *raop_ntp_init(logger_t *logger, raop_callbacks_t *callbacks, const unsigned char *remote_addr,
+raop_ntp_t *raop_ntp_init(logger_t *logger, raop_callbacks_t *callbacks, reactor_t *reactor, const unsigned char *remote_addr,
                           int remote_addr_len, unsigned short timing_rport) {
     raop_ntp_t *raop_ntp;
 
     assert(logger);
     assert(callbacks);
+    assert(reactor);
 
     raop_ntp = calloc(1, sizeof(raop_ntp_t));
     if (!raop_ntp) {
@@ -143,17 +156,26 @@ raop_ntp_t *raop_ntp_init(logger_t *logger, raop_callbacks_t *callbacks, const u
     raop_ntp->logger = logger;
     memcpy(&raop_ntp->callbacks, callbacks, sizeof(raop_callbacks_t));    
     raop_ntp->timing_rport = timing_rport;
+    raop_ntp->reactor = reactor;
 
     if (raop_ntp_parse_remote_address(raop_ntp, remote_addr, remote_addr_len) < 0) {
         free(raop_ntp);
         return NULL;
     }
+    raop_ntp->strand = reactor_strand_init(reactor);
+    if (!raop_ntp->strand) {
+        free(raop_ntp);
+        return NULL;
+    }
 
     // Set port on the remote address struct
     ((struct sockaddr_in *) &raop_ntp->remote_saddr)->sin_port = htons(timing_rport);
 
     raop_ntp->running = 0;
-    raop_ntp->joined = 1;
+    raop_ntp->tsock = -1;
+    raop_ntp->request[0] = 0x80;
+    raop_ntp->request[1] = 0xd2;
+    raop_ntp->request[3] = 0x07;
 
     uint64_t time = raop_ntp_get_local_time(raop_ntp);
 
@@ -169,8 +191,6 @@ raop_ntp_t *raop_ntp_init(logger_t *logger, raop_callbacks_t *callbacks, const u
     raop_ntp->sync_offset = 0;
 
     MUTEX_CREATE(raop_ntp->run_mutex);
-    MUTEX_CREATE(raop_ntp->wait_mutex);
-    COND_CREATE(raop_ntp->wait_cond);
     MUTEX_CREATE(raop_ntp->sync_params_mutex);
     return raop_ntp;
 }
@@ -180,9 +200,8 @@ raop_ntp_destroy(raop_ntp_t *raop_ntp)
 {
     if (raop_ntp) {
         raop_ntp_stop(raop_ntp);
+        reactor_strand_destroy(raop_ntp->strand);
         MUTEX_DESTROY(raop_ntp->run_mutex);
-        MUTEX_DESTROY(raop_ntp->wait_mutex);
-        COND_DESTROY(raop_ntp->wait_cond);
         MUTEX_DESTROY(raop_ntp->sync_params_mutex);
         free(raop_ntp);
     }
@@ -203,21 +222,6 @@ raop_ntp_init_socket(raop_ntp_t *raop_ntp, int use_ipv6)
         goto sockets_cleanup;
     }
 
-    // We're calling recvfrom without knowing whether there is any data, so we need a timeout
-#ifndef WIN32
-    struct timeval tv;
-    tv.tv_sec = 0;
-    tv.tv_usec = 300000;
-    if (setsockopt(tsock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
-        goto sockets_cleanup;
-    }
-#else
-    int iTimeout = 300;
-    if (setsockopt(tsock, SOL_SOCKET, SO_RCVTIMEO, &iTimeout, sizeof(iTimeout)) < 0) {
-        goto sockets_cleanup;
-    }
-#endif // !WIN32
-
     /* Set socket descriptors */
     raop_ntp->tsock = tsock;
 
@@ -274,132 +278,159 @@ int gettimeofday(struct timeval *tp, void *tzp)
 }
 #endif
 
-static THREAD_RETVAL
-raop_ntp_thread(void *arg)
+static void
+raop_ntp_send_request(raop_ntp_t *raop_ntp)
+{
+    // Flush the socket in case a super delayed response arrived or something
+    raop_ntp_flush_socket(raop_ntp->tsock);
+
+    // Send request
+    raop_ntp->send_time = raop_ntp_get_local_time(raop_ntp);
+    byteutils_put_ntp_timestamp(raop_ntp->request, 24, raop_ntp->send_time);
+    int send_len = sendto(raop_ntp->tsock, (char *)raop_ntp->request, sizeof(raop_ntp->request), 0,
+                          (struct sockaddr *) &raop_ntp->remote_saddr, raop_ntp->remote_saddr_len);
+    logger_log(raop_ntp->logger, LOGGER_DEBUG, "\nraop_ntp send_len = %d, now = %llu", send_len, raop_ntp->send_time);
+    if (send_len < 0) {
+        logger_log(raop_ntp->logger, LOGGER_ERR, "raop_ntp error sending request");
+        reactor_source_set_timer(raop_ntp->source, RAOP_NTP_INTERVAL);
+    } else {
+        raop_ntp->waiting = true;
+        metrics_count(raop_ntp->metrics, METRICS_NTP_REQUESTS, 1);
+        reactor_source_set_timer(raop_ntp->source, RAOP_NTP_TIMEOUT);
+    }
+}
+
+/* Adds a measurement to the data set and updates the sync params from the best of it */
+void
+raop_ntp_add_sample(raop_ntp_t *raop_ntp, int64_t t0, int64_t t1, int64_t t2, int64_t t3)
 {
-    raop_ntp_t *raop_ntp = arg;
-    assert(raop_ntp);
-    unsigned char response[128];
-    int response_len;
-    unsigned char request[32] = {0x80, 0xd2, 0x00, 0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-                                 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
-    };
     raop_ntp_data_t data_sorted[RAOP_NTP_DATA_COUNT];
     const unsigned  two_pow_n[RAOP_NTP_DATA_COUNT] = {2, 4, 8, 16, 32, 64, 128, 256};
-    int timeout_counter = 0;
-    bool conn_reset = false;
-      
-    while (1) {
-        MUTEX_LOCK(raop_ntp->run_mutex);
-        if (!raop_ntp->running) {
-            MUTEX_UNLOCK(raop_ntp->run_mutex);
-            break;
-        }
-        MUTEX_UNLOCK(raop_ntp->run_mutex);
 
-        // Flush the socket in case a super delayed response arrived or something
-        raop_ntp_flush_socket(raop_ntp->tsock);
-
-        // Send request
-        uint64_t send_time = raop_ntp_get_local_time(raop_ntp);
-        byteutils_put_ntp_timestamp(request, 24, send_time);
-        int send_len = sendto(raop_ntp->tsock, (char *)request, sizeof(request), 0,
-                              (struct sockaddr *) &raop_ntp->remote_saddr, raop_ntp->remote_saddr_len);
-        logger_log(raop_ntp->logger, LOGGER_DEBUG, "\nraop_ntp send_len = %d, now = %llu", send_len, send_time);
-        if (send_len < 0) {
-            logger_log(raop_ntp->logger, LOGGER_ERR, "raop_ntp error sending request");
-        } else {
-            // Read response
-            response_len = recvfrom(raop_ntp->tsock, (char *)response, sizeof(response), 0,
-                                    (struct sockaddr *) &raop_ntp->remote_saddr, &raop_ntp->remote_saddr_len);
-            if (response_len < 0) {
-                timeout_counter++;
-                char time[28];
-                int level = (timeout_counter == 1 ? LOGGER_DEBUG : LOGGER_ERR);
-                ntp_timestamp_to_time(send_time, time, sizeof(time));
-                logger_log(raop_ntp->logger, level, "raop_ntp receive timeout %d (limit %d) (request sent %s)",
-                           timeout_counter, raop_ntp->max_ntp_timeouts, time);
-                if (timeout_counter ==  raop_ntp->max_ntp_timeouts) {
-                    conn_reset = true;   /* client is no longer responding */
-                    break;
-                }
-	    } else {
-                //local time of the server when the NTP response packet returns
-                int64_t t3 = (int64_t) raop_ntp_get_local_time(raop_ntp);
-
-                timeout_counter = 0;
-                char *str = utils_data_to_string(response, response_len, 16);                   
-                logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp receive time type_t=%d packetlen = %d\n%s",
-                           response[1] &~0x80, response_len, str);
-                free(str);
-
-                // Local time of the server when the NTP request packet leaves the server
-                int64_t t0 = (int64_t) byteutils_get_ntp_timestamp(response, 8);
-
-                // Local time of the client when the NTP request packet arrives at the client
-                int64_t t1 = (int64_t) byteutils_get_ntp_timestamp(response, 16);
-
-                // Local time of the client when the response message leaves the client
-                int64_t t2 = (int64_t) byteutils_get_ntp_timestamp(response, 24);
-
-                // The iOS client device sends its time in micro seconds relative to an arbitrary Epoch (the last boot).
-                // For a little bonus confusion, they add SECONDS_FROM_1900_TO_1970 * 1000000 us.
-                // This means we have to expect some rather huge offset, but its growth or shrink over time should be small.
-
-                raop_ntp->data_index = (raop_ntp->data_index + 1) % RAOP_NTP_DATA_COUNT;
-                raop_ntp->data[raop_ntp->data_index].time = t3;
-                raop_ntp->data[raop_ntp->data_index].offset     = ((t1 - t0) + (t2 - t3)) / 2;
-                raop_ntp->data[raop_ntp->data_index].delay      = ((t3 - t0) - (t2 - t1));
-                raop_ntp->data[raop_ntp->data_index].dispersion = RAOP_NTP_R_RHO + RAOP_NTP_S_RHO +  (t3 - t0) * RAOP_NTP_PHI_PPM / 1000000u;
-
-                // Sort by delay
-                memcpy(data_sorted, raop_ntp->data, sizeof(data_sorted));
-                qsort(data_sorted, RAOP_NTP_DATA_COUNT, sizeof(data_sorted[0]), raop_ntp_compare);
-
-                uint64_t dispersion = 0ull;
-                int64_t offset = data_sorted[0].offset;
-                int64_t delay = data_sorted[RAOP_NTP_DATA_COUNT - 1].delay;
-
-                // Calculate dispersion
-                for(int i = 0; i < RAOP_NTP_DATA_COUNT; ++i) {
-                    unsigned long long disp = raop_ntp->data[i].dispersion + (t3 - raop_ntp->data[i].time) * RAOP_NTP_PHI_PPM / 1000000u;
-                    dispersion += disp / two_pow_n[i];
-                }
-
-                MUTEX_LOCK(raop_ntp->sync_params_mutex);
-
-                int64_t correction = offset - raop_ntp->sync_offset;
-                raop_ntp->sync_offset = offset;
-                raop_ntp->sync_dispersion = dispersion;
-                raop_ntp->sync_delay = delay;
-                MUTEX_UNLOCK(raop_ntp->sync_params_mutex);
-
-                logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp sync correction = %lld", correction);
+    raop_ntp->data_index = (raop_ntp->data_index + 1) % RAOP_NTP_DATA_COUNT;
+    raop_ntp->data[raop_ntp->data_index].time = t3;
+    raop_ntp->data[raop_ntp->data_index].offset     = ((t1 - t0) + (t2 - t3)) / 2;
+    raop_ntp->data[raop_ntp->data_index].delay      = ((t3 - t0) - (t2 - t1));
+    raop_ntp->data[raop_ntp->data_index].dispersion = RAOP_NTP_R_RHO + RAOP_NTP_S_RHO +  (t3 - t0) * RAOP_NTP_PHI_PPM / 1000000u;
+
+    // Sort by delay
+    memcpy(data_sorted, raop_ntp->data, sizeof(data_sorted));
+    qsort(data_sorted, RAOP_NTP_DATA_COUNT, sizeof(data_sorted[0]), raop_ntp_compare);
+
+    uint64_t dispersion = 0ull;
+    int64_t offset = data_sorted[0].offset;
+    int64_t delay = data_sorted[RAOP_NTP_DATA_COUNT - 1].delay;
+
+    // Calculate dispersion
+    for(int i = 0; i < RAOP_NTP_DATA_COUNT; ++i) {
+        unsigned long long disp = raop_ntp->data[i].dispersion + (t3 - raop_ntp->data[i].time) * RAOP_NTP_PHI_PPM / 1000000u;
+        dispersion += disp / two_pow_n[i];
+    }
+
+    MUTEX_LOCK(raop_ntp->sync_params_mutex);
+
+    int64_t correction = offset - raop_ntp->sync_offset;
+    raop_ntp->sync_offset = offset;
+    raop_ntp->sync_dispersion = dispersion;
+    raop_ntp->sync_delay = delay;
+    MUTEX_UNLOCK(raop_ntp->sync_params_mutex);
+
+    // The dispersion is in NTP units (2^-32 s)
+    metrics_set(raop_ntp->metrics, METRICS_NTP_DISPERSION, (int64_t) ((double) dispersion * 1000000.0 / 4294967296.0));
+    metrics_set(raop_ntp->metrics, METRICS_NTP_DELAY, delay);
+
+    logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp sync correction = %lld", correction);
+}
+
+static void
+raop_ntp_process_response(raop_ntp_t *raop_ntp, unsigned char *response, int response_len)
+{
+    //local time of the server when the NTP response packet returns
+    int64_t t3 = (int64_t) raop_ntp_get_local_time(raop_ntp);
+
+    raop_ntp->timeout_counter = 0;
+    char *str = utils_data_to_string(response, response_len, 16);                   
+    logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp receive time type_t=%d packetlen = %d\n%s",
+               response[1] &~0x80, response_len, str);
+    free(str);
+
+    // Local time of the server when the NTP request packet leaves the server
+    int64_t t0 = (int64_t) byteutils_get_ntp_timestamp(response, 8);
+
+    // Local time of the client when the NTP request packet arrives at the client
+    int64_t t1 = (int64_t) byteutils_get_ntp_timestamp(response, 16);
+
+    // Local time of the client when the response message leaves the client
+    int64_t t2 = (int64_t) byteutils_get_ntp_timestamp(response, 24);
+
+    // The iOS client device sends its time in micro seconds relative to an arbitrary Epoch (the last boot).
+    // For a little bonus confusion, they add SECONDS_FROM_1900_TO_1970 * 1000000 us.
+    // This means we have to expect some rather huge offset, but its growth or shrink over time should be small.
+
+    raop_ntp_add_sample(raop_ntp, t0, t1, t2, t3);
+}
+
+/*
+ * Runs on the reactor: a request is sent every RAOP_NTP_INTERVAL ms, and the timer is
+ * set to RAOP_NTP_TIMEOUT while the response is awaited.
+ */
+static void
+raop_ntp_handler(void *cls, int events)
+{
+    raop_ntp_t *raop_ntp = cls;
+    unsigned char response[128];
+    int response_len;
+
+    int running = (int) ATOMIC_LOAD(raop_ntp->running);
+
+    if (events & REACTOR_READ) {
+        while ((response_len = recvfrom(raop_ntp->tsock, (char *)response, sizeof(response), 0,
+                                        (struct sockaddr *) &raop_ntp->remote_saddr, &raop_ntp->remote_saddr_len)) >= 0) {
+            if (!running || !raop_ntp->waiting) {
+                continue;   /* a late response, the request has already timed out */
             }
+            raop_ntp->waiting = false;
+            raop_ntp_process_response(raop_ntp, response, response_len);
+            reactor_source_set_timer(raop_ntp->source, RAOP_NTP_INTERVAL);
         }
+    }
+    if (!running || !(events & REACTOR_TIMER)) {
+        return;
+    }
+    if (!raop_ntp->waiting) {
+        raop_ntp_send_request(raop_ntp);
+        return;
+    }
 
-        // Sleep for 3 seconds
-        struct timeval now;
-        struct timespec wait_time;
-        MUTEX_LOCK(raop_ntp->wait_mutex);
-        gettimeofday(&now, NULL);
-        wait_time.tv_sec = now.tv_sec + 3;
-        wait_time.tv_nsec = now.tv_usec * 1000;
-        pthread_cond_timedwait(&raop_ntp->wait_cond, &raop_ntp->wait_mutex, &wait_time);
-        MUTEX_UNLOCK(raop_ntp->wait_mutex);
+    raop_ntp->waiting = false;
+    raop_ntp->timeout_counter++;
+    metrics_count(raop_ntp->metrics, METRICS_NTP_TIMEOUTS, 1);
+    char time[28];
+    int level = (raop_ntp->timeout_counter == 1 ? LOGGER_DEBUG : LOGGER_ERR);
+    ntp_timestamp_to_time(raop_ntp->send_time, time, sizeof(time));
+    logger_log(raop_ntp->logger, level, "raop_ntp receive timeout %d (limit %d) (request sent %s)",
+               raop_ntp->timeout_counter, raop_ntp->max_ntp_timeouts, time);
+    if (raop_ntp->timeout_counter != raop_ntp->max_ntp_timeouts) {
+        reactor_source_set_timer(raop_ntp->source, RAOP_NTP_INTERVAL);
+        return;
     }
 
-    // Ensure running reflects the actual state
+    /* client is no longer responding */
     MUTEX_LOCK(raop_ntp->run_mutex);
-    raop_ntp->running = false;
+    ATOMIC_STORE(raop_ntp->running, 0);
     MUTEX_UNLOCK(raop_ntp->run_mutex);
-
-    logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp exiting thread");
-    if (conn_reset && raop_ntp->callbacks.conn_reset) {
+    logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp stopped requests");
+    if (raop_ntp->callbacks.conn_reset) {
         const bool video_reset = false;   /* leave "frozen video" in place */
-        raop_ntp->callbacks.conn_reset(raop_ntp->callbacks.cls, timeout_counter, video_reset);
+        raop_ntp->callbacks.conn_reset(raop_ntp->callbacks.cls, raop_ntp->timeout_counter, video_reset);
     }
-    return 0;
+}
+
+void
+raop_ntp_set_metrics(raop_ntp_t *raop_ntp, metrics_session_t *metrics)
+{
+    assert(raop_ntp);
+    raop_ntp->metrics = metrics;
 }
 
 void
@@ -415,7 +446,7 @@ raop_ntp_start(raop_ntp_t *raop_ntp, unsigned short *timing_lport, int max_ntp_t
     raop_ntp->timing_lport = *timing_lport;
 
     MUTEX_LOCK(raop_ntp->run_mutex);
-    if (raop_ntp->running || !raop_ntp->joined) {
+    if (raop_ntp->source) {
         MUTEX_UNLOCK(raop_ntp->run_mutex);
         return;
     }
@@ -432,11 +463,20 @@ raop_ntp_start(raop_ntp_t *raop_ntp, unsigned short *timing_lport, int max_ntp_t
     }
     *timing_lport = raop_ntp->timing_lport;
 
-    /* Create the thread and initialize running values */
-    raop_ntp->running = 1;
-    raop_ntp->joined = 0;
-    
-    THREAD_CREATE(raop_ntp->thread, raop_ntp_thread, raop_ntp);
+    /* Watch the socket and send the first request right away */
+    ATOMIC_STORE(raop_ntp->running, 1);
+    raop_ntp->waiting = false;
+    raop_ntp->timeout_counter = 0;
+    raop_ntp->source = reactor_source_add(raop_ntp->strand, raop_ntp->tsock, raop_ntp_handler, raop_ntp);
+    if (!raop_ntp->source) {
+        logger_log(raop_ntp->logger, LOGGER_ERR, "raop_ntp could not watch timing socket");
+        ATOMIC_STORE(raop_ntp->running, 0);
+        closesocket(raop_ntp->tsock);
+        raop_ntp->tsock = -1;
+        MUTEX_UNLOCK(raop_ntp->run_mutex);
+        return;
+    }
+    reactor_source_set_timer(raop_ntp->source, 0);
     MUTEX_UNLOCK(raop_ntp->run_mutex);
 }
 
@@ -445,35 +485,30 @@ raop_ntp_stop(raop_ntp_t *raop_ntp)
 {
     assert(raop_ntp);
 
-    /* Check that we are running and thread is not
-     * joined (should never be while still running) */
+    /* Check that we have been started */
     MUTEX_LOCK(raop_ntp->run_mutex);
-    if (!raop_ntp->running || raop_ntp->joined) {
+    reactor_source_t *source = raop_ntp->source;
+    if (!source) {
         MUTEX_UNLOCK(raop_ntp->run_mutex);
         return;
     }
-    raop_ntp->running = 0;
+    ATOMIC_STORE(raop_ntp->running, 0);
     MUTEX_UNLOCK(raop_ntp->run_mutex);
 
-    logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp stopping time thread");
+    logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp stopping time");
 
-    MUTEX_LOCK(raop_ntp->wait_mutex);
-    COND_SIGNAL(raop_ntp->wait_cond);
-    MUTEX_UNLOCK(raop_ntp->wait_mutex);
+    /* Waits for a running handler */
+    reactor_source_remove(source);
+    MUTEX_LOCK(raop_ntp->run_mutex);
+    raop_ntp->source = NULL;
+    MUTEX_UNLOCK(raop_ntp->run_mutex);
 
     if (raop_ntp->tsock != -1) {
         closesocket(raop_ntp->tsock);
         raop_ntp->tsock = -1;
     }
 
-    THREAD_JOIN(raop_ntp->thread);
-
-    logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp stopped time thread");
-
-    /* Mark thread as joined */
-    MUTEX_LOCK(raop_ntp->run_mutex);
-    raop_ntp->joined = 1;
-    MUTEX_UNLOCK(raop_ntp->run_mutex);
+    logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp stopped time");
 }
 
 /**
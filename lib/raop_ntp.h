@@ -19,12 +19,21 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include "logger.h"
+#include "reactor.h"
+#include "metrics.h"
 
 typedef struct raop_ntp_s raop_ntp_t;
 
 
 void raop_ntp_start(raop_ntp_t *raop_ntp, unsigned short *timing_lport, int max_ntp_timeouts);
 
+/* Requests, timeouts and the clock sync quality go to metrics (may be NULL); set before raop_ntp_start */
+void raop_ntp_set_metrics(raop_ntp_t *raop_ntp, metrics_session_t *metrics);
+
+/* A timing measurement (us): request sent (t0), received by the client (t1), answered (t2), answer received (t3) *
+ * Used on the receive path, exposed for the benchmarks                                                          */
+void raop_ntp_add_sample(raop_ntp_t *raop_ntp, int64_t t0, int64_t t1, int64_t t2, int64_t t3);
+
 void raop_ntp_stop(raop_ntp_t *raop_ntp);
 
 unsigned short raop_ntp_get_port(raop_ntp_t *raop_ntp);
@@ -29,6 +29,8 @@
 #include "mirror_buffer.h"
 #include "stream.h"
 #include "utils.h"
+#include "reactor.h"
+#include "trace.h"
 
 #define NO_FLUSH (-42)
 
@@ -78,9 +80,10 @@ struct raop_rtp_s {
     socklen_t remote_saddr_len;
 
     /* MUTEX LOCKED VARIABLES START */
-    /* These variables only edited mutex locked */
-    int running;
-    int joined;
+    /* These variables only edited mutex locked; running and events_pending *
+     * are also read without the mutex by the handlers on the strand         */
+    long running;
+    long events_pending;
 
     float volume;
     int volume_changed;
@@ -96,10 +99,24 @@ struct raop_rtp_s {
     int progress_changed;
 
     int flush;
-    thread_handle_t thread;
     mutex_handle_t run_mutex;
     /* MUTEX LOCKED VARIABLES END */
 
+    /* The control and data sockets are handled on one strand of the reactor; *
+     * the events source is posted to when the RTSP thread changes something */
+    reactor_t *reactor;
+    reactor_strand_t *strand;
+    reactor_source_t *csource, *dsource, *esource;
+
+    /* for initial rtp to ntp conversions */
+    bool have_synced;
+    int rtp_count;
+    int64_t initial_offset;
+    double sync_adjustment;
+    int64_t delay;
+    unsigned short seqnum1, seqnum2;
+    bool offset_estimate_initialized;
+
     /* Remote control and timing ports */
     unsigned short control_rport;
 
@@ -117,6 +134,13 @@ struct raop_rtp_s {
 
     /* audio compression type: ct = 2 (ALAC), ct = 8 (AAC_ELD) (ct = 4 would be AAC-MAIN) */
     unsigned char ct;
+
+    /* Optional capture of the received datagrams */
+    raop_capture_t *capture;
+    int capture_session_id;
+
+    /* Optional metrics of the session */
+    metrics_session_t *metrics;
 };
 
 static int
@@ -147,13 +171,14 @@ raop_rtp_parse_remote(raop_rtp_t *raop_rtp, const unsigned char *remote, int rem
 }
 
 raop_rtp_t *
-raop_rtp_init(logger_t *logger, raop_callbacks_t *callbacks, raop_ntp_t *ntp, const unsigned char *remote, 
+raop_rtp_init(logger_t *logger, raop_callbacks_t *callbacks, reactor_t *reactor, raop_ntp_t *ntp, const unsigned char *remote,
               int remotelen, const unsigned char *aeskey, const unsigned char *aesiv)
 {
     raop_rtp_t *raop_rtp;
 
     assert(logger);
     assert(callbacks);
+    assert(reactor);
 
     raop_rtp = calloc(1, sizeof(raop_rtp_t));
     if (!raop_rtp) {
@@ -189,9 +214,17 @@ raop_rtp_init(logger_t *logger, raop_callbacks_t *callbacks, raop_ntp_t *ntp, co
         free(raop_rtp);
         return NULL;
     }
+    raop_rtp->reactor = reactor;
+    raop_rtp->strand = reactor_strand_init(reactor);
+    if (!raop_rtp->strand) {
+        raop_buffer_destroy(raop_rtp->buffer);
+        free(raop_rtp);
+        return NULL;
+    }
 
     raop_rtp->running = 0;
-    raop_rtp->joined = 1;
+    raop_rtp->csock = -1;
+    raop_rtp->dsock = -1;
     raop_rtp->flush = NO_FLUSH;
 
     MUTEX_CREATE(raop_rtp->run_mutex);
@@ -204,6 +237,7 @@ raop_rtp_destroy(raop_rtp_t *raop_rtp)
 {
     if (raop_rtp) {
         raop_rtp_stop(raop_rtp);
+        reactor_strand_destroy(raop_rtp->strand);
         MUTEX_DESTROY(raop_rtp->run_mutex);
         raop_buffer_destroy(raop_rtp->buffer);
         free(raop_rtp->metadata);
@@ -214,6 +248,21 @@ raop_rtp_destroy(raop_rtp_t *raop_rtp)
     }
 }
 
+void
+raop_rtp_set_capture(raop_rtp_t *raop_rtp, raop_capture_t *capture, int session_id)
+{
+    assert(raop_rtp);
+    raop_rtp->capture = capture;
+    raop_rtp->capture_session_id = session_id;
+}
+
+void
+raop_rtp_set_metrics(raop_rtp_t *raop_rtp, metrics_session_t *metrics)
+{
+    assert(raop_rtp);
+    raop_rtp->metrics = metrics;
+}
+
 static int
 raop_rtp_resend_callback(void *opaque, unsigned short seqnum, unsigned short count)
 {
@@ -228,6 +277,7 @@ raop_rtp_resend_callback(void *opaque, unsigned short seqnum, unsigned short cou
     addrlen = raop_rtp->control_saddr_len;
 
     logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp got resend request %d %d", seqnum, count);
+    metrics_count(raop_rtp->metrics, METRICS_AUDIO_RESEND_REQUESTS, count);
     ourseqnum = raop_rtp->control_seqnum++;
 
     /* Fill the request buffer */
@@ -298,11 +348,15 @@ raop_rtp_process_events(raop_rtp_t *raop_rtp, void *cb_data)
 
     assert(raop_rtp);
 
-    MUTEX_LOCK(raop_rtp->run_mutex);
-    if (!raop_rtp->running) {
-        MUTEX_UNLOCK(raop_rtp->run_mutex);
+    if (!ATOMIC_LOAD(raop_rtp->running)) {
         return 1;
     }
+    /* Only take the mutex when a setter has changed something since the last call */
+    if (!ATOMIC_EXCHANGE(raop_rtp->events_pending, 0)) {
+        return 0;
+    }
+
+    MUTEX_LOCK(raop_rtp->run_mutex);
 
     /* Read the volume level */
     volume = raop_rtp->volume;
@@ -442,271 +496,256 @@ uint64_t rtp64_time (raop_rtp_t *raop_rtp, const uint32_t *rtp32) {
     return  raop_rtp->rtp_time;
 }
 
-static THREAD_RETVAL
-raop_rtp_thread_udp(void *arg)
+static void
+raop_rtp_process_control(raop_rtp_t *raop_rtp, unsigned char *packet, int packetlen)
 {
-    raop_rtp_t *raop_rtp = arg;
-    unsigned char packet[RAOP_PACKET_LEN];
-    unsigned int packetlen;
-    struct sockaddr_storage saddr;
-    socklen_t saddrlen;
+    int type_c = packet[1] & ~0x80;
+    logger_log(raop_rtp->logger, LOGGER_DEBUG, "\nraop_rtp type_c 0x%02x, packetlen = %d", type_c, packetlen);
 
-    /* for initial rtp to ntp conversions */    
-    bool have_synced = false;
-    int rtp_count = 0;
-    int64_t initial_offset = 0;
-    double sync_adjustment = 0;
-    int64_t delay = 0;
-    unsigned short seqnum1 = 0, seqnum2 = 0;
-    bool offset_estimate_initialized  = false;
-
-    assert(raop_rtp);
-    raop_rtp->ntp_start_time = raop_ntp_get_local_time(raop_rtp->ntp);
-    raop_rtp->rtp_clock_started = false;
-    for (int i = 0; i < RAOP_RTP_SYNC_DATA_COUNT; i++) {
-        raop_rtp->sync_data[i].ntp_time = 0;
-    }
-
-    logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp start_time = %8.6f (raop_rtp audio)",
-               ((double) raop_rtp->ntp_start_time) / SEC);
-
-    while(1) {
-        fd_set rfds;
-        struct timeval tv;
-        int nfds, ret;	
-        /* Check if we are still running and process callbacks */
-        if (raop_rtp_process_events(raop_rtp, NULL)) {
-            break;
+    if (type_c == 0x56 && packetlen >= 8) {
+	        /* Handle resent data packet, which begins at offset 4 of these packets */
+        unsigned char *resent_packet =  &packet[4];
+        unsigned int resent_packetlen = packetlen - 4;
+        unsigned short seqnum = byteutils_get_short_be(resent_packet, 2);
+        if (resent_packetlen >= 12) {
+            uint32_t timestamp = byteutils_get_int_be(resent_packet, 4);
+            uint64_t rtp_time = rtp64_time(raop_rtp, &timestamp);
+            logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp resent audio packet: seqnum=%u", seqnum);
+            metrics_count(raop_rtp->metrics, METRICS_AUDIO_RESENT, 1);
+            int enqueue_ret = raop_buffer_enqueue(raop_rtp->buffer, resent_packet, resent_packetlen, rtp_time, 1);
+            assert(enqueue_ret >= 0);
+        } else {
+            /* type_c = 0x56 packets  with length 8 have been reported */
+            char *str = utils_data_to_string(packet, packetlen, 16);
+            logger_log(raop_rtp->logger, LOGGER_DEBUG, "Received empty resent audio packet length %d, seqnum=%u:\n%s",
+                       packetlen, seqnum, str);
+            free (str);
         }
-
-        /* Set timeout value to 5ms */
-        tv.tv_sec = 0;
-        tv.tv_usec = 5000;
-
-        /* Get the correct nfds value */
-        nfds = raop_rtp->csock+1;
-        if (raop_rtp->dsock >= nfds)
-            nfds = raop_rtp->dsock+1;
-
-        /* Set rfds and call select */
-        FD_ZERO(&rfds);
-        FD_SET(raop_rtp->csock, &rfds);
-        FD_SET(raop_rtp->dsock, &rfds);
-
-        ret = select(nfds, &rfds, NULL, NULL, &tv);
-        if (ret == 0) {
-            /* Timeout happened */
-            continue;
-        } else if (ret == -1) {
-            logger_log(raop_rtp->logger, LOGGER_ERR, "raop_rtp error in select");
+    } else if (type_c == 0x54 && packetlen >= 20) {
+        /* packet[0] = 0x90 (first sync ?) or 0x80 (subsequent ones)
+         * packet[1] = 0xd4,  (0xd4 && ~0x80 = type 0x54)
+         * packet[2:3] = 0x00 0x04
+         * packet[4:7] : sync_rtp (big-endian uint32_t)
+         * packet[8:15]: remote ntp timestamp (big-endian uint64_t)  
+         * packet[16:20]: next_rtp (big-endian uint32_t)
+         * next_rtp = sync_rtp + 7497 =  441 *  17 (0.17 sec) for AAC-ELD
+         * next_rtp = sync_rtp + 77175  = 441 * 175 (1.75 sec) for ALAC */
+
+        // The unit for the rtp clock is 1 / sample rate = 1 / 44100
+        uint32_t sync_rtp = byteutils_get_int_be(packet, 4);
+        uint64_t sync_rtp64 = rtp64_time(raop_rtp, &sync_rtp);
+
+
+        if (raop_rtp->have_synced == false) {
+            logger_log(raop_rtp->logger, LOGGER_DEBUG, "first audio rtp sync");
+            raop_rtp->have_synced = true;
+        }
+        uint64_t sync_ntp_raw = byteutils_get_long_be(packet, 8);
+        uint64_t sync_ntp_remote = raop_ntp_timestamp_to_micro_seconds(sync_ntp_raw, true);
+        uint64_t sync_ntp_local = raop_ntp_convert_remote_time(raop_rtp->ntp, sync_ntp_remote);
+        int64_t shift;
+        switch (raop_rtp->ct) {
+        case 0x08:                   /*AAC-ELD */
+            shift = -11025;           /* 44100/4 */
+            break;
+        case 0x02:
+        default:
+            shift = 0;   /* not needed for ALAC (audio only) */
             break;
         }
+        char *str = utils_data_to_string(packet, packetlen, 20);
+        logger_log(raop_rtp->logger, LOGGER_DEBUG,
+                   "raop_rtp sync: client ntp=%8.6f, ntp = %8.6f, ntp_start_time %8.6f, sync_rtp=%u\n%s",
+                   ((double) sync_ntp_remote) / SEC, ((double)sync_ntp_local) / SEC,
+                   ((double) raop_rtp->ntp_start_time) / SEC, sync_rtp, str);
+        free(str);
+        raop_rtp_sync_clock(raop_rtp, sync_ntp_local, sync_rtp64, shift);		
+    } else {
+        char *str = utils_data_to_string(packet, packetlen, 16);
+        logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp unknown udp control packet\n%s", str);
+        free(str);
+    }
+}
 
-        if (FD_ISSET(raop_rtp->csock, &rfds)) {
-            saddrlen = sizeof(saddr);
-            packetlen = recvfrom(raop_rtp->csock, (char *)packet, sizeof(packet), 0,
-                                 (struct sockaddr *)&saddr, &saddrlen);
-
-            memcpy(&raop_rtp->control_saddr, &saddr, saddrlen);
-            raop_rtp->control_saddr_len = saddrlen;
-            int type_c = packet[1] & ~0x80;
-            logger_log(raop_rtp->logger, LOGGER_DEBUG, "\nraop_rtp type_c 0x%02x, packetlen = %d", type_c, packetlen);
-
-            if (type_c == 0x56 && packetlen >= 8) {
-	        /* Handle resent data packet, which begins at offset 4 of these packets */
-                unsigned char *resent_packet =  &packet[4];
-                unsigned int resent_packetlen = packetlen - 4;
-                unsigned short seqnum = byteutils_get_short_be(resent_packet, 2);
-                if (resent_packetlen >= 12) {
-                    uint32_t timestamp = byteutils_get_int_be(resent_packet, 4);
-                    uint64_t rtp_time = rtp64_time(raop_rtp, &timestamp);
-                    logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp resent audio packet: seqnum=%u", seqnum);
-                    int enqueue_ret = raop_buffer_enqueue(raop_rtp->buffer, resent_packet, resent_packetlen, rtp_time, 1);
-                    assert(enqueue_ret >= 0);
-                } else {
-                    /* type_c = 0x56 packets  with length 8 have been reported */
-                    char *str = utils_data_to_string(packet, packetlen, 16);
-                    logger_log(raop_rtp->logger, LOGGER_DEBUG, "Received empty resent audio packet length %d, seqnum=%u:\n%s",
-                               packetlen, seqnum, str);
-                    free (str);
-                }
-            } else if (type_c == 0x54 && packetlen >= 20) {
-                /* packet[0] = 0x90 (first sync ?) or 0x80 (subsequent ones)
-                 * packet[1] = 0xd4,  (0xd4 && ~0x80 = type 0x54)
-                 * packet[2:3] = 0x00 0x04
-                 * packet[4:7] : sync_rtp (big-endian uint32_t)
-                 * packet[8:15]: remote ntp timestamp (big-endian uint64_t)  
-                 * packet[16:20]: next_rtp (big-endian uint32_t)
-                 * next_rtp = sync_rtp + 7497 =  441 *  17 (0.17 sec) for AAC-ELD
-                 * next_rtp = sync_rtp + 77175  = 441 * 175 (1.75 sec) for ALAC */
-
-                // The unit for the rtp clock is 1 / sample rate = 1 / 44100
-                uint32_t sync_rtp = byteutils_get_int_be(packet, 4);
-                uint64_t sync_rtp64 = rtp64_time(raop_rtp, &sync_rtp);
- 
-
-                if (have_synced == false) {
-                    logger_log(raop_rtp->logger, LOGGER_DEBUG, "first audio rtp sync");
-                    have_synced = true;
-                }
-                uint64_t sync_ntp_raw = byteutils_get_long_be(packet, 8);
-                uint64_t sync_ntp_remote = raop_ntp_timestamp_to_micro_seconds(sync_ntp_raw, true);
-                uint64_t sync_ntp_local = raop_ntp_convert_remote_time(raop_rtp->ntp, sync_ntp_remote);
-                int64_t shift;
+/* rtp audio data packets:
+ * packet[0] 0x80
+ * packet[1] 0x60 = 96
+ * packet[2:3] seqnum (big-endian unsigned short)
+ * packet[4:7] rtp timestamp (big-endian unsigned int)
+ * packet[8:11] 0x00 0x00 0x00 0x00
+ * packet[12:packetlen - 1] encrypted audio payload
+ * For (AAC-ELD only), the payload of initial packets at the start of
+ * the stream may be replaced by a 4-byte "no_data_marker" 0x00 0x68 0x34 0x00 */
+
+/* consecutive AAC-ELD rtp timestamps differ by spf = 480
+ * consecutive ALAC rtp timestamps differ by spf = 352
+ * both have PCM uncompressed sampling rate = 441000 Hz */
+
+/* clock time in microseconds advances at (rtp_timestamp * 1000000)/44100 between frames */
+
+/* every AAC-ELD packet is sent three times:  0  0 1  0 1 2  1 2 3  2 3 4 ...
+ * (after decoding AAC-ELD into PCM, the sound frame is three times bigger)
+ * ALAC packets are sent once only  0 1 2 3 4 5  ...  */
+
+/* When the AAC-ELD audio stream starts, the initial packets are length-16 packets with
+ * a four-byte "no_data_marker" 0x00 0x68 0x34 0x00 replacing the payload.
+ * The 12-byte packetheader contains  a secnum and rtp_timestamp, and each  packets is sent
+ * three times; the secnum and rtp_timestamp increment according to the same pattern as
+ * AAC-ELD packets with audio content.*/
+
+/* When the ALAC audio stream starts, the initial packets are length-44 packets with
+ * the same 32-byte encrypted payload which after decryption is the beginning of a
+ * 32-byte ALAC packet, presumably with format information, but not actual audio data.
+ * The secnum and rtp_timestamp in the packet header increment according to the same
+ * pattern as ALAC packets with audio content */
+static void
+raop_rtp_process_data(raop_rtp_t *raop_rtp, unsigned char *packet, int packetlen)
+{
+    // rtp payload type
+    //int type_d = packet[1] & ~0x80;
+    //logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp_thread_udp type_d 0x%02x, packetlen = %d", type_d, packetlen);
+    if (packetlen >= 12) {
+        int no_resend = (raop_rtp->control_rport == 0); /* true when control_rport is not set */
+        uint32_t rtp_timestamp =  byteutils_get_int_be(packet, 4);
+        uint64_t rtp_time = rtp64_time(raop_rtp, &rtp_timestamp);
+        if (raop_rtp->have_synced == false) {
+            /* until the first rtp sync occurs, we don't know the exact client ntp timestamp that matches the client rtp timestamp */
+            int64_t sync_ntp =  ((int64_t) raop_ntp_get_local_time(raop_rtp->ntp)) - ((int64_t) raop_rtp->ntp_start_time) ;
+            int64_t sync_rtp = ((int64_t) rtp_time) - ((int64_t) raop_rtp->rtp_start_time);
+            int64_t offset;
+            unsigned short seqnum = byteutils_get_short_be(packet,2);
+            if (!raop_rtp->offset_estimate_initialized) {
+                raop_rtp->offset_estimate_initialized = true;
                 switch (raop_rtp->ct) {
-                case 0x08:                   /*AAC-ELD */
-                    shift = -11025;           /* 44100/4 */
+                case 0x02:  
+                    raop_rtp->delay = DELAY_ALAC;   /* DELAY = 2000000 (2.0 sec) is empirical choice for ALAC */
+                    logger_log(raop_rtp->logger, LOGGER_DEBUG, "Audio is ALAC: using initial latency estimate -%8.6f sec",
+                              ((double) raop_rtp->delay) / SEC);
+                    break;
+                case 0x08:
+                    raop_rtp->delay = DELAY_AAC;   /* DELAY = 500000 (0.5 sec) is empirical choice for AAC-ELD */
+                    logger_log(raop_rtp->logger, LOGGER_DEBUG, "Audio is AAC: using initial latency estimate -%8.6f sec",
+                               ((double) raop_rtp->delay ) / SEC);
                     break;
-                case 0x02:
                 default:
-                    shift = 0;   /* not needed for ALAC (audio only) */
                     break;
                 }
-                char *str = utils_data_to_string(packet, packetlen, 20);
-                logger_log(raop_rtp->logger, LOGGER_DEBUG,
-                           "raop_rtp sync: client ntp=%8.6f, ntp = %8.6f, ntp_start_time %8.6f, sync_rtp=%u\n%s",
-                           ((double) sync_ntp_remote) / SEC, ((double)sync_ntp_local) / SEC,
-                           ((double) raop_rtp->ntp_start_time) / SEC, sync_rtp, str);
-                free(str);
-                raop_rtp_sync_clock(raop_rtp, sync_ntp_local, sync_rtp64, shift);		
-            } else {
-                char *str = utils_data_to_string(packet, packetlen, 16);
-                logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp unknown udp control packet\n%s", str);
-                free(str);
+                raop_rtp->initial_offset = -(sync_ntp + raop_rtp->delay);
+                raop_rtp->rtp_sync_offset = raop_rtp->initial_offset;
+                raop_rtp->sync_adjustment = 0;
+                raop_rtp->seqnum1 = seqnum;
+                raop_rtp->seqnum2 = seqnum;
             }
+            sync_ntp += raop_rtp->delay;
+            offset = -sync_ntp;
+            if (raop_rtp->seqnum2 != seqnum) {  /* for AAC-ELD  only use copy 3 of the 3 copies of each  frame */
+                raop_rtp->rtp_count++;
+                offset -= raop_rtp->initial_offset;
+                raop_rtp->sync_adjustment += ((double) offset) + (((double) sync_rtp) / raop_rtp->rtp_sync_scale);
+                raop_rtp->rtp_sync_offset = raop_rtp->initial_offset + (int64_t) (raop_rtp->sync_adjustment / raop_rtp->rtp_count);
+                //logger_log(raop_rtp->logger, LOGGER_DEBUG, "initial estimate of rtp_sync_offset %d secnum = %u:  %8.6f",
+                //           raop_rtp->rtp_count, seqnum,  ((double) raop_rtp->rtp_sync_offset) / SEC);
+            }
+            raop_rtp->seqnum2 = raop_rtp->seqnum1;
+            raop_rtp->seqnum1 = seqnum;
+        }
+        metrics_count(raop_rtp->metrics, METRICS_AUDIO_PACKETS, 1);
+        metrics_count(raop_rtp->metrics, METRICS_AUDIO_BYTES, packetlen);
+        uint64_t decrypt_start = metrics_stage_begin(raop_rtp->metrics);
+        uint64_t span_start = TRACE_BEGIN();
+        int enqueue_ret = raop_buffer_enqueue(raop_rtp->buffer, packet, packetlen, rtp_time, 1);
+        assert(enqueue_ret >= 0);
+        metrics_stage_end(raop_rtp->metrics, METRICS_AUDIO_DECRYPT, decrypt_start);
+        TRACE_END("audio", "decrypt", byteutils_get_short_be(packet, 2), span_start);
+        // Render continuous buffer entries
+        refbuf_t *payload = NULL;
+        unsigned int payload_size;
+        unsigned short seqnum;
+        uint64_t rtp64_timestamp;
+        while ((payload = raop_buffer_dequeue(raop_rtp->buffer, &payload_size, &rtp64_timestamp, &seqnum, no_resend))) {
+            double  elapsed_time =  (((double) (rtp64_timestamp - (uint64_t) raop_rtp->rtp_start_time)) / raop_rtp->rtp_sync_scale);
+            audio_decode_struct audio_data; 
+            audio_data.data_len = payload_size;
+            audio_data.data = payload->data;
+            audio_data.buf = payload;
+            audio_data.ntp_time = raop_rtp->ntp_start_time + (uint64_t) elapsed_time;
+            audio_data.ntp_time -= raop_rtp->rtp_sync_offset;
+            audio_data.rtp_time = rtp64_timestamp;
+            audio_data.seqnum = seqnum;
+            uint64_t enqueue_start = metrics_stage_begin(raop_rtp->metrics);
+            span_start = TRACE_BEGIN();
+            raop_rtp->callbacks.audio_process(raop_rtp->callbacks.cls, raop_rtp->ntp, &audio_data);
+            TRACE_END("audio", "enqueue", seqnum, span_start);
+            refbuf_unref(payload);
+            metrics_stage_end(raop_rtp->metrics, METRICS_AUDIO_ENQUEUE, enqueue_start);
+            uint64_t ntp_now = raop_ntp_get_local_time(raop_rtp->ntp);
+            int64_t latency =  ((int64_t) ntp_now) - ((int64_t) audio_data.ntp_time); 
+            logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp audio: now = %8.6f, npt = %8.6f, latency = %8.6f, rtp_time=%u seqnum = %u",
+                       ((double) ntp_now ) / SEC, ((double) audio_data.ntp_time) / SEC, ((double) latency) / SEC, (uint32_t) rtp64_timestamp,
+                       seqnum);
         }
 
-        /* rtp audio data packets:
-         * packet[0] 0x80
-         * packet[1] 0x60 = 96
-         * packet[2:3] seqnum (big-endian unsigned short)
-         * packet[4:7] rtp timestamp (big-endian unsigned int)
-         * packet[8:11] 0x00 0x00 0x00 0x00
-         * packet[12:packetlen - 1] encrypted audio payload
-         * For (AAC-ELD only), the payload of initial packets at the start of
-         * the stream may be replaced by a 4-byte "no_data_marker" 0x00 0x68 0x34 0x00 */
-	
-        /* consecutive AAC-ELD rtp timestamps differ by spf = 480
-         * consecutive ALAC rtp timestamps differ by spf = 352
-         * both have PCM uncompressed sampling rate = 441000 Hz */
-
-        /* clock time in microseconds advances at (rtp_timestamp * 1000000)/44100 between frames */
-
-        /* every AAC-ELD packet is sent three times:  0  0 1  0 1 2  1 2 3  2 3 4 ... 
-         * (after decoding AAC-ELD into PCM, the sound frame is three times bigger)
-         * ALAC packets are sent once only  0 1 2 3 4 5  ...  */
-
-        /* When the AAC-ELD audio stream starts, the initial packets are length-16 packets with
-         * a four-byte "no_data_marker" 0x00 0x68 0x34 0x00 replacing the payload.
-         * The 12-byte packetheader contains  a secnum and rtp_timestamp, and each  packets is sent
-         * three times; the secnum and rtp_timestamp increment according to the same pattern as 
-         * AAC-ELD packets with audio content.*/
-
-	 /* When the ALAC audio stream starts, the initial packets are length-44 packets with 
-	  * the same 32-byte encrypted payload which after decryption is the beginning of a
-          * 32-byte ALAC packet, presumably with format information, but not actual audio data.
-          * The secnum and rtp_timestamp in the packet header increment according to the same
-          * pattern as ALAC packets with audio content */
-
-        if (FD_ISSET(raop_rtp->dsock, &rfds)) {
-            //logger_log(raop_rtp->logger, LOGGER_INFO, "Would have data packet in queue");
-            // Receiving audio data here
-            saddrlen = sizeof(saddr);
-            packetlen = recvfrom(raop_rtp->dsock, (char *)packet, sizeof(packet), 0,
-                                 (struct sockaddr *)&saddr, &saddrlen);
-            // rtp payload type
-            //int type_d = packet[1] & ~0x80;
-            //logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp_thread_udp type_d 0x%02x, packetlen = %d", type_d, packetlen);
-            if (packetlen >= 12) {
-                int no_resend = (raop_rtp->control_rport == 0); /* true when control_rport is not set */
-                uint32_t rtp_timestamp =  byteutils_get_int_be(packet, 4);
-                uint64_t rtp_time = rtp64_time(raop_rtp, &rtp_timestamp);
-                if (have_synced == false) {
-                    /* until the first rtp sync occurs, we don't know the exact client ntp timestamp that matches the client rtp timestamp */
-                    int64_t sync_ntp =  ((int64_t) raop_ntp_get_local_time(raop_rtp->ntp)) - ((int64_t) raop_rtp->ntp_start_time) ;
-                    int64_t sync_rtp = ((int64_t) rtp_time) - ((int64_t) raop_rtp->rtp_start_time);
-                    int64_t offset;
-                    unsigned short seqnum = byteutils_get_short_be(packet,2);
-                    if (!offset_estimate_initialized) {
-                        offset_estimate_initialized = true;
-                        switch (raop_rtp->ct) {
-                        case 0x02:  
-                            delay = DELAY_ALAC;   /* DELAY = 2000000 (2.0 sec) is empirical choice for ALAC */
-                            logger_log(raop_rtp->logger, LOGGER_DEBUG, "Audio is ALAC: using initial latency estimate -%8.6f sec",
-                                      ((double) delay) / SEC);
-                            break;
-                        case 0x08:
-                            delay = DELAY_AAC;   /* DELAY = 500000 (0.5 sec) is empirical choice for AAC-ELD */
-                            logger_log(raop_rtp->logger, LOGGER_DEBUG, "Audio is AAC: using initial latency estimate -%8.6f sec",
-                                       ((double) delay ) / SEC);
-                            break;
-                        default:
-                            break;
-                        }
-                        initial_offset = -(sync_ntp + delay);
-                        raop_rtp->rtp_sync_offset = initial_offset;
-                        sync_adjustment = 0;
-                        seqnum1 = seqnum;
-                        seqnum2 = seqnum;
-                    }
-                    sync_ntp += delay;
-                    offset = -sync_ntp;
-                    if (seqnum2 != seqnum) {  /* for AAC-ELD  only use copy 3 of the 3 copies of each  frame */
-                        rtp_count++;
-                        offset -= initial_offset;
-                        sync_adjustment += ((double) offset) + (((double) sync_rtp) / raop_rtp->rtp_sync_scale);
-                        raop_rtp->rtp_sync_offset = initial_offset + (int64_t) (sync_adjustment / rtp_count);
-                        //logger_log(raop_rtp->logger, LOGGER_DEBUG, "initial estimate of rtp_sync_offset %d secnum = %u:  %8.6f",
-                        //           rtp_count, seqnum,  ((double) raop_rtp->rtp_sync_offset) / SEC);
-                    }
-                    seqnum2 = seqnum1;
-                    seqnum1 = seqnum;
-                }
-                int enqueue_ret = raop_buffer_enqueue(raop_rtp->buffer, packet, packetlen, rtp_time, 1);
-                assert(enqueue_ret >= 0);
-                // Render continuous buffer entries
-                void *payload = NULL;
-                unsigned int payload_size;
-                unsigned short seqnum;
-                uint64_t rtp64_timestamp;
-                while ((payload = raop_buffer_dequeue(raop_rtp->buffer, &payload_size, &rtp64_timestamp, &seqnum, no_resend))) {
-                    double  elapsed_time =  (((double) (rtp64_timestamp - (uint64_t) raop_rtp->rtp_start_time)) / raop_rtp->rtp_sync_scale);
-                    audio_decode_struct audio_data; 
-                    audio_data.data_len = payload_size;
-                    audio_data.data = payload;
-                    audio_data.ntp_time = raop_rtp->ntp_start_time + (uint64_t) elapsed_time;
-                    audio_data.ntp_time -= raop_rtp->rtp_sync_offset;
-                    audio_data.rtp_time = rtp64_timestamp;
-                    audio_data.seqnum = seqnum;
-                    raop_rtp->callbacks.audio_process(raop_rtp->callbacks.cls, raop_rtp->ntp, &audio_data);
-                    free(payload);
-                    uint64_t ntp_now = raop_ntp_get_local_time(raop_rtp->ntp);
-                    int64_t latency =  ((int64_t) ntp_now) - ((int64_t) audio_data.ntp_time); 
-                    logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp audio: now = %8.6f, npt = %8.6f, latency = %8.6f, rtp_time=%u seqnum = %u",
-                               ((double) ntp_now ) / SEC, ((double) audio_data.ntp_time) / SEC, ((double) latency) / SEC, (uint32_t) rtp64_timestamp,
-                               seqnum);
-                }
+        metrics_set(raop_rtp->metrics, METRICS_AUDIO_QUEUE, raop_buffer_get_depth(raop_rtp->buffer));
 
-                /* Handle possible resend requests */
-                if (!no_resend) {
-                    raop_buffer_handle_resends(raop_rtp->buffer, raop_rtp_resend_callback, raop_rtp);
-                }
-            } else {
-                   char *str = utils_data_to_string(packet, packetlen, 16);
-                   logger_log(raop_rtp->logger, LOGGER_DEBUG, "Received short type_d = 0x%2x  packet with length %d:\n%s", packet[1] & ~0x80, packetlen, str);
-                   free (str);
-            }
+        /* Handle possible resend requests */
+        if (!no_resend) {
+            raop_buffer_handle_resends(raop_rtp->buffer, raop_rtp_resend_callback, raop_rtp);
         }
+    } else {
+           char *str = utils_data_to_string(packet, packetlen, 16);
+           logger_log(raop_rtp->logger, LOGGER_DEBUG, "Received short type_d = 0x%2x  packet with length %d:\n%s", packet[1] & ~0x80, packetlen, str);
+           free (str);
     }
+}
 
-    // Ensure running reflects the actual state
-    MUTEX_LOCK(raop_rtp->run_mutex);
-    raop_rtp->running = false;
-    MUTEX_UNLOCK(raop_rtp->run_mutex);
+static void
+raop_rtp_control_handler(void *cls, int events)
+{
+    raop_rtp_t *raop_rtp = cls;
+    unsigned char packet[RAOP_PACKET_LEN];
+    struct sockaddr_storage saddr;
+    socklen_t saddrlen = sizeof(saddr);
+    int packetlen;
 
-    logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp exiting thread");
+    /* Check if we are still running and process callbacks */
+    if (raop_rtp_process_events(raop_rtp, NULL)) {
+        return;
+    }
+    while ((packetlen = recvfrom(raop_rtp->csock, (char *)packet, sizeof(packet), 0,
+                                 (struct sockaddr *)&saddr, &saddrlen)) >= 0) {
+        if (packetlen > 0) {
+            raop_capture_write(raop_rtp->capture, raop_rtp->capture_session_id, RAOP_CAPTURE_AUDIO_CONTROL, packet, packetlen);
+        }
+        memcpy(&raop_rtp->control_saddr, &saddr, saddrlen);
+        raop_rtp->control_saddr_len = saddrlen;
+        raop_rtp_process_control(raop_rtp, packet, packetlen);
+        saddrlen = sizeof(saddr);
+    }
+}
 
-    return 0;
+static void
+raop_rtp_data_handler(void *cls, int events)
+{
+    raop_rtp_t *raop_rtp = cls;
+    unsigned char packet[RAOP_PACKET_LEN];
+    int packetlen;
+
+    if (raop_rtp_process_events(raop_rtp, NULL)) {
+        return;
+    }
+    while ((packetlen = recvfrom(raop_rtp->dsock, (char *)packet, sizeof(packet), 0, NULL, NULL)) >= 0) {
+        if (packetlen > 0) {
+            raop_capture_write(raop_rtp->capture, raop_rtp->capture_session_id, RAOP_CAPTURE_AUDIO_DATA, packet, packetlen);
+        }
+        raop_rtp_process_data(raop_rtp, packet, packetlen);
+    }
+}
+
+/* Posted to when volume, flush, metadata, coverart, remote control or progress are set */
+static void
+raop_rtp_events_handler(void *cls, int events)
+{
+    raop_rtp_process_events(cls, NULL);
 }
 
 // Start rtp service, three udp ports
@@ -722,7 +761,7 @@ raop_rtp_start_audio(raop_rtp_t *raop_rtp, int use_udp, unsigned short control_r
     assert(data_lport);
 
     MUTEX_LOCK(raop_rtp->run_mutex);
-    if (raop_rtp->running || !raop_rtp->joined) {
+    if (raop_rtp->csource) {
         MUTEX_UNLOCK(raop_rtp->run_mutex);
         return;
     }
@@ -744,14 +783,53 @@ raop_rtp_start_audio(raop_rtp_t *raop_rtp, int use_udp, unsigned short control_r
     }
     *control_lport = raop_rtp->control_lport;
     *data_lport = raop_rtp->data_lport;
-    /* Create the thread and initialize running values */
-    raop_rtp->running = 1;
-    raop_rtp->joined = 0;
 
-    THREAD_CREATE(raop_rtp->thread, raop_rtp_thread_udp, raop_rtp);
+    raop_rtp->ntp_start_time = raop_ntp_get_local_time(raop_rtp->ntp);
+    raop_rtp->rtp_clock_started = false;
+    for (int i = 0; i < RAOP_RTP_SYNC_DATA_COUNT; i++) {
+        raop_rtp->sync_data[i].ntp_time = 0;
+    }
+    raop_rtp->have_synced = false;
+    raop_rtp->rtp_count = 0;
+    raop_rtp->initial_offset = 0;
+    raop_rtp->sync_adjustment = 0;
+    raop_rtp->delay = 0;
+    raop_rtp->seqnum1 = raop_rtp->seqnum2 = 0;
+    raop_rtp->offset_estimate_initialized = false;
+    logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp start_time = %8.6f (raop_rtp audio)",
+               ((double) raop_rtp->ntp_start_time) / SEC);
+
+    /* Hand the sockets to the reactor and initialize running values; *
+     * values set before the start are processed with the first packet  */
+    ATOMIC_STORE(raop_rtp->events_pending, 1);
+    ATOMIC_STORE(raop_rtp->running, 1);
+    raop_rtp->csource = reactor_source_add(raop_rtp->strand, raop_rtp->csock, raop_rtp_control_handler, raop_rtp);
+    raop_rtp->dsource = reactor_source_add(raop_rtp->strand, raop_rtp->dsock, raop_rtp_data_handler, raop_rtp);
+    raop_rtp->esource = reactor_source_add(raop_rtp->strand, -1, raop_rtp_events_handler, raop_rtp);
+    if (!raop_rtp->csource || !raop_rtp->dsource || !raop_rtp->esource) {
+        logger_log(raop_rtp->logger, LOGGER_ERR, "raop_rtp could not watch sockets");
+        ATOMIC_STORE(raop_rtp->running, 0);
+        reactor_source_remove(raop_rtp->csource);
+        reactor_source_remove(raop_rtp->dsource);
+        reactor_source_remove(raop_rtp->esource);
+        raop_rtp->csource = raop_rtp->dsource = raop_rtp->esource = NULL;
+        closesocket(raop_rtp->csock);
+        closesocket(raop_rtp->dsock);
+        raop_rtp->csock = raop_rtp->dsock = -1;
+    }
     MUTEX_UNLOCK(raop_rtp->run_mutex);
 }
 
+/* Called with run_mutex locked, after a value for raop_rtp_process_events has been set */
+static void
+raop_rtp_post_events(raop_rtp_t *raop_rtp)
+{
+    ATOMIC_STORE(raop_rtp->events_pending, 1);
+    if (raop_rtp->esource) {
+        reactor_source_post(raop_rtp->esource);
+    }
+}
+
 void
 raop_rtp_set_volume(raop_rtp_t *raop_rtp, float volume)
 {
@@ -767,6 +845,7 @@ raop_rtp_set_volume(raop_rtp_t *raop_rtp, float volume)
     MUTEX_LOCK(raop_rtp->run_mutex);
     raop_rtp->volume = volume;
     raop_rtp->volume_changed = 1;
+    raop_rtp_post_events(raop_rtp);
     MUTEX_UNLOCK(raop_rtp->run_mutex);
 }
 
@@ -788,6 +867,7 @@ raop_rtp_set_metadata(raop_rtp_t *raop_rtp, const char *data, int datalen)
     MUTEX_LOCK(raop_rtp->run_mutex);
     raop_rtp->metadata = metadata;
     raop_rtp->metadata_len = datalen;
+    raop_rtp_post_events(raop_rtp);
     MUTEX_UNLOCK(raop_rtp->run_mutex);
 }
 
@@ -809,6 +889,7 @@ raop_rtp_set_coverart(raop_rtp_t *raop_rtp, const char *data, int datalen)
     MUTEX_LOCK(raop_rtp->run_mutex);
     raop_rtp->coverart = coverart;
     raop_rtp->coverart_len = datalen;
+    raop_rtp_post_events(raop_rtp);
     MUTEX_UNLOCK(raop_rtp->run_mutex);
 }
 
@@ -831,6 +912,7 @@ raop_rtp_remote_control_id(raop_rtp_t *raop_rtp, const char *dacp_id, const char
       free(raop_rtp->active_remote_header);
     }
     raop_rtp->active_remote_header = strdup(active_remote_header);
+    raop_rtp_post_events(raop_rtp);
     MUTEX_UNLOCK(raop_rtp->run_mutex);
 }
 
@@ -845,6 +927,7 @@ raop_rtp_set_progress(raop_rtp_t *raop_rtp, unsigned int start, unsigned int cur
     raop_rtp->progress_curr = curr;
     raop_rtp->progress_end = end;
     raop_rtp->progress_changed = 1;
+    raop_rtp_post_events(raop_rtp);
     MUTEX_UNLOCK(raop_rtp->run_mutex);
 }
 
@@ -856,6 +939,7 @@ raop_rtp_flush(raop_rtp_t *raop_rtp, int next_seq)
     /* Call flush in thread instead */
     MUTEX_LOCK(raop_rtp->run_mutex);
     raop_rtp->flush = next_seq;
+    raop_rtp_post_events(raop_rtp);
     MUTEX_UNLOCK(raop_rtp->run_mutex);
 }
 
@@ -864,28 +948,35 @@ raop_rtp_stop(raop_rtp_t *raop_rtp)
 {
     assert(raop_rtp);
 
-    /* Check that we are running and thread is not
-     * joined (should never be while still running) */
+    /* Check that audio was started */
     MUTEX_LOCK(raop_rtp->run_mutex);
-    if (!raop_rtp->running || raop_rtp->joined) {
+    if (!raop_rtp->csource) {
         MUTEX_UNLOCK(raop_rtp->run_mutex);
         return;
     }
-    raop_rtp->running = 0;
+    ATOMIC_STORE(raop_rtp->running, 0);
+    reactor_source_t *csource = raop_rtp->csource;
+    reactor_source_t *dsource = raop_rtp->dsource;
+    reactor_source_t *esource = raop_rtp->esource;
+    raop_rtp->esource = NULL;
     MUTEX_UNLOCK(raop_rtp->run_mutex);
 
-    /* Join the thread */
-    THREAD_JOIN(raop_rtp->thread);
+    /* Waits for running handlers */
+    reactor_source_remove(csource);
+    reactor_source_remove(dsource);
+    reactor_source_remove(esource);
 
     if (raop_rtp->csock != -1) closesocket(raop_rtp->csock);
     if (raop_rtp->dsock != -1) closesocket(raop_rtp->dsock);
+    raop_rtp->csock = raop_rtp->dsock = -1;
 
     /* Flush buffer into initial state */
     raop_buffer_flush(raop_rtp->buffer, -1);
 
-    /* Mark thread as joined */
+    logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp stopped audio");
+
     MUTEX_LOCK(raop_rtp->run_mutex);
-    raop_rtp->joined = 1;
+    raop_rtp->csource = raop_rtp->dsource = NULL;
     MUTEX_UNLOCK(raop_rtp->run_mutex);
 }
 
@@ -894,7 +985,7 @@ raop_rtp_is_running(raop_rtp_t *raop_rtp)
 {
     assert(raop_rtp);
     MUTEX_LOCK(raop_rtp->run_mutex);
-    int running = raop_rtp->running;
+    int running = (int) raop_rtp->running;
     MUTEX_UNLOCK(raop_rtp->run_mutex);
     return running;
 }
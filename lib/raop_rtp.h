@@ -19,6 +19,8 @@
 #include "raop.h"
 #include "logger.h"
 #include "raop_ntp.h"
+#include "raop_capture.h"
+#include "metrics.h"
 
 #define RAOP_AESIV_LEN  16
 #define RAOP_AESKEY_LEN 16
@@ -26,12 +28,21 @@
 
 typedef struct raop_rtp_s raop_rtp_t;
 
-raop_rtp_t *raop_rtp_init(logger_t *logger, raop_callbacks_t *callbacks, raop_ntp_t *ntp, const unsigned char *remote, 
+raop_rtp_t *raop_rtp_init(logger_t *logger, raop_callbacks_t *callbacks, reactor_t *reactor, raop_ntp_t *ntp, const unsigned char *remote,
                           int remotelen, const unsigned char *aeskey, const unsigned char *aesiv);
 
 void raop_rtp_start_audio(raop_rtp_t *raop_rtp, int use_udp, unsigned short control_rport,
                           unsigned short *control_lport, unsigned short *data_lport, unsigned char ct);
 
+/* Received datagrams are written to capture (may be NULL) */
+void raop_rtp_set_capture(raop_rtp_t *raop_rtp, raop_capture_t *capture, int session_id);
+/* Counters and timings of the audio stream go to metrics (may be NULL) */
+void raop_rtp_set_metrics(raop_rtp_t *raop_rtp, metrics_session_t *metrics);
+
+/* Clock of the audio stream, used on the receive path (exposed for the benchmarks) */
+uint64_t rtp64_time(raop_rtp_t *raop_rtp, const uint32_t *rtp32);
+void raop_rtp_sync_clock(raop_rtp_t *raop_rtp, uint64_t ntp_time, uint64_t rtp_time, int shift);
+
 void raop_rtp_set_volume(raop_rtp_t *raop_rtp, float volume);
 void raop_rtp_set_metadata(raop_rtp_t *raop_rtp, const char *data, int datalen);
 void raop_rtp_set_coverart(raop_rtp_t *raop_rtp, const char *data, int datalen);
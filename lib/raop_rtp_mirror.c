@@ -32,8 +32,12 @@
 #include "stream.h"
 #include "utils.h"
 #include "plist/plist.h"
+#include "reactor.h"
+#include "trace.h"
+#include "h264_sps.h"
 
 #define SEC 1000000
+//#define DUMP_H264
 /* for MacOS, where SOL_TCP and TCP_KEEPIDLE are not defined */
 #if !defined(SOL_TCP) && defined(IPPROTO_TCP)
 #define SOL_TCP IPPROTO_TCP
@@ -56,6 +60,30 @@
 //    unsigned char version;
 //};
 
+/* State of a video payload whose NAL units are handed off while it is being received */
+typedef struct {
+    bool active;
+    bool done;                /* the access unit has been completed (or abandoned) */
+    bool first;               /* nothing of the access unit has been handed off yet */
+    bool prepend_sps_pps;
+    unsigned char *data;      /* decrypted payload, NAL length prefixes rewritten to start codes unless AVCC */
+    int decrypted;            /* bytes of the payload decrypted so far */
+    int handed_off;           /* bytes of the payload already passed to video_process_nal */
+    uint64_t pts;
+} raop_rtp_mirror_handoff_t;
+
+/* State and statistics of dropping late video frames */
+typedef struct {
+    bool dropping_gop;        /* dropping everything up to the next IDR frame */
+    uint64_t gop_drop_start;  /* local time the current GOP drop started */
+    int frames;
+    int dropped_nonref;
+    int dropped_gop;
+    int gop_drops;
+    uint64_t recovery_total;  /* time from starting a GOP drop to the next IDR frame */
+    uint64_t recovery_max;
+} raop_rtp_mirror_drop_t;
+
 struct raop_rtp_mirror_s {
     logger_t *logger;
     raop_callbacks_t callbacks;
@@ -70,26 +98,73 @@ struct raop_rtp_mirror_s {
 
     /* MUTEX LOCKED VARIABLES START */
     /* These variables only edited mutex locked */
-    int running;
-    int joined;
+    long running;   /* also read without the mutex by the handler */
 
     int flush;
-    thread_handle_t thread_mirror;
     mutex_handle_t run_mutex;
 
     /* MUTEX LOCKED VARIABLES END */
     int mirror_data_sock;
 
+    /* The listening socket, and then the accepted stream, are watched by one source of the reactor */
+    reactor_t *reactor;
+    reactor_strand_t *strand;
+    reactor_source_t *source;
+    int stream_fd;
+    bool finished;
+
+    /* The packet being received, only used on the strand */
+    unsigned char packet[128];
+    unsigned char *payload;
+    int payload_size;
+    unsigned int readstart;
+    uint64_t receive_start;   /* when the first bytes of the packet arrived (metrics_stage_begin) */
+    uint64_t trace_receive;   /* the same for the trace, 0 while tracing is stopped */
+    uint64_t ntp_timestamp_nal;
+    uint64_t ntp_timestamp_raw;
+    raop_rtp_mirror_handoff_t handoff;
+    raop_rtp_mirror_drop_t drop;
+#ifdef DUMP_H264
+    FILE *file;           /* decrypted */
+    FILE *file_source;    /* encrypted source */
+    FILE *file_len;
+#endif
+
     unsigned short mirror_data_lport;
 
      /* switch for displaying client FPS data */
      uint8_t show_client_FPS_data;
 
+    /* switch for handing off NAL units to video_process_nal as they are received */
+    uint8_t nal_handoff;
+
+    /* switch for passing on AVCC video data, with SPS and PPS sent to video_configure */
+    uint8_t avcc_passthrough;
+
+    /* latency (us) beyond which video frames are dropped, 0: never drop */
+    int64_t max_video_latency;
+
     /* SPS and PPS */
     int sps_pps_len;
     unsigned char* sps_pps;
     bool sps_pps_waiting;
 
+    /* hash of the last SPS and PPS, to recognize parameter sets sent again unchanged */
+    uint64_t sps_pps_hash;
+    bool sps_pps_hashed;
+    bool sps_pps_repeat;
+
+    /* after corrupt video data, frames that may reference it are skipped (see raop_rtp_mirror_gate_frame) */
+    bool corrupt_gating;
+    int corrupt_frames;
+    int corrupt_skipped;
+
+    /* optional capture of the received stream */
+    raop_capture_t *capture;
+    int capture_session_id;
+
+    /* optional metrics of the session, only updated on the strand */
+    metrics_session_t *metrics;
 };
 
 static int
@@ -120,13 +195,14 @@ raop_rtp_parse_remote(raop_rtp_mirror_t *raop_rtp_mirror, const unsigned char *r
 }
 
 #define NO_FLUSH (-42)
-raop_rtp_mirror_t *raop_rtp_mirror_init(logger_t *logger, raop_callbacks_t *callbacks, raop_ntp_t *ntp,
+raop_rtp_mirror_t *raop_rtp_mirror_init(logger_t *logger, raop_callbacks_t *callbacks, reactor_t *reactor, raop_ntp_t *ntp,
                                         const unsigned char *remote, int remotelen, const unsigned char *aeskey)
 {
     raop_rtp_mirror_t *raop_rtp_mirror;
 
     assert(logger);
     assert(callbacks);
+    assert(reactor);
 
     raop_rtp_mirror = calloc(1, sizeof(raop_rtp_mirror_t));
     if (!raop_rtp_mirror) {
@@ -137,6 +213,12 @@ raop_rtp_mirror_t *raop_rtp_mirror_init(logger_t *logger, raop_callbacks_t *call
     raop_rtp_mirror->sps_pps_len = 0;
     raop_rtp_mirror->sps_pps = NULL;
     raop_rtp_mirror->sps_pps_waiting = false;
+    raop_rtp_mirror->sps_pps_hash = 0;
+    raop_rtp_mirror->sps_pps_hashed = false;
+    raop_rtp_mirror->sps_pps_repeat = false;
+    raop_rtp_mirror->corrupt_gating = false;
+    raop_rtp_mirror->corrupt_frames = 0;
+    raop_rtp_mirror->corrupt_skipped = 0;
 
     memcpy(&raop_rtp_mirror->callbacks, callbacks, sizeof(raop_callbacks_t));
     raop_rtp_mirror->buffer = mirror_buffer_init(logger, aeskey);
@@ -148,8 +230,16 @@ raop_rtp_mirror_t *raop_rtp_mirror_init(logger_t *logger, raop_callbacks_t *call
         free(raop_rtp_mirror);
         return NULL;
     }
+    raop_rtp_mirror->reactor = reactor;
+    raop_rtp_mirror->strand = reactor_strand_init(reactor);
+    if (!raop_rtp_mirror->strand) {
+        mirror_buffer_destroy(raop_rtp_mirror->buffer);
+        free(raop_rtp_mirror);
+        return NULL;
+    }
     raop_rtp_mirror->running = 0;
-    raop_rtp_mirror->joined = 1;
+    raop_rtp_mirror->mirror_data_sock = -1;
+    raop_rtp_mirror->stream_fd = -1;
     raop_rtp_mirror->flush = NO_FLUSH;
 
     MUTEX_CREATE(raop_rtp_mirror->run_mutex);
@@ -162,428 +252,831 @@ raop_rtp_init_mirror_aes(raop_rtp_mirror_t *raop_rtp_mirror, uint64_t *streamCon
     mirror_buffer_init_aes(raop_rtp_mirror->buffer, streamConnectionID);
 }
 
-//#define DUMP_H264
+void
+raop_rtp_mirror_set_capture(raop_rtp_mirror_t *raop_rtp_mirror, raop_capture_t *capture, int session_id)
+{
+    raop_rtp_mirror->capture = capture;
+    raop_rtp_mirror->capture_session_id = session_id;
+}
 
-#define RAOP_PACKET_LEN 32768
-/**
- * Mirror
- */
-static THREAD_RETVAL
-raop_rtp_mirror_thread(void *arg)
+void
+raop_rtp_mirror_set_metrics(raop_rtp_mirror_t *raop_rtp_mirror, metrics_session_t *metrics)
 {
-    raop_rtp_mirror_t *raop_rtp_mirror = arg;
-    assert(raop_rtp_mirror);
+    raop_rtp_mirror->metrics = metrics;
+}
 
-    int stream_fd = -1;
-    unsigned char packet[128];
-    memset(packet, 0 , 128);
-    unsigned char* payload = NULL;
-    unsigned int readstart = 0;
-    bool conn_reset = false;
-    uint64_t ntp_timestamp_nal = 0;
-    uint64_t ntp_timestamp_raw = 0;
+bool
+raop_rtp_mirror_rewrite_nals(logger_t *logger, unsigned char *data, int size, bool avcc, int *nal_count, int *frame_type)
+{
     unsigned char nal_start_code[4] = { 0x00, 0x00, 0x00, 0x01 };
-
-#ifdef DUMP_H264
-    // C decrypted
-    FILE* file = fopen("/home/pi/Airplay.h264", "wb");
-    // Encrypted source file
-    FILE* file_source = fopen("/home/pi/Airplay.source", "wb");
-    FILE* file_len = fopen("/home/pi/Airplay.len", "wb");
-#endif
-
-    while (1) {
-        fd_set rfds;
-        struct timeval tv;
-        int nfds, ret;
-        MUTEX_LOCK(raop_rtp_mirror->run_mutex);
-        if (!raop_rtp_mirror->running) {
-            MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
-            logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror->running is no longer true");
+    bool valid_data = true;
+    int nalu_size = 0;
+    int nalus_count = 0;
+    int nalu_type;               /* 0x01 non-IDR VCL, 0x05 IDR VCL, 0x06 SEI 0x07 SPS, 0x08 PPS */
+    int type = H264_FRAME_UNKNOWN;
+    while (nalu_size < size) {
+        if (size - nalu_size < 4) {
+            valid_data = false;
             break;
         }
-        MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
+        /* compared without adding to nalu_size, which a huge length would overflow */
+        int nc_len = byteutils_get_int_be(data, nalu_size);
+        if (nc_len <= 0 || nc_len > size - nalu_size - 4) {
+            valid_data = false;
+            break;
+        }
+        if (!avcc) {
+            memcpy(data + nalu_size, nal_start_code, 4);
+        }
+        nalu_size += 4;
+        nalus_count++;
+        if (data[nalu_size] & 0x80) valid_data = false;  /* first bit of h264 nalu MUST be 0 ("forbidden_zero_bit") */
+        nalu_type = data[nalu_size] & 0x1f;
+        if (nalu_type == 5) {
+            type = H264_FRAME_IDR;
+        } else if (nalu_type == 1 && type != H264_FRAME_IDR && type != H264_FRAME_REF) {
+            /* nal_ref_idc = 0: no other picture references this slice's picture */
+            type = (data[nalu_size] & 0x60) ? H264_FRAME_REF : H264_FRAME_NONREF;
+        }
+        nalu_size += nc_len;
+        if (nalu_type != 1) {
+             logger_log(logger, LOGGER_DEBUG, "nalu_type = %d, nalu_size = %d,  processed bytes %d, payloadsize = %d nalus_count = %d",
+                        nalu_type, nc_len, nalu_size, size, nalus_count);
+        }
+    }
+    if (nalu_size != size) valid_data = false;
+    *nal_count = nalus_count;
+    *frame_type = type;
+    return valid_data;
+}
 
-        /* Set timeout valu to 5ms */
-        tv.tv_sec = 0;
-        tv.tv_usec = 5000;
+/* Corrupt video data breaks the reference chain: until decoding can start over at an IDR frame *
+ * (or at new parameter sets, see case 0x01 below), the frames after it are skipped instead of   *
+ * being decoded against broken references.  Returns true if the access unit is to be skipped;   *
+ * the corrupt one itself is passed on, flagged as H264_DATA_CORRUPT.                            */
+static bool
+raop_rtp_mirror_gate_frame(raop_rtp_mirror_t *raop_rtp_mirror, h264_validity_t validity, int frame_type)
+{
+    if (validity != H264_DATA_VALID) {
+        raop_rtp_mirror->corrupt_frames++;
+        metrics_count(raop_rtp_mirror->metrics, METRICS_VIDEO_CORRUPT, 1);
+        if (!raop_rtp_mirror->corrupt_gating) {
+            logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "raop_rtp_mirror: corrupt video data, skipping frames until the next IDR frame");
+        }
+        raop_rtp_mirror->corrupt_gating = true;
+        return false;
+    }
+    if (!raop_rtp_mirror->corrupt_gating) {
+        return false;
+    }
+    if (frame_type == H264_FRAME_IDR) {
+        raop_rtp_mirror->corrupt_gating = false;
+        logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror: video resumes at IDR frame after corrupt data");
+        return false;
+    }
+    raop_rtp_mirror->corrupt_skipped++;
+    return true;
+}
 
-        /* Get the correct nfds value and set rfds */
-        FD_ZERO(&rfds);
-        if (stream_fd == -1) {
-            FD_SET(raop_rtp_mirror->mirror_data_sock, &rfds);
-            nfds = raop_rtp_mirror->mirror_data_sock+1;
-        } else {
-            FD_SET(stream_fd, &rfds);
-            nfds = stream_fd+1;
+/* Decide whether to drop an access unit that arrived latency (us) after its timestamp.  *
+ * Over the latency budget, non-reference frames are dropped on their own; a reference   *
+ * frame can only be dropped together with the rest of its GOP, up to the next IDR frame. */
+static bool
+raop_rtp_mirror_drop_frame(raop_rtp_mirror_t *raop_rtp_mirror, raop_rtp_mirror_drop_t *drop, int frame_type,
+                           int64_t latency, uint64_t now)
+{
+    drop->frames++;
+    if (frame_type == H264_FRAME_IDR) {
+        if (drop->dropping_gop) {
+            uint64_t recovery = now - drop->gop_drop_start;
+            drop->recovery_total += recovery;
+            if (recovery > drop->recovery_max) drop->recovery_max = recovery;
+            drop->dropping_gop = false;
+            logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror: video resumes at IDR frame after %.3f seconds",
+                       ((double) recovery) / SEC);
         }
-        ret = select(nfds, &rfds, NULL, NULL, &tv);
-        if (ret == 0) {
-            /* Timeout happened */
-            continue;
-        } else if (ret == -1) {
-            logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror error in select");
-            break;
+        return false;
+    }
+    if (drop->dropping_gop) {
+        drop->dropped_gop++;
+        return true;
+    }
+    if (raop_rtp_mirror->max_video_latency == 0 || latency <= raop_rtp_mirror->max_video_latency) {
+        return false;
+    }
+    switch (frame_type) {
+    case H264_FRAME_NONREF:
+        drop->dropped_nonref++;
+        return true;
+    case H264_FRAME_REF:
+        drop->dropping_gop = true;
+        drop->gop_drop_start = now;
+        drop->gop_drops++;
+        drop->dropped_gop++;
+        logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "raop_rtp_mirror: video latency %.3f seconds exceeds %.3f, dropping frames until the next IDR frame",
+                   ((double) latency) / SEC, ((double) raop_rtp_mirror->max_video_latency) / SEC);
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Frame type (H264_FRAME_*) of the first slice NAL unit in length prefixed data,
+ * or H264_FRAME_UNKNOWN if it is not in data */
+static int
+raop_rtp_mirror_first_slice_type(unsigned char *data, int data_len)
+{
+    int offset = 0;
+    while (offset + 5 <= data_len) {
+        int nc_len = byteutils_get_int_be(data, offset);
+        int nalu_type = data[offset + 4] & 0x1f;
+        if (nalu_type == 5) {
+            return H264_FRAME_IDR;
+        } else if (nalu_type == 1) {
+            return (data[offset + 4] & 0x60) ? H264_FRAME_REF : H264_FRAME_NONREF;
+        }
+        if (nc_len <= 0 || nc_len > data_len - offset - 4) {
+            break;   /* the next NAL unit does not start in data */
         }
+        offset += 4 + nc_len;
+    }
+    return 0;
+}
 
-        if (stream_fd == -1 && FD_ISSET(raop_rtp_mirror->mirror_data_sock, &rfds)) {
-            struct sockaddr_storage saddr;
-            socklen_t saddrlen;
-            logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror accepting client");
-            saddrlen = sizeof(saddr);
-            stream_fd = accept(raop_rtp_mirror->mirror_data_sock, (struct sockaddr *)&saddr, &saddrlen);
-            if (stream_fd == -1) {
-                logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror error in accept %d %s", errno, strerror(errno));
-                break;
-            }
+/* Decrypt the newly received part of a video payload and hand off the NAL units it completes.
+ * Decryption must continue to the end of the payload even after the access unit has been
+ * abandoned, because the AES-CTR key stream runs on across payloads.                      */
+static void
+raop_rtp_mirror_handoff_nals(raop_rtp_mirror_t *raop_rtp_mirror, raop_rtp_mirror_handoff_t *handoff,
+                             unsigned char *payload, int received, int payload_size)
+{
+    unsigned char nal_start_code[4] = { 0x00, 0x00, 0x00, 0x01 };
+    h264_nal_struct nal_data;
 
-            // We're calling recv for a certain amount of data, so we need a timeout
-#ifndef WIN32
-            struct timeval tv;
-            tv.tv_sec = 0;
-            tv.tv_usec = 5000;
-            if (setsockopt(stream_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
-                logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror could not set stream socket timeout %d %s", errno, strerror(errno));
-                break;
+    if (received > handoff->decrypted) {
+        mirror_buffer_decrypt(raop_rtp_mirror->buffer, payload + handoff->decrypted,
+                              handoff->data + handoff->decrypted, received - handoff->decrypted);
+        handoff->decrypted = received;
+    }
+    if (handoff->done) {
+        return;
+    }
+    if (handoff->first && (raop_rtp_mirror->corrupt_gating || raop_rtp_mirror->max_video_latency > 0)) {
+        /* nothing has been handed off yet: the first slice tells whether the access unit can be decoded,
+         * and whether it is dropped for being late (see raop_rtp_mirror_drop_frame) */
+        int slice_type = raop_rtp_mirror_first_slice_type(handoff->data, handoff->decrypted);
+        if (slice_type == H264_FRAME_UNKNOWN && handoff->decrypted < payload_size) {
+            return;
+        }
+        uint64_t now = raop_ntp_get_local_time(raop_rtp_mirror->ntp);
+        int64_t latency = ((int64_t) now) - ((int64_t) handoff->pts);
+        if (raop_rtp_mirror_gate_frame(raop_rtp_mirror, H264_DATA_VALID, slice_type) ||
+            raop_rtp_mirror_drop_frame(raop_rtp_mirror, &raop_rtp_mirror->drop, slice_type, latency, now)) {
+            if (handoff->prepend_sps_pps) {
+                /* the parameter sets go with the next frame that is handed off */
+                raop_rtp_mirror->sps_pps_waiting = true;
             }
-#else
-            int timeout = 5000;//这里win32设置了5s，因为网络不稳定 or win10系统容易出问题 不确定是不是后两个导致非win系统没有出现超时的情况
-            if (setsockopt(stream_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
-                logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror could not set stream socket timeout %d %s", errno, strerror(errno));
-                break;
+            metrics_count(raop_rtp_mirror->metrics, METRICS_VIDEO_DROPPED, 1);
+            handoff->done = true;
+            return;
+        }
+    }
+
+    bool valid_data = true;
+    int nalu_size = handoff->handed_off;
+    int nalus_count = 0;
+    int frame_type = H264_FRAME_UNKNOWN;
+    while (nalu_size + 4 <= handoff->decrypted) {
+        int nc_len = byteutils_get_int_be(handoff->data, nalu_size);
+        if (nc_len < 0 || nc_len > payload_size - nalu_size - 4) {
+            valid_data = false;
+            break;
+        }
+        if (nalu_size + 4 + nc_len > handoff->decrypted) {
+            break;   /* this NAL unit has not been received completely yet */
+        }
+        if (nc_len > 0 && (handoff->data[nalu_size + 4] & 0x80)) {
+            valid_data = false;   /* first bit of h264 nalu MUST be 0 ("forbidden_zero_bit") */
+            break;
+        }
+        if (nc_len > 0) {
+            int nalu_type = handoff->data[nalu_size + 4] & 0x1f;
+            if (nalu_type == 5 || nalu_type == 7) {
+                frame_type = H264_FRAME_IDR;
+            } else if (nalu_type == 1 && frame_type != H264_FRAME_IDR && frame_type != H264_FRAME_REF) {
+                frame_type = (handoff->data[nalu_size + 4] & 0x60) ? H264_FRAME_REF : H264_FRAME_NONREF;
             }
+        }
+        if (!raop_rtp_mirror->avcc_passthrough) {
+            memcpy(handoff->data + nalu_size, nal_start_code, 4);
+        }
+        nalu_size += 4 + nc_len;
+        nalus_count++;
+    }
+    if (!valid_data) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "nalu marked as invalid, access unit ends after %d bytes", nalu_size);
+    }
+    bool last = (!valid_data || nalu_size == payload_size);
+    if (nalu_size == handoff->handed_off && !last) {
+        return;
+    }
+
+    if (handoff->first && handoff->prepend_sps_pps) {
+        nal_data.pts = handoff->pts;
+        nal_data.nal_count = 2;
+        nal_data.data = raop_rtp_mirror->sps_pps;
+        nal_data.data_len = raop_rtp_mirror->sps_pps_len;
+        nal_data.first = true;
+        nal_data.last = false;
+        nal_data.frame_type = H264_FRAME_IDR;
+        nal_data.validity = H264_DATA_VALID;
+        raop_rtp_mirror->callbacks.video_process_nal(raop_rtp_mirror->callbacks.cls, raop_rtp_mirror->ntp, &nal_data);
+        raop_rtp_mirror->sps_pps_waiting = false;
+        handoff->first = false;
+    }
+    nal_data.pts = handoff->pts;
+    nal_data.nal_count = nalus_count;
+    nal_data.data = handoff->data + handoff->handed_off;
+    nal_data.data_len = nalu_size - handoff->handed_off;
+    nal_data.first = handoff->first;
+    nal_data.last = last;
+    nal_data.frame_type = frame_type;
+    nal_data.validity = valid_data ? H264_DATA_VALID : H264_DATA_CORRUPT;
+    if (!valid_data) {
+        raop_rtp_mirror_gate_frame(raop_rtp_mirror, H264_DATA_CORRUPT, H264_FRAME_UNKNOWN);
+    }
+    raop_rtp_mirror->callbacks.video_process_nal(raop_rtp_mirror->callbacks.cls, raop_rtp_mirror->ntp, &nal_data);
+    handoff->first = false;
+    handoff->handed_off = nalu_size;
+    handoff->done = last;
+}
+
+#define RAOP_PACKET_LEN 32768
+
+#define RAOP_RTP_MIRROR_PACKET_BATCH 16   /* packets received per handler call, before other work on the reactor */
+#define RAOP_RTP_MIRROR_MAX_PAYLOAD (16 * 1024 * 1024)   /* larger payload sizes are taken as a broken stream */
+
+/* Called on the strand for each packet that has been received completely */
+static void
+raop_rtp_mirror_process_packet(raop_rtp_mirror_t *raop_rtp_mirror)
+{
+    unsigned char *packet = raop_rtp_mirror->packet;
+    unsigned char *payload = raop_rtp_mirror->payload;
+    int payload_size = raop_rtp_mirror->payload_size;
+    unsigned char nal_start_code[4] = { 0x00, 0x00, 0x00, 0x01 };
+
+    switch (packet[4]) {
+    case  0x00:
+        // Normal video data (VCL NAL)
+
+        // Conveniently, the video data is already stamped with the remote wall clock time,
+        // so no additional clock syncing needed. The only thing odd here is that the video
+        // ntp time stamps don't include the SECONDS_FROM_1900_TO_1970, so it's really just
+        // counting micro seconds since last boot.
+        raop_rtp_mirror->ntp_timestamp_raw = byteutils_get_long(packet, 8);
+        uint64_t ntp_timestamp_remote = raop_ntp_timestamp_to_micro_seconds(raop_rtp_mirror->ntp_timestamp_raw, false);
+        uint64_t ntp_timestamp = raop_ntp_convert_remote_time(raop_rtp_mirror->ntp, ntp_timestamp_remote);
+
+        uint64_t ntp_now = raop_ntp_get_local_time(raop_rtp_mirror->ntp);
+        int64_t latency = ((int64_t) ntp_now) - ((int64_t) ntp_timestamp);
+        logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp video: now = %8.6f, ntp = %8.6f, latency = %8.6f",
+                   ((double) ntp_now) / SEC, ((double) ntp_timestamp) / SEC, ((double) latency) / SEC);
+        metrics_count(raop_rtp_mirror->metrics, METRICS_VIDEO_FRAMES, 1);
+        metrics_count(raop_rtp_mirror->metrics, METRICS_VIDEO_BYTES, payload_size);
+        metrics_record(raop_rtp_mirror->metrics, METRICS_VIDEO_LATENCY_RECEIVED, latency);
+        TRACE_END("video", "receive", ntp_timestamp, raop_rtp_mirror->trace_receive);
+
+        if (raop_rtp_mirror->handoff.active) {
+            // The NAL units have already been handed off while the payload was received
+            raop_rtp_mirror_handoff_nals(raop_rtp_mirror, &raop_rtp_mirror->handoff, payload, payload_size, payload_size);
+            free(raop_rtp_mirror->handoff.data);
+            raop_rtp_mirror->handoff.data = NULL;
+            raop_rtp_mirror->handoff.active = false;
+            break;
+        }
+
+#ifdef DUMP_H264
+        fwrite(payload, payload_size, 1, raop_rtp_mirror->file_source);
+        fwrite(&payload_size, sizeof(payload_size), 1, raop_rtp_mirror->file_len);
 #endif
-            int option;
-            option = 1;
-            if (setsockopt(stream_fd, SOL_SOCKET, SO_KEEPALIVE, &option, sizeof(option)) < 0) {
-                logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "raop_rtp_mirror could not set stream socket keepalive %d %s", errno, strerror(errno));
-            }
-            #ifndef WIN32
-            option = 60;
-            if (setsockopt(stream_fd, SOL_TCP, TCP_KEEPIDLE, &option, sizeof(option)) < 0) {
-                logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "raop_rtp_mirror could not set stream socket keepalive time %d %s", errno, strerror(errno));
-            }
-            option = 10;
-            if (setsockopt(stream_fd, SOL_TCP, TCP_KEEPINTVL, &option, sizeof(option)) < 0) {
-                logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "raop_rtp_mirror could not set stream socket keepalive interval %d %s", errno, strerror(errno));
+        refbuf_t* payload_out;
+        unsigned char* payload_decrypted;
+        if (!raop_rtp_mirror->sps_pps_waiting && packet[5] != 0x00 && !raop_rtp_mirror->avcc_passthrough &&
+            !raop_rtp_mirror->sps_pps_repeat) {
+            logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "unexpected: packet[5] = %2.2x, but  not preceded  by SPS+PPS packet", packet[5]);
+        }
+        /* if a previous unencrypted packet contains an SPS (type 7) and PPS (type 8) NAL which has not 
+         * yet been sent, it should be prepended to the current NAL.    In this case packet[5] is usually 
+         * 0x10; however, the M1 Macs have increased the h264 level, and now the encrypted packet after the
+         * unencrypted SPS+PPS packet may contain a SEI (type 6) NAL prepended to the next VCL NAL, with
+         * packet[5] = 0x00.   Now the flag raop_rtp_mirror->sps_pps_waiting = true will signal that a 
+         * previous packet contained a SPS NAL + a PPS NAL, that has not yet been sent.   This will trigger
+         * prepending it to the current NAL, and the sps_pps_waiting flag will be set to false after
+         * it has been prepended.    It is not clear if the case packet[5] = 0x10 will occur when
+         * raop_rtp_mirror->sps_pps = false, but if it does, the current code will prepend the stored
+         * PPS + SPS NAL to the current encrypted NAL, and issue a warning message */
+
+        /* With AVCC pass-through, the parameter sets have already been sent to video_configure */
+        /* Unchanged parameter sets that the client sent again are not prepended either */
+        bool prepend_sps_pps = !raop_rtp_mirror->avcc_passthrough &&
+                               (raop_rtp_mirror->sps_pps_waiting || (packet[5] != 0x00 && !raop_rtp_mirror->sps_pps_repeat));
+        if (prepend_sps_pps) {
+            assert(raop_rtp_mirror->sps_pps);
+            payload_out = refbuf_alloc(payload_size + raop_rtp_mirror->sps_pps_len);
+            payload_decrypted = payload_out->data + raop_rtp_mirror->sps_pps_len;
+            memcpy(payload_out->data, raop_rtp_mirror->sps_pps, raop_rtp_mirror->sps_pps_len);
+            raop_rtp_mirror->sps_pps_waiting = false;
+        } else {
+            payload_out = refbuf_alloc(payload_size);
+            payload_decrypted = payload_out->data;
+        }
+        // Decrypt data
+        uint64_t decrypt_start = metrics_stage_begin(raop_rtp_mirror->metrics);
+        uint64_t span_start = TRACE_BEGIN();
+        mirror_buffer_decrypt(raop_rtp_mirror->buffer, payload, payload_decrypted, payload_size);
+        metrics_stage_end(raop_rtp_mirror->metrics, METRICS_VIDEO_DECRYPT, decrypt_start);
+        TRACE_END("video", "decrypt", ntp_timestamp, span_start);
+        span_start = TRACE_BEGIN();
+
+        // It seems the AirPlay protocol prepends NALs with their size, which we're replacing with the 4-byte
+        // start code for the NAL Byte-Stream Format (unless the renderer takes AVCC, i.e. length prefixed NALs).
+        int nalus_count;
+        int frame_type;
+        bool valid_data = raop_rtp_mirror_rewrite_nals(raop_rtp_mirror->logger, payload_decrypted, payload_size,
+                                                       raop_rtp_mirror->avcc_passthrough, &nalus_count, &frame_type);
+        TRACE_END("video", "nal", ntp_timestamp, span_start);
+        if(!valid_data) {
+            /* signalled through h264_data.validity, the payload itself is left as it is: patching a start code
+             * byte would corrupt the length prefix of AVCC data */
+            logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "nalu marked as invalid");
+            frame_type = H264_FRAME_UNKNOWN;
+        }
+#ifdef DUMP_H264
+        fwrite(payload_decrypted, payload_size, 1, raop_rtp_mirror->file);
+#endif
+        payload_decrypted = NULL;
+        h264_validity_t validity = valid_data ? H264_DATA_VALID : H264_DATA_CORRUPT;
+        if (raop_rtp_mirror_gate_frame(raop_rtp_mirror, validity, frame_type) ||
+            raop_rtp_mirror_drop_frame(raop_rtp_mirror, &raop_rtp_mirror->drop, frame_type, latency, ntp_now)) {
+            if (prepend_sps_pps) {
+                /* the parameter sets go with the next frame that is passed on */
+                raop_rtp_mirror->sps_pps_waiting = true;
             }
-            option = 6;
-            if (setsockopt(stream_fd, SOL_TCP, TCP_KEEPCNT, &option, sizeof(option)) < 0) {
-                logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "raop_rtp_mirror could not set stream socket keepalive probes %d %s", errno, strerror(errno));
+            metrics_count(raop_rtp_mirror->metrics, METRICS_VIDEO_DROPPED, 1);
+            refbuf_unref(payload_out);
+            break;
+        }
+        h264_decode_struct h264_data;
+        h264_data.pts = ntp_timestamp;
+        h264_data.nal_count = nalus_count;   /*nal_count will be the number of nal units in the packet */
+        h264_data.data_len = payload_size;
+        h264_data.data = payload_out->data;
+        h264_data.buf = payload_out;
+        h264_data.frame_type = frame_type;
+        h264_data.validity = validity;
+        if (validity != H264_DATA_VALID && prepend_sps_pps) {
+            /* the corrupt frame is not decoded, the next one needs the parameter sets */
+            raop_rtp_mirror->sps_pps_waiting = true;
+        }
+        if (prepend_sps_pps) {
+            h264_data.data_len += raop_rtp_mirror->sps_pps_len;
+            h264_data.nal_count += 2;
+            if (raop_rtp_mirror->ntp_timestamp_raw != raop_rtp_mirror->ntp_timestamp_nal) {
+                logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "raop_rtp_mirror: prepended sps_pps timestamp does not match that of video payload");
             }
-            #endif
-            readstart = 0;
+        }
+        uint64_t enqueue_start = metrics_stage_begin(raop_rtp_mirror->metrics);
+        span_start = TRACE_BEGIN();
+        raop_rtp_mirror->callbacks.video_process(raop_rtp_mirror->callbacks.cls, raop_rtp_mirror->ntp, &h264_data);
+        metrics_stage_end(raop_rtp_mirror->metrics, METRICS_VIDEO_ENQUEUE, enqueue_start);
+        TRACE_END("video", "enqueue", ntp_timestamp, span_start);
+        refbuf_unref(payload_out);
+        break;
+    case 0x01:
+        // The information in the payload contains an SPS and a PPS NAL
+        // The sps_pps is not encrypted
+        raop_rtp_mirror->ntp_timestamp_nal = byteutils_get_long(packet, 8);
+        float width = byteutils_get_float(packet, 16);
+        float height = byteutils_get_float(packet, 20);
+        float width_source = byteutils_get_float(packet, 40);
+        float height_source = byteutils_get_float(packet, 44);
+        if (width != width_source || height != height_source) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror: Unexpected : data  %f, %f != width_source = %f, height_source = %f",
+                   width, height, width_source, height_source);
+        }
+        width = byteutils_get_float(packet, 48);
+        height = byteutils_get_float(packet, 52);
+        logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror: unidentified extra header data  %f, %f", width, height);
+        width = byteutils_get_float(packet, 56);
+        height = byteutils_get_float(packet, 60);
+        if (raop_rtp_mirror->callbacks.video_report_size) {
+            raop_rtp_mirror->callbacks.video_report_size(raop_rtp_mirror->callbacks.cls, &width_source, &height_source, &width, &height);
+        }
+        logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror width_source = %f height_source = %f width = %f height = %f",
+                   width_source, height_source, width, height);
+
+        // avcC record: 6 byte header, SPS size and SPS, PPS count, PPS size and PPS, maybe more after that
+        short sps_size = byteutils_get_short_be(payload,6);
+        if (sps_size <= 0 || sps_size + 11 > payload_size) {
+            logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror: invalid sps size %d in %d byte sps/pps packet, dropped",
+                       sps_size, payload_size);
+            break;
+        }
+        unsigned char *sequence_parameter_set = payload + 8;
+        short pps_size = byteutils_get_short_be(payload, sps_size + 9);
+        if (pps_size <= 0 || sps_size + pps_size + 11 > payload_size) {
+            logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror: invalid pps size %d in %d byte sps/pps packet, dropped",
+                       pps_size, payload_size);
+            break;
+        }
+        unsigned char *picture_parameter_set = payload + sps_size + 11;
+        int avcc_len = sps_size + pps_size + 11;   /* validated above, within the payload */
+        int data_size = 6; 
+        char *str = utils_data_to_string(payload, data_size, 16);
+        logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror: sps/pps header size = %d", data_size);		
+        logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror h264 sps/pps header:\n%s", str);
+        free(str);
+        str = utils_data_to_string(sequence_parameter_set, sps_size,16);
+        logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror sps size = %d",  sps_size);		
+        logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror h264 Sequence Parameter Set:\n%s", str);
+        free(str);
+        str = utils_data_to_string(picture_parameter_set, pps_size, 16);
+        logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror pps size = %d", pps_size);
+        logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror h264 Picture Parameter Set:\n%s", str);
+        free(str);
+        data_size = payload_size - avcc_len;
+        if (data_size > 0) {
+            str = utils_data_to_string (picture_parameter_set + pps_size, data_size, 16);
+            logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "remainder size = %d", data_size);
+            logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "remainder of sps+pps packet:\n%s", str);
+            free(str);
         }
 
-        if (stream_fd != -1 && FD_ISSET(stream_fd, &rfds)) {
+        if (raop_rtp_mirror->corrupt_gating) {
+            // Parameter sets come with a new IDR frame
+            raop_rtp_mirror->corrupt_gating = false;
+            logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror: video resumes at new SPS and PPS after corrupt data");
+        }
 
-            // The first 128 bytes are some kind of header for the payload that follows
-            while (payload == NULL && readstart < 128) {
-                ret = recv(stream_fd, packet + readstart, 128 - readstart, 0);
-                if (ret <= 0) break;
-                readstart = readstart + ret;
+        // Clients often resend identical parameter sets; passing them on again can make decoders reinitialize
+        uint64_t sps_pps_hash = utils_hash_data(payload, avcc_len);
+        raop_rtp_mirror->sps_pps_repeat = (raop_rtp_mirror->sps_pps_hashed && sps_pps_hash == raop_rtp_mirror->sps_pps_hash);
+        if (raop_rtp_mirror->sps_pps_repeat) {
+            logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror: unchanged SPS and PPS sent again, not passed on");
+            break;
+        }
+        if (raop_rtp_mirror->callbacks.video_format_changed) {
+            h264_format_struct h264_format;
+            // The picture size coded in the SPS is what the decoder outputs; the header values are a fallback
+            if (!h264_sps_get_size(sequence_parameter_set, sps_size, &h264_format.width, &h264_format.height)) {
+                logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "raop_rtp_mirror: could not parse SPS, using the header video size");
+                h264_format.width = (int) width;
+                h264_format.height = (int) height;
             }
+            h264_format.profile_idc = payload[1];
+            h264_format.constraint_flags = payload[2];
+            h264_format.level_idc = payload[3];
+            h264_format.first = !raop_rtp_mirror->sps_pps_hashed;
+            logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror: video format %dx%d, h264 profile %d level %d",
+                       h264_format.width, h264_format.height, h264_format.profile_idc, h264_format.level_idc);
+            raop_rtp_mirror->callbacks.video_format_changed(raop_rtp_mirror->callbacks.cls, raop_rtp_mirror->ntp, &h264_format);
+        }
+        raop_rtp_mirror->sps_pps_hash = sps_pps_hash;
+        raop_rtp_mirror->sps_pps_hashed = true;
+
+        if (raop_rtp_mirror->avcc_passthrough) {
+            // The payload is an avcC record: hand it over as is, instead of prepending SPS and PPS to the next NAL unit
+            h264_config_struct h264_config;
+            h264_config.avcc = payload;
+            h264_config.avcc_len = avcc_len;
+            h264_config.pts = raop_ntp_convert_remote_time(raop_rtp_mirror->ntp,
+                              raop_ntp_timestamp_to_micro_seconds(raop_rtp_mirror->ntp_timestamp_nal, false));
+            raop_rtp_mirror->callbacks.video_configure(raop_rtp_mirror->callbacks.cls, raop_rtp_mirror->ntp, &h264_config);
+            break;
+        }
 
-            if (payload == NULL && ret == 0) {
-                logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror tcp socket is closed, got %d bytes of 128 byte header",readstart);
-                FD_CLR(stream_fd, &rfds);
-                stream_fd = -1;
-                continue;
-            } else if (payload == NULL && ret == -1) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) continue; // Timeouts can happen even if the connection is fine
-                logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror error  in header recv: %d %s", errno, strerror(errno));
-                if (errno == ECONNRESET) conn_reset = true;; 
-                break;
-            }
+        // Copy the sps and pps into a buffer to prepend to the next NAL unit.
+        raop_rtp_mirror->sps_pps_len = sps_size + pps_size + 8;
+        if (raop_rtp_mirror->sps_pps) {
+            free(raop_rtp_mirror->sps_pps);
+        }
+        raop_rtp_mirror->sps_pps = (unsigned char*) malloc(raop_rtp_mirror->sps_pps_len);
+        assert(raop_rtp_mirror->sps_pps);
+        memcpy(raop_rtp_mirror->sps_pps, nal_start_code, 4);
+        memcpy(raop_rtp_mirror->sps_pps + 4, sequence_parameter_set, sps_size);
+        memcpy(raop_rtp_mirror->sps_pps + sps_size + 4, nal_start_code, 4); 
+        memcpy(raop_rtp_mirror->sps_pps + sps_size + 8, payload + sps_size + 11, pps_size);
+        raop_rtp_mirror->sps_pps_waiting = true;
+#ifdef DUMP_H264
+        fwrite(raop_rtp_mirror->sps_pps, raop_rtp_mirror->sps_pps_len, 1, raop_rtp_mirror->file);
+#endif
 
-            /*packet[0:3] contains the payload size */
-            int payload_size = byteutils_get_int(packet, 0);
+        // h264codec_t h264;
+        // h264.version = payload[0];
+        // h264.profile_high = payload[1];
+        // h264.compatibility = payload[2];
+        // h264.level = payload[3];
+        // h264.reserved_6_and_nal = payload[4];
+        // h264.reserved_3_and_sps = payload[5];
+        // h264.sps_size =  sps_size;
+        // h264.sequence_parameter_set = malloc(h264.sps_size);
+        // memcpy(h264.sequence_parameter_set, sequence_parameter_set, sps_size);
+        // h264.number_of_pps = payload[h264.sps_size + 8];
+        // h264.pps_size = pps_size;
+        // h264.picture_parameter_set = malloc(h264.pps_size);
+        // memcpy(h264.picture_parameter_set, picture_parameter_set, pps_size);
+
+        break;
+    case 0x05:
+        logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "\nReceived video streaming performance info packet from client");
+        /* payloads with packet[4] = 0x05 have no timestamp, and carry video info from the client as a binary plist *
+         * Sometimes (e.g, when the client has a locked screen), there is a 25kB trailer attached to the packet.    *
+         * This 25000 Byte trailer with unidentified content seems to be the same data each time it is sent.        */
+
+        if (payload_size && raop_rtp_mirror->show_client_FPS_data) {
+            //char *str = utils_data_to_string(packet, 128, 16);
+            //logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "type 5 video packet header:\n%s", str);
+            //free (str);
+
+            int plist_size = payload_size;
+            if (payload_size > 25000) {
+                plist_size = payload_size - 25000;
+                char *str = utils_data_to_string(payload + plist_size, 16, 16);
+                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "video_info packet had 25kB trailer; first 16 bytes are:\n%s", str);
+                free(str);
+            }
+            if (plist_size) {
+                char *plist_xml;
+                uint32_t plist_len;
+                plist_t root_node = NULL;
+                plist_from_bin((char *) payload, plist_size, &root_node);
+                plist_to_xml(root_node, &plist_xml, &plist_len);
+                logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "%s", plist_xml);
+                free(plist_xml);
+            }
+        }
+        break;
+    default:
+        logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "\nReceived unexpected TCP packet from client, packet[4] = 0x%2.2x", packet[4]);
+        break;
+    }
+}
 
-            /* packet[4] appears to have one of three possible values:                           *
-             * 0x00 : encrypted packet                                                           *    
-             * 0x01 : unencrypted packet with a SPS and a PPS NAL, sent initially, and also when *
-             *        a change in video format (e.g., width, height) subsequently occurs         *
-             * 0x05 : unencrypted packet with a "streaming report", sent once per second         */
+static void
+raop_rtp_mirror_close_stream(raop_rtp_mirror_t *raop_rtp_mirror)
+{
+    if (raop_rtp_mirror->stream_fd != -1) {
+        closesocket(raop_rtp_mirror->stream_fd);
+        raop_rtp_mirror->stream_fd = -1;
+    }
+    if (raop_rtp_mirror->payload) {
+        free(raop_rtp_mirror->payload);
+        raop_rtp_mirror->payload = NULL;
+    }
+    if (raop_rtp_mirror->handoff.data) {
+        free(raop_rtp_mirror->handoff.data);
+        raop_rtp_mirror->handoff.data = NULL;
+    }
+    raop_rtp_mirror->handoff.active = false;
+    memset(raop_rtp_mirror->packet, 0, 128);
+    raop_rtp_mirror->readstart = 0;
+}
 
-            /* encrypted packets have packet[5] = 0x00 or 0x10, and packet[6]= packet[7] = 0x00; *
-             * encrypted packets immediately following an unencrypted SPS/PPS packet appear to   *
-             * be the only ones with packet[5] = 0x10, and almost always have packet[5] = 0x10,  *
-             * but occasionally have packet[5] = 0x00.                                           */
+/* Logs what happened to the video frames, when the stream ends or is stopped */
+static void
+raop_rtp_mirror_finish(raop_rtp_mirror_t *raop_rtp_mirror)
+{
+    raop_rtp_mirror_drop_t *drop = &raop_rtp_mirror->drop;
+    if (raop_rtp_mirror->finished) {
+        return;
+    }
+    raop_rtp_mirror->finished = true;
+    if (raop_rtp_mirror->corrupt_frames) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror: %d corrupt video frames, %d frames skipped after them",
+                   raop_rtp_mirror->corrupt_frames, raop_rtp_mirror->corrupt_skipped);
+    }
+    if (drop->dropped_nonref || drop->gop_drops) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror: dropped %d of %d video frames: %d non-reference, "
+                   "%d in %d GOPs (recovery average %.3f, max %.3f seconds)", drop->dropped_nonref + drop->dropped_gop, drop->frames,
+                   drop->dropped_nonref, drop->dropped_gop, drop->gop_drops,
+                   drop->gop_drops ? ((double) drop->recovery_total) / SEC / drop->gop_drops : 0.0, ((double) drop->recovery_max) / SEC);
+    }
+}
 
-            /* unencrypted SPS/PPS packets have packet[4:7] = 0x01 0x00 0x01 0x16                *
-             * they are followed by an encrypted packet with the same timestamp in packet[8:15]  */
+/* Returns -1 if the mirror stream cannot be received */
+static int
+raop_rtp_mirror_accept(raop_rtp_mirror_t *raop_rtp_mirror)
+{
+    struct sockaddr_storage saddr;
+    socklen_t saddrlen = sizeof(saddr);
+    logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror accepting client");
+    int stream_fd = accept(raop_rtp_mirror->mirror_data_sock, (struct sockaddr *)&saddr, &saddrlen);
+    if (stream_fd == -1) {
+        if (reactor_would_block()) return 0;
+        logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror error in accept %d %s", errno, strerror(errno));
+        return -1;
+    }
 
-            /* "streaming report" packages have packet[4:7] = 0x05 0x00 0x00 0x00, and have no    *
-             * timestamp in packet[8:15]                                                         */
+    int option;
+    option = 1;
+    if (setsockopt(stream_fd, SOL_SOCKET, SO_KEEPALIVE, &option, sizeof(option)) < 0) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "raop_rtp_mirror could not set stream socket keepalive %d %s", errno, strerror(errno));
+    }
+    #ifndef WIN32
+    option = 60;
+    if (setsockopt(stream_fd, SOL_TCP, TCP_KEEPIDLE, &option, sizeof(option)) < 0) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "raop_rtp_mirror could not set stream socket keepalive time %d %s", errno, strerror(errno));
+    }
+    option = 10;
+    if (setsockopt(stream_fd, SOL_TCP, TCP_KEEPINTVL, &option, sizeof(option)) < 0) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "raop_rtp_mirror could not set stream socket keepalive interval %d %s", errno, strerror(errno));
+    }
+    option = 6;
+    if (setsockopt(stream_fd, SOL_TCP, TCP_KEEPCNT, &option, sizeof(option)) < 0) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "raop_rtp_mirror could not set stream socket keepalive probes %d %s", errno, strerror(errno));
+    }
+    #endif
 
-            //unsigned short payload_type = byteutils_get_short(packet, 4) & 0xff;
-            //unsigned short payload_option = byteutils_get_short(packet, 6);
+    // From now on the stream is watched instead of the listening socket
+    if (reactor_source_set_fd(raop_rtp_mirror->source, stream_fd) < 0) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror could not watch stream socket");
+        closesocket(stream_fd);
+        return -1;
+    }
+    raop_rtp_mirror->stream_fd = stream_fd;
+    raop_rtp_mirror->readstart = 0;
+    return 0;
+}
 
-            if (payload == NULL) {
-                payload = malloc(payload_size);
-                readstart = 0;
-            }
+#define RAOP_RTP_MIRROR_RECV_AGAIN     0   /* the socket would block */
+#define RAOP_RTP_MIRROR_RECV_COMPLETE  1   /* header and payload of a packet have been received */
+#define RAOP_RTP_MIRROR_RECV_CLOSED   -1   /* the client closed the connection between packets */
+#define RAOP_RTP_MIRROR_RECV_ERROR    -2
 
-            while (readstart < payload_size) {
-                // Payload data
-                ret = recv(stream_fd, payload + readstart, payload_size - readstart, 0);
-                if (ret <= 0) break;
-                readstart = readstart + ret;
-            }
+/* Receives what is available of the current packet, the socket does not block */
+static int
+raop_rtp_mirror_receive(raop_rtp_mirror_t *raop_rtp_mirror, bool *conn_reset)
+{
+    unsigned char *packet = raop_rtp_mirror->packet;
+    int stream_fd = raop_rtp_mirror->stream_fd;
+    int ret;
 
+    if (raop_rtp_mirror->payload == NULL) {
+        // The first 128 bytes are some kind of header for the payload that follows
+        while (raop_rtp_mirror->readstart < 128) {
+            ret = recv(stream_fd, packet + raop_rtp_mirror->readstart, 128 - raop_rtp_mirror->readstart, 0);
             if (ret == 0) {
-                logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror tcp socket is closed");
-                break;
+                logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror tcp socket is closed, got %d bytes of 128 byte header",
+                           raop_rtp_mirror->readstart);
+                return RAOP_RTP_MIRROR_RECV_CLOSED;
             } else if (ret == -1) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) continue; // Timeouts can happen even if the connection is fine
-                logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror error in recv: %d %s", errno, strerror(errno));
-                if (errno == ECONNRESET) conn_reset = true;
-                break;
+                if (reactor_would_block()) return RAOP_RTP_MIRROR_RECV_AGAIN;
+                logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror error  in header recv: %d %s", errno, strerror(errno));
+                if (errno == ECONNRESET) *conn_reset = true;
+                return RAOP_RTP_MIRROR_RECV_ERROR;
+            }
+            raop_capture_write(raop_rtp_mirror->capture, raop_rtp_mirror->capture_session_id, RAOP_CAPTURE_MIRROR, packet + raop_rtp_mirror->readstart, ret);
+            if (raop_rtp_mirror->readstart == 0) {
+                raop_rtp_mirror->receive_start = metrics_stage_begin(raop_rtp_mirror->metrics);
+                raop_rtp_mirror->trace_receive = TRACE_BEGIN();
             }
+            raop_rtp_mirror->readstart += ret;
+        }
 
-	    switch (packet[4]) {
-            case  0x00:
-                // Normal video data (VCL NAL)
+        /*packet[0:3] contains the payload size */
+        int payload_size = byteutils_get_int(packet, 0);
 
-                // Conveniently, the video data is already stamped with the remote wall clock time,
-                // so no additional clock syncing needed. The only thing odd here is that the video
-                // ntp time stamps don't include the SECONDS_FROM_1900_TO_1970, so it's really just
-                // counting micro seconds since last boot.
-                ntp_timestamp_raw = byteutils_get_long(packet, 8);
-                uint64_t ntp_timestamp_remote = raop_ntp_timestamp_to_micro_seconds(ntp_timestamp_raw, false);
-                uint64_t ntp_timestamp = raop_ntp_convert_remote_time(raop_rtp_mirror->ntp, ntp_timestamp_remote);
+        /* packet[4] appears to have one of three possible values:                           *
+         * 0x00 : encrypted packet                                                           *
+         * 0x01 : unencrypted packet with a SPS and a PPS NAL, sent initially, and also when *
+         *        a change in video format (e.g., width, height) subsequently occurs         *
+         * 0x05 : unencrypted packet with a "streaming report", sent once per second         */
 
-                uint64_t ntp_now = raop_ntp_get_local_time(raop_rtp_mirror->ntp);
-                int64_t latency = ((int64_t) ntp_now) - ((int64_t) ntp_timestamp);
-                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp video: now = %8.6f, ntp = %8.6f, latency = %8.6f",
-                           ((double) ntp_now) / SEC, ((double) ntp_timestamp) / SEC, ((double) latency) / SEC);
+        /* encrypted packets have packet[5] = 0x00 or 0x10, and packet[6]= packet[7] = 0x00; *
+         * encrypted packets immediately following an unencrypted SPS/PPS packet appear to   *
+         * be the only ones with packet[5] = 0x10, and almost always have packet[5] = 0x10,  *
+         * but occasionally have packet[5] = 0x00.                                           */
 
-#ifdef DUMP_H264
-                fwrite(payload, payload_size, 1, file_source);
-                fwrite(&readstart, sizeof(readstart), 1, file_len);
-#endif
-                unsigned char* payload_out;
-		unsigned char* payload_decrypted;
-                if (!raop_rtp_mirror->sps_pps_waiting && packet[5] != 0x00) {
-                    logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "unexpected: packet[5] = %2.2x, but  not preceded  by SPS+PPS packet", packet[5]);
-                }
-                /* if a previous unencrypted packet contains an SPS (type 7) and PPS (type 8) NAL which has not 
-                 * yet been sent, it should be prepended to the current NAL.    In this case packet[5] is usually 
-                 * 0x10; however, the M1 Macs have increased the h264 level, and now the encrypted packet after the
-                 * unencrypted SPS+PPS packet may contain a SEI (type 6) NAL prepended to the next VCL NAL, with
-                 * packet[5] = 0x00.   Now the flag raop_rtp_mirror->sps_pps_waiting = true will signal that a 
-                 * previous packet contained a SPS NAL + a PPS NAL, that has not yet been sent.   This will trigger
-                 * prepending it to the current NAL, and the sps_pps_waiting flag will be set to false after
-                 * it has been prepended.    It is not clear if the case packet[5] = 0x10 will occur when
-                 * raop_rtp_mirror->sps_pps = false, but if it does, the current code will prepend the stored
-                 * PPS + SPS NAL to the current encrypted NAL, and issue a warning message */
-
-                bool prepend_sps_pps = (raop_rtp_mirror->sps_pps_waiting || packet[5] != 0x00);
-                if (prepend_sps_pps) {
-                    assert(raop_rtp_mirror->sps_pps);
-                    payload_out = (unsigned char*)  malloc(payload_size + raop_rtp_mirror->sps_pps_len);
-                    payload_decrypted = payload_out + raop_rtp_mirror->sps_pps_len;
-                    memcpy(payload_out, raop_rtp_mirror->sps_pps, raop_rtp_mirror->sps_pps_len);
-                    raop_rtp_mirror->sps_pps_waiting = false;
-                } else {
-                    payload_out = (unsigned char*)  malloc(payload_size);
-                    payload_decrypted = payload_out;
-                }
-                // Decrypt data
-                mirror_buffer_decrypt(raop_rtp_mirror->buffer, payload, payload_decrypted, payload_size);
-
-                // It seems the AirPlay protocol prepends NALs with their size, which we're replacing with the 4-byte
-                // start code for the NAL Byte-Stream Format.
-                bool valid_data = true;
-                int nalu_size = 0;
-                int nalus_count = 0;
-                int nalu_type;               /* 0x01 non-IDR VCL, 0x05 IDR VCL, 0x06 SEI 0x07 SPS, 0x08 PPS */
-                while (nalu_size < payload_size) {
-                    int nc_len = byteutils_get_int_be(payload_decrypted, nalu_size);
-                    if (nc_len < 0 || nalu_size + 4 > payload_size) {
-                        valid_data = false;
-                        break;
-                    }
-                    memcpy(payload_decrypted + nalu_size, nal_start_code, 4);
-                    nalu_size += 4;
-                    nalus_count++;
-                    if (payload_decrypted[nalu_size] & 0x80) valid_data = false;  /* first bit of h264 nalu MUST be 0 ("forbidden_zero_bit") */
-                    nalu_type = payload_decrypted[nalu_size] & 0x1f;
-                    nalu_size += nc_len;
-                    if (nalu_type != 1) {
-                         logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "nalu_type = %d, nalu_size = %d,  processed bytes %d, payloadsize = %d nalus_count = %d",
-                                    nalu_type, nc_len, nalu_size, payload_size, nalus_count);
-                    }
-                 }
-                if (nalu_size != payload_size) valid_data = false;
-                if(!valid_data) {
-                    logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "nalu marked as invalid");
-                    payload_out[0] = 1; /* mark video data as invalid h264 (failed decryption) */
-                }
-#ifdef DUMP_H264
-                fwrite(payload_decrypted, payload_size, 1, file);
-#endif
-                payload_decrypted = NULL;
-                h264_decode_struct h264_data;
-                h264_data.pts = ntp_timestamp;
-                h264_data.nal_count = nalus_count;   /*nal_count will be the number of nal units in the packet */
-                h264_data.data_len = payload_size;
-                h264_data.data = payload_out;
-                if (prepend_sps_pps) {
-                    h264_data.data_len += raop_rtp_mirror->sps_pps_len;
-                    h264_data.nal_count += 2;
-                    if (ntp_timestamp_raw != ntp_timestamp_nal) {
-                        logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "raop_rtp_mirror: prepended sps_pps timestamp does not match that of video payload");
-                    }
-                }
-                raop_rtp_mirror->callbacks.video_process(raop_rtp_mirror->callbacks.cls, raop_rtp_mirror->ntp, &h264_data);
-                free(payload_out);
-                break;
-            case 0x01:
-                // The information in the payload contains an SPS and a PPS NAL
-                // The sps_pps is not encrypted
-                ntp_timestamp_nal = byteutils_get_long(packet, 8);
-                float width = byteutils_get_float(packet, 16);
-                float height = byteutils_get_float(packet, 20);
-                float width_source = byteutils_get_float(packet, 40);
-                float height_source = byteutils_get_float(packet, 44);
-                if (width != width_source || height != height_source) {
-                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror: Unexpected : data  %f, %f != width_source = %f, height_source = %f",
-                           width, height, width_source, height_source);
-                }
-                width = byteutils_get_float(packet, 48);
-                height = byteutils_get_float(packet, 52);
-                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror: unidentified extra header data  %f, %f", width, height);
-                width = byteutils_get_float(packet, 56);
-                height = byteutils_get_float(packet, 60);
-                if (raop_rtp_mirror->callbacks.video_report_size) {
-                    raop_rtp_mirror->callbacks.video_report_size(raop_rtp_mirror->callbacks.cls, &width_source, &height_source, &width, &height);
-                }
-                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror width_source = %f height_source = %f width = %f height = %f",
-                           width_source, height_source, width, height);
-
-                short sps_size = byteutils_get_short_be(payload,6);
-                unsigned char *sequence_parameter_set = payload + 8;
-                short pps_size = byteutils_get_short_be(payload, sps_size + 9);
-                unsigned char *picture_parameter_set = payload + sps_size + 11;
-                int data_size = 6; 
-                char *str = utils_data_to_string(payload, data_size, 16);
-                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror: sps/pps header size = %d", data_size);		
-                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror h264 sps/pps header:\n%s", str);
-                free(str);
-                str = utils_data_to_string(sequence_parameter_set, sps_size,16);
-                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror sps size = %d",  sps_size);		
-                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror h264 Sequence Parameter Set:\n%s", str);
-                free(str);
-                str = utils_data_to_string(picture_parameter_set, pps_size, 16);
-                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror pps size = %d", pps_size);
-                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror h264 Picture Parameter Set:\n%s", str);
-                free(str);
-                data_size = payload_size - sps_size - pps_size - 11; 
-                if (data_size > 0) {
-                    str = utils_data_to_string (picture_parameter_set + pps_size, data_size, 16);
-                    logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "remainder size = %d", data_size);
-                    logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "remainder of sps+pps packet:\n%s", str);
-                    free(str);
-                } else if (data_size < 0) {
-                    logger_log(raop_rtp_mirror->logger, LOGGER_ERR, " pps_sps error: packet remainder size = %d < 0", data_size);
-                }
-
-                // Copy the sps and pps into a buffer to prepend to the next NAL unit.
-                raop_rtp_mirror->sps_pps_len = sps_size + pps_size + 8;
-                if (raop_rtp_mirror->sps_pps) {
-                    free(raop_rtp_mirror->sps_pps);
-                }
-                raop_rtp_mirror->sps_pps = (unsigned char*) malloc(raop_rtp_mirror->sps_pps_len);
-                assert(raop_rtp_mirror->sps_pps);
-                memcpy(raop_rtp_mirror->sps_pps, nal_start_code, 4);
-                memcpy(raop_rtp_mirror->sps_pps + 4, sequence_parameter_set, sps_size);
-                memcpy(raop_rtp_mirror->sps_pps + sps_size + 4, nal_start_code, 4); 
-                memcpy(raop_rtp_mirror->sps_pps + sps_size + 8, payload + sps_size + 11, pps_size);
-                raop_rtp_mirror->sps_pps_waiting = true;
-#ifdef DUMP_H264
-                fwrite(raop_rtp_mirror->sps_pps, raop_rtp_mirror->sps_pps_len, 1, file);
-#endif
+        /* unencrypted SPS/PPS packets have packet[4:7] = 0x01 0x00 0x01 0x16                *
+         * they are followed by an encrypted packet with the same timestamp in packet[8:15]  */
 
-                // h264codec_t h264;
-                // h264.version = payload[0];
-                // h264.profile_high = payload[1];
-                // h264.compatibility = payload[2];
-                // h264.level = payload[3];
-                // h264.reserved_6_and_nal = payload[4];
-                // h264.reserved_3_and_sps = payload[5];
-                // h264.sps_size =  sps_size;
-                // h264.sequence_parameter_set = malloc(h264.sps_size);
-                // memcpy(h264.sequence_parameter_set, sequence_parameter_set, sps_size);
-                // h264.number_of_pps = payload[h264.sps_size + 8];
-                // h264.pps_size = pps_size;
-                // h264.picture_parameter_set = malloc(h264.pps_size);
-                // memcpy(h264.picture_parameter_set, picture_parameter_set, pps_size);
+        /* "streaming report" packages have packet[4:7] = 0x05 0x00 0x00 0x00, and have no    *
+         * timestamp in packet[8:15]                                                         */
 
-                break;
-            case 0x05:
-                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "\nReceived video streaming performance info packet from client");
-                /* payloads with packet[4] = 0x05 have no timestamp, and carry video info from the client as a binary plist *
-                 * Sometimes (e.g, when the client has a locked screen), there is a 25kB trailer attached to the packet.    *
-                 * This 25000 Byte trailer with unidentified content seems to be the same data each time it is sent.        */
-
-                if (payload_size && raop_rtp_mirror->show_client_FPS_data) {
-                    //char *str = utils_data_to_string(packet, 128, 16);
-                    //logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "type 5 video packet header:\n%s", str);
-                    //free (str);
-		    
-                    int plist_size = payload_size;
-                    if (payload_size > 25000) {
-		        plist_size = payload_size - 25000;
-                        char *str = utils_data_to_string(payload + plist_size, 16, 16);
-                        logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "video_info packet had 25kB trailer; first 16 bytes are:\n%s", str);
-                        free(str);
-                    }
-                    if (plist_size) {
-                        char *plist_xml;
-                        uint32_t plist_len;
-                        plist_t root_node = NULL;
-                        plist_from_bin((char *) payload, plist_size, &root_node);
-                        plist_to_xml(root_node, &plist_xml, &plist_len);
-                        logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "%s", plist_xml);
-                        free(plist_xml);
-                    }
-                }
-                break;
-            default:
-                logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "\nReceived unexpected TCP packet from client, packet[4] = 0x%2.2x", packet[4]);
-                break;
+        //unsigned short payload_type = byteutils_get_short(packet, 4) & 0xff;
+        //unsigned short payload_option = byteutils_get_short(packet, 6);
+        if (payload_size < 0 || payload_size > RAOP_RTP_MIRROR_MAX_PAYLOAD) {
+            // The stream is out of step, or not a mirror stream
+            logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror invalid payload size %d", payload_size);
+            return RAOP_RTP_MIRROR_RECV_ERROR;
+        }
+        raop_rtp_mirror->payload_size = payload_size;
+        raop_rtp_mirror->payload = malloc(payload_size);
+        if (!raop_rtp_mirror->payload && payload_size > 0) {
+            logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror could not allocate %d byte payload", payload_size);
+            return RAOP_RTP_MIRROR_RECV_ERROR;
+        }
+        raop_rtp_mirror->readstart = 0;
+        raop_rtp_mirror_handoff_t *handoff = &raop_rtp_mirror->handoff;
+        if (packet[4] == 0x00 && raop_rtp_mirror->nal_handoff && raop_rtp_mirror->callbacks.video_process_nal) {
+            // Low-latency mode: NAL units are decrypted and handed off while the payload is received
+            handoff->data = (unsigned char*) malloc(payload_size);
+            if (!handoff->data && payload_size > 0) {
+                logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror could not allocate %d byte payload", payload_size);
+                return RAOP_RTP_MIRROR_RECV_ERROR;
             }
+            handoff->active = true;
+            handoff->done = false;
+            handoff->first = true;
+            handoff->prepend_sps_pps = !raop_rtp_mirror->avcc_passthrough && raop_rtp_mirror->sps_pps &&
+                                       (raop_rtp_mirror->sps_pps_waiting ||
+                                        (packet[5] != 0x00 && !raop_rtp_mirror->sps_pps_repeat));
+            handoff->decrypted = 0;
+            handoff->handed_off = 0;
+            handoff->pts = raop_ntp_convert_remote_time(raop_rtp_mirror->ntp,
+                           raop_ntp_timestamp_to_micro_seconds(byteutils_get_long(packet, 8), false));
+        }
+    }
 
-            free(payload);
-            payload = NULL;
-            memset(packet, 0, 128);
-            readstart = 0;
+    unsigned char *payload = raop_rtp_mirror->payload;
+    int payload_size = raop_rtp_mirror->payload_size;
+    while (raop_rtp_mirror->readstart < payload_size) {
+        // Payload data
+        ret = recv(stream_fd, payload + raop_rtp_mirror->readstart, payload_size - raop_rtp_mirror->readstart, 0);
+        if (ret == 0) {
+            logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror tcp socket is closed");
+            return RAOP_RTP_MIRROR_RECV_ERROR;
+        } else if (ret == -1) {
+            if (reactor_would_block()) return RAOP_RTP_MIRROR_RECV_AGAIN;
+            logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror error in recv: %d %s", errno, strerror(errno));
+            if (errno == ECONNRESET) *conn_reset = true;
+            return RAOP_RTP_MIRROR_RECV_ERROR;
+        }
+        raop_capture_write(raop_rtp_mirror->capture, raop_rtp_mirror->capture_session_id, RAOP_CAPTURE_MIRROR, payload + raop_rtp_mirror->readstart, ret);
+        raop_rtp_mirror->readstart += ret;
+        if (raop_rtp_mirror->handoff.active) {
+            uint64_t span_start = TRACE_BEGIN();
+            raop_rtp_mirror_handoff_nals(raop_rtp_mirror, &raop_rtp_mirror->handoff, payload, raop_rtp_mirror->readstart, payload_size);
+            TRACE_END("video", "handoff", raop_rtp_mirror->handoff.pts, span_start);
         }
     }
+    metrics_stage_end(raop_rtp_mirror->metrics, METRICS_VIDEO_RECEIVE, raop_rtp_mirror->receive_start);
+    return RAOP_RTP_MIRROR_RECV_COMPLETE;
+}
 
-    /* Close the stream file descriptor */
-    if (stream_fd != -1) {
-        closesocket(stream_fd);
+/**
+ * Mirror: runs on the reactor when a client connects to the listening socket, and then
+ * whenever data of the stream arrives
+ */
+static void
+raop_rtp_mirror_handler(void *cls, int events)
+{
+    raop_rtp_mirror_t *raop_rtp_mirror = cls;
+    bool conn_reset = false;
+    int ret = RAOP_RTP_MIRROR_RECV_AGAIN;
+
+    if (!ATOMIC_LOAD(raop_rtp_mirror->running)) {
+        return;
     }
 
-#ifdef DUMP_H264
-    fclose(file);
-    fclose(file_source);
-    fclose(file_len);
-#endif
+    if (raop_rtp_mirror->stream_fd == -1) {
+        if (raop_rtp_mirror_accept(raop_rtp_mirror) < 0) {
+            ret = RAOP_RTP_MIRROR_RECV_ERROR;
+        }
+    } else {
+        for (int n = 0; n < RAOP_RTP_MIRROR_PACKET_BATCH; n++) {
+            ret = raop_rtp_mirror_receive(raop_rtp_mirror, &conn_reset);
+            if (ret != RAOP_RTP_MIRROR_RECV_COMPLETE) {
+                break;
+            }
+            raop_rtp_mirror_process_packet(raop_rtp_mirror);
+            free(raop_rtp_mirror->payload);
+            raop_rtp_mirror->payload = NULL;
+            memset(raop_rtp_mirror->packet, 0, 128);
+            raop_rtp_mirror->readstart = 0;
+        }
+    }
 
-    // Ensure running reflects the actual state
-    MUTEX_LOCK(raop_rtp_mirror->run_mutex);
-    raop_rtp_mirror->running = false;
-    MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
+    if (ret == RAOP_RTP_MIRROR_RECV_CLOSED) {
+        // Wait for the client to connect again
+        reactor_source_set_fd(raop_rtp_mirror->source, raop_rtp_mirror->mirror_data_sock);
+        raop_rtp_mirror_close_stream(raop_rtp_mirror);
+    } else if (ret == RAOP_RTP_MIRROR_RECV_ERROR) {
+        reactor_source_set_fd(raop_rtp_mirror->source, -1);
+        raop_rtp_mirror_close_stream(raop_rtp_mirror);
 
-    logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror exiting TCP thread");
-    if (conn_reset && raop_rtp_mirror->callbacks.conn_reset) {
-        const bool video_reset = false;   /* leave "frozen video" showing */
-        raop_rtp_mirror->callbacks.conn_reset(raop_rtp_mirror->callbacks.cls, 0, video_reset);
+        // Ensure running reflects the actual state
+        MUTEX_LOCK(raop_rtp_mirror->run_mutex);
+        ATOMIC_STORE(raop_rtp_mirror->running, 0);
+        MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
+
+        raop_rtp_mirror_finish(raop_rtp_mirror);
+        logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror stream ended");
+        if (conn_reset && raop_rtp_mirror->callbacks.conn_reset) {
+            const bool video_reset = false;   /* leave "frozen video" showing */
+            raop_rtp_mirror->callbacks.conn_reset(raop_rtp_mirror->callbacks.cls, 0, video_reset);
+        }
     }
-    return 0;
 }
 
 static int
@@ -616,7 +1109,8 @@ raop_rtp_init_mirror_sockets(raop_rtp_mirror_t *raop_rtp_mirror, int use_ipv6)
 }
 
 void
-raop_rtp_start_mirror(raop_rtp_mirror_t *raop_rtp_mirror, int use_udp, unsigned short *mirror_data_lport, uint8_t show_client_FPS_data)
+raop_rtp_start_mirror(raop_rtp_mirror_t *raop_rtp_mirror, int use_udp, unsigned short *mirror_data_lport, uint8_t show_client_FPS_data,
+                      uint8_t nal_handoff, uint8_t avcc_passthrough, int max_video_latency)
 {
     logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror starting mirroring");
     int use_ipv6 = 0;
@@ -624,9 +1118,12 @@ raop_rtp_start_mirror(raop_rtp_mirror_t *raop_rtp_mirror, int use_udp, unsigned
     assert(raop_rtp_mirror);
     assert(mirror_data_lport);
     raop_rtp_mirror->show_client_FPS_data = show_client_FPS_data;
+    raop_rtp_mirror->nal_handoff = nal_handoff;
+    raop_rtp_mirror->avcc_passthrough = (avcc_passthrough && raop_rtp_mirror->callbacks.video_configure);
+    raop_rtp_mirror->max_video_latency = (int64_t) max_video_latency * 1000;
 
     MUTEX_LOCK(raop_rtp_mirror->run_mutex);
-    if (raop_rtp_mirror->running || !raop_rtp_mirror->joined) {
+    if (raop_rtp_mirror->source) {
         MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
         return;
     }
@@ -644,44 +1141,68 @@ raop_rtp_start_mirror(raop_rtp_mirror_t *raop_rtp_mirror, int use_udp, unsigned
     }
     *mirror_data_lport = raop_rtp_mirror->mirror_data_lport;
 
-    /* Create the thread and initialize running values */
-    raop_rtp_mirror->running = 1;
-    raop_rtp_mirror->joined = 0;
+    /* Initialize running values and wait for the client on the reactor */
+    ATOMIC_STORE(raop_rtp_mirror->running, 1);
+    raop_rtp_mirror->finished = false;
+    raop_rtp_mirror->stream_fd = -1;
+    raop_rtp_mirror->readstart = 0;
+    memset(&raop_rtp_mirror->drop, 0, sizeof(raop_rtp_mirror->drop));
+    memset(raop_rtp_mirror->packet, 0, sizeof(raop_rtp_mirror->packet));
+
+#ifdef DUMP_H264
+    // C decrypted
+    raop_rtp_mirror->file = fopen("/home/pi/Airplay.h264", "wb");
+    // Encrypted source file
+    raop_rtp_mirror->file_source = fopen("/home/pi/Airplay.source", "wb");
+    raop_rtp_mirror->file_len = fopen("/home/pi/Airplay.len", "wb");
+#endif
 
-    THREAD_CREATE(raop_rtp_mirror->thread_mirror, raop_rtp_mirror_thread, raop_rtp_mirror);
+    raop_rtp_mirror->source = reactor_source_add(raop_rtp_mirror->strand, raop_rtp_mirror->mirror_data_sock,
+                                                 raop_rtp_mirror_handler, raop_rtp_mirror);
+    if (!raop_rtp_mirror->source) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror could not watch the mirror data socket");
+        ATOMIC_STORE(raop_rtp_mirror->running, 0);
+    }
     MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
 }
 
 void raop_rtp_mirror_stop(raop_rtp_mirror_t *raop_rtp_mirror) {
     assert(raop_rtp_mirror);
 
-    /* Check that we are running and thread is not
-     * joined (should never be while still running) */
+    /* Check that mirroring was started; the stream may already have ended by itself */
     MUTEX_LOCK(raop_rtp_mirror->run_mutex);
-    if (!raop_rtp_mirror->running || raop_rtp_mirror->joined) {
+    if (!raop_rtp_mirror->source) {
         MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
         return;
     }
-    raop_rtp_mirror->running = 0;
+    ATOMIC_STORE(raop_rtp_mirror->running, 0);
     MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
 
+    /* Waits for a running handler to return */
+    reactor_source_remove(raop_rtp_mirror->source);
+
+    raop_rtp_mirror_close_stream(raop_rtp_mirror);
     if (raop_rtp_mirror->mirror_data_sock != -1) {
         closesocket(raop_rtp_mirror->mirror_data_sock);
         raop_rtp_mirror->mirror_data_sock = -1;
     }
+    raop_rtp_mirror_finish(raop_rtp_mirror);
 
-    /* Join the thread */
-    THREAD_JOIN(raop_rtp_mirror->thread_mirror);
+#ifdef DUMP_H264
+    fclose(raop_rtp_mirror->file);
+    fclose(raop_rtp_mirror->file_source);
+    fclose(raop_rtp_mirror->file_len);
+#endif
 
-    /* Mark thread as joined */
     MUTEX_LOCK(raop_rtp_mirror->run_mutex);
-    raop_rtp_mirror->joined = 1;
+    raop_rtp_mirror->source = NULL;
     MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
 }
 
 void raop_rtp_mirror_destroy(raop_rtp_mirror_t *raop_rtp_mirror) {
     if (raop_rtp_mirror) {
         raop_rtp_mirror_stop(raop_rtp_mirror);
+        reactor_strand_destroy(raop_rtp_mirror->strand);
         MUTEX_DESTROY(raop_rtp_mirror->run_mutex);
         mirror_buffer_destroy(raop_rtp_mirror->buffer);
         if (raop_rtp_mirror->sps_pps) {
@@ -18,14 +18,28 @@
 #include <stdint.h>
 #include "raop.h"
 #include "logger.h"
+#include "raop_capture.h"
+#include "metrics.h"
+#include "reactor.h"
 
 typedef struct raop_rtp_mirror_s raop_rtp_mirror_t;
 typedef struct h264codec_s h264codec_t;
 
-raop_rtp_mirror_t *raop_rtp_mirror_init(logger_t *logger, raop_callbacks_t *callbacks, raop_ntp_t *ntp,
+raop_rtp_mirror_t *raop_rtp_mirror_init(logger_t *logger, raop_callbacks_t *callbacks, reactor_t *reactor, raop_ntp_t *ntp,
                                         const unsigned char *remote, int remotelen, const unsigned char *aeskey);
 void raop_rtp_init_mirror_aes(raop_rtp_mirror_t *raop_rtp_mirror, uint64_t *streamConnectionID);
-void raop_rtp_start_mirror(raop_rtp_mirror_t *raop_rtp_mirror, int use_udp, unsigned short *mirror_data_lport,  uint8_t show_client_FPS_data);
+void raop_rtp_start_mirror(raop_rtp_mirror_t *raop_rtp_mirror, int use_udp, unsigned short *mirror_data_lport,  uint8_t show_client_FPS_data,
+                           uint8_t nal_handoff, uint8_t avcc_passthrough, int max_video_latency);
+/* The received stream is written to capture (may be NULL) */
+void raop_rtp_mirror_set_capture(raop_rtp_mirror_t *raop_rtp_mirror, raop_capture_t *capture, int session_id);
+/* Counters and timings of the video stream go to metrics (may be NULL) */
+void raop_rtp_mirror_set_metrics(raop_rtp_mirror_t *raop_rtp_mirror, metrics_session_t *metrics);
+
+/**
+ * Replaces the 4-byte length prefixes of the NAL units of an access unit with start codes (unless avcc),
+ * counts them and finds the frame type (H264_FRAME_*). Returns false if the NAL units are malformed.
+ */
+bool raop_rtp_mirror_rewrite_nals(logger_t *logger, unsigned char *data, int size, bool avcc, int *nal_count, int *frame_type);
 void raop_rtp_mirror_stop(raop_rtp_mirror_t *raop_rtp_mirror);
 void raop_rtp_mirror_destroy(raop_rtp_mirror_t *raop_rtp_mirror);
 #endif //RAOP_RTP_MIRROR_H
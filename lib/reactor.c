@@ -0,0 +1,805 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "reactor.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "compat.h"
+#include "threads.h"
+#include "netutils.h"
+#include "trace.h"
+
+#if defined(__linux__)
+#define REACTOR_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+#ifndef WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#else
+#define poll WSAPoll
+#endif
+
+#define REACTOR_MAX_WORKERS 8
+#define REACTOR_MAX_EVENTS 64
+#define REACTOR_BATCH 16          /* handlers run for one strand before it goes back to the end of the queue */
+#define REACTOR_WAKE_EVENT UINT64_MAX
+
+/* Sockets and timers are registered in slots; the generation tells events for a removed source from current ones */
+typedef struct {
+    reactor_source_t *source;     /* NULL: free slot */
+    uint32_t gen;
+    int fd;
+    bool armed;                   /* the socket is watched */
+    uint64_t deadline;            /* timer (monotonic us), 0: none */
+} reactor_slot_t;
+
+struct reactor_source_s {
+    reactor_strand_t *strand;
+    reactor_handler_t handler;
+    void *cls;
+    int slot;
+    uint32_t gen;
+
+    /* locked by the strand mutex */
+    int pending;                  /* REACTOR_ events not yet handled */
+    bool queued;
+    bool removed;
+    int refs;                     /* owner, and the strand while queued or running */
+    reactor_source_t *next;
+};
+
+struct reactor_strand_s {
+    reactor_t *reactor;
+    int worker;                   /* preferred worker */
+
+    mutex_handle_t mutex;
+    cond_handle_t cond;           /* signalled when a handler returns */
+    reactor_source_t *head, *tail;
+    bool scheduled;               /* on a worker queue or running */
+    reactor_source_t *current;
+    thread_handle_t current_thread;
+
+    reactor_strand_t *next;       /* on a worker queue */
+};
+
+typedef struct {
+    reactor_t *reactor;
+    int index;
+    thread_handle_t thread;
+    mutex_handle_t mutex;
+    reactor_strand_t *head, *tail;
+} reactor_worker_t;
+
+struct reactor_s {
+    logger_t *logger;
+
+    thread_handle_t thread;
+    mutex_handle_t mutex;         /* slots, timers and running */
+    bool running;
+    reactor_slot_t *slots;
+    int slot_count;
+    uint64_t next_deadline;       /* no timer expires earlier */
+    uint64_t wait_deadline;       /* the reactor thread sleeps until then, 0: it is not waiting */
+#ifdef REACTOR_EPOLL
+    int epfd;
+    int wakefd;
+#else
+    int wake_sock;                /* loopback UDP socket connected to itself */
+    struct pollfd *pollfds;       /* the wake-up socket, then the armed sockets */
+    int *poll_slots;
+    uint32_t *poll_gens;          /* generation of the slots when pollfds was built */
+    int poll_size;
+#endif
+
+    reactor_worker_t workers[REACTOR_MAX_WORKERS];
+    int worker_count;
+    int next_worker;
+
+    mutex_handle_t idle_mutex;
+    cond_handle_t idle_cond;
+    int idle;
+    bool stopping;
+};
+
+static uint64_t
+reactor_now(void)
+{
+#ifdef WIN32
+    return (uint64_t) GetTickCount64() * 1000;
+#else
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000 + (uint64_t) (time.tv_nsec / 1000);
+#endif
+}
+
+static int
+reactor_cpu_count(void)
+{
+#ifdef WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int) info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int) count : 1;
+#endif
+}
+
+int
+reactor_set_nonblocking(int fd)
+{
+#ifdef WIN32
+    u_long mode = 1;
+    return ioctlsocket(fd, FIONBIO, &mode);
+#else
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) {
+        return -1;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+#endif
+}
+
+int
+reactor_would_block(void)
+{
+    int error = SOCKET_GET_ERROR();
+    return error == SOCKET_ERRORNAME(EWOULDBLOCK) || error == SOCKET_ERRORNAME(EAGAIN);
+}
+
+static void
+reactor_wake(reactor_t *reactor)
+{
+#ifdef REACTOR_EPOLL
+    uint64_t value = 1;
+    if (write(reactor->wakefd, &value, sizeof(value)) < 0) {
+        /* the counter is already non-zero */
+    }
+#else
+    netutils_wake(reactor->wake_sock);
+#endif
+}
+
+static void
+reactor_drain_wake(reactor_t *reactor)
+{
+#ifdef REACTOR_EPOLL
+    uint64_t value;
+    if (read(reactor->wakefd, &value, sizeof(value)) < 0) {
+        /* nothing to drain */
+    }
+#else
+    netutils_drain_wake_socket(reactor->wake_sock);
+#endif
+}
+
+/* Hand a strand to a worker; whichever worker is idle may run it */
+static void
+reactor_schedule(reactor_t *reactor, reactor_strand_t *strand)
+{
+    reactor_worker_t *worker = &reactor->workers[strand->worker];
+    MUTEX_LOCK(worker->mutex);
+    strand->next = NULL;
+    if (worker->tail) {
+        worker->tail->next = strand;
+    } else {
+        worker->head = strand;
+    }
+    worker->tail = strand;
+    MUTEX_UNLOCK(worker->mutex);
+
+    MUTEX_LOCK(reactor->idle_mutex);
+    if (reactor->idle) {
+        COND_SIGNAL(reactor->idle_cond);
+    }
+    MUTEX_UNLOCK(reactor->idle_mutex);
+}
+
+/* Queue events for a source; the strand is scheduled unless it already is */
+static void
+reactor_dispatch(reactor_source_t *source, int events)
+{
+    reactor_strand_t *strand = source->strand;
+    bool schedule = false;
+
+    MUTEX_LOCK(strand->mutex);
+    if (!source->removed) {
+        source->pending |= events;
+        if (!source->queued) {
+            source->queued = true;
+            source->refs++;
+            source->next = NULL;
+            if (strand->tail) {
+                strand->tail->next = source;
+            } else {
+                strand->head = source;
+            }
+            strand->tail = source;
+        }
+        if (!strand->scheduled) {
+            strand->scheduled = true;
+            schedule = true;
+        }
+    }
+    MUTEX_UNLOCK(strand->mutex);
+
+    if (schedule) {
+        reactor_schedule(strand->reactor, strand);
+    }
+}
+
+static void
+reactor_arm(reactor_t *reactor, int slot, uint32_t gen)
+{
+    MUTEX_LOCK(reactor->mutex);
+    reactor_slot_t *entry = &reactor->slots[slot];
+    if (entry->source && entry->gen == gen && entry->fd != -1 && !entry->armed) {
+        entry->armed = true;
+#ifdef REACTOR_EPOLL
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLONESHOT;
+        event.data.u64 = ((uint64_t) gen << 32) | (uint32_t) slot;
+        epoll_ctl(reactor->epfd, EPOLL_CTL_MOD, entry->fd, &event);
+#else
+        reactor_wake(reactor);
+#endif
+    }
+    MUTEX_UNLOCK(reactor->mutex);
+}
+
+/* Called with the reactor mutex locked */
+static void
+reactor_expire_timers(reactor_t *reactor, uint64_t now)
+{
+    uint64_t next = UINT64_MAX;
+    for (int i = 0; i < reactor->slot_count; i++) {
+        reactor_slot_t *entry = &reactor->slots[i];
+        if (!entry->source || !entry->deadline) {
+            continue;
+        }
+        if (entry->deadline <= now) {
+            entry->deadline = 0;
+            reactor_dispatch(entry->source, REACTOR_TIMER);
+        } else if (entry->deadline < next) {
+            next = entry->deadline;
+        }
+    }
+    reactor->next_deadline = next;
+}
+
+/* Called with the reactor mutex locked */
+static void
+reactor_ready(reactor_t *reactor, uint64_t data)
+{
+    int slot = (int) (data & 0xffffffff);
+    uint32_t gen = (uint32_t) (data >> 32);
+    if (slot >= reactor->slot_count) {
+        return;
+    }
+    reactor_slot_t *entry = &reactor->slots[slot];
+    if (entry->source && entry->gen == gen && entry->armed) {
+        entry->armed = false;
+        reactor_dispatch(entry->source, REACTOR_READ);
+    }
+}
+
+static THREAD_RETVAL
+reactor_thread(void *arg)
+{
+    reactor_t *reactor = arg;
+#ifdef REACTOR_EPOLL
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+#endif
+
+    MUTEX_LOCK(reactor->mutex);
+    while (reactor->running) {
+        uint64_t now = reactor_now();
+        if (reactor->next_deadline <= now) {
+            reactor_expire_timers(reactor, now);
+        }
+        int timeout = -1;
+        if (reactor->next_deadline != UINT64_MAX) {
+            timeout = (int) ((reactor->next_deadline - now + 999) / 1000);
+        }
+        reactor->wait_deadline = reactor->next_deadline;
+
+#ifdef REACTOR_EPOLL
+        MUTEX_UNLOCK(reactor->mutex);
+        int count = epoll_wait(reactor->epfd, events, REACTOR_MAX_EVENTS, timeout);
+        MUTEX_LOCK(reactor->mutex);
+        reactor->wait_deadline = 0;
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.u64 == REACTOR_WAKE_EVENT) {
+                reactor_drain_wake(reactor);
+            } else {
+                reactor_ready(reactor, events[i].data.u64);
+            }
+        }
+#else
+        /* only this thread uses the poll set, it grows with the slots */
+        if (reactor->poll_size < reactor->slot_count + 1) {
+            int size = reactor->slot_count + 1;
+            struct pollfd *pollfds = realloc(reactor->pollfds, size * sizeof(struct pollfd));
+            int *poll_slots = realloc(reactor->poll_slots, size * sizeof(int));
+            uint32_t *poll_gens = realloc(reactor->poll_gens, size * sizeof(uint32_t));
+            if (pollfds) reactor->pollfds = pollfds;
+            if (poll_slots) reactor->poll_slots = poll_slots;
+            if (poll_gens) reactor->poll_gens = poll_gens;
+            if (pollfds && poll_slots && poll_gens) reactor->poll_size = size;
+        }
+        int nfds = 1;
+        reactor->pollfds[0].fd = reactor->wake_sock;
+        reactor->pollfds[0].events = POLLIN;
+        reactor->pollfds[0].revents = 0;
+        for (int i = 0; i < reactor->slot_count; i++) {
+            reactor_slot_t *entry = &reactor->slots[i];
+            if (entry->source && entry->armed && nfds < reactor->poll_size) {
+                reactor->pollfds[nfds].fd = entry->fd;
+                reactor->pollfds[nfds].events = POLLIN;
+                reactor->pollfds[nfds].revents = 0;
+                reactor->poll_slots[nfds] = i;
+                reactor->poll_gens[nfds] = entry->gen;
+                nfds++;
+            }
+        }
+        MUTEX_UNLOCK(reactor->mutex);
+        int count = poll(reactor->pollfds, nfds, timeout);
+        MUTEX_LOCK(reactor->mutex);
+        reactor->wait_deadline = 0;
+        if (count > 0) {
+            if (reactor->pollfds[0].revents) {
+                reactor_drain_wake(reactor);
+            }
+            for (int i = 1; i < nfds; i++) {
+                if (reactor->pollfds[i].revents & (POLLIN | POLLERR | POLLHUP)) {
+                    reactor_ready(reactor, ((uint64_t) reactor->poll_gens[i] << 32) | (uint32_t) reactor->poll_slots[i]);
+                }
+            }
+        }
+#endif
+    }
+    MUTEX_UNLOCK(reactor->mutex);
+    return 0;
+}
+
+/* Take the first strand from the worker's own queue, or else steal one from another worker */
+static reactor_strand_t *
+reactor_take(reactor_t *reactor, int index)
+{
+    for (int i = 0; i < reactor->worker_count; i++) {
+        reactor_worker_t *worker = &reactor->workers[(index + i) % reactor->worker_count];
+        MUTEX_LOCK(worker->mutex);
+        reactor_strand_t *strand = worker->head;
+        if (strand) {
+            worker->head = strand->next;
+            if (!worker->head) {
+                worker->tail = NULL;
+            }
+        }
+        MUTEX_UNLOCK(worker->mutex);
+        if (strand) {
+            return strand;
+        }
+    }
+    return NULL;
+}
+
+static void
+reactor_run_strand(reactor_t *reactor, reactor_strand_t *strand)
+{
+    MUTEX_LOCK(strand->mutex);
+    strand->current_thread = pthread_self();
+    for (int n = 0; n < REACTOR_BATCH && strand->head; n++) {
+        reactor_source_t *source = strand->head;
+        strand->head = source->next;
+        if (!strand->head) {
+            strand->tail = NULL;
+        }
+        source->queued = false;
+        int events = source->pending;
+        source->pending = 0;
+        strand->current = source;
+        MUTEX_UNLOCK(strand->mutex);
+
+        source->handler(source->cls, events);
+
+        MUTEX_LOCK(strand->mutex);
+        strand->current = NULL;
+        pthread_cond_broadcast(&strand->cond);
+        if ((events & REACTOR_READ) && !source->removed) {
+            int slot = source->slot;
+            uint32_t gen = source->gen;
+            MUTEX_UNLOCK(strand->mutex);
+            reactor_arm(reactor, slot, gen);
+            MUTEX_LOCK(strand->mutex);
+        }
+        if (--source->refs == 0) {
+            free(source);
+        }
+    }
+    if (strand->head) {
+        MUTEX_UNLOCK(strand->mutex);
+        reactor_schedule(reactor, strand);
+        return;
+    }
+    strand->scheduled = false;
+    pthread_cond_broadcast(&strand->cond);
+    MUTEX_UNLOCK(strand->mutex);
+}
+
+static THREAD_RETVAL
+reactor_worker_thread(void *arg)
+{
+    reactor_worker_t *worker = arg;
+    reactor_t *reactor = worker->reactor;
+    char name[16];
+
+    snprintf(name, sizeof(name), "reactor %d", worker->index);
+    trace_set_thread_name(name);
+    while (1) {
+        reactor_strand_t *strand = reactor_take(reactor, worker->index);
+        if (!strand) {
+            MUTEX_LOCK(reactor->idle_mutex);
+            if (reactor->stopping) {
+                MUTEX_UNLOCK(reactor->idle_mutex);
+                break;
+            }
+            reactor->idle++;
+            strand = reactor_take(reactor, worker->index);
+            if (!strand) {
+                pthread_cond_wait(&reactor->idle_cond, &reactor->idle_mutex);
+            }
+            reactor->idle--;
+            MUTEX_UNLOCK(reactor->idle_mutex);
+        }
+        if (strand) {
+            reactor_run_strand(reactor, strand);
+        }
+    }
+    return 0;
+}
+
+reactor_t *
+reactor_init(logger_t *logger, int workers)
+{
+    reactor_t *reactor = calloc(1, sizeof(reactor_t));
+    if (!reactor) {
+        return NULL;
+    }
+    reactor->logger = logger;
+    reactor->next_deadline = UINT64_MAX;
+    if (workers <= 0) {
+        workers = reactor_cpu_count();
+    }
+    reactor->worker_count = workers < REACTOR_MAX_WORKERS ? workers : REACTOR_MAX_WORKERS;
+
+#ifdef REACTOR_EPOLL
+    reactor->epfd = epoll_create1(EPOLL_CLOEXEC);
+    reactor->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reactor->epfd == -1 || reactor->wakefd == -1) {
+        logger_log(logger, LOGGER_ERR, "reactor: could not create epoll instance");
+        if (reactor->epfd != -1) close(reactor->epfd);
+        if (reactor->wakefd != -1) close(reactor->wakefd);
+        free(reactor);
+        return NULL;
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = REACTOR_WAKE_EVENT;
+    epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, reactor->wakefd, &event);
+#else
+    reactor->wake_sock = netutils_init_wake_socket();
+    reactor->pollfds = calloc(1, sizeof(struct pollfd));
+    reactor->poll_slots = calloc(1, sizeof(int));
+    reactor->poll_gens = calloc(1, sizeof(uint32_t));
+    if (reactor->wake_sock == -1 || !reactor->pollfds || !reactor->poll_slots || !reactor->poll_gens) {
+        logger_log(logger, LOGGER_ERR, "reactor: could not create wake-up socket");
+        if (reactor->wake_sock != -1) closesocket(reactor->wake_sock);
+        free(reactor->pollfds);
+        free(reactor->poll_slots);
+        free(reactor->poll_gens);
+        free(reactor);
+        return NULL;
+    }
+    reactor->poll_size = 1;
+#endif
+
+    MUTEX_CREATE(reactor->mutex);
+    MUTEX_CREATE(reactor->idle_mutex);
+    COND_CREATE(reactor->idle_cond);
+    reactor->running = true;
+    THREAD_CREATE(reactor->thread, reactor_thread, reactor);
+    for (int i = 0; i < reactor->worker_count; i++) {
+        reactor->workers[i].reactor = reactor;
+        reactor->workers[i].index = i;
+        MUTEX_CREATE(reactor->workers[i].mutex);
+    }
+    for (int i = 0; i < reactor->worker_count; i++) {
+        THREAD_CREATE(reactor->workers[i].thread, reactor_worker_thread, &reactor->workers[i]);
+    }
+    logger_log(logger, LOGGER_DEBUG, "reactor: started with %d workers", reactor->worker_count);
+    return reactor;
+}
+
+void
+reactor_destroy(reactor_t *reactor)
+{
+    if (!reactor) {
+        return;
+    }
+    MUTEX_LOCK(reactor->mutex);
+    reactor->running = false;
+    reactor_wake(reactor);
+    MUTEX_UNLOCK(reactor->mutex);
+    THREAD_JOIN(reactor->thread);
+
+    MUTEX_LOCK(reactor->idle_mutex);
+    reactor->stopping = true;
+    pthread_cond_broadcast(&reactor->idle_cond);
+    MUTEX_UNLOCK(reactor->idle_mutex);
+    for (int i = 0; i < reactor->worker_count; i++) {
+        THREAD_JOIN(reactor->workers[i].thread);
+    }
+    for (int i = 0; i < reactor->worker_count; i++) {
+        MUTEX_DESTROY(reactor->workers[i].mutex);
+    }
+
+#ifdef REACTOR_EPOLL
+    close(reactor->epfd);
+    close(reactor->wakefd);
+#else
+    closesocket(reactor->wake_sock);
+    free(reactor->pollfds);
+    free(reactor->poll_slots);
+    free(reactor->poll_gens);
+#endif
+    MUTEX_DESTROY(reactor->mutex);
+    MUTEX_DESTROY(reactor->idle_mutex);
+    COND_DESTROY(reactor->idle_cond);
+    free(reactor->slots);
+    free(reactor);
+}
+
+reactor_strand_t *
+reactor_strand_init(reactor_t *reactor)
+{
+    assert(reactor);
+    reactor_strand_t *strand = calloc(1, sizeof(reactor_strand_t));
+    if (!strand) {
+        return NULL;
+    }
+    strand->reactor = reactor;
+    MUTEX_CREATE(strand->mutex);
+    COND_CREATE(strand->cond);
+    MUTEX_LOCK(reactor->mutex);
+    strand->worker = reactor->next_worker;
+    reactor->next_worker = (reactor->next_worker + 1) % reactor->worker_count;
+    MUTEX_UNLOCK(reactor->mutex);
+    return strand;
+}
+
+void
+reactor_strand_destroy(reactor_strand_t *strand)
+{
+    if (!strand) {
+        return;
+    }
+    MUTEX_LOCK(strand->mutex);
+    assert(!strand->head);
+    while (strand->scheduled) {
+        pthread_cond_wait(&strand->cond, &strand->mutex);
+    }
+    MUTEX_UNLOCK(strand->mutex);
+    MUTEX_DESTROY(strand->mutex);
+    COND_DESTROY(strand->cond);
+    free(strand);
+}
+
+/* Called with the reactor mutex locked */
+static int
+reactor_alloc_slot(reactor_t *reactor)
+{
+    for (int i = 0; i < reactor->slot_count; i++) {
+        if (!reactor->slots[i].source) {
+            return i;
+        }
+    }
+    int count = reactor->slot_count ? reactor->slot_count * 2 : 64;
+    reactor_slot_t *slots = realloc(reactor->slots, count * sizeof(reactor_slot_t));
+    if (!slots) {
+        return -1;
+    }
+    memset(slots + reactor->slot_count, 0, (count - reactor->slot_count) * sizeof(reactor_slot_t));
+    reactor->slots = slots;
+    int slot = reactor->slot_count;
+    reactor->slot_count = count;
+    return slot;
+}
+
+reactor_source_t *
+reactor_source_add(reactor_strand_t *strand, int fd, reactor_handler_t handler, void *cls)
+{
+    assert(strand);
+    assert(handler);
+    reactor_t *reactor = strand->reactor;
+
+    if (fd != -1 && reactor_set_nonblocking(fd) < 0) {
+        logger_log(reactor->logger, LOGGER_ERR, "reactor: could not make socket %d non-blocking", fd);
+        return NULL;
+    }
+    reactor_source_t *source = calloc(1, sizeof(reactor_source_t));
+    if (!source) {
+        return NULL;
+    }
+    source->strand = strand;
+    source->handler = handler;
+    source->cls = cls;
+    source->refs = 1;
+
+    MUTEX_LOCK(reactor->mutex);
+    int slot = reactor_alloc_slot(reactor);
+    if (slot < 0) {
+        MUTEX_UNLOCK(reactor->mutex);
+        free(source);
+        return NULL;
+    }
+    reactor_slot_t *entry = &reactor->slots[slot];
+    entry->gen++;
+    entry->source = source;
+    entry->fd = fd;
+    entry->armed = (fd != -1);
+    entry->deadline = 0;
+    source->slot = slot;
+    source->gen = entry->gen;
+    if (fd != -1) {
+#ifdef REACTOR_EPOLL
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLONESHOT;
+        event.data.u64 = ((uint64_t) entry->gen << 32) | (uint32_t) slot;
+        if (epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            logger_log(reactor->logger, LOGGER_ERR, "reactor: could not watch socket %d", fd);
+            entry->source = NULL;
+            MUTEX_UNLOCK(reactor->mutex);
+            free(source);
+            return NULL;
+        }
+#else
+        reactor_wake(reactor);
+#endif
+    }
+    MUTEX_UNLOCK(reactor->mutex);
+    return source;
+}
+
+void
+reactor_source_set_timer(reactor_source_t *source, int timeout_ms)
+{
+    assert(source);
+    reactor_t *reactor = source->strand->reactor;
+    MUTEX_LOCK(reactor->mutex);
+    reactor_slot_t *entry = &reactor->slots[source->slot];
+    if (entry->source == source) {
+        if (timeout_ms < 0) {
+            entry->deadline = 0;
+        } else {
+            entry->deadline = reactor_now() + (uint64_t) timeout_ms * 1000;
+            if (entry->deadline < reactor->next_deadline) {
+                reactor->next_deadline = entry->deadline;
+            }
+            if (reactor->wait_deadline && entry->deadline < reactor->wait_deadline) {
+                reactor_wake(reactor);
+            }
+        }
+    }
+    MUTEX_UNLOCK(reactor->mutex);
+}
+
+int
+reactor_source_set_fd(reactor_source_t *source, int fd)
+{
+    assert(source);
+    reactor_t *reactor = source->strand->reactor;
+
+    if (fd != -1 && reactor_set_nonblocking(fd) < 0) {
+        logger_log(reactor->logger, LOGGER_ERR, "reactor: could not make socket %d non-blocking", fd);
+        return -1;
+    }
+    int ret = 0;
+    MUTEX_LOCK(reactor->mutex);
+    reactor_slot_t *entry = &reactor->slots[source->slot];
+    if (entry->source == source) {
+#ifdef REACTOR_EPOLL
+        if (entry->fd != -1) {
+            epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, entry->fd, NULL);
+        }
+        if (fd != -1) {
+            struct epoll_event event;
+            event.events = EPOLLIN | EPOLLONESHOT;
+            event.data.u64 = ((uint64_t) entry->gen << 32) | (uint32_t) source->slot;
+            ret = epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, fd, &event);
+        }
+#else
+        reactor_wake(reactor);
+#endif
+        entry->fd = (ret < 0 ? -1 : fd);
+        entry->armed = (entry->fd != -1);
+    }
+    MUTEX_UNLOCK(reactor->mutex);
+    return ret;
+}
+
+void
+reactor_source_post(reactor_source_t *source)
+{
+    assert(source);
+    reactor_dispatch(source, REACTOR_POST);
+}
+
+void
+reactor_source_remove(reactor_source_t *source)
+{
+    if (!source) {
+        return;
+    }
+    reactor_strand_t *strand = source->strand;
+    reactor_t *reactor = strand->reactor;
+
+    MUTEX_LOCK(reactor->mutex);
+    reactor_slot_t *entry = &reactor->slots[source->slot];
+#ifdef REACTOR_EPOLL
+    if (entry->fd != -1) {
+        epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, entry->fd, NULL);
+    }
+#endif
+    entry->source = NULL;
+    entry->fd = -1;
+    entry->armed = false;
+    entry->deadline = 0;
+    entry->gen++;
+    MUTEX_UNLOCK(reactor->mutex);
+
+    MUTEX_LOCK(strand->mutex);
+    source->removed = true;
+    if (source->queued) {
+        reactor_source_t **link = &strand->head;
+        reactor_source_t *prev = NULL;
+        while (*link != source) {
+            prev = *link;
+            link = &(*link)->next;
+        }
+        *link = source->next;
+        if (strand->tail == source) {
+            strand->tail = prev;
+        }
+        source->queued = false;
+        source->refs--;
+    }
+    bool own_strand = strand->current && pthread_equal(strand->current_thread, pthread_self());
+    while (strand->current == source && !own_strand) {
+        pthread_cond_wait(&strand->cond, &strand->mutex);
+    }
+    bool last = (--source->refs == 0);
+    MUTEX_UNLOCK(strand->mutex);
+    if (last) {
+        free(source);
+    }
+}
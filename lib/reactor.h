@@ -0,0 +1,74 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * Reactor: one thread waits on the sockets and timers of all sessions (epoll on Linux, poll
+ * elsewhere) and hands the ready work to a small pool of worker threads.
+ *
+ * Work is ordered by strands: the handlers of the sources on one strand never run concurrently
+ * and run in the order their events arrived, on whichever worker is free. Each strand prefers
+ * one worker; idle workers steal queued strands from the others.
+ *
+ * A socket source is armed once: after its handler has run with REACTOR_READ, it is watched
+ * again. Sockets are switched to non-blocking mode when they are added, so a handler reads
+ * until the socket would block.
+ */
+
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include "logger.h"
+
+#define REACTOR_READ  0x01   /* the socket is readable */
+#define REACTOR_TIMER 0x02   /* the timer set with reactor_source_set_timer expired */
+#define REACTOR_POST  0x04   /* reactor_source_post was called */
+
+typedef struct reactor_s reactor_t;
+typedef struct reactor_strand_s reactor_strand_t;
+typedef struct reactor_source_s reactor_source_t;
+
+/* events: the REACTOR_ flags that occurred since the handler last ran */
+typedef void (*reactor_handler_t)(void *cls, int events);
+
+/* workers <= 0: one worker per CPU, at most 8 */
+reactor_t *reactor_init(logger_t *logger, int workers);
+/* All strands must have been destroyed */
+void reactor_destroy(reactor_t *reactor);
+
+reactor_strand_t *reactor_strand_init(reactor_t *reactor);
+/* All sources of the strand must have been removed; must not be called from the strand itself */
+void reactor_strand_destroy(reactor_strand_t *strand);
+
+/* fd may be -1 for a source that only has a timer or is posted to */
+reactor_source_t *reactor_source_add(reactor_strand_t *strand, int fd, reactor_handler_t handler, void *cls);
+
+/* Watch fd (-1: none) instead of the socket watched so far, which may be closed afterwards */
+int reactor_source_set_fd(reactor_source_t *source, int fd);
+
+/* The handler runs with REACTOR_TIMER after timeout_ms; replaces an earlier timeout, < 0 cancels it */
+void reactor_source_set_timer(reactor_source_t *source, int timeout_ms);
+
+/* The handler runs with REACTOR_POST as soon as possible; may be called from any thread */
+void reactor_source_post(reactor_source_t *source);
+
+/**
+ * Stop watching the source and free it; the caller still owns and closes the socket.
+ * Waits for a running handler of the source to return, unless called from the source's own strand.
+ */
+void reactor_source_remove(reactor_source_t *source);
+
+int reactor_set_nonblocking(int fd);
+
+/* After a failed recv or send on a non-blocking socket: true if it only would have blocked */
+int reactor_would_block(void);
+
+#endif //REACTOR_H
@@ -0,0 +1,87 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "refbuf.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(WIN32)
+#include <WinSock2.h>
+#include <windows.h>
+#define REFCOUNT_INC(x) InterlockedIncrement(&(x))
+#define REFCOUNT_DEC(x) InterlockedDecrement(&(x))
+#else
+#define REFCOUNT_INC(x) __atomic_add_fetch(&(x), 1, __ATOMIC_RELAXED)
+#define REFCOUNT_DEC(x) __atomic_sub_fetch(&(x), 1, __ATOMIC_ACQ_REL)
+#endif
+
+refbuf_t *
+refbuf_alloc(int size)
+{
+    refbuf_t *buf;
+    assert(size >= 0);
+
+    /* the data follows the header in the same allocation */
+    buf = malloc(sizeof(refbuf_t) + size + REFBUF_PADDING);
+    if (!buf) {
+        return NULL;
+    }
+    buf->data = (unsigned char *) (buf + 1);
+    buf->size = size;
+    buf->refcount = 1;
+    buf->release = NULL;
+    buf->opaque = NULL;
+    memset(buf->data + size, 0, REFBUF_PADDING);
+    return buf;
+}
+
+refbuf_t *
+refbuf_wrap(unsigned char *data, int size, refbuf_release_t release, void *opaque)
+{
+    refbuf_t *buf;
+    assert(data);
+
+    buf = malloc(sizeof(refbuf_t));
+    if (!buf) {
+        return NULL;
+    }
+    buf->data = data;
+    buf->size = size;
+    buf->refcount = 1;
+    buf->release = release;
+    buf->opaque = opaque;
+    return buf;
+}
+
+refbuf_t *
+refbuf_ref(refbuf_t *buf)
+{
+    assert(buf);
+    REFCOUNT_INC(buf->refcount);
+    return buf;
+}
+
+void
+refbuf_unref(refbuf_t *buf)
+{
+    if (!buf) {
+        return;
+    }
+    if (REFCOUNT_DEC(buf->refcount) == 0) {
+        if (buf->release) {
+            buf->release(buf->opaque, buf->data);
+        }
+        free(buf);
+    }
+}
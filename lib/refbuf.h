@@ -0,0 +1,53 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/* Reference counted buffer holding a media payload, so that it can be handed from the   *
+ * receiving threads to a renderer (and on to its decoder) without being copied.         *
+ * Whoever keeps the buffer beyond the call it was passed to takes a reference with      *
+ * refbuf_ref; the data is released when the last reference is dropped.                 */
+
+#ifndef REFBUF_H
+#define REFBUF_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Zeroed bytes after the data: decoders read up to this many bytes past the end *
+ * (same as AV_INPUT_BUFFER_PADDING_SIZE in ffmpeg)                              */
+#define REFBUF_PADDING 64
+
+typedef void (*refbuf_release_t)(void *opaque, unsigned char *data);
+
+typedef struct refbuf_s {
+    unsigned char *data;
+    int size;
+    /* private */
+    volatile long refcount;
+    refbuf_release_t release;
+    void *opaque;
+} refbuf_t;
+
+/* New buffer of size bytes (plus REFBUF_PADDING zeroed bytes), with one reference */
+refbuf_t *refbuf_alloc(int size);
+/* New buffer around data, with one reference; release(opaque, data) is called when it   *
+ * is freed. data must be followed by REFBUF_PADDING readable bytes.                      */
+refbuf_t *refbuf_wrap(unsigned char *data, int size, refbuf_release_t release, void *opaque);
+/* Take another reference; returns buf */
+refbuf_t *refbuf_ref(refbuf_t *buf);
+void refbuf_unref(refbuf_t *buf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //REFBUF_H
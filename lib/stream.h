@@ -17,20 +17,73 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "refbuf.h"
+
+/* Frame type of an access unit, from its VCL NAL units */
+#define H264_FRAME_UNKNOWN 0
+#define H264_FRAME_IDR     1   /* IDR picture: decoding can (re)start here */
+#define H264_FRAME_REF     2   /* referenced by later frames (nal_ref_idc != 0) */
+#define H264_FRAME_NONREF  3   /* not referenced, can be dropped on its own */
+
+/* Whether video data can be decoded */
+typedef enum h264_validity_e {
+    H264_DATA_VALID,
+    H264_DATA_CORRUPT      /* malformed NAL structure, usually from failed decryption: do not decode */
+} h264_validity_t;
 
 typedef struct {
     int nal_count;
     unsigned char *data;
     int data_len;
     uint64_t pts;
+    refbuf_t *buf;     /* holds data; refbuf_ref it to keep data after the callback returns */
+    int frame_type;    /* H264_FRAME_* */
+    h264_validity_t validity;
 } h264_decode_struct;
 
+/* Part of an access unit, handed off as soon as its NAL units have been received *
+ * completely (see the "nalHandoff" plist item).  data holds one or more complete *
+ * NAL units in Annex-B format (start codes instead of length prefixes), or in    *
+ * AVCC format if the "avccPassthrough" plist item is set.                        */
+typedef struct {
+    int nal_count;
+    unsigned char *data;
+    int data_len;
+    uint64_t pts;
+    bool first;    /* first part of a new access unit */
+    bool last;     /* access unit is complete after this part (data_len may be 0) */
+    int frame_type;    /* H264_FRAME_* of the slices in this part; H264_FRAME_IDR for the parameter sets before an *
+                        * IDR frame, H264_FRAME_UNKNOWN if there is no slice (e.g. only SEI)                      */
+    h264_validity_t validity;  /* H264_DATA_CORRUPT: the access unit was cut short after this (valid) part */
+} h264_nal_struct;
+
+/* Parameter sets for AVCC pass-through (see the "avccPassthrough" plist item):   *
+ * with it, video data keeps its 4-byte NAL length prefixes, and SPS and PPS are  *
+ * only delivered through this AVCDecoderConfigurationRecord ("avcC").            */
+typedef struct {
+    unsigned char *avcc;
+    int avcc_len;
+    uint64_t pts;
+} h264_config_struct;
+
+/* Video format, reported when the client sends SPS and PPS that differ from the   *
+ * previous ones; unchanged parameter sets that are sent again are not passed on. */
+typedef struct {
+    int width;     /* size of the decoded pictures, from the SPS */
+    int height;
+    unsigned char profile_idc;
+    unsigned char constraint_flags;
+    unsigned char level_idc;
+    bool first;    /* first parameter sets of the stream */
+} h264_format_struct;
+
 typedef struct {
     unsigned char *data;
     int data_len;
     uint64_t ntp_time;
     uint64_t rtp_time;
     unsigned short seqnum;
+    refbuf_t *buf;     /* holds data; refbuf_ref it to keep data after the callback returns */
 } audio_decode_struct;
 
 #endif //AIRPLAYSERVER_STREAM_H
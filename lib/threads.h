@@ -42,6 +42,11 @@ typedef pthread_cond_t cond_handle_t;
 #define COND_SIGNAL(handle) pthread_cond_signal(&(handle))
 #define COND_DESTROY(handle) pthread_cond_destroy(&(handle))
 
+/* For long flags that are read without taking a mutex */
+#define ATOMIC_LOAD(x) InterlockedCompareExchange(&(x), 0, 0)
+#define ATOMIC_STORE(x, v) InterlockedExchange(&(x), (v))
+#define ATOMIC_EXCHANGE(x, v) InterlockedExchange(&(x), (v))
+
 #else /* Use pthread library */
 
 #include <pthread.h>
@@ -69,6 +74,11 @@ typedef pthread_cond_t cond_handle_t;
 #define COND_SIGNAL(handle) pthread_cond_signal(&(handle))
 #define COND_DESTROY(handle) pthread_cond_destroy(&(handle))
 
+/* For long flags that are read without taking a mutex */
+#define ATOMIC_LOAD(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#define ATOMIC_EXCHANGE(x, v) __atomic_exchange_n(&(x), (v), __ATOMIC_ACQ_REL)
+
 #endif
 
 #endif /* THREADS_H */
@@ -0,0 +1,223 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "trace.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "threads.h"
+
+#if defined(WIN32)
+#define TRACE_THREAD_LOCAL __declspec(thread)
+#define TRACE_LOAD(x) InterlockedCompareExchange64((volatile LONG64 *) &(x), 0, 0)
+#define TRACE_STORE(x, v) InterlockedExchange64((volatile LONG64 *) &(x), (LONG64) (v))
+#define TRACE_FENCE() MemoryBarrier()
+#else
+#define TRACE_THREAD_LOCAL __thread
+#define TRACE_LOAD(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define TRACE_STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#define TRACE_FENCE() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#endif
+
+#define TRACE_MAX_THREADS 128
+#define TRACE_NAME_LEN 32
+
+typedef struct trace_event_s {
+    uint64_t start;       /* ns */
+    uint64_t duration;
+    uint64_t id;
+    const char *category;
+    const char *name;
+} trace_event_t;
+
+/* Only its thread writes to a ring; head is published after each event for trace_dump */
+typedef struct trace_ring_s {
+    struct trace_ring_s *next;
+    int tid;
+    char name[TRACE_NAME_LEN];
+    int64_t head;         /* events written so far */
+    trace_event_t events[TRACE_RING_EVENTS];
+} trace_ring_t;
+
+volatile long trace_active = 0;
+
+/* Rings are never freed: a thread that has ended still has its spans in the trace */
+static mutex_handle_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static trace_ring_t *trace_rings = NULL;
+static int trace_ring_count = 0;
+static uint64_t trace_epoch = 0;
+
+static TRACE_THREAD_LOCAL trace_ring_t *trace_ring = NULL;
+static TRACE_THREAD_LOCAL int trace_ring_failed = 0;
+static TRACE_THREAD_LOCAL char trace_thread_name[TRACE_NAME_LEN];
+
+uint64_t
+trace_now(void)
+{
+#if defined(WIN32)
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    if (!frequency.QuadPart) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&counter);
+    return (uint64_t) (counter.QuadPart / frequency.QuadPart) * 1000000000ull +
+           (uint64_t) (counter.QuadPart % frequency.QuadPart) * 1000000000ull / frequency.QuadPart;
+#else
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000000ull + (uint64_t) time.tv_nsec;
+#endif
+}
+
+static trace_ring_t *
+trace_ring_register(void)
+{
+    trace_ring_t *ring = NULL;
+
+    MUTEX_LOCK(trace_mutex);
+    if (trace_ring_count < TRACE_MAX_THREADS) {
+        ring = malloc(sizeof(trace_ring_t));
+    }
+    if (ring) {
+        ring->tid = ++trace_ring_count;
+        if (trace_thread_name[0]) {
+            memcpy(ring->name, trace_thread_name, TRACE_NAME_LEN);
+        } else {
+            snprintf(ring->name, TRACE_NAME_LEN, "thread %d", ring->tid);
+        }
+        ring->head = 0;
+        ring->next = trace_rings;
+        trace_rings = ring;
+    }
+    MUTEX_UNLOCK(trace_mutex);
+
+    trace_ring = ring;
+    trace_ring_failed = !ring;
+    return ring;
+}
+
+void
+trace_start(void)
+{
+    MUTEX_LOCK(trace_mutex);
+    if (!trace_epoch) {
+        trace_epoch = trace_now();
+    }
+    MUTEX_UNLOCK(trace_mutex);
+    ATOMIC_STORE(trace_active, 1);
+}
+
+void
+trace_stop(void)
+{
+    ATOMIC_STORE(trace_active, 0);
+}
+
+void
+trace_set_thread_name(const char *name)
+{
+    snprintf(trace_thread_name, TRACE_NAME_LEN, "%s", name);
+    if (trace_ring) {
+        MUTEX_LOCK(trace_mutex);
+        memcpy(trace_ring->name, trace_thread_name, TRACE_NAME_LEN);
+        MUTEX_UNLOCK(trace_mutex);
+    }
+}
+
+void
+trace_span(const char *category, const char *name, uint64_t id, uint64_t start)
+{
+    trace_ring_t *ring = trace_ring;
+    if (!ring) {
+        if (trace_ring_failed || !(ring = trace_ring_register())) {
+            return;
+        }
+    }
+    int64_t head = ring->head;
+    trace_event_t *event = &ring->events[head & (TRACE_RING_EVENTS - 1)];
+    event->start = start;
+    event->duration = trace_now() - start;
+    event->id = id;
+    event->category = category;
+    event->name = name;
+    TRACE_STORE(ring->head, head + 1);
+}
+
+/* The events of a ring that are not being overwritten while they are copied, oldest first */
+static int
+trace_ring_copy(trace_ring_t *ring, trace_event_t *events)
+{
+    int64_t head = TRACE_LOAD(ring->head);
+    int64_t first = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0;
+    for (int64_t i = first; i < head; i++) {
+        events[i - first] = ring->events[i & (TRACE_RING_EVENTS - 1)];
+    }
+    TRACE_FENCE();
+    /* the thread may have gone on writing meanwhile, into the slots of the oldest events */
+    int64_t now_head = TRACE_LOAD(ring->head);
+    int64_t valid = now_head >= TRACE_RING_EVENTS ? now_head - TRACE_RING_EVENTS + 1 : 0;
+    if (valid > first) {
+        if (valid >= head) {
+            return 0;
+        }
+        memmove(events, events + (valid - first), (size_t) (head - valid) * sizeof(trace_event_t));
+        first = valid;
+    }
+    return (int) (head - first);
+}
+
+int
+trace_dump(const char *path)
+{
+    trace_event_t *events = malloc(TRACE_RING_EVENTS * sizeof(trace_event_t));
+    if (!events) {
+        return -1;
+    }
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        free(events);
+        return -1;
+    }
+
+    MUTEX_LOCK(trace_mutex);
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"RPiPlay\"}}");
+    for (trace_ring_t *ring = trace_rings; ring; ring = ring->next) {
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                ring->tid, ring->name);
+        int count = trace_ring_copy(ring, events);
+        for (int i = 0; i < count; i++) {
+            trace_event_t *event = &events[i];
+            /* spans begun before tracing was first started are clamped to its start */
+            uint64_t start = event->start > trace_epoch ? event->start - trace_epoch : 0;
+            fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                    "\"ts\":%llu.%03u,\"dur\":%llu.%03u,\"args\":{\"id\":%llu}}",
+                    event->name, event->category, ring->tid,
+                    (unsigned long long) (start / 1000), (unsigned int) (start % 1000),
+                    (unsigned long long) (event->duration / 1000), (unsigned int) (event->duration % 1000),
+                    (unsigned long long) event->id);
+        }
+    }
+    MUTEX_UNLOCK(trace_mutex);
+    fprintf(file, "\n]}\n");
+
+    int ret = ferror(file) ? -1 : 0;
+    if (fclose(file)) {
+        ret = -1;
+    }
+    free(events);
+    return ret;
+}
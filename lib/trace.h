@@ -0,0 +1,68 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * Tracing of the receive and render pipeline: spans around the stages a video frame (keyed by its
+ * pts) or an audio packet (keyed by its seqnum) goes through, written on demand as a Chrome
+ * trace-event JSON file that opens in Perfetto or chrome://tracing.
+ *
+ * Each thread records into its own ring buffer, which keeps its newest TRACE_RING_EVENTS spans, so
+ * a span costs two reads of the monotonic clock and a few stores. While tracing is not started,
+ * TRACE_BEGIN is one load and branch, and TRACE_END does nothing.
+ *
+ *     uint64_t start = TRACE_BEGIN();
+ *     mirror_buffer_decrypt(...);
+ *     TRACE_END("video", "decrypt", pts, start);
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRACE_RING_EVENTS 16384   /* per thread, a power of two */
+
+extern volatile long trace_active;
+
+#if defined(WIN32)
+#define TRACE_ACTIVE() (trace_active)
+#else
+#define TRACE_ACTIVE() __atomic_load_n(&trace_active, __ATOMIC_RELAXED)
+#endif
+
+/* Start of a span, 0 while tracing is stopped */
+#define TRACE_BEGIN() (TRACE_ACTIVE() ? trace_now() : 0)
+/* End of the span begun at start; category and name must be string literals (they are kept as pointers) */
+#define TRACE_END(category, name, id, start) do { if (start) trace_span(category, name, id, start); } while (0)
+
+void trace_start(void);
+/* The spans recorded so far are kept for trace_dump */
+void trace_stop(void);
+/* Write the spans kept in the ring buffers of all threads to path; can be called while tracing */
+int trace_dump(const char *path);
+
+/* Name of the calling thread in the trace (at most 31 characters) */
+void trace_set_thread_name(const char *name);
+
+/* Monotonic clock, ns */
+uint64_t trace_now(void);
+void trace_span(const char *category, const char *name, uint64_t id, uint64_t start);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //TRACE_H
@@ -229,3 +229,13 @@ void ntp_timestamp_to_seconds(uint64_t ntp_timestamp, char *timestamp, size_t ma
     strftime(timestamp, 3, "%S", &ts);
     snprintf(timestamp + 2, 8,".%6.6u", (unsigned int) ntp_timestamp % 1000000);
 }
+
+/* 64-bit FNV-1a hash, used to recognize data that is sent again unchanged */
+uint64_t utils_hash_data(const unsigned char *data, int datalen) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < datalen; i++) {
+        hash ^= (uint64_t) data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
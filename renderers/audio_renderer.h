@@ -60,6 +60,13 @@ typedef struct audio_renderer_funcs_s {
     void (*flush)(audio_renderer_t *renderer);
     void (*destroy)(audio_renderer_t *renderer);
     void (*setformat)(audio_renderer_t *renderer,audio_renderer_format_t fmt);
+    /**
+     * Render a refcounted audio packet, used instead of render_buffer if not NULL
+     * @param renderer
+     * @param buf the packet in buf->data, followed by REFBUF_PADDING zero bytes;
+     *        take a reference with refbuf_ref to keep it after returning
+     */
+    void (*render_refbuf)(audio_renderer_t *renderer, raop_ntp_t *ntp, refbuf_t *buf, uint64_t pts);
 } audio_renderer_funcs_t;
 
 typedef struct audio_renderer_s {
@@ -125,6 +125,21 @@ void audio_renderer_gstreamer_render_buffer(audio_renderer_t *renderer, raop_ntp
 
 }
 
+static void audio_renderer_gstreamer_render_refbuf(audio_renderer_t *renderer, raop_ntp_t *ntp, refbuf_t *buf, uint64_t pts) {
+    GstBuffer *buffer;
+
+    if (buf->size == 0) return;
+
+    audio_renderer_gstreamer_t *r = (audio_renderer_gstreamer_t *)renderer;
+
+    // The pipeline keeps a reference to the received data instead of a copy
+    buffer = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, buf->data, buf->size, 0, buf->size,
+                                         refbuf_ref(buf), (GDestroyNotify) refbuf_unref);
+    assert(buffer != NULL);
+    GST_BUFFER_DTS(buffer) = (GstClockTime)pts;
+    gst_app_src_push_buffer(GST_APP_SRC(r->appsrc), buffer);
+}
+
 void audio_renderer_gstreamer_set_volume(audio_renderer_t *renderer, float volume) {
     audio_renderer_gstreamer_t *r = (audio_renderer_gstreamer_t *)renderer;
     float avol;
@@ -160,5 +175,6 @@ static const audio_renderer_funcs_t audio_renderer_gstreamer_funcs = {
     .flush = audio_renderer_gstreamer_flush,
     .destroy = audio_renderer_gstreamer_destroy,
     .setformat=audio_renderer_gstreamer_setformat,
+    .render_refbuf = audio_renderer_gstreamer_render_refbuf,
 
 };
@@ -110,6 +110,9 @@ static int audio_renderer_sdl_init_decoder(audio_renderer_sdl_t *renderer,audio_
 			default:
 			break;
 		}
+		/* packets are decoded one at a time as they arrive, don't let the decoder hold any back */
+		renderer->audioctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+		renderer->audioctx->thread_count = 1;
 		ret = avcodec_open2(renderer->audioctx, audiodecode, NULL);
 	}
 	return ret;
@@ -169,16 +172,34 @@ audio_renderer_t *audio_renderer_sdl_init(logger_t *logger, video_renderer_t *vi
 static void audio_renderer_sdl_start(audio_renderer_t *renderer) {
 }
 
-static void audio_renderer_sdl_render_buffer(audio_renderer_t *renderer, raop_ntp_t *ntp, unsigned char *data, int data_len, uint64_t pts) {
-
+static void audio_renderer_sdl_release_refbuf(void *opaque, uint8_t *data) {
+	refbuf_unref(opaque);
+}
 
-	audio_renderer_sdl_t *r = (audio_renderer_sdl_t*)renderer;
+/* buf, if not NULL, holds data; the packet then references it instead of a copy */
+static void audio_renderer_sdl_decode(audio_renderer_sdl_t *r, unsigned char *data, int data_len, uint64_t pts, refbuf_t *buf) {
 	AVFrame* pFrame = av_frame_alloc();
 	AVPacket* packet = av_packet_alloc();
 	packet->pts = pts;
 	int i = 0;
-	av_new_packet(packet, data_len);
-	memcpy(packet->data, data, data_len);
+	if (buf)
+	{
+		packet->buf = av_buffer_create(buf->data, buf->size, audio_renderer_sdl_release_refbuf, refbuf_ref(buf), AV_BUFFER_FLAG_READONLY);
+		if (!packet->buf)
+		{
+			refbuf_unref(buf);
+			av_frame_free(&pFrame);
+			av_packet_free(&packet);
+			return;
+		}
+		packet->data = data;
+		packet->size = data_len;
+	}
+	else
+	{
+		av_new_packet(packet, data_len);
+		memcpy(packet->data, data, data_len);
+	}
 	avcodec_send_packet(r->audioctx, packet);
 	while (avcodec_receive_frame(r->audioctx, pFrame) == 0)
 	{
@@ -216,8 +237,16 @@ static void audio_renderer_sdl_render_buffer(audio_renderer_t *renderer, raop_nt
 	}
 	av_frame_free(&pFrame);
 	av_packet_free(&packet);
+}
 
-	
+static void audio_renderer_sdl_render_buffer(audio_renderer_t *renderer, raop_ntp_t *ntp, unsigned char *data, int data_len, uint64_t pts) {
+	audio_renderer_sdl_t *r = (audio_renderer_sdl_t*)renderer;
+	audio_renderer_sdl_decode(r, data, data_len, pts, NULL);
+}
+
+static void audio_renderer_sdl_render_refbuf(audio_renderer_t *renderer, raop_ntp_t *ntp, refbuf_t *buf, uint64_t pts) {
+	audio_renderer_sdl_t *r = (audio_renderer_sdl_t*)renderer;
+	audio_renderer_sdl_decode(r, buf->data, buf->size, pts, buf);
 }
 
 static void audio_renderer_sdl_set_volume(audio_renderer_t *renderer, float volume) {
@@ -284,4 +313,5 @@ static const audio_renderer_funcs_t audio_renderer_sdl_funcs = {
     .flush = audio_renderer_sdl_flush,
     .destroy = audio_renderer_sdl_destroy,
 	.setformat=audio_renderer_sdl_setformat,
+	.render_refbuf = audio_renderer_sdl_render_refbuf,
 };
@@ -0,0 +1,173 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include "decode_control.h"
+
+#include <string.h>
+
+/* Smoothed lag (us) above which each level is entered; a level is left again below half of it */
+static const int64_t decode_level_threshold[DECODE_LEVEL_COUNT] = { 0, 120000, 250000, 500000 };
+
+/* Packets to wait after a change before degrading further (for its effect to show) or restoring */
+#define DECODE_CONTROL_HOLD_UP 8
+#define DECODE_CONTROL_HOLD_DOWN 60
+
+/* Key frames only is entered if a key frame was decoded within this time (us), and left again
+ * if none follows within it: the client may send key frames rarely or only on request */
+#define DECODE_CONTROL_KEY_INTERVAL 2000000
+
+/* Longest time (us) packets are dropped waiting for a resume point; decoding then starts over without one */
+#define DECODE_CONTROL_DROP_MAX 1000000
+
+static const char *decode_level_names[DECODE_LEVEL_COUNT] = {
+    "full decoding", "no deblocking", "no non-reference frames", "key frames only"
+};
+
+void decode_control_init(decode_control_t *control, logger_t *logger, metrics_session_t *metrics) {
+    memset(control, 0, sizeof(decode_control_t));
+    control->logger = logger;
+    control->metrics = metrics;
+    control->level = DECODE_LEVEL_FULL;
+    control->base_skip_loop_filter = AVDISCARD_DEFAULT;
+}
+
+static void decode_control_apply(decode_control_t *control, AVCodecContext *ctx) {
+    enum AVDiscard skip_loop_filter = control->base_skip_loop_filter;
+    if (control->level >= DECODE_LEVEL_NO_DEBLOCK) {
+        skip_loop_filter = AVDISCARD_ALL;
+    }
+    ctx->skip_loop_filter = skip_loop_filter;
+    ctx->skip_frame = control->level == DECODE_LEVEL_KEY_ONLY ? AVDISCARD_NONKEY :
+                      control->level == DECODE_LEVEL_NO_NONREF ? AVDISCARD_NONREF :
+                      AVDISCARD_DEFAULT;
+}
+
+void decode_control_attach(decode_control_t *control, AVCodecContext *ctx) {
+    control->base_skip_loop_filter = ctx->skip_loop_filter;
+    decode_control_apply(control, ctx);
+}
+
+/* reason is logged instead of "overloaded" or "caught up" if not NULL */
+static void decode_control_set_level(decode_control_t *control, AVCodecContext *ctx, decode_level_t level,
+                                     const char *reason) {
+    decode_level_t old_level = control->level;
+    control->level = level;
+    control->since_change = 0;
+    control->changes++;
+    decode_control_apply(control, ctx);
+    metrics_set(control->metrics, METRICS_VIDEO_DECODE_LEVEL, level);
+    metrics_count(control->metrics, METRICS_VIDEO_DECODE_LEVEL_CHANGES, 1);
+    logger_log(control->logger, level > old_level ? LOGGER_WARNING : LOGGER_INFO,
+               "Video decoding %s (%.0f ms behind), switching %s %s",
+               reason ? reason : level > old_level ? "overloaded" : "caught up",
+               control->lag / 1000.0, level > old_level ? "to" : "back to", decode_level_names[level]);
+}
+
+void decode_control_update(decode_control_t *control, AVCodecContext *ctx, int64_t lag, bool key_frame, uint64_t now) {
+    if (key_frame) {
+        control->last_key_frame = now;
+    }
+    bool keys_recent = control->last_key_frame && now - control->last_key_frame < DECODE_CONTROL_KEY_INTERVAL;
+    if (lag < 0) {
+        lag = 0;
+    }
+    control->lag = control->lag_count ? control->lag + (lag - control->lag) / 8 : lag;
+    metrics_set(control->metrics, METRICS_VIDEO_DECODE_LAG, control->lag);
+    if (lag > control->max_lag) {
+        control->max_lag = lag;
+    }
+    control->lag_sum += lag;
+    control->lag_count++;
+    control->packets[control->level]++;
+    control->since_change++;
+
+    decode_level_t level = control->level;
+    if (level + 1 < DECODE_LEVEL_COUNT && control->lag > decode_level_threshold[level + 1] &&
+        control->since_change >= DECODE_CONTROL_HOLD_UP && (level + 1 != DECODE_LEVEL_KEY_ONLY || keys_recent)) {
+        decode_control_set_level(control, ctx, level + 1, NULL);
+    } else if (level > DECODE_LEVEL_FULL && control->lag < decode_level_threshold[level] / 2 &&
+               control->since_change >= DECODE_CONTROL_HOLD_DOWN) {
+        // Non-reference frames can be decoded again right away, but the frames after a
+        // key frame reference each other: start decoding them at a key frame
+        if (level != DECODE_LEVEL_KEY_ONLY || key_frame) {
+            decode_control_set_level(control, ctx, level - 1, NULL);
+        }
+    } else if (level == DECODE_LEVEL_KEY_ONLY && !keys_recent) {
+        // Nothing is shown until the next key frame: rather decode the frames after the
+        // missing key frame against the references there are
+        decode_control_set_level(control, ctx, level - 1, "gets no key frames");
+    }
+}
+
+decode_queue_action_t decode_control_queue(decode_control_t *control, int queued, bool first, bool resume, uint64_t now) {
+    if (!first) {
+        // Dropping or flushing part of an access unit would leave the rest without its first slices
+        if (control->unit_dropped) {
+            control->packets_dropped++;
+            metrics_count(control->metrics, METRICS_VIDEO_DROPPED, 1);
+            return DECODE_QUEUE_DROP;
+        }
+        return DECODE_QUEUE_ADD;
+    }
+    control->unit_dropped = false;
+    if (queued >= DECODE_CONTROL_QUEUE_LIMIT && !control->dropping) {
+        control->dropping = true;
+        control->dropping_since = now;
+        logger_log(control->logger, LOGGER_WARNING, "Video decoding: %d packets waiting, dropping packets until the next key frame",
+                   queued);
+    }
+    if (!control->dropping) {
+        return DECODE_QUEUE_ADD;
+    }
+    if (!resume && now - control->dropping_since >= DECODE_CONTROL_DROP_MAX) {
+        // The client may not send a key frame for long: references are missing from here on,
+        // but that beats showing nothing
+        logger_log(control->logger, LOGGER_WARNING, "Video decoding: no key frame within %d ms, starting over without one",
+                   DECODE_CONTROL_DROP_MAX / 1000);
+        resume = true;
+    }
+    if (resume) {
+        // Decoding starts over here, the packets still waiting before it would only delay it
+        control->dropping = false;
+        control->packets_dropped += queued;
+        metrics_count(control->metrics, METRICS_VIDEO_DROPPED, queued);
+        return DECODE_QUEUE_FLUSH;
+    }
+    control->unit_dropped = true;
+    control->packets_dropped++;
+    metrics_count(control->metrics, METRICS_VIDEO_DROPPED, 1);
+    return DECODE_QUEUE_DROP;
+}
+
+void decode_control_log_stats(decode_control_t *control) {
+    if (control->packets_dropped) {
+        logger_log(control->logger, LOGGER_INFO, "Video decoding: %d packets dropped with the queue full", control->packets_dropped);
+    }
+    if (control->lag_count == 0) {
+        return;
+    }
+    logger_log(control->logger, LOGGER_INFO, "Video decoding lag: average %.1f ms, max %.1f ms, %d level changes",
+               control->lag_sum / 1000.0 / control->lag_count, control->max_lag / 1000.0, control->changes);
+    for (int i = DECODE_LEVEL_NO_DEBLOCK; i < DECODE_LEVEL_COUNT; i++) {
+        if (control->packets[i]) {
+            logger_log(control->logger, LOGGER_INFO, "Video decoding: %d of %d packets with %s",
+                       control->packets[i], control->lag_count, decode_level_names[i]);
+        }
+    }
+}
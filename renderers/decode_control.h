@@ -0,0 +1,120 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Overload control for the ffmpeg H264 decoder: when decoded frames fall behind their
+ * pts, decoding is degraded step by step (no deblocking, then no non-reference frames,
+ * then key frames only) until the decoder has caught up, and then restored step by step.
+ * The queue in front of the decoder is limited: once it is full, packets are dropped up
+ * to the next point where decoding can start over. Neither key frames only nor dropping
+ * waits for key frames longer than a time limit. Lag and level are exported as metrics.
+ */
+
+#ifndef DECODE_CONTROL_H
+#define DECODE_CONTROL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <libavcodec/avcodec.h>
+#include "../lib/logger.h"
+#include "../lib/metrics.h"
+
+/* Most packets waiting for the decoder (access units, or parts of them in low-latency mode) */
+#define DECODE_CONTROL_QUEUE_LIMIT 32
+
+typedef enum decode_level_e {
+    DECODE_LEVEL_FULL,          // decode everything
+    DECODE_LEVEL_NO_DEBLOCK,    // skip_loop_filter
+    DECODE_LEVEL_NO_NONREF,     // also skip_frame = AVDISCARD_NONREF
+    DECODE_LEVEL_KEY_ONLY,      // skip_frame = AVDISCARD_NONKEY, until caught up
+    DECODE_LEVEL_COUNT
+} decode_level_t;
+
+typedef enum decode_queue_action_e {
+    DECODE_QUEUE_ADD,           // queue the packet
+    DECODE_QUEUE_DROP,          // drop the packet, the queue is full
+    DECODE_QUEUE_FLUSH          // decoding starts over with the packet: drop the waiting ones, then queue it
+} decode_queue_action_t;
+
+typedef struct decode_control_s {
+    logger_t *logger;
+    metrics_session_t *metrics;
+
+    decode_level_t level;
+    int64_t lag;                /* smoothed lag of decoded frames behind their pts (us) */
+    int since_change;           /* packets decoded since the last level change */
+    enum AVDiscard base_skip_loop_filter;   /* as set by the decode profile */
+    uint64_t last_key_frame;    /* when the last key frame was decoded (us), 0 if none yet */
+
+    /* queue limit, used by the thread that queues the packets */
+    bool dropping;              /* queue was full, packets are dropped up to the next resume point */
+    uint64_t dropping_since;    /* when the queue was found full (us) */
+    bool unit_dropped;          /* the access unit whose parts are arriving is dropped */
+    int packets_dropped;
+
+    /* statistics */
+    int64_t max_lag;
+    int64_t lag_sum;
+    int lag_count;
+    int packets[DECODE_LEVEL_COUNT];
+    int changes;
+} decode_control_t;
+
+/* Level changes are reported as log messages (warnings when degrading) and in metrics (may be NULL) */
+void decode_control_init(decode_control_t *control, logger_t *logger, metrics_session_t *metrics);
+
+/**
+ * Apply the current level to a decoder context, e.g. after opening it; also remembers the
+ * context's own skip_loop_filter setting to restore at DECODE_LEVEL_FULL
+ */
+void decode_control_attach(decode_control_t *control, AVCodecContext *ctx);
+
+/**
+ * Account for a decoded packet and change the level if needed (applied to ctx)
+ * @param lag how far behind its pts the packet was decoded (us)
+ * @param key_frame true if the packet was a key frame; leaving DECODE_LEVEL_KEY_ONLY waits for one,
+ *        unless there has been none for a while, and it is only entered if there was one recently
+ * @param now local time (us)
+ */
+void decode_control_update(decode_control_t *control, AVCodecContext *ctx, int64_t lag, bool key_frame, uint64_t now);
+
+/**
+ * Decide on a packet before it is queued for the decoder, and account for it
+ * @param queued packets waiting for the decoder
+ * @param first false for the later parts of an access unit (low-latency mode): they are dropped
+ *        if the first part was, and queued otherwise
+ * @param resume true if decoding can start over with the packet (IDR frame or new parameter sets)
+ * @param now local time (us)
+ * @return DECODE_QUEUE_DROP from the packet that finds the queue full up to the next resume
+ *         point, which gets DECODE_QUEUE_FLUSH; the queued packets are dropped then. Without a
+ *         resume point for a while, the packet after that time gets DECODE_QUEUE_FLUSH instead
+ */
+decode_queue_action_t decode_control_queue(decode_control_t *control, int queued, bool first, bool resume, uint64_t now);
+
+void decode_control_log_stats(decode_control_t *control);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //DECODE_CONTROL_H
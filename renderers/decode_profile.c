@@ -0,0 +1,66 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include "decode_profile.h"
+
+const char *decode_profile_name(decode_profile_t profile) {
+    switch (profile) {
+        case DECODE_PROFILE_LOWEST_LATENCY:
+            return "lowest-latency";
+        case DECODE_PROFILE_THROUGHPUT:
+            return "throughput";
+        case DECODE_PROFILE_WEAK_CPU:
+            return "weak-cpu";
+        default:
+            return "unknown";
+    }
+}
+
+decode_profile_t decode_profile_resolve(const video_renderer_config_t *config, int height) {
+    // the threshold comes from the user (-dp), e.g. where decode_bench showed one core falling behind
+    if (config->decode_switch_height > 0 && height >= config->decode_switch_height) {
+        return config->decode_profile_large;
+    }
+    return config->decode_profile;
+}
+
+void decode_profile_apply(AVCodecContext *ctx, decode_profile_t profile, bool chunks) {
+    ctx->thread_count = 0;   // one per core
+    switch (profile) {
+        case DECODE_PROFILE_THROUGHPUT:
+            ctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+            break;
+        case DECODE_PROFILE_WEAK_CPU:
+            ctx->thread_type = FF_THREAD_SLICE;
+            ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+            ctx->flags2 |= AV_CODEC_FLAG2_FAST;
+            ctx->skip_loop_filter = AVDISCARD_ALL;
+            break;
+        case DECODE_PROFILE_LOWEST_LATENCY:
+        default:
+            ctx->thread_type = FF_THREAD_SLICE;
+            ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+            ctx->flags2 |= AV_CODEC_FLAG2_FAST;
+            break;
+    }
+    if (chunks) {
+        // access units arrive in parts (render_partial); finish a frame once its last slice is decoded
+        ctx->flags2 |= AV_CODEC_FLAG2_CHUNKS;
+    }
+}
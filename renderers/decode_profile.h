@@ -0,0 +1,57 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * ffmpeg H264 decoder settings for the decode profiles (see decode_profile_t),
+ * shared by the SDL renderer and the decode benchmark.
+ */
+
+#ifndef DECODE_PROFILE_H
+#define DECODE_PROFILE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <libavcodec/avcodec.h>
+#include "video_renderer.h"
+
+const char *decode_profile_name(decode_profile_t profile);
+
+/**
+ * Get the profile to use for a video size, with the switch set up in a renderer config
+ * @param height of the video, 0 if not known yet
+ * @return config->decode_profile_large from config->decode_switch_height lines up, else config->decode_profile
+ */
+decode_profile_t decode_profile_resolve(const video_renderer_config_t *config, int height);
+
+/**
+ * Set up a decoder context for a profile, before avcodec_open2
+ * @param profile
+ * @param chunks true if access units are passed on in parts (AV_CODEC_FLAG2_CHUNKS);
+ *        ffmpeg cannot use frame threads then
+ */
+void decode_profile_apply(AVCodecContext *ctx, decode_profile_t profile, bool chunks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //DECODE_PROFILE_H
@@ -175,3 +175,9 @@ C_ALLOC_MEM_OVERLAY(WorkBufferCore1, CWorkBufferCore1, 1, SECT_DATA_L1,
 /* double buffer size needed for de-/interleaving */
 C_ALLOC_MEM_OVERLAY(WorkBufferCore5, PCM_DEC, (8) * (1024 * 4) * 2,
                     SECT_DATA_EXTERN, WORKBUFFER5_TAG)
+
+/* WorkBufferCore5 for a configuration that needs less than the full size, size
+   in bytes. It is freed with FreeWorkBufferCore5(). */
+PCM_DEC *GetWorkBufferCore5Size(UINT size) {
+  return (PCM_DEC *)FDKaalloc_L(size, ALIGNMENT_DEFAULT, SECT_DATA_EXTERN);
+}
@@ -137,6 +137,7 @@ H_ALLOC_MEM(TimeDataFlush, PCM_DEC)
 H_ALLOC_MEM_OVERLAY(WorkBufferCore1, CWorkBufferCore1)
 H_ALLOC_MEM_OVERLAY(WorkBufferCore2, FIXP_DBL)
 H_ALLOC_MEM_OVERLAY(WorkBufferCore5, PCM_DEC)
+PCM_DEC *GetWorkBufferCore5Size(UINT size);
 H_ALLOC_MEM_OVERLAY(WorkBufferCore6, SCHAR)
 
 #endif /* #ifndef AAC_RAM_H */
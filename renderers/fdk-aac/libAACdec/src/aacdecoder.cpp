@@ -929,6 +929,11 @@ static AAC_DECODER_ERROR CAacDecoder_ExtPayloadParse(
           goto bail;
       }
 
+      error = CAacDecoder_UniDrcOpen(self);
+      if (error != AAC_DEC_OK) {
+        goto bail;
+      }
+
       drcErr = FDK_drcDec_SetCodecMode(self->hUniDrcDecoder, drcDecCodecMode);
       if (drcErr) {
         error = AAC_DEC_PARSE_ERROR;
@@ -1360,12 +1365,8 @@ LINKSPEC_CPP HANDLE_AACDECODER CAacDecoder_Open(
   self->workBufferCore2 = GetWorkBufferCore2();
   if (self->workBufferCore2 == NULL) goto bail;
 
-  /* When RSVD60 is active use dedicated memory for core decoding */
-  self->pTimeData2 = GetWorkBufferCore5();
-  self->timeData2Size = GetRequiredMemWorkBufferCore5();
-  if (self->pTimeData2 == NULL) {
-    goto bail;
-  }
+  /* The time data buffer (pTimeData2) is allocated by CAacDecoder_Init(), in
+   * the size the configuration needs. */
 
   return self;
 
@@ -1569,6 +1570,69 @@ LINKSPEC_CPP void CAacDecoder_Close(HANDLE_AACDECODER self) {
   FreeAacDecoder(&self);
 }
 
+/* Configure the MPEG-D DRC decoder for the current stream */
+static INT CAacDecoder_UniDrcInit(HANDLE_AACDECODER self) {
+  int drcDecSampleRate, drcDecFrameSize;
+
+  if (self->streamInfo.extSamplingRate != 0) {
+    drcDecSampleRate = self->streamInfo.extSamplingRate;
+    drcDecFrameSize = (self->streamInfo.aacSamplesPerFrame *
+                       self->streamInfo.extSamplingRate) /
+                      self->streamInfo.aacSampleRate;
+  } else {
+    drcDecSampleRate = self->streamInfo.aacSampleRate;
+    drcDecFrameSize = self->streamInfo.aacSamplesPerFrame;
+  }
+
+  return FDK_drcDec_Init(self->hUniDrcDecoder, drcDecFrameSize,
+                         drcDecSampleRate, self->aacChannels);
+}
+
+LINKSPEC_CPP AAC_DECODER_ERROR CAacDecoder_UniDrcOpen(HANDLE_AACDECODER self) {
+  INT maxOutputChannels = -1;
+
+  if (self->hUniDrcDecoder != NULL) {
+    return AAC_DEC_OK;
+  }
+
+  if (FDK_drcDec_Open(&self->hUniDrcDecoder, DRC_DEC_ALL) != 0) {
+    FDK_drcDec_Close(&self->hUniDrcDecoder);
+    return AAC_DEC_OUT_OF_MEMORY;
+  }
+
+  /* Apply what has been set before: the requested channel count (kept by the
+     PCM utils) and the configuration of the stream, if there is one yet. */
+  pcmDmx_GetParam(self->hPcmUtils, MAX_NUMBER_OF_OUTPUT_CHANNELS,
+                  &maxOutputChannels);
+  if (maxOutputChannels > 0) {
+    FDK_drcDec_SetParam(self->hUniDrcDecoder,
+                        DRC_DEC_TARGET_CHANNEL_COUNT_REQUESTED,
+                        (FIXP_DBL)maxOutputChannels);
+  }
+  if ((self->aacChannels > 0) && (self->streamInfo.aacSampleRate > 0)) {
+    if (CAacDecoder_UniDrcInit(self) != 0) {
+      return AAC_DEC_UNKNOWN;
+    }
+  }
+
+  return AAC_DEC_OK;
+}
+
+LINKSPEC_CPP AAC_DECODER_ERROR CAacDecoder_LimiterOpen(HANDLE_AACDECODER self) {
+  if (self->hLimiter != NULL) {
+    return AAC_DEC_OK;
+  }
+
+  self->hLimiter =
+      pcmLimiter_Create(TDL_ATTACK_DEFAULT_MS, TDL_RELEASE_DEFAULT_MS,
+                        (FIXP_DBL)MAXVAL_DBL, (8), 96000);
+  if (self->hLimiter == NULL) {
+    return AAC_DEC_OUT_OF_MEMORY;
+  }
+
+  return AAC_DEC_OK;
+}
+
 /*!
   \brief Initialization of decoder instance
 
@@ -1718,6 +1782,43 @@ CAacDecoder_Init(HANDLE_AACDECODER self, const CSAudioSpecificConfig *asc,
     flushChannels = fMin(fMax(numChannel, flushChannels), (8));
   }
 
+  {
+    /* When RSVD60 is active use dedicated memory for core decoding. An AAC-ELD
+       stream needs a buffer for its channels (at least two, for LD MPS and
+       upmixing) of dual rate SBR output, twice for de-/interleaving; the other
+       AOTs get the full size. */
+    PCM_DEC *pTimeData2;
+    INT timeData2Size;
+
+    if (asc->m_aot == AOT_ER_AAC_ELD) {
+      INT numChannel;
+      pcmDmx_GetParam(self->hPcmUtils, MIN_NUMBER_OF_OUTPUT_CHANNELS,
+                      &numChannel);
+      numChannel = fMin(fMax(fMax(ascChannels, 2), numChannel), (8));
+      timeData2Size = 2 * numChannel * 2 * (INT)asc->m_samplesPerFrame *
+                      (INT)sizeof(PCM_DEC);
+    } else {
+      timeData2Size = GetRequiredMemWorkBufferCore5();
+    }
+
+    if ((self->pTimeData2 == NULL) || (self->timeData2Size != timeData2Size)) {
+      /* Keep the current buffer if there is no memory for the new one */
+      if (asc->m_aot == AOT_ER_AAC_ELD) {
+        pTimeData2 = GetWorkBufferCore5Size(timeData2Size);
+      } else {
+        pTimeData2 = GetWorkBufferCore5();
+      }
+      if (pTimeData2 == NULL) {
+        return AAC_DEC_OUT_OF_MEMORY;
+      }
+      if (self->pTimeData2 != NULL) {
+        FreeWorkBufferCore5(&self->pTimeData2);
+      }
+      self->pTimeData2 = pTimeData2;
+      self->timeData2Size = timeData2Size;
+    }
+  }
+
   if (IS_USAC(asc->m_aot)) {
     for (int el = 0; el < (INT)asc->m_sc.m_usacConfig.m_usacNumElements; el++) {
       /* fix number of core channels aka ascChannels for stereoConfigIndex = 1
@@ -2470,22 +2571,8 @@ CAacDecoder_Init(HANDLE_AACDECODER self, const CSAudioSpecificConfig *asc,
     }
   }
 
-  if (*configChanged) {
-    int drcDecSampleRate, drcDecFrameSize;
-
-    if (self->streamInfo.extSamplingRate != 0) {
-      drcDecSampleRate = self->streamInfo.extSamplingRate;
-      drcDecFrameSize = (self->streamInfo.aacSamplesPerFrame *
-                         self->streamInfo.extSamplingRate) /
-                        self->streamInfo.aacSampleRate;
-    } else {
-      drcDecSampleRate = self->streamInfo.aacSampleRate;
-      drcDecFrameSize = self->streamInfo.aacSamplesPerFrame;
-    }
-
-    if (FDK_drcDec_Init(self->hUniDrcDecoder, drcDecFrameSize, drcDecSampleRate,
-                        self->aacChannels) != 0)
-      goto bail;
+  if (*configChanged && (self->hUniDrcDecoder != NULL)) {
+    if (CAacDecoder_UniDrcInit(self) != 0) goto bail;
   }
 
   if (*configChanged) {
@@ -2495,6 +2582,7 @@ CAacDecoder_Init(HANDLE_AACDECODER self, const CSAudioSpecificConfig *asc,
   }
 
   if (asc->m_aot == AOT_USAC) {
+    if (CAacDecoder_LimiterOpen(self) != AAC_DEC_OK) goto bail;
     pcmLimiter_SetAttack(self->hLimiter, (5));
     pcmLimiter_SetThreshold(self->hLimiter, FL2FXCONST_DBL(0.89125094f));
   }
@@ -3005,6 +3093,10 @@ LINKSPEC_CPP AAC_DECODER_ERROR CAacDecoder_DecodeFrame(
                 if (streamIndex == 0) {
                   int drcErr;
 
+                  if (CAacDecoder_UniDrcOpen(self) != AAC_DEC_OK) {
+                    ErrorStatus = AAC_DEC_OUT_OF_MEMORY;
+                    break;
+                  }
                   drcErr = FDK_drcDec_ReadUniDrcGain(self->hUniDrcDecoder, bs);
                   if (drcErr != 0) {
                     ErrorStatus = AAC_DEC_PARSE_ERROR;
@@ -3314,7 +3406,8 @@ LINKSPEC_CPP AAC_DECODER_ERROR CAacDecoder_DecodeFrame(
      * present and one of DRC or Loudness Normalization is switched on */
     aacDecoder_drcSetParam(
         self->hDrcInfo, UNIDRC_PRECEDENCE,
-        FDK_drcDec_GetParam(self->hUniDrcDecoder, DRC_DEC_IS_ACTIVE));
+        (self->hUniDrcDecoder != NULL) &&
+            FDK_drcDec_GetParam(self->hUniDrcDecoder, DRC_DEC_IS_ACTIVE));
 
     /* Extract DRC control data and map it to channels (without bitstream delay)
      */
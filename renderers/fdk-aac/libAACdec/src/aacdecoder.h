@@ -422,6 +422,14 @@ LINKSPEC_H AAC_DECODER_ERROR CAacDecoder_Init(HANDLE_AACDECODER self,
                                               const CSAudioSpecificConfig *asc,
                                               UCHAR configMode,
                                               UCHAR *configChanged);
+
+/* Open the MPEG-D DRC decoder, if not done yet. It is needed only for streams
+   with uniDrc payload, or if the library user sets an MPEG-D DRC parameter. */
+LINKSPEC_H AAC_DECODER_ERROR CAacDecoder_UniDrcOpen(HANDLE_AACDECODER self);
+
+/* Create the time domain limiter, if not done yet */
+LINKSPEC_H AAC_DECODER_ERROR CAacDecoder_LimiterOpen(HANDLE_AACDECODER self);
+
 /*!
   \brief Decodes one aac frame
 
@@ -234,6 +234,9 @@ LINKSPEC_CPP AAC_DECODER_ERROR aacDecoder_RawISOBMFFData(HANDLE_AACDECODER self,
 
   if (length < 8) return AAC_DEC_UNKNOWN;
 
+  err = CAacDecoder_UniDrcOpen(self);
+  if (err != AAC_DEC_OK) return err;
+
   while (length >= 8) {
     UINT size =
         (buffer[0] << 24) | (buffer[1] << 16) | (buffer[2] << 8) | buffer[3];
@@ -450,6 +453,10 @@ static INT aacDecoder_UniDrcCallback(void *handle, HANDLE_FDK_BITSTREAM hBs,
   }
 
   if (hBs == NULL) {
+    if (hAacDecoder->hUniDrcDecoder == NULL) {
+      /* no payload seen yet, nothing to clear */
+      return TRANSPORTDEC_OK;
+    }
     /* use dummy zero payload to clear memory */
     hReadBs = &dummyBs;
     FDKinitBitStream(hReadBs, dummyBuffer, 4, 24);
@@ -461,6 +468,10 @@ static INT aacDecoder_UniDrcCallback(void *handle, HANDLE_FDK_BITSTREAM hBs,
     drcDecCodecMode = DRC_DEC_MPEG_D_USAC;
   }
 
+  if (CAacDecoder_UniDrcOpen(hAacDecoder) != AAC_DEC_OK) {
+    return (INT)TRANSPORTDEC_UNKOWN_ERROR;
+  }
+
   err = FDK_drcDec_SetCodecMode(hAacDecoder->hUniDrcDecoder, drcDecCodecMode);
   if (err) return (INT)TRANSPORTDEC_UNKOWN_ERROR;
 
@@ -681,7 +692,6 @@ LINKSPEC_CPP AAC_DECODER_ERROR aacDecoder_SetParam(
   HANDLE_AAC_DRC hDrcInfo = NULL;
   HANDLE_PCM_DOWNMIX hPcmDmx = NULL;
   PCMDMX_ERROR dmxErr = PCMDMX_OK;
-  TDLimiterPtr hPcmTdl = NULL;
   DRC_DEC_ERROR uniDrcErr = DRC_DEC_OK;
 
   /* check decoder handle */
@@ -689,7 +699,6 @@ LINKSPEC_CPP AAC_DECODER_ERROR aacDecoder_SetParam(
     hTpDec = self->hInput;
     hDrcInfo = self->hDrcInfo;
     hPcmDmx = self->hPcmUtils;
-    hPcmTdl = self->hLimiter;
   } else {
     errorStatus = AAC_DEC_INVALID_HANDLE;
     goto bail;
@@ -715,7 +724,8 @@ LINKSPEC_CPP AAC_DECODER_ERROR aacDecoder_SetParam(
       }
       errorStatus =
           aacDecoder_drcSetParam(hDrcInfo, MAX_OUTPUT_CHANNELS, value);
-      if (value > 0) {
+      /* otherwise CAacDecoder_UniDrcOpen() takes it from the PCM utils */
+      if ((value > 0) && (self->hUniDrcDecoder != NULL)) {
         uniDrcErr = FDK_drcDec_SetParam(self->hUniDrcDecoder,
                                         DRC_DEC_TARGET_CHANNEL_COUNT_REQUESTED,
                                         (FIXP_DBL)value);
@@ -737,7 +747,11 @@ LINKSPEC_CPP AAC_DECODER_ERROR aacDecoder_SetParam(
       if (value <= 0) { /* module function converts value to unsigned */
         return AAC_DEC_SET_PARAM_FAIL;
       }
-      switch (pcmLimiter_SetAttack(hPcmTdl, value)) {
+      errorStatus = CAacDecoder_LimiterOpen(self);
+      if (errorStatus != AAC_DEC_OK) {
+        goto bail;
+      }
+      switch (pcmLimiter_SetAttack(self->hLimiter, value)) {
         case TDLIMIT_OK:
           break;
         case TDLIMIT_INVALID_HANDLE:
@@ -752,7 +766,11 @@ LINKSPEC_CPP AAC_DECODER_ERROR aacDecoder_SetParam(
       if (value <= 0) { /* module function converts value to unsigned */
         return AAC_DEC_SET_PARAM_FAIL;
       }
-      switch (pcmLimiter_SetRelease(hPcmTdl, value)) {
+      errorStatus = CAacDecoder_LimiterOpen(self);
+      if (errorStatus != AAC_DEC_OK) {
+        goto bail;
+      }
+      switch (pcmLimiter_SetRelease(self->hLimiter, value)) {
         case TDLIMIT_OK:
           break;
         case TDLIMIT_INVALID_HANDLE:
@@ -835,6 +853,9 @@ LINKSPEC_CPP AAC_DECODER_ERROR aacDecoder_SetParam(
         return AAC_DEC_SET_PARAM_FAIL;
       }
       errorStatus = aacDecoder_drcSetParam(hDrcInfo, DRC_CUT_SCALE, value);
+      if (errorStatus == AAC_DEC_OK) {
+        errorStatus = CAacDecoder_UniDrcOpen(self);
+      }
       uniDrcErr = FDK_drcDec_SetParam(self->hUniDrcDecoder, DRC_DEC_COMPRESS,
                                       value * (FL2FXCONST_DBL(0.5f / 127.0f)));
       break;
@@ -845,6 +866,9 @@ LINKSPEC_CPP AAC_DECODER_ERROR aacDecoder_SetParam(
         return AAC_DEC_SET_PARAM_FAIL;
       }
       errorStatus = aacDecoder_drcSetParam(hDrcInfo, DRC_BOOST_SCALE, value);
+      if (errorStatus == AAC_DEC_OK) {
+        errorStatus = CAacDecoder_UniDrcOpen(self);
+      }
       uniDrcErr = FDK_drcDec_SetParam(self->hUniDrcDecoder, DRC_DEC_BOOST,
                                       value * (FL2FXCONST_DBL(0.5f / 127.0f)));
       break;
@@ -858,6 +882,9 @@ LINKSPEC_CPP AAC_DECODER_ERROR aacDecoder_SetParam(
          values also switch off MPEG-4 DRC, while MPEG-D DRC can be separately
          switched on/off with AAC_UNIDRC_SET_EFFECT */
       errorStatus = aacDecoder_drcSetParam(hDrcInfo, TARGET_REF_LEVEL, value);
+      if (errorStatus == AAC_DEC_OK) {
+        errorStatus = CAacDecoder_UniDrcOpen(self);
+      }
       uniDrcErr = FDK_drcDec_SetParam(self->hUniDrcDecoder,
                                       DRC_DEC_LOUDNESS_NORMALIZATION_ON,
                                       (FIXP_DBL)(value >= 0));
@@ -887,10 +914,12 @@ LINKSPEC_CPP AAC_DECODER_ERROR aacDecoder_SetParam(
 
     case AAC_UNIDRC_SET_EFFECT:
       if ((value < -1) || (value > 6)) return AAC_DEC_SET_PARAM_FAIL;
+      errorStatus = CAacDecoder_UniDrcOpen(self);
       uniDrcErr = FDK_drcDec_SetParam(self->hUniDrcDecoder, DRC_DEC_EFFECT_TYPE,
                                       (FIXP_DBL)value);
       break;
     case AAC_UNIDRC_ALBUM_MODE:
+      errorStatus = CAacDecoder_UniDrcOpen(self);
       uniDrcErr = FDK_drcDec_SetParam(self->hUniDrcDecoder, DRC_DEC_ALBUM_MODE,
                                       (FIXP_DBL)value);
       break;
@@ -1019,13 +1048,8 @@ LINKSPEC_CPP HANDLE_AACDECODER aacDecoder_Open(TRANSPORT_TYPE transportFmt,
   aacDec->mpsOutputMode = (SCHAR)SACDEC_OUT_MODE_NORMAL;
   transportDec_RegisterSscCallback(pIn, aacDecoder_SscCallback, (void *)aacDec);
 
-  {
-    if (FDK_drcDec_Open(&(aacDec->hUniDrcDecoder), DRC_DEC_ALL) != 0) {
-      err = -1;
-      goto bail;
-    }
-  }
-
+  /* The MPEG-D DRC decoder is opened with the first uniDrc payload, see
+   * CAacDecoder_UniDrcOpen() */
   transportDec_RegisterUniDrcConfigCallback(pIn, aacDecoder_UniDrcCallback,
                                             (void *)aacDec,
                                             aacDec->loudnessInfoSetPosition);
@@ -1037,13 +1061,8 @@ LINKSPEC_CPP HANDLE_AACDECODER aacDecoder_Open(TRANSPORT_TYPE transportFmt,
     goto bail;
   }
 
-  aacDec->hLimiter =
-      pcmLimiter_Create(TDL_ATTACK_DEFAULT_MS, TDL_RELEASE_DEFAULT_MS,
-                        (FIXP_DBL)MAXVAL_DBL, (8), 96000);
-  if (NULL == aacDec->hLimiter) {
-    err = -1;
-    goto bail;
-  }
+  /* The limiter is created when it is enabled, see CAacDecoder_LimiterOpen().
+   * By default it is not for the low delay AOTs. */
   aacDec->limiterEnableUser = (UCHAR)-1;
   aacDec->limiterEnableCurr = 0;
 
@@ -1332,6 +1351,12 @@ LINKSPEC_CPP AAC_DECODER_ERROR aacDecoder_DecodeFrame(HANDLE_AACDECODER self,
       /* Use limiter configuration as requested. */
       self->limiterEnableCurr = self->limiterEnableUser;
     }
+    if (self->limiterEnableCurr) {
+      ErrorStatus = CAacDecoder_LimiterOpen(self);
+      if (ErrorStatus != AAC_DEC_OK) {
+        goto bail;
+      }
+    }
 
     /* reset DRC level normalization gain on a per frame basis */
     self->extGain[0] = AACDEC_DRC_GAIN_INIT_VALUE;
@@ -1682,7 +1707,8 @@ LINKSPEC_CPP AAC_DECODER_ERROR aacDecoder_DecodeFrame(HANDLE_AACDECODER self,
       }
 
       {
-        if ((FDK_drcDec_GetParam(self->hUniDrcDecoder, DRC_DEC_IS_ACTIVE)) &&
+        if ((self->hUniDrcDecoder != NULL) &&
+            (FDK_drcDec_GetParam(self->hUniDrcDecoder, DRC_DEC_IS_ACTIVE)) &&
             !(self->flags[0] & AC_RSV603DA)) {
           /* Apply DRC gains*/
           int ch, drcDelay = 0;
@@ -1786,7 +1812,8 @@ LINKSPEC_CPP AAC_DECODER_ERROR aacDecoder_DecodeFrame(HANDLE_AACDECODER self,
           }
         }
       }
-      if (FDK_drcDec_GetParam(self->hUniDrcDecoder, DRC_DEC_IS_ACTIVE)) {
+      if ((self->hUniDrcDecoder != NULL) &&
+          FDK_drcDec_GetParam(self->hUniDrcDecoder, DRC_DEC_IS_ACTIVE)) {
         /* return output loudness information for MPEG-D DRC */
         LONG outputLoudness =
             FDK_drcDec_GetParam(self->hUniDrcDecoder, DRC_DEC_OUTPUT_LOUDNESS);
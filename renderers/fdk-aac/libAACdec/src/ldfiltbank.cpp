@@ -112,6 +112,12 @@ amm-info@iis.fraunhofer.de
 #if defined(__arm__)
 #endif
 
+#if defined(__x86__)
+#include "x86/ldfiltbank_x86.cpp"
+
+#endif
+
+#if !defined(FUNCTION_multE2_DinvF_fdk)
 static void multE2_DinvF_fdk(PCM_DEC *output, FIXP_DBL *x, const FIXP_WTB *fb,
                              FIXP_DBL *z, const int N) {
   int i;
@@ -214,6 +220,7 @@ static void multE2_DinvF_fdk(PCM_DEC *output, FIXP_DBL *x, const FIXP_WTB *fb,
 #endif
   }
 }
+#endif /* FUNCTION_multE2_DinvF_fdk */
 
 int InvMdctTransformLowDelay_fdk(FIXP_DBL *mdctData, const int mdctData_e,
                                  PCM_DEC *output, FIXP_DBL *fs_buffer,
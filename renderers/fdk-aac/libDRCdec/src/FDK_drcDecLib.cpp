@@ -127,7 +127,7 @@ typedef enum {
   DRC_DEC_INTERPOLATION_PREPARED
 } DRC_DEC_STATUS;
 
-struct s_drc_decoder {
+typedef struct s_drc_decoder {
   DRC_DEC_CODEC_MODE codecMode;
   DRC_DEC_FUNCTIONAL_RANGE functionalRange;
   DRC_DEC_STATUS status;
@@ -0,0 +1,385 @@
+/* -----------------------------------------------------------------------------
+Software License for The Fraunhofer FDK AAC Codec Library for Android
+
+© Copyright  1995 - 2018 Fraunhofer-Gesellschaft zur Förderung der angewandten
+Forschung e.V. All rights reserved.
+
+ 1.    INTRODUCTION
+The Fraunhofer FDK AAC Codec Library for Android ("FDK AAC Codec") is software
+that implements the MPEG Advanced Audio Coding ("AAC") encoding and decoding
+scheme for digital audio. This FDK AAC Codec software is intended to be used on
+a wide variety of Android devices.
+
+AAC's HE-AAC and HE-AAC v2 versions are regarded as today's most efficient
+general perceptual audio codecs. AAC-ELD is considered the best-performing
+full-bandwidth communications codec by independent studies and is widely
+deployed. AAC has been standardized by ISO and IEC as part of the MPEG
+specifications.
+
+Patent licenses for necessary patent claims for the FDK AAC Codec (including
+those of Fraunhofer) may be obtained through Via Licensing
+(www.vialicensing.com) or through the respective patent owners individually for
+the purpose of encoding or decoding bit streams in products that are compliant
+with the ISO/IEC MPEG audio standards. Please note that most manufacturers of
+Android devices already license these patent claims through Via Licensing or
+directly from the patent owners, and therefore FDK AAC Codec software may
+already be covered under those patent licenses when it is used for those
+licensed purposes only.
+
+Commercially-licensed AAC software libraries, including floating-point versions
+with enhanced sound quality, are also available from Fraunhofer. Users are
+encouraged to check the Fraunhofer website for additional applications
+information and documentation.
+
+2.    COPYRIGHT LICENSE
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted without payment of copyright license fees provided that you
+satisfy the following conditions:
+
+You must retain the complete text of this software license in redistributions of
+the FDK AAC Codec or your modifications thereto in source code form.
+
+You must retain the complete text of this software license in the documentation
+and/or other materials provided with redistributions of the FDK AAC Codec or
+your modifications thereto in binary form. You must make available free of
+charge copies of the complete source code of the FDK AAC Codec and your
+modifications thereto to recipients of copies in binary form.
+
+The name of Fraunhofer may not be used to endorse or promote products derived
+from this library without prior written permission.
+
+You may not charge copyright license fees for anyone to use, copy or distribute
+the FDK AAC Codec software or your modifications thereto.
+
+Your modified versions of the FDK AAC Codec must carry prominent notices stating
+that you changed the software and the date of any change. For modified versions
+of the FDK AAC Codec, the term "Fraunhofer FDK AAC Codec Library for Android"
+must be replaced by the term "Third-Party Modified Version of the Fraunhofer FDK
+AAC Codec Library for Android."
+
+3.    NO PATENT LICENSE
+
+NO EXPRESS OR IMPLIED LICENSES TO ANY PATENT CLAIMS, including without
+limitation the patents of Fraunhofer, ARE GRANTED BY THIS SOFTWARE LICENSE.
+Fraunhofer provides no warranty of patent non-infringement with respect to this
+software.
+
+You may use this FDK AAC Codec software or modifications thereto only for
+purposes that are authorized by appropriate patent licenses.
+
+4.    DISCLAIMER
+
+This FDK AAC Codec software is provided by Fraunhofer on behalf of the copyright
+holders and contributors "AS IS" and WITHOUT ANY EXPRESS OR IMPLIED WARRANTIES,
+including but not limited to the implied warranties of merchantability and
+fitness for a particular purpose. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+CONTRIBUTORS BE LIABLE for any direct, indirect, incidental, special, exemplary,
+or consequential damages, including but not limited to procurement of substitute
+goods or services; loss of use, data, or profits, or business interruption,
+however caused and on any theory of liability, whether in contract, strict
+liability, or tort (including negligence), arising in any way out of the use of
+this software, even if advised of the possibility of such damage.
+
+5.    CONTACT INFORMATION
+
+Fraunhofer Institute for Integrated Circuits IIS
+Attention: Audio and Multimedia Departments - FDK AAC LL
+Am Wolfsmantel 33
+91058 Erlangen, Germany
+
+www.iis.fraunhofer.de/amm
+amm-info@iis.fraunhofer.de
+----------------------------------------------------------------------------- */
+
+/******************* Library for basic calculation routines ********************
+
+   Author(s):
+
+   Description: fixed point SIMD vectors for the x86 kernels
+
+*******************************************************************************/
+
+/*
+  FIXP_DBLV holds FDK_SIMD_LANES FIXP_DBL values (8 with AVX2, 4 with SSE4.1)
+  and has the operators and multiplications of FIXP_DBL, lane by lane, with the
+  same results as the scalar ones on x86: +, - and << wrap around, >> is
+  arithmetic, fMultDiv2() is the upper word of the 64 bit product. Kernels
+  written with it are bit-exact with the C code they are translated from.
+
+  The kernels are compiled in when the compiler targets SSE4.1 or AVX2 (see
+  FDK_AAC_SIMD in CMakeLists.txt), FDK_SIMD_X86 is defined then.
+*/
+
+#if !defined(SIMD_X86_H)
+#define SIMD_X86_H
+
+#include "common_fix.h"
+
+#if defined(__x86__) && \
+    (defined(__AVX2__) || defined(__AVX__) || defined(__SSE4_1__))
+
+#define FDK_SIMD_X86
+
+#include <immintrin.h>
+
+#if defined(__AVX2__)
+#define FDK_SIMD_LANES 8
+typedef __m256i FDK_SIMD_REG;
+#else
+#define FDK_SIMD_LANES 4
+typedef __m128i FDK_SIMD_REG;
+#endif
+
+struct FIXP_DBLV {
+  FDK_SIMD_REG v;
+};
+
+static inline FIXP_DBLV fvMake(FDK_SIMD_REG v) {
+  FIXP_DBLV r;
+  r.v = v;
+  return r;
+}
+
+/* p[0], p[stride], p[2 * stride], p[3 * stride] in the upper halves of 4 lanes
+ */
+static inline __m128i fvInsertSgl4(const FIXP_SGL *p, int stride) {
+  __m128i v = _mm_setzero_si128();
+  v = _mm_insert_epi16(v, p[0], 1);
+  v = _mm_insert_epi16(v, p[stride], 3);
+  v = _mm_insert_epi16(v, p[2 * stride], 5);
+  return _mm_insert_epi16(v, p[3 * stride], 7);
+}
+
+#if defined(__AVX2__)
+
+static inline FIXP_DBLV fvLoad(const FIXP_DBL *p) {
+  return fvMake(_mm256_loadu_si256((const __m256i *)p));
+}
+static inline void fvStore(FIXP_DBL *p, FIXP_DBLV a) {
+  _mm256_storeu_si256((__m256i *)p, a.v);
+}
+static inline FIXP_DBLV fvSet1(FIXP_DBL a) {
+  return fvMake(_mm256_set1_epi32(a));
+}
+static inline FIXP_DBLV operator+(FIXP_DBLV a, FIXP_DBLV b) {
+  return fvMake(_mm256_add_epi32(a.v, b.v));
+}
+static inline FIXP_DBLV operator-(FIXP_DBLV a, FIXP_DBLV b) {
+  return fvMake(_mm256_sub_epi32(a.v, b.v));
+}
+static inline FIXP_DBLV operator>>(FIXP_DBLV a, int n) {
+  return fvMake(_mm256_sra_epi32(a.v, _mm_cvtsi32_si128(n)));
+}
+static inline FIXP_DBLV operator<<(FIXP_DBLV a, int n) {
+  return fvMake(_mm256_sll_epi32(a.v, _mm_cvtsi32_si128(n)));
+}
+static inline FIXP_DBLV fMin(FIXP_DBLV a, FIXP_DBLV b) {
+  return fvMake(_mm256_min_epi32(a.v, b.v));
+}
+static inline FIXP_DBLV fMax(FIXP_DBLV a, FIXP_DBLV b) {
+  return fvMake(_mm256_max_epi32(a.v, b.v));
+}
+/* lanes of b where mask is set (all ones), else lanes of a */
+static inline FIXP_DBLV fvSelect(FIXP_DBLV a, FIXP_DBLV b, FIXP_DBLV mask) {
+  return fvMake(_mm256_blendv_epi8(a.v, b.v, mask.v));
+}
+static inline FIXP_DBLV fvGreater(FIXP_DBLV a, FIXP_DBLV b) {
+  return fvMake(_mm256_cmpgt_epi32(a.v, b.v));
+}
+static inline FIXP_DBLV fvEqual(FIXP_DBLV a, FIXP_DBLV b) {
+  return fvMake(_mm256_cmpeq_epi32(a.v, b.v));
+}
+static inline FIXP_DBLV fMultDiv2(FIXP_DBLV a, FIXP_DBLV b) {
+  __m256i even = _mm256_mul_epi32(a.v, b.v);
+  __m256i odd =
+      _mm256_mul_epi32(_mm256_srli_epi64(a.v, 32), _mm256_srli_epi64(b.v, 32));
+  return fvMake(_mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA));
+}
+/* FIXP_SGL values of p, as FIXP_DBL (shifted up by 16) */
+static inline FIXP_DBLV fvLoadSgl(const FIXP_SGL *p) {
+  return fvMake(_mm256_slli_epi32(
+      _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)p)), 16));
+}
+/* every stride-th FIXP_SGL value from p on, as FIXP_DBL */
+static inline FIXP_DBLV fvLoadSglStride(const FIXP_SGL *p, int stride) {
+  return fvMake(_mm256_inserti128_si256(
+      _mm256_castsi128_si256(fvInsertSgl4(p, stride)),
+      fvInsertSgl4(p + 4 * stride, stride), 1));
+}
+/* upper halves of the lanes, FX_DBL2FX_SGL(), to p */
+static inline void fvStoreSgl(FIXP_SGL *p, FIXP_DBLV a) {
+  __m256i w = _mm256_srai_epi32(a.v, 16);
+  w = _mm256_permute4x64_epi64(_mm256_packs_epi32(w, w), 0xD8);
+  _mm_storeu_si128((__m128i *)p, _mm256_castsi256_si128(w));
+}
+/* lanes in reverse order */
+static inline FIXP_DBLV fvReverse(FIXP_DBLV a) {
+  return fvMake(_mm256_permutevar8x32_epi32(
+      a.v, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0)));
+}
+/* 8 complex values, interleaved in p, split into real and imaginary parts */
+static inline void fvLoadCplx(const FIXP_DBL *p, FIXP_DBLV *re, FIXP_DBLV *im) {
+  __m256 a = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *)p));
+  __m256 b = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *)(p + 8)));
+  /* re0 re1 re4 re5 re2 re3 re6 re7, the same for im */
+  __m256i r = _mm256_castps_si256(_mm256_shuffle_ps(a, b, 0x88));
+  __m256i i = _mm256_castps_si256(_mm256_shuffle_ps(a, b, 0xDD));
+  re->v = _mm256_permute4x64_epi64(r, 0xD8);
+  im->v = _mm256_permute4x64_epi64(i, 0xD8);
+}
+static inline void fvStoreCplx(FIXP_DBL *p, FIXP_DBLV re, FIXP_DBLV im) {
+  __m256i lo = _mm256_unpacklo_epi32(re.v, im.v); /* c0 c1 c4 c5 */
+  __m256i hi = _mm256_unpackhi_epi32(re.v, im.v); /* c2 c3 c6 c7 */
+  _mm256_storeu_si256((__m256i *)p, _mm256_permute2x128_si256(lo, hi, 0x20));
+  _mm256_storeu_si256((__m256i *)(p + 8),
+                      _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+/* FIXP_SPK words (FIXP_STP, FIXP_WTP) split into re and im, as FIXP_DBL */
+static inline void fvSplitSpk(FIXP_DBLV w, FIXP_DBLV *re, FIXP_DBLV *im) {
+  re->v = _mm256_slli_epi32(w.v, 16);
+  im->v = _mm256_and_si256(w.v, _mm256_set1_epi32((INT)0xFFFF0000));
+}
+
+#else /* SSE4.1 */
+
+static inline FIXP_DBLV fvLoad(const FIXP_DBL *p) {
+  return fvMake(_mm_loadu_si128((const __m128i *)p));
+}
+static inline void fvStore(FIXP_DBL *p, FIXP_DBLV a) {
+  _mm_storeu_si128((__m128i *)p, a.v);
+}
+static inline FIXP_DBLV fvSet1(FIXP_DBL a) { return fvMake(_mm_set1_epi32(a)); }
+static inline FIXP_DBLV operator+(FIXP_DBLV a, FIXP_DBLV b) {
+  return fvMake(_mm_add_epi32(a.v, b.v));
+}
+static inline FIXP_DBLV operator-(FIXP_DBLV a, FIXP_DBLV b) {
+  return fvMake(_mm_sub_epi32(a.v, b.v));
+}
+static inline FIXP_DBLV operator>>(FIXP_DBLV a, int n) {
+  return fvMake(_mm_sra_epi32(a.v, _mm_cvtsi32_si128(n)));
+}
+static inline FIXP_DBLV operator<<(FIXP_DBLV a, int n) {
+  return fvMake(_mm_sll_epi32(a.v, _mm_cvtsi32_si128(n)));
+}
+static inline FIXP_DBLV fMin(FIXP_DBLV a, FIXP_DBLV b) {
+  return fvMake(_mm_min_epi32(a.v, b.v));
+}
+static inline FIXP_DBLV fMax(FIXP_DBLV a, FIXP_DBLV b) {
+  return fvMake(_mm_max_epi32(a.v, b.v));
+}
+/* lanes of b where mask is set (all ones), else lanes of a */
+static inline FIXP_DBLV fvSelect(FIXP_DBLV a, FIXP_DBLV b, FIXP_DBLV mask) {
+  return fvMake(_mm_blendv_epi8(a.v, b.v, mask.v));
+}
+static inline FIXP_DBLV fvGreater(FIXP_DBLV a, FIXP_DBLV b) {
+  return fvMake(_mm_cmpgt_epi32(a.v, b.v));
+}
+static inline FIXP_DBLV fvEqual(FIXP_DBLV a, FIXP_DBLV b) {
+  return fvMake(_mm_cmpeq_epi32(a.v, b.v));
+}
+static inline FIXP_DBLV fMultDiv2(FIXP_DBLV a, FIXP_DBLV b) {
+  __m128i even = _mm_mul_epi32(a.v, b.v);
+  __m128i odd = _mm_mul_epi32(_mm_srli_epi64(a.v, 32), _mm_srli_epi64(b.v, 32));
+  return fvMake(_mm_blend_epi16(_mm_srli_epi64(even, 32), odd, 0xCC));
+}
+/* FIXP_SGL values of p, as FIXP_DBL (shifted up by 16) */
+static inline FIXP_DBLV fvLoadSgl(const FIXP_SGL *p) {
+  return fvMake(_mm_slli_epi32(
+      _mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *)p)), 16));
+}
+/* every stride-th FIXP_SGL value from p on, as FIXP_DBL */
+static inline FIXP_DBLV fvLoadSglStride(const FIXP_SGL *p, int stride) {
+  return fvMake(fvInsertSgl4(p, stride));
+}
+/* upper halves of the lanes, FX_DBL2FX_SGL(), to p */
+static inline void fvStoreSgl(FIXP_SGL *p, FIXP_DBLV a) {
+  __m128i w = _mm_srai_epi32(a.v, 16);
+  _mm_storel_epi64((__m128i *)p, _mm_packs_epi32(w, w));
+}
+/* lanes in reverse order */
+static inline FIXP_DBLV fvReverse(FIXP_DBLV a) {
+  return fvMake(_mm_shuffle_epi32(a.v, 0x1B));
+}
+/* 4 complex values, interleaved in p, split into real and imaginary parts */
+static inline void fvLoadCplx(const FIXP_DBL *p, FIXP_DBLV *re, FIXP_DBLV *im) {
+  __m128 a = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)p));
+  __m128 b = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(p + 4)));
+  re->v = _mm_castps_si128(_mm_shuffle_ps(a, b, 0x88));
+  im->v = _mm_castps_si128(_mm_shuffle_ps(a, b, 0xDD));
+}
+static inline void fvStoreCplx(FIXP_DBL *p, FIXP_DBLV re, FIXP_DBLV im) {
+  _mm_storeu_si128((__m128i *)p, _mm_unpacklo_epi32(re.v, im.v));
+  _mm_storeu_si128((__m128i *)(p + 4), _mm_unpackhi_epi32(re.v, im.v));
+}
+/* FIXP_SPK words (FIXP_STP, FIXP_WTP) split into re and im, as FIXP_DBL */
+static inline void fvSplitSpk(FIXP_DBLV w, FIXP_DBLV *re, FIXP_DBLV *im) {
+  re->v = _mm_slli_epi32(w.v, 16);
+  im->v = _mm_and_si128(w.v, _mm_set1_epi32((INT)0xFFFF0000));
+}
+
+#endif /* __AVX2__ */
+
+static inline FIXP_DBLV operator-(FIXP_DBLV a) { return fvSet1(0) - a; }
+
+/* FDK_SIMD_LANES values of p, as FIXP_DBL */
+static inline void fvLoadSpk(const FIXP_SPK *p, FIXP_DBLV *re, FIXP_DBLV *im) {
+  fvSplitSpk(fvLoad((const FIXP_DBL *)p), re, im);
+}
+static inline FIXP_DBLV &operator+=(FIXP_DBLV &a, FIXP_DBLV b) {
+  return a = a + b;
+}
+static inline FIXP_DBLV &operator-=(FIXP_DBLV &a, FIXP_DBLV b) {
+  return a = a - b;
+}
+
+static inline FIXP_DBLV fMultDiv2(FIXP_DBLV a, FIXP_SGL b) {
+  return fMultDiv2(a, fvSet1(FX_SGL2FX_DBL(b)));
+}
+static inline FIXP_DBLV fMult(FIXP_DBLV a, FIXP_DBLV b) {
+  return fMultDiv2(a, b) << 1;
+}
+static inline FIXP_DBLV fMult(FIXP_DBLV a, FIXP_SGL b) {
+  return fMultDiv2(a, b) << 1;
+}
+
+/* as fAddSaturate(FIXP_DBL, FIXP_DBL) */
+static inline FIXP_DBLV fAddSaturate(FIXP_DBLV a, FIXP_DBLV b) {
+  FIXP_DBLV sum = (a >> 1) + (b >> 1);
+  sum = fMax(fMin(sum, fvSet1(MAXVAL_DBL >> 1)), fvSet1(MINVAL_DBL >> 1));
+  return sum << 1;
+}
+
+/* as SATURATE_LEFT_SHIFT(src, scale, DFRACT_BITS) */
+static inline FIXP_DBLV fvSaturateLeftShift(FIXP_DBLV src, int scale) {
+  FIXP_DBLV limit = fvSet1(MAXVAL_DBL >> scale);
+  FIXP_DBLV result = src << scale;
+  result = fvSelect(result, fvSet1(MAXVAL_DBL), fvGreater(src, limit));
+  return fvSelect(result, fvSet1(MINVAL_DBL),
+                  fvGreater(fvSet1(~(MAXVAL_DBL >> scale)), src));
+}
+
+/* as cplxMultDiv2() and cplxMult() of cplx_mul.h, b is FIXP_SGL (shifted up
+ * by 16) or FIXP_DBL */
+static inline void cplxMultDiv2(FIXP_DBLV *c_Re, FIXP_DBLV *c_Im,
+                                const FIXP_DBLV a_Re, const FIXP_DBLV a_Im,
+                                const FIXP_DBLV b_Re, const FIXP_DBLV b_Im) {
+  *c_Re = fMultDiv2(a_Re, b_Re) - fMultDiv2(a_Im, b_Im);
+  *c_Im = fMultDiv2(a_Re, b_Im) + fMultDiv2(a_Im, b_Re);
+}
+static inline void cplxMultDiv2(FIXP_DBLV *c_Re, FIXP_DBLV *c_Im,
+                                const FIXP_DBLV a_Re, const FIXP_DBLV a_Im,
+                                const FIXP_SPK w) {
+  cplxMultDiv2(c_Re, c_Im, a_Re, a_Im, fvSet1(FX_SGL2FX_DBL(w.v.re)),
+               fvSet1(FX_SGL2FX_DBL(w.v.im)));
+}
+static inline void cplxMult(FIXP_DBLV *c_Re, FIXP_DBLV *c_Im,
+                            const FIXP_DBLV a_Re, const FIXP_DBLV a_Im,
+                            const FIXP_DBLV b_Re, const FIXP_DBLV b_Im) {
+  *c_Re = fMult(a_Re, b_Re) - fMult(a_Im, b_Im);
+  *c_Im = fMult(a_Re, b_Im) + fMult(a_Im, b_Re);
+}
+
+#endif /* __x86__ && (AVX2 || SSE4.1) */
+
+#endif /* !defined(SIMD_X86_H) */
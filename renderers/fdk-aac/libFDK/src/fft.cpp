@@ -166,6 +166,11 @@ amm-info@iis.fraunhofer.de
 
 #include "fft.h"
 
+#if defined(__x86__)
+#include "x86/fft_x86.cpp"
+
+#endif
+
 #ifndef FUNCTION_fft2
 
 /* Performs the FFT of length 2. Input vector unscaled, output vector scaled
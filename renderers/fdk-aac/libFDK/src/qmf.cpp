@@ -143,6 +143,10 @@ amm-info@iis.fraunhofer.de
 #define FX_DBL2FX_QSS(x) (x)
 #define FX_QSS2FX_DBL(x) (x)
 
+#if defined(__x86__)
+#include "x86/qmf_x86.cpp"
+#endif
+
 /* moved to qmf_pcm.h: -> qmfSynPrototypeFirSlot */
 /* moved to qmf_pcm.h: -> qmfSynPrototypeFirSlot_NonSymmetric */
 /* moved to qmf_pcm.h: -> qmfSynthesisFilteringSlot */
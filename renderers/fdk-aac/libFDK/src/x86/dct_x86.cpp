@@ -0,0 +1,282 @@
+/* -----------------------------------------------------------------------------
+Software License for The Fraunhofer FDK AAC Codec Library for Android
+
+© Copyright  1995 - 2018 Fraunhofer-Gesellschaft zur Förderung der angewandten
+Forschung e.V. All rights reserved.
+
+ 1.    INTRODUCTION
+The Fraunhofer FDK AAC Codec Library for Android ("FDK AAC Codec") is software
+that implements the MPEG Advanced Audio Coding ("AAC") encoding and decoding
+scheme for digital audio. This FDK AAC Codec software is intended to be used on
+a wide variety of Android devices.
+
+AAC's HE-AAC and HE-AAC v2 versions are regarded as today's most efficient
+general perceptual audio codecs. AAC-ELD is considered the best-performing
+full-bandwidth communications codec by independent studies and is widely
+deployed. AAC has been standardized by ISO and IEC as part of the MPEG
+specifications.
+
+Patent licenses for necessary patent claims for the FDK AAC Codec (including
+those of Fraunhofer) may be obtained through Via Licensing
+(www.vialicensing.com) or through the respective patent owners individually for
+the purpose of encoding or decoding bit streams in products that are compliant
+with the ISO/IEC MPEG audio standards. Please note that most manufacturers of
+Android devices already license these patent claims through Via Licensing or
+directly from the patent owners, and therefore FDK AAC Codec software may
+already be covered under those patent licenses when it is used for those
+licensed purposes only.
+
+Commercially-licensed AAC software libraries, including floating-point versions
+with enhanced sound quality, are also available from Fraunhofer. Users are
+encouraged to check the Fraunhofer website for additional applications
+information and documentation.
+
+2.    COPYRIGHT LICENSE
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted without payment of copyright license fees provided that you
+satisfy the following conditions:
+
+You must retain the complete text of this software license in redistributions of
+the FDK AAC Codec or your modifications thereto in source code form.
+
+You must retain the complete text of this software license in the documentation
+and/or other materials provided with redistributions of the FDK AAC Codec or
+your modifications thereto in binary form. You must make available free of
+charge copies of the complete source code of the FDK AAC Codec and your
+modifications thereto to recipients of copies in binary form.
+
+The name of Fraunhofer may not be used to endorse or promote products derived
+from this library without prior written permission.
+
+You may not charge copyright license fees for anyone to use, copy or distribute
+the FDK AAC Codec software or your modifications thereto.
+
+Your modified versions of the FDK AAC Codec must carry prominent notices stating
+that you changed the software and the date of any change. For modified versions
+of the FDK AAC Codec, the term "Fraunhofer FDK AAC Codec Library for Android"
+must be replaced by the term "Third-Party Modified Version of the Fraunhofer FDK
+AAC Codec Library for Android."
+
+3.    NO PATENT LICENSE
+
+NO EXPRESS OR IMPLIED LICENSES TO ANY PATENT CLAIMS, including without
+limitation the patents of Fraunhofer, ARE GRANTED BY THIS SOFTWARE LICENSE.
+Fraunhofer provides no warranty of patent non-infringement with respect to this
+software.
+
+You may use this FDK AAC Codec software or modifications thereto only for
+purposes that are authorized by appropriate patent licenses.
+
+4.    DISCLAIMER
+
+This FDK AAC Codec software is provided by Fraunhofer on behalf of the copyright
+holders and contributors "AS IS" and WITHOUT ANY EXPRESS OR IMPLIED WARRANTIES,
+including but not limited to the implied warranties of merchantability and
+fitness for a particular purpose. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+CONTRIBUTORS BE LIABLE for any direct, indirect, incidental, special, exemplary,
+or consequential damages, including but not limited to procurement of substitute
+goods or services; loss of use, data, or profits, or business interruption,
+however caused and on any theory of liability, whether in contract, strict
+liability, or tort (including negligence), arising in any way out of the use of
+this software, even if advised of the possibility of such damage.
+
+5.    CONTACT INFORMATION
+
+Fraunhofer Institute for Integrated Circuits IIS
+Attention: Audio and Multimedia Departments - FDK AAC LL
+Am Wolfsmantel 33
+91058 Erlangen, Germany
+
+www.iis.fraunhofer.de/amm
+amm-info@iis.fraunhofer.de
+----------------------------------------------------------------------------- */
+
+/******************* Library for basic calculation routines ********************
+
+   Author(s):
+
+   Description: DCT type IV with SSE4.1 / AVX2
+
+*******************************************************************************/
+
+/*
+  The twiddling before and after the FFT of dct_IV() works on pairs from the
+  front and from the back of pDat. Here FDK_SIMD_LANES iterations of these
+  loops run at a time, the pairs from the back in reversed lane order. The
+  loops of dct.cpp finish the remaining iterations.
+*/
+
+#include "x86/simd_x86.h"
+
+#if defined(FDK_SIMD_X86)
+
+#define FUNCTION_dct_IV
+
+/* FDK_SIMD_LANES complex values, p points to the last one, the lowest address
+ */
+static inline void dct_x86_load_back(const FIXP_DBL *p, FIXP_DBLV *re,
+                                     FIXP_DBLV *im) {
+  fvLoadCplx(p, re, im);
+  *re = fvReverse(*re);
+  *im = fvReverse(*im);
+}
+
+static inline void dct_x86_store_back(FIXP_DBL *p, FIXP_DBLV re,
+                                      FIXP_DBLV im) {
+  fvStoreCplx(p, fvReverse(re), fvReverse(im));
+}
+
+void dct_IV(FIXP_DBL *pDat, int L, int *pDat_e) {
+  int sin_step = 0;
+  int M = L >> 1;
+
+  const FIXP_WTP *twiddle;
+  const FIXP_STP *sin_twiddle;
+
+  FDK_ASSERT(L >= 4);
+
+  dct_getTables(&twiddle, &sin_twiddle, &sin_step, L);
+
+  {
+    FIXP_DBL *RESTRICT pDat_0 = &pDat[0];
+    FIXP_DBL *RESTRICT pDat_1 = &pDat[L - 2];
+    int i;
+
+    /* twiddle[i] and twiddle[i + 1] of each lane are the even and odd words of
+     * the loaded pairs */
+    for (i = 0; i < M - 1 - 2 * (FDK_SIMD_LANES - 1);
+         i += 2 * FDK_SIMD_LANES, pDat_0 += 2 * FDK_SIMD_LANES,
+        pDat_1 -= 2 * FDK_SIMD_LANES) {
+      FIXP_DBLV accu1, accu2, accu3, accu4;
+      FIXP_DBLV twd0, twd1, twdRe, twdIm;
+
+      fvLoadCplx(pDat_0, &accu2, &accu3);
+      dct_x86_load_back(pDat_1 - 2 * (FDK_SIMD_LANES - 1), &accu4, &accu1);
+      fvLoadCplx((const FIXP_DBL *)&twiddle[i], &twd0, &twd1);
+
+      fvSplitSpk(twd0, &twdRe, &twdIm);
+      cplxMultDiv2(&accu1, &accu2, accu1, accu2, twdRe, twdIm);
+      fvSplitSpk(twd1, &twdRe, &twdIm);
+      cplxMultDiv2(&accu3, &accu4, accu4, accu3, twdRe, twdIm);
+
+      fvStoreCplx(pDat_0, accu2 >> 1, accu1 >> 1);
+      dct_x86_store_back(pDat_1 - 2 * (FDK_SIMD_LANES - 1), accu4 >> 1,
+                         -(accu3 >> 1));
+    }
+    for (; i < M - 1; i += 2, pDat_0 += 2, pDat_1 -= 2) {
+      FIXP_DBL accu1, accu2, accu3, accu4;
+
+      accu1 = pDat_1[1];
+      accu2 = pDat_0[0];
+      accu3 = pDat_0[1];
+      accu4 = pDat_1[0];
+
+      cplxMultDiv2(&accu1, &accu2, accu1, accu2, twiddle[i]);
+      cplxMultDiv2(&accu3, &accu4, accu4, accu3, twiddle[i + 1]);
+
+      pDat_0[0] = accu2 >> 1;
+      pDat_0[1] = accu1 >> 1;
+      pDat_1[0] = accu4 >> 1;
+      pDat_1[1] = -(accu3 >> 1);
+    }
+    if (M & 1) {
+      FIXP_DBL accu1, accu2;
+
+      accu1 = pDat_1[1];
+      accu2 = pDat_0[0];
+
+      cplxMultDiv2(&accu1, &accu2, accu1, accu2, twiddle[i]);
+
+      pDat_0[0] = accu2 >> 1;
+      pDat_0[1] = accu1 >> 1;
+    }
+  }
+
+  fft(M, pDat, pDat_e);
+
+  {
+    FIXP_DBL *RESTRICT pDat_0;
+    FIXP_DBL *RESTRICT pDat_1;
+    FIXP_DBL accu1, accu2, accu3, accu4;
+    FIXP_DBLV backRe, backIm;
+    const int K = (M + 1) >> 1;
+    int idx, i;
+
+    /* Each iteration i of the loop below reads the pair at pDat[L - 2 - 2 * i],
+       which the iteration before has partly overwritten, as accu1 and accu2.
+       So the pairs from the back of the next lanes, and accu1 and accu2 for
+       the loop below, are loaded before the results are stored. */
+    if (1 + FDK_SIMD_LANES <= K) {
+      dct_x86_load_back(&pDat[L - 2 * FDK_SIMD_LANES], &backRe, &backIm);
+    }
+
+    /* Sin and Cos values are 0.0f and 1.0f */
+    accu1 = pDat[L - 2];
+    accu2 = pDat[L - 1];
+
+    pDat[L - 1] = -pDat[1];
+
+    for (idx = sin_step, i = 1; i + FDK_SIMD_LANES <= K;
+         i += FDK_SIMD_LANES) {
+      FIXP_SPK twd[FDK_SIMD_LANES];
+      FIXP_DBLV twdRe, twdIm, frontRe, frontIm;
+      FIXP_DBLV vaccu1, vaccu2, vaccu3, vaccu4;
+      int k;
+
+      for (k = 0; k < FDK_SIMD_LANES; k++, idx += sin_step) {
+        twd[k] = sin_twiddle[idx];
+      }
+      fvLoadSpk(twd, &twdRe, &twdIm);
+      fvLoadCplx(&pDat[2 * i], &frontRe, &frontIm);
+
+      cplxMult(&vaccu1, &vaccu2, backRe, backIm, twdRe, twdIm);
+      cplxMult(&vaccu3, &vaccu4, frontIm, frontRe, twdRe, twdIm);
+
+      accu1 = pDat[L - 2 * (i + FDK_SIMD_LANES)];
+      accu2 = pDat[L - 2 * (i + FDK_SIMD_LANES) + 1];
+      if (i + 2 * FDK_SIMD_LANES <= K) {
+        dct_x86_load_back(&pDat[L - 2 * (i + 2 * FDK_SIMD_LANES - 1)], &backRe,
+                          &backIm);
+      }
+
+      fvStoreCplx(&pDat[2 * i - 1], vaccu1, vaccu4);
+      dct_x86_store_back(&pDat[L - 1 - 2 * (i + FDK_SIMD_LANES - 1)], -vaccu3,
+                         vaccu2);
+    }
+
+    pDat_0 = &pDat[2 * (i - 1)];
+    pDat_1 = &pDat[L - 2 - 2 * (i - 1)];
+    for (; i < K; i++, idx += sin_step) {
+      FIXP_STP twd = sin_twiddle[idx];
+      cplxMult(&accu3, &accu4, accu1, accu2, twd);
+      pDat_0[1] = accu3;
+      pDat_1[0] = accu4;
+
+      pDat_0 += 2;
+      pDat_1 -= 2;
+
+      cplxMult(&accu3, &accu4, pDat_0[1], pDat_0[0], twd);
+
+      accu1 = pDat_1[0];
+      accu2 = pDat_1[1];
+
+      pDat_1[1] = -accu3;
+      pDat_0[0] = accu4;
+    }
+
+    if ((M & 1) == 0) {
+      /* Last Sin and Cos value pair are the same */
+      accu1 = fMult(accu1, WTC(0x5a82799a));
+      accu2 = fMult(accu2, WTC(0x5a82799a));
+
+      pDat_1[0] = accu1 + accu2;
+      pDat_0[1] = accu1 - accu2;
+    }
+  }
+
+  /* Add twiddeling scale. */
+  *pDat_e += 2;
+}
+
+#endif /* FDK_SIMD_X86 */
@@ -0,0 +1,799 @@
+/* -----------------------------------------------------------------------------
+Software License for The Fraunhofer FDK AAC Codec Library for Android
+
+© Copyright  1995 - 2018 Fraunhofer-Gesellschaft zur Förderung der angewandten
+Forschung e.V. All rights reserved.
+
+ 1.    INTRODUCTION
+The Fraunhofer FDK AAC Codec Library for Android ("FDK AAC Codec") is software
+that implements the MPEG Advanced Audio Coding ("AAC") encoding and decoding
+scheme for digital audio. This FDK AAC Codec software is intended to be used on
+a wide variety of Android devices.
+
+AAC's HE-AAC and HE-AAC v2 versions are regarded as today's most efficient
+general perceptual audio codecs. AAC-ELD is considered the best-performing
+full-bandwidth communications codec by independent studies and is widely
+deployed. AAC has been standardized by ISO and IEC as part of the MPEG
+specifications.
+
+Patent licenses for necessary patent claims for the FDK AAC Codec (including
+those of Fraunhofer) may be obtained through Via Licensing
+(www.vialicensing.com) or through the respective patent owners individually for
+the purpose of encoding or decoding bit streams in products that are compliant
+with the ISO/IEC MPEG audio standards. Please note that most manufacturers of
+Android devices already license these patent claims through Via Licensing or
+directly from the patent owners, and therefore FDK AAC Codec software may
+already be covered under those patent licenses when it is used for those
+licensed purposes only.
+
+Commercially-licensed AAC software libraries, including floating-point versions
+with enhanced sound quality, are also available from Fraunhofer. Users are
+encouraged to check the Fraunhofer website for additional applications
+information and documentation.
+
+2.    COPYRIGHT LICENSE
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted without payment of copyright license fees provided that you
+satisfy the following conditions:
+
+You must retain the complete text of this software license in redistributions of
+the FDK AAC Codec or your modifications thereto in source code form.
+
+You must retain the complete text of this software license in the documentation
+and/or other materials provided with redistributions of the FDK AAC Codec or
+your modifications thereto in binary form. You must make available free of
+charge copies of the complete source code of the FDK AAC Codec and your
+modifications thereto to recipients of copies in binary form.
+
+The name of Fraunhofer may not be used to endorse or promote products derived
+from this library without prior written permission.
+
+You may not charge copyright license fees for anyone to use, copy or distribute
+the FDK AAC Codec software or your modifications thereto.
+
+Your modified versions of the FDK AAC Codec must carry prominent notices stating
+that you changed the software and the date of any change. For modified versions
+of the FDK AAC Codec, the term "Fraunhofer FDK AAC Codec Library for Android"
+must be replaced by the term "Third-Party Modified Version of the Fraunhofer FDK
+AAC Codec Library for Android."
+
+3.    NO PATENT LICENSE
+
+NO EXPRESS OR IMPLIED LICENSES TO ANY PATENT CLAIMS, including without
+limitation the patents of Fraunhofer, ARE GRANTED BY THIS SOFTWARE LICENSE.
+Fraunhofer provides no warranty of patent non-infringement with respect to this
+software.
+
+You may use this FDK AAC Codec software or modifications thereto only for
+purposes that are authorized by appropriate patent licenses.
+
+4.    DISCLAIMER
+
+This FDK AAC Codec software is provided by Fraunhofer on behalf of the copyright
+holders and contributors "AS IS" and WITHOUT ANY EXPRESS OR IMPLIED WARRANTIES,
+including but not limited to the implied warranties of merchantability and
+fitness for a particular purpose. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+CONTRIBUTORS BE LIABLE for any direct, indirect, incidental, special, exemplary,
+or consequential damages, including but not limited to procurement of substitute
+goods or services; loss of use, data, or profits, or business interruption,
+however caused and on any theory of liability, whether in contract, strict
+liability, or tort (including negligence), arising in any way out of the use of
+this software, even if advised of the possibility of such damage.
+
+5.    CONTACT INFORMATION
+
+Fraunhofer Institute for Integrated Circuits IIS
+Attention: Audio and Multimedia Departments - FDK AAC LL
+Am Wolfsmantel 33
+91058 Erlangen, Germany
+
+www.iis.fraunhofer.de/amm
+amm-info@iis.fraunhofer.de
+----------------------------------------------------------------------------- */
+
+/******************* Library for basic calculation routines ********************
+
+   Author(s):
+
+   Description: FFT of length 120 and 240 with SSE4.1 / AVX2
+
+*******************************************************************************/
+
+/*
+  fftN2() splits these FFTs into dim2 = 15 FFTs of length dim1 (8 or 16) and
+  then dim1 FFTs of length 15. Here each lane of a FIXP_DBLV computes one of
+  them, so the short FFTs below are those of fft.cpp and fft.h with FIXP_DBLV
+  instead of FIXP_DBL, and give the same results, bit by bit.
+*/
+
+#include "x86/simd_x86.h"
+
+#if defined(FDK_SIMD_X86)
+
+#define C31 (STC(0x91261468)) /* FL2FXCONST_DBL(-0.86602540) = -sqrt(3)/2  */
+
+#define F5C(x) STC(x)
+
+#define C51 (F5C(0x79bc3854)) /* FL2FXCONST_DBL( 0.95105652)   */
+#define C52 (F5C(0x9d839db0)) /* FL2FXCONST_DBL(-1.53884180/2) */
+#define C53 (F5C(0xd18053ce)) /* FL2FXCONST_DBL(-0.36327126)   */
+#define C54 (F5C(0x478dde64)) /* FL2FXCONST_DBL( 0.55901699)   */
+#define C55 (F5C(0xb0000001)) /* FL2FXCONST_DBL(-1.25/2)       */
+
+#define N3 3
+#define N5 5
+#define N6 6
+#define N15 15
+
+#define SUMDIFF_PIFOURTH_V(diff, sum, a, b) \
+  {                                         \
+    FIXP_DBLV wa, wb;                       \
+    wa = fMultDiv2(a, W_PiFOURTH);          \
+    wb = fMultDiv2(b, W_PiFOURTH);          \
+    diff = wb - wa;                         \
+    sum = wb + wa;                          \
+  }
+
+static const FIXP_STP fft16_w16_x86[2] = {STCP(0x7641af3d, 0x30fbc54d),
+                                          STCP(0x30fbc54d, 0x7641af3d)};
+
+static inline void fft5(FIXP_DBLV *RESTRICT pDat) {
+  FIXP_DBLV r1, r2, r3, r4;
+  FIXP_DBLV s1, s2, s3, s4;
+  FIXP_DBLV t;
+
+  /* real part */
+  r1 = (pDat[2] + pDat[8]) >> 1;
+  r4 = (pDat[2] - pDat[8]) >> 1;
+  r3 = (pDat[4] + pDat[6]) >> 1;
+  r2 = (pDat[4] - pDat[6]) >> 1;
+  t = fMult((r1 - r3), C54);
+  r1 = r1 + r3;
+  pDat[0] = (pDat[0] >> 1) + r1;
+  /* Bit shift left because of the constant C55 which was scaled with the factor
+     0.5 because of the representation of the values as fracts */
+  r1 = pDat[0] + (fMultDiv2(r1, C55) << (2));
+  r3 = r1 - t;
+  r1 = r1 + t;
+  t = fMult((r4 + r2), C51);
+  /* Bit shift left because of the constant C55 which was scaled with the factor
+     0.5 because of the representation of the values as fracts */
+  r4 = t + (fMultDiv2(r4, C52) << (2));
+  r2 = t + fMult(r2, C53);
+
+  /* imaginary part */
+  s1 = (pDat[3] + pDat[9]) >> 1;
+  s4 = (pDat[3] - pDat[9]) >> 1;
+  s3 = (pDat[5] + pDat[7]) >> 1;
+  s2 = (pDat[5] - pDat[7]) >> 1;
+  t = fMult((s1 - s3), C54);
+  s1 = s1 + s3;
+  pDat[1] = (pDat[1] >> 1) + s1;
+  /* Bit shift left because of the constant C55 which was scaled with the factor
+     0.5 because of the representation of the values as fracts */
+  s1 = pDat[1] + (fMultDiv2(s1, C55) << (2));
+  s3 = s1 - t;
+  s1 = s1 + t;
+  t = fMult((s4 + s2), C51);
+  /* Bit shift left because of the constant C55 which was scaled with the factor
+     0.5 because of the representation of the values as fracts */
+  s4 = t + (fMultDiv2(s4, C52) << (2));
+  s2 = t + fMult(s2, C53);
+
+  /* combination */
+  pDat[2] = r1 + s2;
+  pDat[8] = r1 - s2;
+  pDat[4] = r3 - s4;
+  pDat[6] = r3 + s4;
+
+  pDat[3] = s1 - r2;
+  pDat[9] = s1 + r2;
+  pDat[5] = s3 + r4;
+  pDat[7] = s3 - r4;
+}
+
+static inline void fft15(FIXP_DBLV *pInput) {
+  FIXP_DBLV aDst[2 * N15];
+  FIXP_DBLV aDst1[2 * N15];
+  int i, k, l;
+
+  /* Sort input vector for fft's of length 3
+  input3(0:2)   = [input(0) input(5) input(10)];
+  input3(3:5)   = [input(3) input(8) input(13)];
+  input3(6:8)   = [input(6) input(11) input(1)];
+  input3(9:11)  = [input(9) input(14) input(4)];
+  input3(12:14) = [input(12) input(2) input(7)]; */
+  {
+    const FIXP_DBLV *pSrc = pInput;
+    FIXP_DBLV *RESTRICT pDst = aDst;
+    /* Merge 3 loops into one, skip call of fft3 */
+    for (i = 0, l = 0, k = 0; i < N5; i++, k += 6) {
+      pDst[k + 0] = pSrc[l];
+      pDst[k + 1] = pSrc[l + 1];
+      l += 2 * N5;
+      if (l >= (2 * N15)) l -= (2 * N15);
+
+      pDst[k + 2] = pSrc[l];
+      pDst[k + 3] = pSrc[l + 1];
+      l += 2 * N5;
+      if (l >= (2 * N15)) l -= (2 * N15);
+      pDst[k + 4] = pSrc[l];
+      pDst[k + 5] = pSrc[l + 1];
+      l += (2 * N5) + (2 * N3);
+      if (l >= (2 * N15)) l -= (2 * N15);
+
+      /* fft3 merged with shift right by 2 loop */
+      FIXP_DBLV r1, r2, r3;
+      FIXP_DBLV s1, s2;
+      /* real part */
+      r1 = pDst[k + 2] + pDst[k + 4];
+      r2 = fMult((pDst[k + 2] - pDst[k + 4]), C31);
+      s1 = pDst[k + 0];
+      pDst[k + 0] = (s1 + r1) >> 2;
+      r1 = s1 - (r1 >> 1);
+
+      /* imaginary part */
+      s1 = pDst[k + 3] + pDst[k + 5];
+      s2 = fMult((pDst[k + 3] - pDst[k + 5]), C31);
+      r3 = pDst[k + 1];
+      pDst[k + 1] = (r3 + s1) >> 2;
+      s1 = r3 - (s1 >> 1);
+
+      /* combination */
+      pDst[k + 2] = (r1 - s2) >> 2;
+      pDst[k + 4] = (r1 + s2) >> 2;
+      pDst[k + 3] = (s1 + r2) >> 2;
+      pDst[k + 5] = (s1 - r2) >> 2;
+    }
+  }
+  /* Sort input vector for fft's of length 5
+  input5(0:4)   = [output3(0) output3(3) output3(6) output3(9) output3(12)];
+  input5(5:9)   = [output3(1) output3(4) output3(7) output3(10) output3(13)];
+  input5(10:14) = [output3(2) output3(5) output3(8) output3(11) output3(14)]; */
+  /* Merge 2 loops into one, brings about 10% */
+  {
+    const FIXP_DBLV *pSrc = aDst;
+    FIXP_DBLV *RESTRICT pDst = aDst1;
+    for (i = 0, l = 0, k = 0; i < N3; i++, k += 10) {
+      l = 2 * i;
+      pDst[k + 0] = pSrc[l + 0];
+      pDst[k + 1] = pSrc[l + 1];
+      pDst[k + 2] = pSrc[l + 0 + (2 * N3)];
+      pDst[k + 3] = pSrc[l + 1 + (2 * N3)];
+      pDst[k + 4] = pSrc[l + 0 + (4 * N3)];
+      pDst[k + 5] = pSrc[l + 1 + (4 * N3)];
+      pDst[k + 6] = pSrc[l + 0 + (6 * N3)];
+      pDst[k + 7] = pSrc[l + 1 + (6 * N3)];
+      pDst[k + 8] = pSrc[l + 0 + (8 * N3)];
+      pDst[k + 9] = pSrc[l + 1 + (8 * N3)];
+      fft5(&pDst[k]);
+    }
+  }
+  /* Sort output vector of length 15
+  output = [out5(0)  out5(6)  out5(12) out5(3)  out5(9)
+            out5(10) out5(1)  out5(7)  out5(13) out5(4)
+            out5(5)  out5(11) out5(2)  out5(8)  out5(14)]; */
+  /* optimize clumsy loop, brings about 5% */
+  {
+    const FIXP_DBLV *pSrc = aDst1;
+    FIXP_DBLV *RESTRICT pDst = pInput;
+    for (i = 0, l = 0, k = 0; i < N3; i++, k += 10) {
+      pDst[k + 0] = pSrc[l];
+      pDst[k + 1] = pSrc[l + 1];
+      l += (2 * N6);
+      if (l >= (2 * N15)) l -= (2 * N15);
+      pDst[k + 2] = pSrc[l];
+      pDst[k + 3] = pSrc[l + 1];
+      l += (2 * N6);
+      if (l >= (2 * N15)) l -= (2 * N15);
+      pDst[k + 4] = pSrc[l];
+      pDst[k + 5] = pSrc[l + 1];
+      l += (2 * N6);
+      if (l >= (2 * N15)) l -= (2 * N15);
+      pDst[k + 6] = pSrc[l];
+      pDst[k + 7] = pSrc[l + 1];
+      l += (2 * N6);
+      if (l >= (2 * N15)) l -= (2 * N15);
+      pDst[k + 8] = pSrc[l];
+      pDst[k + 9] = pSrc[l + 1];
+      l += 2; /* no modulo check needed, it cannot occur */
+    }
+  }
+}
+
+static inline void fft_8(FIXP_DBLV *x) {
+  const FIXP_SPK w_PiFOURTH = {{FIXP_SGL(0x5A82), FIXP_SGL(0x5A82)}};
+
+  FIXP_DBLV a00, a10, a20, a30;
+  FIXP_DBLV y[16];
+
+  a00 = (x[0] + x[8]) >> 1;
+  a10 = x[4] + x[12];
+  a20 = (x[1] + x[9]) >> 1;
+  a30 = x[5] + x[13];
+
+  y[0] = a00 + (a10 >> 1);
+  y[4] = a00 - (a10 >> 1);
+  y[1] = a20 + (a30 >> 1);
+  y[5] = a20 - (a30 >> 1);
+
+  a00 = a00 - x[8];
+  a10 = (a10 >> 1) - x[12];
+  a20 = a20 - x[9];
+  a30 = (a30 >> 1) - x[13];
+
+  y[2] = a00 + a30;
+  y[6] = a00 - a30;
+  y[3] = a20 - a10;
+  y[7] = a20 + a10;
+
+  a00 = (x[2] + x[10]) >> 1;
+  a10 = x[6] + x[14];
+  a20 = (x[3] + x[11]) >> 1;
+  a30 = x[7] + x[15];
+
+  y[8] = a00 + (a10 >> 1);
+  y[12] = a00 - (a10 >> 1);
+  y[9] = a20 + (a30 >> 1);
+  y[13] = a20 - (a30 >> 1);
+
+  a00 = a00 - x[10];
+  a10 = (a10 >> 1) - x[14];
+  a20 = a20 - x[11];
+  a30 = (a30 >> 1) - x[15];
+
+  y[10] = a00 + a30;
+  y[14] = a00 - a30;
+  y[11] = a20 - a10;
+  y[15] = a20 + a10;
+
+  FIXP_DBLV vr, vi, ur, ui;
+
+  ur = y[0] >> 1;
+  ui = y[1] >> 1;
+  vr = y[8];
+  vi = y[9];
+  x[0] = ur + (vr >> 1);
+  x[1] = ui + (vi >> 1);
+  x[8] = ur - (vr >> 1);
+  x[9] = ui - (vi >> 1);
+
+  ur = y[4] >> 1;
+  ui = y[5] >> 1;
+  vi = y[12];
+  vr = y[13];
+  x[4] = ur + (vr >> 1);
+  x[5] = ui - (vi >> 1);
+  x[12] = ur - (vr >> 1);
+  x[13] = ui + (vi >> 1);
+
+  ur = y[10];
+  ui = y[11];
+
+  cplxMultDiv2(&vi, &vr, ui, ur, w_PiFOURTH);
+
+  ur = y[2];
+  ui = y[3];
+  x[2] = (ur >> 1) + vr;
+  x[3] = (ui >> 1) + vi;
+  x[10] = (ur >> 1) - vr;
+  x[11] = (ui >> 1) - vi;
+
+  ur = y[14];
+  ui = y[15];
+
+  cplxMultDiv2(&vr, &vi, ui, ur, w_PiFOURTH);
+
+  ur = y[6];
+  ui = y[7];
+  x[6] = (ur >> 1) + vr;
+  x[7] = (ui >> 1) - vi;
+  x[14] = (ur >> 1) - vr;
+  x[15] = (ui >> 1) + vi;
+}
+
+static inline void fft_16(FIXP_DBLV *RESTRICT x) {
+  FIXP_DBLV vr, ur;
+  FIXP_DBLV vr2, ur2;
+  FIXP_DBLV vr3, ur3;
+  FIXP_DBLV vr4, ur4;
+  FIXP_DBLV vi, ui;
+  FIXP_DBLV vi2, ui2;
+  FIXP_DBLV vi3, ui3;
+
+  vr = (x[0] >> 1) + (x[16] >> 1);       /* Re A + Re B */
+  ur = (x[1] >> 1) + (x[17] >> 1);       /* Im A + Im B */
+  vi = (x[8] >> 1) + (x[24] >> 1); /* Re C + Re D */
+  ui = (x[9] >> 1) + (x[25] >> 1); /* Im C + Im D */
+  x[0] = vr + vi;              /* Re A' = ReA + ReB +ReC + ReD */
+  x[1] = ur + ui;              /* Im A' = sum of imag values */
+
+  vr2 = (x[4] >> 1) + (x[20] >> 1); /* Re A + Re B */
+  ur2 = (x[5] >> 1) + (x[21] >> 1); /* Im A + Im B */
+
+  x[4] = vr - vi; /* Re C' = -(ReC+ReD) + (ReA+ReB) */
+  x[5] = ur - ui; /* Im C' = -Im C -Im D +Im A +Im B */
+  vr -= x[16];              /* Re A - Re B */
+  vi = vi - x[24];  /* Re C - Re D */
+  ur -= x[17];              /* Im A - Im B */
+  ui = ui - x[25];  /* Im C - Im D */
+
+  vr3 = (x[2] >> 1) + (x[18] >> 1); /* Re A + Re B */
+  ur3 = (x[3] >> 1) + (x[19] >> 1); /* Im A + Im B */
+
+  x[2] = ui + vr; /* Re B' = Im C - Im D  + Re A - Re B */
+  x[3] = ur - vi; /* Im B'= -Re C + Re D + Im A - Im B */
+
+  vr4 = (x[6] >> 1) + (x[22] >> 1); /* Re A + Re B */
+  ur4 = (x[7] >> 1) + (x[23] >> 1); /* Im A + Im B */
+
+  x[6] = vr - ui; /* Re D' = -Im C + Im D + Re A - Re B */
+  x[7] = vi + ur; /* Im D'= Re C - Re D + Im A - Im B */
+
+  vi2 = (x[12] >> 1) + (x[28] >> 1); /* Re C + Re D */
+  ui2 = (x[13] >> 1) + (x[29] >> 1); /* Im C + Im D */
+  x[8] = vr2 + vi2;              /* Re A' = ReA + ReB +ReC + ReD */
+  x[9] = ur2 + ui2;              /* Im A' = sum of imag values */
+  x[12] = vr2 - vi2;             /* Re C' = -(ReC+ReD) + (ReA+ReB) */
+  x[13] = ur2 - ui2;             /* Im C' = -Im C -Im D +Im A +Im B */
+  vr2 -= x[20];                            /* Re A - Re B */
+  ur2 -= x[21];                            /* Im A - Im B */
+  vi2 = vi2 - x[28];               /* Re C - Re D */
+  ui2 = ui2 - x[29];               /* Im C - Im D */
+
+  vi = (x[10] >> 1) + (x[26] >> 1); /* Re C + Re D */
+  ui = (x[11] >> 1) + (x[27] >> 1); /* Im C + Im D */
+
+  x[10] = ui2 + vr2; /* Re B' = Im C - Im D  + Re A - Re B */
+  x[11] = ur2 - vi2; /* Im B'= -Re C + Re D + Im A - Im B */
+
+  vi3 = (x[14] >> 1) + (x[30] >> 1); /* Re C + Re D */
+  ui3 = (x[15] >> 1) + (x[31] >> 1); /* Im C + Im D */
+
+  x[14] = vr2 - ui2; /* Re D' = -Im C + Im D + Re A - Re B */
+  x[15] = vi2 + ur2; /* Im D'= Re C - Re D + Im A - Im B */
+
+  x[16] = vr3 + vi; /* Re A' = ReA + ReB +ReC + ReD */
+  x[17] = ur3 + ui; /* Im A' = sum of imag values */
+  x[20] = vr3 - vi; /* Re C' = -(ReC+ReD) + (ReA+ReB) */
+  x[21] = ur3 - ui; /* Im C' = -Im C -Im D +Im A +Im B */
+  vr3 -= x[18];               /* Re A - Re B */
+  ur3 -= x[19];               /* Im A - Im B */
+  vi = vi - x[26];    /* Re C - Re D */
+  ui = ui - x[27];    /* Im C - Im D */
+  x[18] = ui + vr3;           /* Re B' = Im C - Im D  + Re A - Re B */
+  x[19] = ur3 - vi;           /* Im B'= -Re C + Re D + Im A - Im B */
+
+  x[24] = vr4 + vi3; /* Re A' = ReA + ReB +ReC + ReD */
+  x[28] = vr4 - vi3; /* Re C' = -(ReC+ReD) + (ReA+ReB) */
+  x[25] = ur4 + ui3; /* Im A' = sum of imag values */
+  x[29] = ur4 - ui3; /* Im C' = -Im C -Im D +Im A +Im B */
+  vr4 -= x[22];                /* Re A - Re B */
+  ur4 -= x[23];                /* Im A - Im B */
+
+  x[22] = vr3 - ui; /* Re D' = -Im C + Im D + Re A - Re B */
+  x[23] = vi + ur3; /* Im D'= Re C - Re D + Im A - Im B */
+
+  vi3 = vi3 - x[30]; /* Re C - Re D */
+  ui3 = ui3 - x[31]; /* Im C - Im D */
+  x[26] = ui3 + vr4;         /* Re B' = Im C - Im D  + Re A - Re B */
+  x[30] = vr4 - ui3;         /* Re D' = -Im C + Im D + Re A - Re B */
+  x[27] = ur4 - vi3;         /* Im B'= -Re C + Re D + Im A - Im B */
+  x[31] = vi3 + ur4;         /* Im D'= Re C - Re D + Im A - Im B */
+
+  // xt1 =  0
+  // xt2 =  8
+  vr = x[8];
+  vi = x[9];
+  ur = x[0] >> 1;
+  ui = x[1] >> 1;
+  x[0] = ur + (vr >> 1);
+  x[1] = ui + (vi >> 1);
+  x[8] = ur - (vr >> 1);
+  x[9] = ui - (vi >> 1);
+
+  // xt1 =  4
+  // xt2 = 12
+  vr = x[13];
+  vi = x[12];
+  ur = x[4] >> 1;
+  ui = x[5] >> 1;
+  x[4] = ur + (vr >> 1);
+  x[5] = ui - (vi >> 1);
+  x[12] = ur - (vr >> 1);
+  x[13] = ui + (vi >> 1);
+
+  // xt1 = 16
+  // xt2 = 24
+  vr = x[24];
+  vi = x[25];
+  ur = x[16] >> 1;
+  ui = x[17] >> 1;
+  x[16] = ur + (vr >> 1);
+  x[17] = ui + (vi >> 1);
+  x[24] = ur - (vr >> 1);
+  x[25] = ui - (vi >> 1);
+
+  // xt1 = 20
+  // xt2 = 28
+  vr = x[29];
+  vi = x[28];
+  ur = x[20] >> 1;
+  ui = x[21] >> 1;
+  x[20] = ur + (vr >> 1);
+  x[21] = ui - (vi >> 1);
+  x[28] = ur - (vr >> 1);
+  x[29] = ui + (vi >> 1);
+
+  // xt1 =  2
+  // xt2 = 10
+  SUMDIFF_PIFOURTH_V(vi, vr, x[10], x[11])
+  // vr = fMultDiv2((x[11] + x[10]),W_PiFOURTH);
+  // vi = fMultDiv2((x[11] - x[10]),W_PiFOURTH);
+  ur = x[2];
+  ui = x[3];
+  x[2] = (ur >> 1) + vr;
+  x[3] = (ui >> 1) + vi;
+  x[10] = (ur >> 1) - vr;
+  x[11] = (ui >> 1) - vi;
+
+  // xt1 =  6
+  // xt2 = 14
+  SUMDIFF_PIFOURTH_V(vr, vi, x[14], x[15])
+  ur = x[6];
+  ui = x[7];
+  x[6] = (ur >> 1) + vr;
+  x[7] = (ui >> 1) - vi;
+  x[14] = (ur >> 1) - vr;
+  x[15] = (ui >> 1) + vi;
+
+  // xt1 = 18
+  // xt2 = 26
+  SUMDIFF_PIFOURTH_V(vi, vr, x[26], x[27])
+  ur = x[18];
+  ui = x[19];
+  x[18] = (ur >> 1) + vr;
+  x[19] = (ui >> 1) + vi;
+  x[26] = (ur >> 1) - vr;
+  x[27] = (ui >> 1) - vi;
+
+  // xt1 = 22
+  // xt2 = 30
+  SUMDIFF_PIFOURTH_V(vr, vi, x[30], x[31])
+  ur = x[22];
+  ui = x[23];
+  x[22] = (ur >> 1) + vr;
+  x[23] = (ui >> 1) - vi;
+  x[30] = (ur >> 1) - vr;
+  x[31] = (ui >> 1) + vi;
+
+  // xt1 =  0
+  // xt2 = 16
+  vr = x[16];
+  vi = x[17];
+  ur = x[0] >> 1;
+  ui = x[1] >> 1;
+  x[0] = ur + (vr >> 1);
+  x[1] = ui + (vi >> 1);
+  x[16] = ur - (vr >> 1);
+  x[17] = ui - (vi >> 1);
+
+  // xt1 =  8
+  // xt2 = 24
+  vi = x[24];
+  vr = x[25];
+  ur = x[8] >> 1;
+  ui = x[9] >> 1;
+  x[8] = ur + (vr >> 1);
+  x[9] = ui - (vi >> 1);
+  x[24] = ur - (vr >> 1);
+  x[25] = ui + (vi >> 1);
+
+  // xt1 =  2
+  // xt2 = 18
+  cplxMultDiv2(&vi, &vr, x[19], x[18], fft16_w16_x86[0]);
+  ur = x[2];
+  ui = x[3];
+  x[2] = (ur >> 1) + vr;
+  x[3] = (ui >> 1) + vi;
+  x[18] = (ur >> 1) - vr;
+  x[19] = (ui >> 1) - vi;
+
+  // xt1 = 10
+  // xt2 = 26
+  cplxMultDiv2(&vr, &vi, x[27], x[26], fft16_w16_x86[0]);
+  ur = x[10];
+  ui = x[11];
+  x[10] = (ur >> 1) + vr;
+  x[11] = (ui >> 1) - vi;
+  x[26] = (ur >> 1) - vr;
+  x[27] = (ui >> 1) + vi;
+
+  // xt1 =  4
+  // xt2 = 20
+  SUMDIFF_PIFOURTH_V(vi, vr, x[20], x[21])
+  ur = x[4];
+  ui = x[5];
+  x[4] = (ur >> 1) + vr;
+  x[5] = (ui >> 1) + vi;
+  x[20] = (ur >> 1) - vr;
+  x[21] = (ui >> 1) - vi;
+
+  // xt1 = 12
+  // xt2 = 28
+  SUMDIFF_PIFOURTH_V(vr, vi, x[28], x[29])
+  ur = x[12];
+  ui = x[13];
+  x[12] = (ur >> 1) + vr;
+  x[13] = (ui >> 1) - vi;
+  x[28] = (ur >> 1) - vr;
+  x[29] = (ui >> 1) + vi;
+
+  // xt1 =  6
+  // xt2 = 22
+  cplxMultDiv2(&vi, &vr, x[23], x[22], fft16_w16_x86[1]);
+  ur = x[6];
+  ui = x[7];
+  x[6] = (ur >> 1) + vr;
+  x[7] = (ui >> 1) + vi;
+  x[22] = (ur >> 1) - vr;
+  x[23] = (ui >> 1) - vi;
+
+  // xt1 = 14
+  // xt2 = 30
+  cplxMultDiv2(&vr, &vi, x[31], x[30], fft16_w16_x86[1]);
+  ur = x[14];
+  ui = x[15];
+  x[14] = (ur >> 1) + vr;
+  x[15] = (ui >> 1) - vi;
+  x[30] = (ur >> 1) - vr;
+  x[31] = (ui >> 1) + vi;
+}
+
+/* dim1 is 8 or 16, dim2 15 */
+#define FFT_X86_MAX_DIM1 16
+#define FFT_X86_DIM2 16 /* dim2 rounded up to a multiple of FDK_SIMD_LANES */
+#define FFT_X86_STRIDE (FFT_X86_MAX_DIM1 + FDK_SIMD_LANES)
+
+/* transposes the 4x4 block at src into dst */
+static inline void fft_x86_transpose4x4(FIXP_DBL *dst, const int dstStride,
+                                        const FIXP_DBL *src,
+                                        const int srcStride) {
+  __m128 r0 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)src));
+  __m128 r1 =
+      _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(src + srcStride)));
+  __m128 r2 =
+      _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(src + 2 * srcStride)));
+  __m128 r3 =
+      _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(src + 3 * srcStride)));
+  _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+  _mm_storeu_si128((__m128i *)dst, _mm_castps_si128(r0));
+  _mm_storeu_si128((__m128i *)(dst + dstStride), _mm_castps_si128(r1));
+  _mm_storeu_si128((__m128i *)(dst + 2 * dstStride), _mm_castps_si128(r2));
+  _mm_storeu_si128((__m128i *)(dst + 3 * dstStride), _mm_castps_si128(r3));
+}
+
+/* FDK_SIMD_LANES twiddles of pVec from index n on, of which at most len - n
+ * are in the table */
+static inline FIXP_DBLV fft_x86_load_twiddles(const FIXP_STB *pVec, const int n,
+                                              const int len) {
+  if (n + FDK_SIMD_LANES <= len) {
+    return fvLoadSgl(pVec + n);
+  }
+  FIXP_STB tail[FDK_SIMD_LANES];
+  for (int k = 0; k < FDK_SIMD_LANES; k++) {
+    tail[k] = (n + k < len) ? pVec[n + k] : (FIXP_STB)0;
+  }
+  return fvLoadSgl(tail);
+}
+
+/* As fftN2_func(), with the FFTs of length dim1 and those of length dim2
+ * FDK_SIMD_LANES at a time */
+static inline void fftN2_x86(FIXP_DBL *pInput, const int length,
+                             const int dim1, const int dim2,
+                             void (*const fft1)(FIXP_DBLV *),
+                             void (*const fft2)(FIXP_DBLV *),
+                             const FIXP_STB *RotVectorReal,
+                             const FIXP_STB *RotVectorImag) {
+  /* output of the first FFTs, row j holds output j of FFT 0, 1, ... dim2-1 */
+  C_AALLOC_SCRATCH_START(aRe, FIXP_DBL, FFT_X86_MAX_DIM1 * FFT_X86_DIM2)
+  C_AALLOC_SCRATCH_START(aIm, FIXP_DBL, FFT_X86_MAX_DIM1 * FFT_X86_DIM2)
+  /* transposed, the input of the second FFTs, row i holds input i of them */
+  C_AALLOC_SCRATCH_START(bRe, FIXP_DBL, FFT_X86_DIM2 * FFT_X86_STRIDE)
+  C_AALLOC_SCRATCH_START(bIm, FIXP_DBL, FFT_X86_DIM2 * FFT_X86_STRIDE)
+  FIXP_DBLV x[2 * FFT_X86_MAX_DIM1];
+  FIXP_DBL tail[2 * FDK_SIMD_LANES];
+  const int lenRot = (dim2 - 1) * (dim1 - 1);
+  int i, j;
+
+  FDK_ASSERT(length == dim1 * dim2);
+  FDK_ASSERT(dim1 <= FFT_X86_MAX_DIM1 && (dim1 % FDK_SIMD_LANES) == 0);
+  FDK_ASSERT(dim2 <= FFT_X86_DIM2);
+
+  /* FFTs of length dim1, input j of FFT i is at pInput[2 * (j * dim2 + i)] */
+  for (i = 0; i < dim2; i += FDK_SIMD_LANES) {
+    for (j = 0; j < dim1; j++) {
+      const FIXP_DBL *pSrc = pInput + 2 * (j * dim2 + i);
+      int n = length - (j * dim2 + i);
+      if (n < FDK_SIMD_LANES) {
+        /* lanes of the last FFTs past the end of pInput */
+        FDKmemclear(tail, sizeof(tail));
+        FDKmemcpy(tail, pSrc, 2 * n * sizeof(FIXP_DBL));
+        pSrc = tail;
+      }
+      fvLoadCplx(pSrc, &x[2 * j], &x[2 * j + 1]);
+    }
+    fft1(x);
+    for (j = 0; j < dim1; j++) {
+      fvStore(aRe + j * FFT_X86_DIM2 + i, x[2 * j]);
+      fvStore(aIm + j * FFT_X86_DIM2 + i, x[2 * j + 1]);
+    }
+  }
+
+  for (j = 0; j < dim1; j += 4) {
+    for (i = 0; i < FFT_X86_DIM2; i += 4) {
+      fft_x86_transpose4x4(bRe + i * FFT_X86_STRIDE + j, FFT_X86_STRIDE,
+                           aRe + j * FFT_X86_DIM2 + i, FFT_X86_DIM2);
+      fft_x86_transpose4x4(bIm + i * FFT_X86_STRIDE + j, FFT_X86_STRIDE,
+                           aIm + j * FFT_X86_DIM2 + i, FFT_X86_DIM2);
+    }
+  }
+
+  /* fft_apply_rot_vector(), lanes past dim1 in row i are not used */
+  for (j = 0; j < dim1; j += FDK_SIMD_LANES) {
+    fvStore(bRe + j, fvLoad(bRe + j) >> 2);
+    fvStore(bIm + j, fvLoad(bIm + j) >> 2);
+  }
+  for (i = 1; i < dim2; i++) {
+    FIXP_DBL *pRe = bRe + i * FFT_X86_STRIDE;
+    FIXP_DBL *pIm = bIm + i * FFT_X86_STRIDE;
+
+    pRe[0] = pRe[0] >> 2;
+    pIm[0] = pIm[0] >> 2;
+    for (j = 1; j < dim1; j += FDK_SIMD_LANES) {
+      const int n = (i - 1) * (dim1 - 1) + j - 1;
+      FIXP_DBLV re = fvLoad(pRe + j) >> 1;
+      FIXP_DBLV im = fvLoad(pIm + j) >> 1;
+      FIXP_DBLV vre = fft_x86_load_twiddles(RotVectorReal, n, lenRot);
+      FIXP_DBLV vim = fft_x86_load_twiddles(RotVectorImag, n, lenRot);
+      FIXP_DBLV oRe, oIm;
+
+      cplxMultDiv2(&oIm, &oRe, im, re, vre, vim);
+      fvStore(pRe + j, oRe);
+      fvStore(pIm + j, oIm);
+    }
+  }
+
+  /* FFTs of length dim2, output i of FFT j goes to pInput[2 * (i * dim1 + j)]
+   */
+  for (j = 0; j < dim1; j += FDK_SIMD_LANES) {
+    for (i = 0; i < dim2; i++) {
+      x[2 * i] = fvLoad(bRe + i * FFT_X86_STRIDE + j);
+      x[2 * i + 1] = fvLoad(bIm + i * FFT_X86_STRIDE + j);
+    }
+    fft2(x);
+    for (i = 0; i < dim2; i++) {
+      fvStoreCplx(pInput + 2 * (i * dim1 + j), x[2 * i], x[2 * i + 1]);
+    }
+  }
+
+  C_AALLOC_SCRATCH_END(bIm, FIXP_DBL, FFT_X86_DIM2 * FFT_X86_STRIDE)
+  C_AALLOC_SCRATCH_END(bRe, FIXP_DBL, FFT_X86_DIM2 * FFT_X86_STRIDE)
+  C_AALLOC_SCRATCH_END(aIm, FIXP_DBL, FFT_X86_MAX_DIM1 * FFT_X86_DIM2)
+  C_AALLOC_SCRATCH_END(aRe, FIXP_DBL, FFT_X86_MAX_DIM1 * FFT_X86_DIM2)
+}
+
+#define FUNCTION_fft120
+static inline void fft120(FIXP_DBL *pInput) {
+  fftN2_x86(pInput, 120, 8, 15, fft_8, fft15, RotVectorReal120,
+            RotVectorImag120);
+}
+
+#define FUNCTION_fft240
+static inline void fft240(FIXP_DBL *pInput) {
+  fftN2_x86(pInput, 240, 16, 15, fft_16, fft15, RotVectorReal240,
+            RotVectorImag240);
+}
+
+#endif /* FDK_SIMD_X86 */
@@ -0,0 +1,254 @@
+/* -----------------------------------------------------------------------------
+Software License for The Fraunhofer FDK AAC Codec Library for Android
+
+© Copyright  1995 - 2018 Fraunhofer-Gesellschaft zur Förderung der angewandten
+Forschung e.V. All rights reserved.
+
+ 1.    INTRODUCTION
+The Fraunhofer FDK AAC Codec Library for Android ("FDK AAC Codec") is software
+that implements the MPEG Advanced Audio Coding ("AAC") encoding and decoding
+scheme for digital audio. This FDK AAC Codec software is intended to be used on
+a wide variety of Android devices.
+
+AAC's HE-AAC and HE-AAC v2 versions are regarded as today's most efficient
+general perceptual audio codecs. AAC-ELD is considered the best-performing
+full-bandwidth communications codec by independent studies and is widely
+deployed. AAC has been standardized by ISO and IEC as part of the MPEG
+specifications.
+
+Patent licenses for necessary patent claims for the FDK AAC Codec (including
+those of Fraunhofer) may be obtained through Via Licensing
+(www.vialicensing.com) or through the respective patent owners individually for
+the purpose of encoding or decoding bit streams in products that are compliant
+with the ISO/IEC MPEG audio standards. Please note that most manufacturers of
+Android devices already license these patent claims through Via Licensing or
+directly from the patent owners, and therefore FDK AAC Codec software may
+already be covered under those patent licenses when it is used for those
+licensed purposes only.
+
+Commercially-licensed AAC software libraries, including floating-point versions
+with enhanced sound quality, are also available from Fraunhofer. Users are
+encouraged to check the Fraunhofer website for additional applications
+information and documentation.
+
+2.    COPYRIGHT LICENSE
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted without payment of copyright license fees provided that you
+satisfy the following conditions:
+
+You must retain the complete text of this software license in redistributions of
+the FDK AAC Codec or your modifications thereto in source code form.
+
+You must retain the complete text of this software license in the documentation
+and/or other materials provided with redistributions of the FDK AAC Codec or
+your modifications thereto in binary form. You must make available free of
+charge copies of the complete source code of the FDK AAC Codec and your
+modifications thereto to recipients of copies in binary form.
+
+The name of Fraunhofer may not be used to endorse or promote products derived
+from this library without prior written permission.
+
+You may not charge copyright license fees for anyone to use, copy or distribute
+the FDK AAC Codec software or your modifications thereto.
+
+Your modified versions of the FDK AAC Codec must carry prominent notices stating
+that you changed the software and the date of any change. For modified versions
+of the FDK AAC Codec, the term "Fraunhofer FDK AAC Codec Library for Android"
+must be replaced by the term "Third-Party Modified Version of the Fraunhofer FDK
+AAC Codec Library for Android."
+
+3.    NO PATENT LICENSE
+
+NO EXPRESS OR IMPLIED LICENSES TO ANY PATENT CLAIMS, including without
+limitation the patents of Fraunhofer, ARE GRANTED BY THIS SOFTWARE LICENSE.
+Fraunhofer provides no warranty of patent non-infringement with respect to this
+software.
+
+You may use this FDK AAC Codec software or modifications thereto only for
+purposes that are authorized by appropriate patent licenses.
+
+4.    DISCLAIMER
+
+This FDK AAC Codec software is provided by Fraunhofer on behalf of the copyright
+holders and contributors "AS IS" and WITHOUT ANY EXPRESS OR IMPLIED WARRANTIES,
+including but not limited to the implied warranties of merchantability and
+fitness for a particular purpose. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+CONTRIBUTORS BE LIABLE for any direct, indirect, incidental, special, exemplary,
+or consequential damages, including but not limited to procurement of substitute
+goods or services; loss of use, data, or profits, or business interruption,
+however caused and on any theory of liability, whether in contract, strict
+liability, or tort (including negligence), arising in any way out of the use of
+this software, even if advised of the possibility of such damage.
+
+5.    CONTACT INFORMATION
+
+Fraunhofer Institute for Integrated Circuits IIS
+Attention: Audio and Multimedia Departments - FDK AAC LL
+Am Wolfsmantel 33
+91058 Erlangen, Germany
+
+www.iis.fraunhofer.de/amm
+amm-info@iis.fraunhofer.de
+----------------------------------------------------------------------------- */
+
+
+/******************* Library for basic calculation routines ********************
+
+   Author(s):
+
+   Description: QMF prototype filters with SSE4.1 / AVX2
+
+*******************************************************************************/
+
+/*
+  The prototype filters of the QMF banks with QMF_FLAG_NONSYMMETRIC (CLDFB, as
+  used by LD-SBR). The analysis filter computes FDK_SIMD_LANES of its outputs
+  at a time, the coefficients of the lanes are every QMF_NO_POLY-th of the
+  prototype. In the synthesis filter, the update of the states 0..7 of one
+  channel is a vector operation: each state takes the next one plus the product
+  of a coefficient with the real or the imaginary input.
+
+  qmf_pcm.h is compiled for 16 and 32 bit PCM, both functions are templates on
+  the type that differs.
+*/
+
+#include "x86/simd_x86.h"
+
+#if defined(FDK_SIMD_X86)
+
+#define FUNCTION_qmfAnaPrototypeFirSlot_NonSymmetric
+#define FUNCTION_qmfSynPrototypeFirSlot_NonSymmetric
+
+/* FDK_SIMD_LANES analysis filter states, as FIXP_DBL */
+static inline FIXP_DBLV qmf_x86_load_states(const FIXP_DBL *p) {
+  return fvLoad(p);
+}
+static inline FIXP_DBLV qmf_x86_load_states(const FIXP_SGL *p) {
+  return fvLoadSgl(p);
+}
+
+template <class FIXP_STATE>
+static void qmfAnaPrototypeFirSlot_NonSymmetric(
+    FIXP_DBL *analysisBuffer,
+    int no_channels, /*!< Number channels of analysis filter */
+    const FIXP_PFT *p_filter, int p_stride, /*!< Stride of analysis filter    */
+    FIXP_STATE *RESTRICT pFilterStates) {
+  const FIXP_PFT *RESTRICT p_flt = p_filter + QMF_NO_POLY * (p_stride - 1);
+  int pfltStep = QMF_NO_POLY * p_stride;
+  int p, k;
+
+  for (k = 0; k + FDK_SIMD_LANES <= 2 * no_channels; k += FDK_SIMD_LANES) {
+    FIXP_DBLV accu = fvSet1((FIXP_DBL)0);
+
+    for (p = 0; p < QMF_NO_POLY; p++) {
+      accu +=
+          fMultDiv2(fvLoadSglStride(p_flt + p, pfltStep),
+                    qmf_x86_load_states(pFilterStates + 2 * no_channels * p));
+    }
+    fvStore(&analysisBuffer[2 * no_channels - FDK_SIMD_LANES - k],
+            fvReverse(accu << 1));
+    p_flt += FDK_SIMD_LANES * pfltStep;
+    pFilterStates += FDK_SIMD_LANES;
+  }
+
+  for (; k < 2 * no_channels; k++) {
+    FIXP_DBL accu = (FIXP_DBL)0;
+
+    for (p = 0; p < QMF_NO_POLY; p++) {
+      accu += fMultDiv2(p_flt[p], pFilterStates[2 * no_channels * p]);
+    }
+    analysisBuffer[2 * no_channels - 1 - k] = (accu << 1);
+    p_flt += pfltStep;
+    pFilterStates++;
+  }
+}
+
+template <class INT_PCM_OUT>
+static void qmfSynPrototypeFirSlot_NonSymmetric(
+    HANDLE_QMF_FILTER_BANK qmf,
+    FIXP_DBL *RESTRICT realSlot,   /*!< Input: Pointer to real Slot */
+    FIXP_DBL *RESTRICT imagSlot,   /*!< Input: Pointer to imag Slot */
+    INT_PCM_OUT *RESTRICT timeOut, /*!< Time domain data */
+    int stride) {
+  const int sampleBits = (int)(8 * sizeof(INT_PCM_OUT));
+  FIXP_QSS *RESTRICT sta = (FIXP_QSS *)qmf->FilterStates;
+  const FIXP_PFT *RESTRICT p_flt = qmf->p_filter;
+  const FIXP_PFT *RESTRICT p_fltm = &p_flt[qmf->FilterSize / 2];
+  int p_step = qmf->p_stride * QMF_NO_POLY;
+  int scale = (DFRACT_BITS - sampleBits) - 1 - qmf->outScalefactor -
+              qmf->outGain_e;
+  FIXP_SGL gain = FX_DBL2FX_SGL(qmf->outGain_m);
+  FIXP_DBL rnd_val = (FIXP_DBL)0;
+  int j;
+
+  /* The coefficients of the states 0..7 are p_flt[4], p_fltm[3], p_flt[3], ...
+     p_fltm[0]. The shuffle takes them from p_fltm[0] p_flt[1] p_fltm[1] ...
+     p_flt[4] (16 bit) into the upper halves of the lanes, in reverse order. */
+  const __m128i coeff_lo = _mm_setr_epi8(-128, -128, 14, 15, -128, -128, 12,
+                                         13, -128, -128, 10, 11, -128, -128, 8,
+                                         9);
+  const __m128i coeff_hi = _mm_setr_epi8(-128, -128, 6, 7, -128, -128, 4, 5,
+                                         -128, -128, 2, 3, -128, -128, 0, 1);
+#if defined(__AVX2__)
+  const __m256i coeff_shuffle =
+      _mm256_inserti128_si256(_mm256_castsi128_si256(coeff_lo), coeff_hi, 1);
+#endif
+
+  if (scale > 0) {
+    if (scale < (DFRACT_BITS - 1))
+      rnd_val = FIXP_DBL(1 << (scale - 1));
+    else
+      scale = (DFRACT_BITS - 1);
+  } else {
+    scale = fMax(scale, -(DFRACT_BITS - 1));
+  }
+
+  for (j = qmf->no_channels - 1; j >= 0; j--) {
+    FIXP_DBL imag = imagSlot[j]; /* no_channels-1 .. 0 */
+    FIXP_DBL real = realSlot[j]; /* no_channels-1 .. 0 */
+    FIXP_DBL Are = sta[0] + FX_DBL2FX_QSS(fMultDiv2(p_fltm[4], real));
+    __m128i coeff = _mm_unpacklo_epi16(
+        _mm_loadl_epi64((const __m128i *)p_fltm),
+        _mm_loadl_epi64((const __m128i *)(p_flt + 1)));
+    /* imag, real, imag, ... */
+    INT64 input = (INT64)(((UINT64)(UINT)real << 32) | (UINT)imag);
+
+#if defined(__AVX2__)
+    fvStore(sta, fvLoad(sta + 1) +
+                     fMultDiv2(fvMake(_mm256_shuffle_epi8(
+                                   _mm256_broadcastsi128_si256(coeff),
+                                   coeff_shuffle)),
+                               fvMake(_mm256_set1_epi64x(input))));
+#else
+    FIXP_DBLV x = fvMake(_mm_set1_epi64x(input));
+    fvStore(sta, fvLoad(sta + 1) +
+                     fMultDiv2(fvMake(_mm_shuffle_epi8(coeff, coeff_lo)), x));
+    fvStore(sta + 4,
+            fvLoad(sta + 5) +
+                fMultDiv2(fvMake(_mm_shuffle_epi8(coeff, coeff_hi)), x));
+#endif
+    sta[8] = FX_DBL2FX_QSS(fMultDiv2(p_flt[0], imag));
+
+    /* PCM formatting as in qmfSynPrototypeFirSlot_NonSymmetric() of
+     * qmf_pcm.h */
+    if (gain != (FIXP_SGL)(-32768)) /* -1.0f */
+    {
+      Are = fMult(Are, gain);
+    }
+    if (scale > 0) {
+      FDK_ASSERT(Are < (Are + rnd_val)); /* Round-addition must not overflow */
+      timeOut[j * stride] =
+          (INT_PCM_OUT)(SATURATE_RIGHT_SHIFT(Are + rnd_val, scale, sampleBits));
+    } else {
+      timeOut[j * stride] =
+          (INT_PCM_OUT)(SATURATE_LEFT_SHIFT(Are, -scale, sampleBits));
+    }
+
+    p_flt += p_step;
+    p_fltm += p_step;
+    sta += 9; /* = (2*QMF_NO_POLY-1) */
+  }
+}
+
+#endif /* FDK_SIMD_X86 */
@@ -229,6 +229,10 @@ static void adjustTimeSlotHQ(FIXP_DBL *ptrReal, FIXP_DBL *ptrImag,
                              FIXP_SGL smooth_ratio, int noNoiseFlag,
                              int filtBufferNoiseShift);
 
+#if defined(__x86__)
+#include "x86/env_calc_x86.cpp"
+#endif
+
 /*!
   \brief     Map sine flags from bitstream to QMF bands
 
@@ -2380,6 +2384,7 @@ static void calcAvgGain(
   *ptrSumRef_e = sumRef_e;
 }
 
+#if !defined(FUNCTION_adjustTimeSlot_EldGrid)
 static void adjustTimeSlot_EldGrid(
     FIXP_DBL *RESTRICT
         ptrReal, /*!< Subband samples to be adjusted, real part */
@@ -2483,6 +2488,7 @@ static void adjustTimeSlot_EldGrid(
   *ptrHarmIndex = (harmIndex + 1) & 3;
   *ptrPhaseIndex = phaseIndex & (SBR_NF_NO_RANDOM_VAL - 1);
 }
+#endif /* !defined(FUNCTION_adjustTimeSlot_EldGrid) */
 
 /*!
   \brief   Amplify one timeslot of the signal with the calculated gains
@@ -0,0 +1,254 @@
+/* -----------------------------------------------------------------------------
+Software License for The Fraunhofer FDK AAC Codec Library for Android
+
+© Copyright  1995 - 2018 Fraunhofer-Gesellschaft zur Förderung der angewandten
+Forschung e.V. All rights reserved.
+
+ 1.    INTRODUCTION
+The Fraunhofer FDK AAC Codec Library for Android ("FDK AAC Codec") is software
+that implements the MPEG Advanced Audio Coding ("AAC") encoding and decoding
+scheme for digital audio. This FDK AAC Codec software is intended to be used on
+a wide variety of Android devices.
+
+AAC's HE-AAC and HE-AAC v2 versions are regarded as today's most efficient
+general perceptual audio codecs. AAC-ELD is considered the best-performing
+full-bandwidth communications codec by independent studies and is widely
+deployed. AAC has been standardized by ISO and IEC as part of the MPEG
+specifications.
+
+Patent licenses for necessary patent claims for the FDK AAC Codec (including
+those of Fraunhofer) may be obtained through Via Licensing
+(www.vialicensing.com) or through the respective patent owners individually for
+the purpose of encoding or decoding bit streams in products that are compliant
+with the ISO/IEC MPEG audio standards. Please note that most manufacturers of
+Android devices already license these patent claims through Via Licensing or
+directly from the patent owners, and therefore FDK AAC Codec software may
+already be covered under those patent licenses when it is used for those
+licensed purposes only.
+
+Commercially-licensed AAC software libraries, including floating-point versions
+with enhanced sound quality, are also available from Fraunhofer. Users are
+encouraged to check the Fraunhofer website for additional applications
+information and documentation.
+
+2.    COPYRIGHT LICENSE
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted without payment of copyright license fees provided that you
+satisfy the following conditions:
+
+You must retain the complete text of this software license in redistributions of
+the FDK AAC Codec or your modifications thereto in source code form.
+
+You must retain the complete text of this software license in the documentation
+and/or other materials provided with redistributions of the FDK AAC Codec or
+your modifications thereto in binary form. You must make available free of
+charge copies of the complete source code of the FDK AAC Codec and your
+modifications thereto to recipients of copies in binary form.
+
+The name of Fraunhofer may not be used to endorse or promote products derived
+from this library without prior written permission.
+
+You may not charge copyright license fees for anyone to use, copy or distribute
+the FDK AAC Codec software or your modifications thereto.
+
+Your modified versions of the FDK AAC Codec must carry prominent notices stating
+that you changed the software and the date of any change. For modified versions
+of the FDK AAC Codec, the term "Fraunhofer FDK AAC Codec Library for Android"
+must be replaced by the term "Third-Party Modified Version of the Fraunhofer FDK
+AAC Codec Library for Android."
+
+3.    NO PATENT LICENSE
+
+NO EXPRESS OR IMPLIED LICENSES TO ANY PATENT CLAIMS, including without
+limitation the patents of Fraunhofer, ARE GRANTED BY THIS SOFTWARE LICENSE.
+Fraunhofer provides no warranty of patent non-infringement with respect to this
+software.
+
+You may use this FDK AAC Codec software or modifications thereto only for
+purposes that are authorized by appropriate patent licenses.
+
+4.    DISCLAIMER
+
+This FDK AAC Codec software is provided by Fraunhofer on behalf of the copyright
+holders and contributors "AS IS" and WITHOUT ANY EXPRESS OR IMPLIED WARRANTIES,
+including but not limited to the implied warranties of merchantability and
+fitness for a particular purpose. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+CONTRIBUTORS BE LIABLE for any direct, indirect, incidental, special, exemplary,
+or consequential damages, including but not limited to procurement of substitute
+goods or services; loss of use, data, or profits, or business interruption,
+however caused and on any theory of liability, whether in contract, strict
+liability, or tort (including negligence), arising in any way out of the use of
+this software, even if advised of the possibility of such damage.
+
+5.    CONTACT INFORMATION
+
+Fraunhofer Institute for Integrated Circuits IIS
+Attention: Audio and Multimedia Departments - FDK AAC LL
+Am Wolfsmantel 33
+91058 Erlangen, Germany
+
+www.iis.fraunhofer.de/amm
+amm-info@iis.fraunhofer.de
+----------------------------------------------------------------------------- */
+
+
+/**************************** SBR decoder library ******************************
+
+   Author(s):
+
+   Description: envelope adjustment of the ELD grid with SSE4.1 / AVX2
+
+*******************************************************************************/
+
+/*
+  adjustTimeSlot_EldGrid() applies the gains, adds the noise floor and the
+  sines to FDK_SIMD_LANES bands at a time. The harmonics each tone adds to its
+  neighbouring bands are added afterwards, tone by tone: in the C version they
+  make every band depend on the previous one, but they are only sums, so the
+  result is the same.
+*/
+
+#include "x86/simd_x86.h"
+
+#if defined(FDK_SIMD_X86)
+
+#define FUNCTION_adjustTimeSlot_EldGrid
+
+/* FDK_sbrDecoder_sbr_randomPhase[i..][0] of FDK_SIMD_LANES bands, as FIXP_DBL
+ */
+static inline FIXP_DBLV env_calc_x86_random_phase(int i) {
+  FIXP_SGL phase[FDK_SIMD_LANES];
+  int l;
+
+  i &= (SBR_NF_NO_RANDOM_VAL - 1);
+  if (i + FDK_SIMD_LANES <= SBR_NF_NO_RANDOM_VAL) {
+    /* the real parts are the lower halves of the 32 bit words */
+    return fvLoad((const FIXP_DBL *)&FDK_sbrDecoder_sbr_randomPhase[i][0])
+           << FRACT_BITS;
+  }
+  for (l = 0; l < FDK_SIMD_LANES; l++) {
+    phase[l] =
+        FDK_sbrDecoder_sbr_randomPhase[(i + l) & (SBR_NF_NO_RANDOM_VAL - 1)][0];
+  }
+  return fvLoadSgl(phase);
+}
+
+static void adjustTimeSlot_EldGrid(
+    FIXP_DBL *RESTRICT
+        ptrReal, /*!< Subband samples to be adjusted, real part */
+    ENV_CALC_NRGS *nrgs, UCHAR *ptrHarmIndex, /*!< Harmonic index */
+    int lowSubband, /*!< Lowest QMF-channel in the currently used SBR range. */
+    int noSubbands, /*!< Number of QMF subbands */
+    int scale_change,   /*!< Number of bits to shift adjusted samples */
+    int noNoiseFlag,    /*!< Flag to suppress noise addition */
+    int *ptrPhaseIndex, /*!< Start index to random number array */
+    int scale_diff_low) /*!<  */
+
+{
+  int k;
+  int tone_count = 0, tone_bands;
+
+  FIXP_DBL *RESTRICT pGain = nrgs->nrgGain; /*!< Gains of current envelope */
+  FIXP_DBL *RESTRICT pNoiseLevel =
+      nrgs->noiseLevel; /*!< Noise levels of current envelope */
+  FIXP_DBL *RESTRICT pSineLevel = nrgs->nrgSine; /*!< Sine levels */
+
+  int phaseIndex = *ptrPhaseIndex;
+  UCHAR harmIndex = *ptrHarmIndex;
+
+  static const INT harmonicPhase[4] = {1, 0, -1, 0};
+
+  static const FIXP_DBL harmonicPhaseX[4][2] = {
+      {FL2FXCONST_DBL(2.0 * 1.245183154539139e-001),
+       FL2FXCONST_DBL(2.0 * 1.245183154539139e-001)},
+      {FL2FXCONST_DBL(2.0 * -1.123767859325028e-001),
+       FL2FXCONST_DBL(2.0 * 1.123767859325028e-001)},
+      {FL2FXCONST_DBL(2.0 * -1.245183154539139e-001),
+       FL2FXCONST_DBL(2.0 * -1.245183154539139e-001)},
+      {FL2FXCONST_DBL(2.0 * 1.123767859325028e-001),
+       FL2FXCONST_DBL(2.0 * -1.123767859325028e-001)}};
+
+  const FIXP_DBL *p_harmonicPhaseX = &harmonicPhaseX[harmIndex][0];
+  const INT sinePhase = harmonicPhase[harmIndex];
+
+  const FIXP_DBL max_val = MAX_VAL_NRG_HEADROOM >> scale_change;
+  const FIXP_DBL min_val = -max_val;
+  const FIXP_DBLV max_valv = fvSet1(max_val);
+  const FIXP_DBLV min_valv = fvSet1(min_val);
+  const FIXP_DBLV zero = fvSet1((FIXP_DBL)0);
+
+  *(ptrReal - 1) = fAddSaturate(
+      *(ptrReal - 1),
+      SATURATE_SHIFT(fMultDiv2(p_harmonicPhaseX[lowSubband & 1], pSineLevel[0]),
+                     scale_diff_low, DFRACT_BITS));
+
+  /* The harmonics reach the neighbours of the bands up to the 16th tone */
+  for (tone_bands = 0; tone_bands < noSubbands; tone_bands++) {
+    if ((pSineLevel[tone_bands] != FL2FXCONST_DBL(0.0f)) &&
+        (++tone_count == 16)) {
+      tone_bands++;
+      break;
+    }
+  }
+
+  for (k = 0; k + FDK_SIMD_LANES <= noSubbands; k += FDK_SIMD_LANES) {
+    FIXP_DBLV sineLevel = fvLoad(&pSineLevel[k]);
+    FIXP_DBLV signalReal =
+        fMax(fMin(fMultDiv2(fvLoad(&ptrReal[k]), fvLoad(&pGain[k])), max_valv),
+             min_valv)
+        << scale_change;
+
+    if (!noNoiseFlag) {
+      FIXP_DBLV sbNoise = fMult(env_calc_x86_random_phase(phaseIndex + k + 1),
+                                fvLoad(&pNoiseLevel[k]));
+      signalReal += fvSelect(zero, sbNoise, fvEqual(sineLevel, zero));
+    }
+    if (sinePhase > 0) {
+      signalReal += sineLevel;
+    } else if (sinePhase < 0) {
+      signalReal -= sineLevel;
+    }
+    fvStore(&ptrReal[k], signalReal);
+  }
+
+  for (; k < noSubbands; k++) {
+    FIXP_DBL sineLevel = pSineLevel[k];
+    FIXP_DBL signalReal =
+        fMax(fMin(fMultDiv2(ptrReal[k], pGain[k]), max_val), min_val)
+        << scale_change;
+
+    if (((INT)sineLevel | noNoiseFlag) == 0) {
+      signalReal += fMult(
+          FDK_sbrDecoder_sbr_randomPhase
+              [(phaseIndex + k + 1) & (SBR_NF_NO_RANDOM_VAL - 1)][0],
+          pNoiseLevel[k]);
+    }
+    ptrReal[k] = signalReal + sineLevel * sinePhase;
+  }
+
+  /* Harmonics of the tones: the band below gets the part with the phase
+     factor of the tone band, the band above (up to band 62 after the last
+     band) the one of its own. */
+  for (k = 0; k < fMin(tone_bands + 1, noSubbands); k++) {
+    FIXP_DBL sineLevel = pSineLevel[k];
+
+    if (sineLevel == FL2FXCONST_DBL(0.0f)) continue;
+
+    if (k > 0) {
+      ptrReal[k - 1] = fMultAddDiv2(ptrReal[k - 1], sineLevel,
+                                    p_harmonicPhaseX[(lowSubband + k) & 1]);
+    }
+    if ((k + 1 < tone_bands) ||
+        ((k + 1 == noSubbands) && (tone_bands == noSubbands) &&
+         (k + lowSubband + 1 < 63))) {
+      ptrReal[k + 1] = fMultAddDiv2(ptrReal[k + 1], sineLevel,
+                                    p_harmonicPhaseX[(lowSubband + k + 1) & 1]);
+    }
+  }
+
+  *ptrHarmIndex = (harmIndex + 1) & 3;
+  *ptrPhaseIndex = (phaseIndex + noSubbands) & (SBR_NF_NO_RANDOM_VAL - 1);
+}
+
+#endif /* FDK_SIMD_X86 */
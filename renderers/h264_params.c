@@ -0,0 +1,252 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include "h264_params.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "h264-bitstream/h264_stream.h"
+
+/* Room for the VUI fields added to an SPS that has no bitstream restriction yet */
+#define SPS_PATCH_ROOM 32
+
+struct h264_params_s {
+    logger_t *logger;
+    bool patch_vui;
+    h264_stream_t *h;
+
+    /* Last SPS NAL unit (without start code) as received, and as passed on */
+    unsigned char *sps;
+    int sps_len;
+    unsigned char *sps_out;
+    int sps_out_len;
+
+    h264_params_info_t info;
+    bool have_info;
+
+    /* Access unit or avcC with a rewritten SPS */
+    unsigned char *out;
+    int out_size;
+};
+
+h264_params_t *h264_params_init(logger_t *logger, bool patch_vui) {
+    h264_params_t *params;
+    params = calloc(1, sizeof(h264_params_t));
+    if (!params) {
+        return NULL;
+    }
+    params->logger = logger;
+    params->patch_vui = patch_vui;
+    params->h = h264_new();
+    if (!params->h) {
+        free(params);
+        return NULL;
+    }
+    return params;
+}
+
+void h264_params_destroy(h264_params_t *params) {
+    if (params) {
+        h264_free(params->h);
+        free(params->sps);
+        free(params->sps_out);
+        free(params->out);
+        free(params);
+    }
+}
+
+static void h264_params_set_info(h264_params_t *params, sps_t *sps) {
+    int crop_unit_x = 1;
+    int crop_unit_y = 2 - sps->frame_mbs_only_flag;
+    if (sps->chroma_format_idc == 1) {
+        crop_unit_x = 2;
+        crop_unit_y *= 2;
+    } else if (sps->chroma_format_idc == 2) {
+        crop_unit_x = 2;
+    }
+    params->info.width = (sps->pic_width_in_mbs_minus1 + 1) * 16;
+    params->info.height = (2 - sps->frame_mbs_only_flag) * (sps->pic_height_in_map_units_minus1 + 1) * 16;
+    if (sps->frame_cropping_flag) {
+        params->info.width -= crop_unit_x * (sps->frame_crop_left_offset + sps->frame_crop_right_offset);
+        params->info.height -= crop_unit_y * (sps->frame_crop_top_offset + sps->frame_crop_bottom_offset);
+    }
+    params->info.profile_idc = sps->profile_idc;
+    params->info.level_idc = sps->level_idc;
+    params->info.num_ref_frames = sps->num_ref_frames;
+    if (sps->vui_parameters_present_flag && sps->vui.bitstream_restriction_flag) {
+        params->info.num_reorder_frames = sps->vui.num_reorder_frames;
+        params->info.max_dec_frame_buffering = sps->vui.max_dec_frame_buffering;
+    } else {
+        params->info.num_reorder_frames = -1;
+        params->info.max_dec_frame_buffering = -1;
+    }
+    params->have_info = true;
+}
+
+/* Parse a new SPS (NAL unit without start code) and prepare the one to pass on; cached SPS are reused */
+static void h264_params_update_sps(h264_params_t *params, unsigned char *sps, int sps_len) {
+    if (params->sps && params->sps_len == sps_len && memcmp(params->sps, sps, sps_len) == 0) {
+        return;
+    }
+
+    free(params->sps);
+    free(params->sps_out);
+    params->sps = NULL;
+    params->sps_out = NULL;
+    params->sps_len = 0;
+    params->sps_out_len = 0;
+
+    if (read_nal_unit(params->h, sps, sps_len) < 0 || params->h->nal->nal_unit_type != NAL_UNIT_TYPE_SPS) {
+        logger_log(params->logger, LOGGER_ERR, "Could not parse h264 SPS");
+        params->have_info = false;
+        return;
+    }
+    params->sps = malloc(sps_len);
+    if (!params->sps) {
+        params->have_info = false;
+        return;
+    }
+    memcpy(params->sps, sps, sps_len);
+    params->sps_len = sps_len;
+
+    sps_t *parsed = params->h->sps;
+    if (params->patch_vui) {
+        // Without bitstream_restriction_flag, decoders assume the worst case and hold back
+        // frames for reordering. Mirroring streams are not reordered, so signal that.
+        if (!parsed->vui_parameters_present_flag || !parsed->vui.bitstream_restriction_flag) {
+            parsed->vui.motion_vectors_over_pic_boundaries_flag = 1;
+            parsed->vui.max_bytes_per_pic_denom = 2;
+            parsed->vui.max_bits_per_mb_denom = 1;
+            parsed->vui.log2_max_mv_length_horizontal = 16;
+            parsed->vui.log2_max_mv_length_vertical = 16;
+        }
+        parsed->vui_parameters_present_flag = 1;
+        parsed->vui.bitstream_restriction_flag = 1;
+        parsed->vui.num_reorder_frames = 0;
+        /* smallest value allowed, the reference frames still have to be kept */
+        parsed->vui.max_dec_frame_buffering = parsed->num_ref_frames;
+
+        int size = 2 * (sps_len + SPS_PATCH_ROOM);
+        params->sps_out = malloc(size);
+        params->sps_out_len = params->sps_out ? write_nal_unit(params->h, params->sps_out, size) : 0;
+        if (params->sps_out_len > 1) {
+            // write_nal_unit starts with a zero byte (making a 4 byte start code out of a 3 byte one); drop it
+            params->sps_out_len--;
+            memmove(params->sps_out, params->sps_out + 1, params->sps_out_len);
+        } else {
+            logger_log(params->logger, LOGGER_ERR, "Could not rewrite h264 SPS, passing it on unchanged");
+            free(params->sps_out);
+            params->sps_out = NULL;
+            params->sps_out_len = 0;
+        }
+    }
+    h264_params_set_info(params, parsed);
+
+    logger_log(params->logger, LOGGER_DEBUG, "h264 SPS: %dx%d, profile %d level %d, %d reference frames%s",
+               params->info.width, params->info.height, params->info.profile_idc, params->info.level_idc,
+               params->info.num_ref_frames, params->sps_out ? ", rewritten for no reordering" : "");
+}
+
+static unsigned char *h264_params_get_out(h264_params_t *params, int size) {
+    if (size > params->out_size) {
+        free(params->out);
+        params->out = malloc(size);
+        params->out_size = params->out ? size : 0;
+    }
+    return params->out;
+}
+
+unsigned char *h264_params_process(h264_params_t *params, unsigned char *data, int data_len, int *out_len) {
+    int offset = 0;
+    int sps_start = -1, sps_end = -1;
+
+    *out_len = data_len;
+    // The SPS, if any, comes before the first slice
+    while (offset < data_len) {
+        int nal_start, nal_end;
+        int nal_size = find_nal_unit(data + offset, data_len - offset, &nal_start, &nal_end);
+        if (nal_size == 0) break;
+        int nal_type = data[offset + nal_start] & 0x1f;
+        if (nal_type == NAL_UNIT_TYPE_SPS) {
+            sps_start = offset + nal_start;
+            sps_end = offset + nal_end;
+            break;
+        }
+        if (nal_type == NAL_UNIT_TYPE_CODED_SLICE_NON_IDR || nal_type == NAL_UNIT_TYPE_CODED_SLICE_IDR) break;
+        offset += nal_end;
+    }
+    if (sps_start < 0) {
+        return data;
+    }
+
+    h264_params_update_sps(params, data + sps_start, sps_end - sps_start);
+    if (!params->sps_out) {
+        return data;
+    }
+
+    int len = data_len - (sps_end - sps_start) + params->sps_out_len;
+    unsigned char *out = h264_params_get_out(params, len);
+    if (!out) {
+        return data;
+    }
+    memcpy(out, data, sps_start);
+    memcpy(out + sps_start, params->sps_out, params->sps_out_len);
+    memcpy(out + sps_start + params->sps_out_len, data + sps_end, data_len - sps_end);
+    *out_len = len;
+    return out;
+}
+
+unsigned char *h264_params_process_avcc(h264_params_t *params, unsigned char *avcc, int avcc_len, int *out_len) {
+    *out_len = avcc_len;
+    // avcC: version, profile, compatibility, level, length size, SPS count, then the length prefixed SPS
+    if (avcc_len < 8 || (avcc[5] & 0x1f) == 0) {
+        return avcc;
+    }
+    int sps_len = (avcc[6] << 8) | avcc[7];
+    if (8 + sps_len > avcc_len) {
+        return avcc;
+    }
+
+    h264_params_update_sps(params, avcc + 8, sps_len);
+    if (!params->sps_out) {
+        return avcc;
+    }
+
+    int len = avcc_len - sps_len + params->sps_out_len;
+    unsigned char *out = h264_params_get_out(params, len);
+    if (!out) {
+        return avcc;
+    }
+    memcpy(out, avcc, 6);
+    out[6] = (unsigned char) (params->sps_out_len >> 8);
+    out[7] = (unsigned char) (params->sps_out_len & 0xff);
+    memcpy(out + 8, params->sps_out, params->sps_out_len);
+    memcpy(out + 8 + params->sps_out_len, avcc + 8 + sps_len, avcc_len - 8 - sps_len);
+    *out_len = len;
+    return out;
+}
+
+bool h264_params_get_info(h264_params_t *params, h264_params_info_t *info) {
+    if (!params->have_info) {
+        return false;
+    }
+    *info = params->info;
+    return true;
+}
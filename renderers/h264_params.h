@@ -0,0 +1,76 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * H264 parameter set handling shared by the video renderers, using h264-bitstream.
+ * Each new SPS is parsed once and cached; optionally its VUI is rewritten so that
+ * decoders do not hold back frames for reordering (num_reorder_frames = 0).
+ */
+
+#ifndef H264_PARAMS_H
+#define H264_PARAMS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../lib/logger.h"
+
+typedef struct h264_params_info_s {
+    int width;
+    int height;
+    int profile_idc;
+    int level_idc;
+    int num_ref_frames;
+    int num_reorder_frames;        /* as passed on to the decoder; -1 if not signalled */
+    int max_dec_frame_buffering;   /* as passed on to the decoder; -1 if not signalled */
+} h264_params_info_t;
+
+typedef struct h264_params_s h264_params_t;
+
+h264_params_t *h264_params_init(logger_t *logger, bool patch_vui);
+void h264_params_destroy(h264_params_t *params);
+
+/**
+ * Handle the SPS of an Annex-B access unit, if it has one
+ * @return the access unit to pass to the decoder: data itself, or a copy with the rewritten SPS,
+ *         which stays valid until the next call
+ */
+unsigned char *h264_params_process(h264_params_t *params, unsigned char *data, int data_len, int *out_len);
+
+/**
+ * Handle the SPS of an AVCDecoderConfigurationRecord ("avcC")
+ * @return the record to pass to the decoder: avcc itself, or a copy with the rewritten SPS,
+ *         which stays valid until the next call
+ */
+unsigned char *h264_params_process_avcc(h264_params_t *params, unsigned char *avcc, int avcc_len, int *out_len);
+
+/**
+ * Get the parsed values of the last SPS
+ * @return false if no SPS has been parsed yet
+ */
+bool h264_params_get_info(h264_params_t *params, h264_params_info_t *info);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //H264_PARAMS_H
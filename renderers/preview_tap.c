@@ -0,0 +1,358 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include "preview_tap.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/time.h>
+#include <libswscale/swscale.h>
+#include "../lib/threads.h"
+#include "../lib/stream.h"
+
+struct preview_tap_s {
+    logger_t *logger;
+    preview_tap_config_t config;
+    char *path;
+
+    /* decoder, only used by the tap thread */
+    AVCodecContext *ctx;
+    AVFrame *frame;
+    struct SwsContext *sws;
+
+    thread_handle_t thread;
+    mutex_handle_t mutex;
+    cond_handle_t cond;
+
+    /* protected by mutex */
+    bool running;
+    bool busy;                  /* an access unit is pending or being decoded */
+    AVPacket *pending;
+    uint8_t *rgb;               /* newest preview */
+    preview_info_t info;
+
+    /* only used by the caller of preview_tap_submit and preview_tap_configure */
+    int64_t last_submit;
+    uint8_t *avcc;
+    int avcc_len;
+    bool avcc_pending;
+    /* access unit put together from handed-off parts (preview_tap_submit_part) */
+    uint8_t *parts;
+    int parts_len;
+    int parts_size;
+    bool parts_collecting;
+    bool parts_idr;
+
+    /* statistics */
+    int submitted;
+    int failed;
+};
+
+static void preview_tap_release_refbuf(void *opaque, uint8_t *data) {
+    refbuf_unref(opaque);
+}
+
+static void preview_tap_write(preview_tap_t *tap, const uint8_t *rgb, int width, int height) {
+    char *tmp_path = malloc(strlen(tap->path) + 5);
+    if (!tmp_path) {
+        return;
+    }
+    sprintf(tmp_path, "%s.tmp", tap->path);
+    FILE *file = fopen(tmp_path, "wb");
+    if (file) {
+        fprintf(file, "P6\n%d %d\n255\n", width, height);
+        size_t written = fwrite(rgb, width * 3, height, file);
+        fclose(file);
+        // readers only ever see complete images
+        if (written == (size_t) height) {
+            remove(tap->path);
+            rename(tmp_path, tap->path);
+        }
+    }
+    free(tmp_path);
+}
+
+static void preview_tap_decode(preview_tap_t *tap, AVPacket *packet) {
+    int ret = avcodec_send_packet(tap->ctx, packet);
+    if (ret == 0) {
+        // a low delay decoder returns the picture of an IDR frame right away
+        ret = avcodec_receive_frame(tap->ctx, tap->frame);
+    }
+    if (ret < 0) {
+        tap->failed++;
+        logger_log(tap->logger, LOGGER_DEBUG, "Preview: could not decode IDR frame (%d)", ret);
+        return;
+    }
+
+    AVFrame *frame = tap->frame;
+    int width = frame->width;
+    int height = frame->height;
+    if (width > tap->config.max_width) {
+        height = height * tap->config.max_width / width;
+        width = tap->config.max_width;
+    }
+    if (height > tap->config.max_height) {
+        width = width * tap->config.max_height / height;
+        height = tap->config.max_height;
+    }
+    if (width < 1) width = 1;
+    if (height < 1) height = 1;
+
+    tap->sws = sws_getCachedContext(tap->sws, frame->width, frame->height, frame->format,
+                                    width, height, AV_PIX_FMT_RGB24, SWS_BILINEAR, NULL, NULL, NULL);
+    uint8_t *rgb = tap->sws ? malloc(width * height * 3) : NULL;
+    if (!rgb) {
+        av_frame_unref(frame);
+        tap->failed++;
+        return;
+    }
+    int linesize = width * 3;
+    sws_scale(tap->sws, (const uint8_t * const *) frame->data, frame->linesize, 0, frame->height, &rgb, &linesize);
+    uint64_t pts = frame->pts;
+    av_frame_unref(frame);
+
+    MUTEX_LOCK(tap->mutex);
+    uint8_t *old = tap->rgb;
+    tap->rgb = rgb;
+    tap->info.width = width;
+    tap->info.height = height;
+    tap->info.pts = pts;
+    tap->info.seq++;
+    MUTEX_UNLOCK(tap->mutex);
+    free(old);
+
+    // only this thread replaces the preview, rgb stays valid
+    if (tap->path) {
+        preview_tap_write(tap, rgb, width, height);
+    }
+}
+
+static THREAD_RETVAL preview_tap_thread(void *arg) {
+    preview_tap_t *tap = arg;
+    MUTEX_LOCK(tap->mutex);
+    while (1) {
+        while (tap->running && !tap->pending) {
+            pthread_cond_wait(&tap->cond, &tap->mutex);
+        }
+        if (!tap->running) {
+            break;
+        }
+        AVPacket *packet = tap->pending;
+        tap->pending = NULL;
+        MUTEX_UNLOCK(tap->mutex);
+
+        preview_tap_decode(tap, packet);
+        av_packet_free(&packet);
+
+        MUTEX_LOCK(tap->mutex);
+        tap->busy = false;
+    }
+    MUTEX_UNLOCK(tap->mutex);
+    return 0;
+}
+
+preview_tap_t *preview_tap_init(logger_t *logger, preview_tap_config_t const *config) {
+    preview_tap_t *tap = calloc(1, sizeof(preview_tap_t));
+    if (!tap) {
+        return NULL;
+    }
+    tap->logger = logger;
+    tap->config = *config;
+    if (config->path) {
+        tap->path = strdup(config->path);
+    }
+
+    const AVCodec *codec = avcodec_find_decoder(AV_CODEC_ID_H264);
+    tap->ctx = avcodec_alloc_context3(codec);
+    tap->frame = av_frame_alloc();
+    if (!tap->ctx || !tap->frame) {
+        goto error;
+    }
+    // one core and no frame delay: the tap must not compete with the main decoder
+    tap->ctx->thread_count = 1;
+    tap->ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    tap->ctx->flags2 |= AV_CODEC_FLAG2_FAST;
+    tap->ctx->skip_loop_filter = AVDISCARD_ALL;
+    if (avcodec_open2(tap->ctx, codec, NULL) < 0) {
+        goto error;
+    }
+
+    MUTEX_CREATE(tap->mutex);
+    COND_CREATE(tap->cond);
+    tap->running = true;
+    THREAD_CREATE(tap->thread, preview_tap_thread, tap);
+    logger_log(logger, LOGGER_INFO, "Preview: IDR frames every %d ms or more, scaled to fit %dx%d%s%s",
+               config->interval_ms, config->max_width, config->max_height,
+               config->path ? ", written to " : "", config->path ? config->path : "");
+    return tap;
+
+error:
+    logger_log(logger, LOGGER_ERR, "Preview: could not open the H264 decoder");
+    av_frame_free(&tap->frame);
+    avcodec_free_context(&tap->ctx);
+    free(tap->path);
+    free(tap);
+    return NULL;
+}
+
+void preview_tap_destroy(preview_tap_t *tap) {
+    if (!tap) {
+        return;
+    }
+    MUTEX_LOCK(tap->mutex);
+    tap->running = false;
+    COND_SIGNAL(tap->cond);
+    MUTEX_UNLOCK(tap->mutex);
+    THREAD_JOIN(tap->thread);
+
+    logger_log(tap->logger, LOGGER_INFO, "Preview: %d IDR frames submitted, %d could not be decoded", tap->submitted, tap->failed);
+    av_packet_free(&tap->pending);
+    sws_freeContext(tap->sws);
+    av_frame_free(&tap->frame);
+    avcodec_free_context(&tap->ctx);
+    COND_DESTROY(tap->cond);
+    MUTEX_DESTROY(tap->mutex);
+    av_free(tap->avcc);
+    free(tap->parts);
+    free(tap->rgb);
+    free(tap->path);
+    free(tap);
+}
+
+/* true if the interval has passed and the tap thread is idle */
+static bool preview_tap_due(preview_tap_t *tap, int64_t now) {
+    if (tap->submitted && now - tap->last_submit < (int64_t) tap->config.interval_ms * 1000) {
+        return false;
+    }
+    // only the tap thread clears busy, so it cannot be set again in between
+    MUTEX_LOCK(tap->mutex);
+    bool busy = tap->busy;
+    MUTEX_UNLOCK(tap->mutex);
+    return !busy;
+}
+
+void preview_tap_submit(preview_tap_t *tap, refbuf_t *buf, unsigned char *data, int data_len, uint64_t pts) {
+    int64_t now = av_gettime_relative();
+    if (!preview_tap_due(tap, now)) {
+        return;
+    }
+
+    AVPacket *packet = av_packet_alloc();
+    if (!packet) {
+        return;
+    }
+    if (buf && data == buf->data && data_len == buf->size) {
+        packet->buf = av_buffer_create(buf->data, buf->size, preview_tap_release_refbuf, refbuf_ref(buf), AV_BUFFER_FLAG_READONLY);
+        if (!packet->buf) {
+            refbuf_unref(buf);
+            av_packet_free(&packet);
+            return;
+        }
+        packet->data = buf->data;
+        packet->size = buf->size;
+    } else if (av_new_packet(packet, data_len) == 0) {
+        memcpy(packet->data, data, data_len);
+    } else {
+        av_packet_free(&packet);
+        return;
+    }
+    packet->pts = pts;
+    if (tap->avcc_pending) {
+        uint8_t *extradata = av_packet_new_side_data(packet, AV_PKT_DATA_NEW_EXTRADATA, tap->avcc_len);
+        if (extradata) {
+            memcpy(extradata, tap->avcc, tap->avcc_len);
+            tap->avcc_pending = false;
+        }
+    }
+
+    tap->last_submit = now;
+    tap->submitted++;
+    MUTEX_LOCK(tap->mutex);
+    tap->pending = packet;
+    tap->busy = true;
+    COND_SIGNAL(tap->cond);
+    MUTEX_UNLOCK(tap->mutex);
+}
+
+void preview_tap_submit_part(preview_tap_t *tap, unsigned char *data, int data_len, uint64_t pts, int type,
+                             bool first, bool last) {
+    if (first) {
+        // the parts are only collected if a preview is due when the access unit starts
+        tap->parts_len = 0;
+        tap->parts_idr = false;
+        tap->parts_collecting = preview_tap_due(tap, av_gettime_relative());
+    }
+    if (!tap->parts_collecting) {
+        return;
+    }
+    if (type == H264_FRAME_REF || type == H264_FRAME_NONREF) {
+        tap->parts_collecting = false;
+        return;
+    }
+    if (type == H264_FRAME_IDR) {
+        tap->parts_idr = true;
+    }
+    if (tap->parts_len + data_len > tap->parts_size) {
+        int size = 2 * (tap->parts_len + data_len);
+        uint8_t *parts = realloc(tap->parts, size);
+        if (!parts) {
+            tap->parts_collecting = false;
+            return;
+        }
+        tap->parts = parts;
+        tap->parts_size = size;
+    }
+    memcpy(tap->parts + tap->parts_len, data, data_len);
+    tap->parts_len += data_len;
+    if (last) {
+        tap->parts_collecting = false;
+        if (tap->parts_idr && tap->parts_len > 0) {
+            preview_tap_submit(tap, NULL, tap->parts, tap->parts_len, pts);
+        }
+    }
+}
+
+void preview_tap_configure(preview_tap_t *tap, unsigned char *avcc, int avcc_len) {
+    av_free(tap->avcc);
+    tap->avcc = av_malloc(avcc_len);
+    tap->avcc_len = tap->avcc ? avcc_len : 0;
+    if (tap->avcc) {
+        memcpy(tap->avcc, avcc, avcc_len);
+        tap->avcc_pending = true;
+    }
+}
+
+int preview_tap_get(preview_tap_t *tap, unsigned int seq, uint8_t *dst, int dst_size, preview_info_t *info) {
+    int size = 0;
+    MUTEX_LOCK(tap->mutex);
+    *info = tap->info;
+    if (tap->info.seq != seq && tap->rgb) {
+        size = tap->info.width * tap->info.height * 3;
+        if (size <= dst_size) {
+            memcpy(dst, tap->rgb, size);
+        } else {
+            size = -1;
+        }
+    }
+    MUTEX_UNLOCK(tap->mutex);
+    return size;
+}
@@ -0,0 +1,86 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Preview tap: decodes only IDR access units of a mirror session, at most one per interval,
+ * with a separate single-threaded decoder on its own thread, and keeps the newest picture
+ * scaled down to RGB24 for monitoring (thumbnails). All other frames are ignored by the
+ * caller, so the tap costs nothing for them.
+ */
+
+#ifndef PREVIEW_TAP_H
+#define PREVIEW_TAP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../lib/logger.h"
+#include "../lib/refbuf.h"
+
+typedef struct preview_tap_s preview_tap_t;
+
+typedef struct preview_tap_config_s {
+    int max_width;          /* previews are scaled down to fit max_width x max_height */
+    int max_height;
+    int interval_ms;        /* at most one IDR frame is decoded per interval */
+    const char *path;       /* if not NULL, every new preview is also written there as a PPM image */
+} preview_tap_config_t;
+
+typedef struct preview_info_s {
+    int width;              /* RGB24, width * 3 bytes per row */
+    int height;
+    uint64_t pts;
+    unsigned int seq;       /* increases with every new preview, 0 before the first one */
+} preview_info_t;
+
+preview_tap_t *preview_tap_init(logger_t *logger, preview_tap_config_t const *config);
+void preview_tap_destroy(preview_tap_t *tap);
+
+/**
+ * Offer an IDR access unit (Annex-B, or AVCC after preview_tap_configure); it is dropped
+ * right away if the interval has not passed yet or the previous one is still being decoded
+ * @param buf if not NULL, holds data and is referenced instead of copying data
+ */
+void preview_tap_submit(preview_tap_t *tap, refbuf_t *buf, unsigned char *data, int data_len, uint64_t pts);
+
+/**
+ * Offer part of an access unit (NAL handoff, see h264_nal_struct); the parts are put together and
+ * submitted once the access unit is complete, if it is an IDR frame and a preview is due
+ * @param type H264_FRAME_* of the part; collecting stops at the first non-IDR slice
+ */
+void preview_tap_submit_part(preview_tap_t *tap, unsigned char *data, int data_len, uint64_t pts, int type,
+                             bool first, bool last);
+
+/* Set the parameter sets for AVCC input (see the "avccPassthrough" plist item) */
+void preview_tap_configure(preview_tap_t *tap, unsigned char *avcc, int avcc_len);
+
+/**
+ * Copy the newest preview if it is newer than seq
+ * @return its size in bytes, 0 if there is no newer one, or -1 if dst_size is too small (info is set)
+ */
+int preview_tap_get(preview_tap_t *tap, unsigned int seq, uint8_t *dst, int dst_size, preview_info_t *info);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //PREVIEW_TAP_H
@@ -0,0 +1,587 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include "stream_recorder.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <libavformat/avformat.h>
+#include "../lib/threads.h"
+
+#define RECORDER_VIDEO 0
+#define RECORDER_AUDIO 1
+
+/* Timestamps are local times in us, like everywhere in the receiver */
+static const AVRational recorder_time_base = { 1, 1000000 };
+
+/* AudioSpecificConfig / ALAC magic cookie of the formats AirPlay sends, as the SDL renderer uses them */
+static const uint8_t eld_conf[] = { 0xf8, 0xe8, 0x50, 0x00 };
+static const uint8_t aaclc_conf[] = { 0x12, 0x10 };
+static const uint8_t alac_conf[] = {
+    0x00, 0x00, 0x00, 0x24, 'a', 'l', 'a', 'c', 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x01, 0x60, 0x00, 0x10, 0x28, 0x0a, 0x0e, 0x02, 0x00, 0xff,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xac, 0x44
+};
+
+typedef struct recorder_packet_s {
+    AVPacket *packet;
+    int kind;                           /* RECORDER_VIDEO or RECORDER_AUDIO */
+    struct recorder_packet_s *next;
+} recorder_packet_t;
+
+struct stream_recorder_s {
+    logger_t *logger;
+    char *path;
+    int max_queued;
+
+    thread_handle_t thread;
+    mutex_handle_t mutex;
+    cond_handle_t cond;
+
+    /* protected by mutex */
+    bool running;
+    recorder_packet_t *queue;
+    recorder_packet_t *queue_tail;
+    int queued;                         /* bytes of the queued packets */
+    bool video_started;                 /* an IDR frame has been queued */
+    bool video_dropping;                /* the queue was full, video waits for the next IDR frame */
+    uint8_t *avcc;
+    int avcc_len;
+    bool avcc_changed;                  /* new parameter sets, to go in-band with the next IDR frame */
+    int width;
+    int height;
+    bool has_audio_format;
+    audio_renderer_format_t audio_format;
+    int dropped[2];
+
+    /* access unit collected by stream_recorder_video_part */
+    uint8_t *part;
+    int part_len;
+    int part_size;
+
+    /* only used by the writer thread */
+    AVFormatContext *mux;
+    bool failed;
+    int stream_index[2];
+    int64_t start_pts;
+    int64_t last_dts[2];
+    int written[2];
+    int out_of_order;
+};
+
+static void stream_recorder_release_refbuf(void *opaque, uint8_t *data) {
+    refbuf_unref(opaque);
+}
+
+static AVPacket *stream_recorder_packet(refbuf_t *buf, unsigned char *data, int data_len, uint64_t pts) {
+    AVPacket *packet = av_packet_alloc();
+    if (!packet) {
+        return NULL;
+    }
+    if (buf && data == buf->data && data_len == buf->size) {
+        packet->buf = av_buffer_create(buf->data, buf->size, stream_recorder_release_refbuf, refbuf_ref(buf), AV_BUFFER_FLAG_READONLY);
+        if (!packet->buf) {
+            refbuf_unref(buf);
+            av_packet_free(&packet);
+            return NULL;
+        }
+        packet->data = buf->data;
+        packet->size = buf->size;
+    } else if (av_new_packet(packet, data_len) == 0) {
+        memcpy(packet->data, data, data_len);
+    } else {
+        av_packet_free(&packet);
+        return NULL;
+    }
+    packet->pts = pts;
+    packet->dts = pts;
+    return packet;
+}
+
+/* Offset of the next start code (00 00 01) in data at or after offset, or size */
+static int stream_recorder_find_start_code(const uint8_t *data, int size, int offset) {
+    for (; offset + 3 <= size; offset++) {
+        if (data[offset] == 0 && data[offset + 1] == 0 && data[offset + 2] == 1) {
+            return offset;
+        }
+    }
+    return size;
+}
+
+/* true if an access unit (Annex-B, or with 4-byte NAL lengths if avcc) holds an IDR slice */
+static bool stream_recorder_is_idr(const uint8_t *data, int size, bool avcc) {
+    int offset = 0;
+    while (offset + 4 < size) {
+        int nal;
+        if (avcc) {
+            nal = offset + 4;
+            offset = nal + (int) ((uint32_t) data[offset] << 24 | data[offset + 1] << 16 | data[offset + 2] << 8 | data[offset + 3]);
+            if (offset < nal) {
+                break;
+            }
+        } else {
+            nal = stream_recorder_find_start_code(data, size, offset) + 3;
+            offset = nal;
+            if (nal >= size) {
+                break;
+            }
+        }
+        if ((data[nal] & 0x1f) == 5) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Copy the SPS and PPS NAL units of an Annex-B access unit into out (with start codes); returns their size */
+static int stream_recorder_parameter_sets(const uint8_t *data, int size, uint8_t *out) {
+    static const uint8_t start_code[4] = { 0x00, 0x00, 0x00, 0x01 };
+    int len = 0;
+    int start = stream_recorder_find_start_code(data, size, 0);
+    while (start < size) {
+        int nal = start + 3;
+        int next = stream_recorder_find_start_code(data, size, nal);
+        int end = next;
+        // a 4-byte start code leaves a zero byte at the end of the previous NAL unit
+        if (end < size && end > nal && data[end - 1] == 0) {
+            end--;
+        }
+        int nalu_type = nal < size ? data[nal] & 0x1f : 0;
+        if (nalu_type == 7 || nalu_type == 8) {
+            memcpy(out + len, start_code, 4);
+            memcpy(out + len + 4, data + nal, end - nal);
+            len += 4 + end - nal;
+        }
+        start = next;
+    }
+    return len;
+}
+
+/* Copy the SPS and PPS of an avcC record into out as NAL units with 4-byte lengths (at most 2 * avcc_len bytes);
+ * returns their size, 0 if the record is malformed */
+static int stream_recorder_avcc_nals(const uint8_t *avcc, int avcc_len, uint8_t *out) {
+    int len = 0;
+    int offset = 5;
+    // avcC: version, profile, compatibility, level, length size, then the SPS and the PPS, each set with its count
+    for (int set = 0; set < 2; set++) {
+        if (offset >= avcc_len) {
+            return 0;
+        }
+        int count = avcc[offset++] & (set == 0 ? 0x1f : 0xff);
+        for (int i = 0; i < count; i++) {
+            if (offset + 2 > avcc_len) {
+                return 0;
+            }
+            int nal_len = avcc[offset] << 8 | avcc[offset + 1];
+            offset += 2;
+            if (offset + nal_len > avcc_len) {
+                return 0;
+            }
+            out[len] = 0;
+            out[len + 1] = 0;
+            out[len + 2] = (uint8_t) (nal_len >> 8);
+            out[len + 3] = (uint8_t) nal_len;
+            memcpy(out + len + 4, avcc + offset, nal_len);
+            len += 4 + nal_len;
+            offset += nal_len;
+        }
+    }
+    return len;
+}
+
+/* Start the recording with its first IDR frame; returns false if it cannot start with this one */
+static bool stream_recorder_open(stream_recorder_t *recorder, AVPacket *key_packet) {
+    uint8_t *extradata = NULL;
+    int extradata_len = 0;
+
+    MUTEX_LOCK(recorder->mutex);
+    if (recorder->avcc) {
+        extradata_len = recorder->avcc_len;
+        extradata = av_mallocz(extradata_len + AV_INPUT_BUFFER_PADDING_SIZE);
+        if (extradata) memcpy(extradata, recorder->avcc, extradata_len);
+    }
+    int width = recorder->width;
+    int height = recorder->height;
+    bool has_audio = recorder->has_audio_format && recorder->audio_format != AUDIO_FMT_PCM;
+    audio_renderer_format_t audio_format = recorder->audio_format;
+    MUTEX_UNLOCK(recorder->mutex);
+
+    if (!extradata) {
+        // Annex-B: the parameter sets are prepended to the IDR frame
+        extradata = av_mallocz(key_packet->size + 4 * 16 + AV_INPUT_BUFFER_PADDING_SIZE);
+        if (extradata) {
+            extradata_len = stream_recorder_parameter_sets(key_packet->data, key_packet->size, extradata);
+        }
+        if (extradata_len == 0) {
+            av_free(extradata);
+            logger_log(recorder->logger, LOGGER_DEBUG, "Recorder: IDR frame without parameter sets, waiting for the next one");
+            return false;
+        }
+    }
+
+    int ret = avformat_alloc_output_context2(&recorder->mux, NULL, "mp4", recorder->path);
+    if (ret < 0) {
+        av_free(extradata);
+        goto error;
+    }
+    AVStream *video = avformat_new_stream(recorder->mux, NULL);
+    if (!video) {
+        av_free(extradata);
+        ret = AVERROR(ENOMEM);
+        goto error;
+    }
+    video->time_base = recorder_time_base;
+    video->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+    video->codecpar->codec_id = AV_CODEC_ID_H264;
+    video->codecpar->width = width;
+    video->codecpar->height = height;
+    video->codecpar->extradata = extradata;
+    video->codecpar->extradata_size = extradata_len;
+    recorder->stream_index[RECORDER_VIDEO] = video->index;
+
+    if (has_audio) {
+        AVStream *audio = avformat_new_stream(recorder->mux, NULL);
+        if (!audio) {
+            ret = AVERROR(ENOMEM);
+            goto error;
+        }
+        const uint8_t *conf = audio_format == AUDIO_FMT_ALAC ? alac_conf : audio_format == AUDIO_FMT_AAC_LC ? aaclc_conf : eld_conf;
+        int conf_len = audio_format == AUDIO_FMT_ALAC ? sizeof(alac_conf) :
+                       audio_format == AUDIO_FMT_AAC_LC ? sizeof(aaclc_conf) : sizeof(eld_conf);
+        audio->time_base = recorder_time_base;
+        audio->codecpar->codec_type = AVMEDIA_TYPE_AUDIO;
+        audio->codecpar->codec_id = audio_format == AUDIO_FMT_ALAC ? AV_CODEC_ID_ALAC : AV_CODEC_ID_AAC;
+        audio->codecpar->sample_rate = 44100;
+        audio->codecpar->channels = 2;
+        audio->codecpar->channel_layout = AV_CH_LAYOUT_STEREO;
+        audio->codecpar->frame_size = audio_format == AUDIO_FMT_ALAC ? 352 : audio_format == AUDIO_FMT_AAC_LC ? 1024 : 480;
+        audio->codecpar->extradata = av_mallocz(conf_len + AV_INPUT_BUFFER_PADDING_SIZE);
+        if (!audio->codecpar->extradata) {
+            ret = AVERROR(ENOMEM);
+            goto error;
+        }
+        memcpy(audio->codecpar->extradata, conf, conf_len);
+        audio->codecpar->extradata_size = conf_len;
+        recorder->stream_index[RECORDER_AUDIO] = audio->index;
+    }
+
+    ret = avio_open(&recorder->mux->pb, recorder->path, AVIO_FLAG_WRITE);
+    if (ret < 0) {
+        goto error;
+    }
+    // Fragments at every IDR frame, and at least every second: a recording cut short stays playable
+    AVDictionary *options = NULL;
+    av_dict_set(&options, "movflags", "frag_keyframe+empty_moov+default_base_moof", 0);
+    av_dict_set(&options, "frag_duration", "1000000", 0);
+    ret = avformat_write_header(recorder->mux, &options);
+    av_dict_free(&options);
+    if (ret < 0) {
+        goto error;
+    }
+    recorder->start_pts = key_packet->pts;
+    logger_log(recorder->logger, LOGGER_INFO, "Recorder: recording to %s (%dx%d%s)", recorder->path, width, height,
+               has_audio ? ", with audio" : "");
+    return true;
+
+error:
+    logger_log(recorder->logger, LOGGER_ERR, "Recorder: could not start recording to %s (%d)", recorder->path, ret);
+    if (recorder->mux) {
+        avio_closep(&recorder->mux->pb);
+        avformat_free_context(recorder->mux);
+        recorder->mux = NULL;
+    }
+    recorder->failed = true;
+    return false;
+}
+
+static void stream_recorder_write(stream_recorder_t *recorder, int kind, AVPacket *packet) {
+    if (recorder->failed) {
+        return;
+    }
+    if (!recorder->mux) {
+        if (kind != RECORDER_VIDEO || !(packet->flags & AV_PKT_FLAG_KEY) || !stream_recorder_open(recorder, packet)) {
+            return;
+        }
+    }
+    int index = recorder->stream_index[kind];
+    if (index < 0 || packet->pts < recorder->start_pts) {
+        return;
+    }
+    packet->pts -= recorder->start_pts;
+    packet->dts = packet->pts;
+    if (packet->dts <= recorder->last_dts[kind]) {
+        recorder->out_of_order++;
+        return;
+    }
+    recorder->last_dts[kind] = packet->dts;
+    packet->stream_index = index;
+    av_packet_rescale_ts(packet, recorder_time_base, recorder->mux->streams[index]->time_base);
+    int ret = av_interleaved_write_frame(recorder->mux, packet);
+    if (ret < 0) {
+        logger_log(recorder->logger, LOGGER_ERR, "Recorder: could not write to %s (%d), recording stopped", recorder->path, ret);
+        recorder->failed = true;
+        return;
+    }
+    recorder->written[kind]++;
+}
+
+static THREAD_RETVAL stream_recorder_thread(void *arg) {
+    stream_recorder_t *recorder = arg;
+    MUTEX_LOCK(recorder->mutex);
+    while (1) {
+        while (recorder->running && !recorder->queue) {
+            pthread_cond_wait(&recorder->cond, &recorder->mutex);
+        }
+        // what has been queued is written before stopping
+        if (!recorder->queue) {
+            break;
+        }
+        recorder_packet_t *entry = recorder->queue;
+        recorder->queue = entry->next;
+        if (!recorder->queue) {
+            recorder->queue_tail = NULL;
+        }
+        recorder->queued -= entry->packet->size;
+        MUTEX_UNLOCK(recorder->mutex);
+
+        stream_recorder_write(recorder, entry->kind, entry->packet);
+        av_packet_free(&entry->packet);
+        free(entry);
+
+        MUTEX_LOCK(recorder->mutex);
+    }
+    MUTEX_UNLOCK(recorder->mutex);
+    return 0;
+}
+
+stream_recorder_t *stream_recorder_init(logger_t *logger, const char *path, int max_queued) {
+    stream_recorder_t *recorder = calloc(1, sizeof(stream_recorder_t));
+    if (!recorder) {
+        return NULL;
+    }
+    recorder->path = strdup(path);
+    if (!recorder->path) {
+        free(recorder);
+        return NULL;
+    }
+    recorder->logger = logger;
+    recorder->max_queued = max_queued;
+    recorder->stream_index[RECORDER_VIDEO] = -1;
+    recorder->stream_index[RECORDER_AUDIO] = -1;
+    recorder->last_dts[RECORDER_VIDEO] = -1;
+    recorder->last_dts[RECORDER_AUDIO] = -1;
+
+    MUTEX_CREATE(recorder->mutex);
+    COND_CREATE(recorder->cond);
+    recorder->running = true;
+    THREAD_CREATE(recorder->thread, stream_recorder_thread, recorder);
+    return recorder;
+}
+
+void stream_recorder_destroy(stream_recorder_t *recorder) {
+    if (!recorder) {
+        return;
+    }
+    MUTEX_LOCK(recorder->mutex);
+    recorder->running = false;
+    COND_SIGNAL(recorder->cond);
+    MUTEX_UNLOCK(recorder->mutex);
+    THREAD_JOIN(recorder->thread);
+
+    if (recorder->mux) {
+        av_write_trailer(recorder->mux);
+        avio_closep(&recorder->mux->pb);
+        avformat_free_context(recorder->mux);
+        logger_log(recorder->logger, LOGGER_INFO, "Recorder: %d video and %d audio packets written to %s, %d and %d dropped "
+                   "(writer behind), %d out of order", recorder->written[RECORDER_VIDEO], recorder->written[RECORDER_AUDIO],
+                   recorder->path, recorder->dropped[RECORDER_VIDEO], recorder->dropped[RECORDER_AUDIO], recorder->out_of_order);
+    }
+    COND_DESTROY(recorder->cond);
+    MUTEX_DESTROY(recorder->mutex);
+    av_free(recorder->avcc);
+    free(recorder->part);
+    free(recorder->path);
+    free(recorder);
+}
+
+/* Takes over packet; drops it if the queue is full, returning false */
+static bool stream_recorder_queue(stream_recorder_t *recorder, int kind, AVPacket *packet) {
+    recorder_packet_t *entry = malloc(sizeof(recorder_packet_t));
+    if (!entry) {
+        av_packet_free(&packet);
+        return false;
+    }
+    entry->packet = packet;
+    entry->kind = kind;
+    entry->next = NULL;
+
+    MUTEX_LOCK(recorder->mutex);
+    if (recorder->queued + packet->size > recorder->max_queued) {
+        recorder->dropped[kind]++;
+        if (kind == RECORDER_VIDEO) {
+            recorder->video_dropping = true;
+        }
+        MUTEX_UNLOCK(recorder->mutex);
+        av_packet_free(&entry->packet);
+        free(entry);
+        return false;
+    }
+    if (kind == RECORDER_VIDEO && (packet->flags & AV_PKT_FLAG_KEY)) {
+        recorder->video_started = true;
+        recorder->video_dropping = false;
+    }
+    if (recorder->queue_tail) {
+        recorder->queue_tail->next = entry;
+    } else {
+        recorder->queue = entry;
+    }
+    recorder->queue_tail = entry;
+    recorder->queued += packet->size;
+    COND_SIGNAL(recorder->cond);
+    MUTEX_UNLOCK(recorder->mutex);
+    return true;
+}
+
+void stream_recorder_video(stream_recorder_t *recorder, refbuf_t *buf, unsigned char *data, int data_len,
+                           uint64_t pts, bool idr) {
+    if (idr) {
+        // The avcC in the file header is fixed: changed parameter sets go in-band, ahead of the IDR frame they start
+        uint8_t *nals = NULL;
+        int nals_len = 0;
+        MUTEX_LOCK(recorder->mutex);
+        if (recorder->avcc_changed) {
+            recorder->avcc_changed = false;
+            nals = malloc(2 * recorder->avcc_len);
+            if (nals) nals_len = stream_recorder_avcc_nals(recorder->avcc, recorder->avcc_len, nals);
+        }
+        MUTEX_UNLOCK(recorder->mutex);
+        if (nals_len > 0) {
+            bool queued = false;
+            AVPacket *packet = av_packet_alloc();
+            if (packet && av_new_packet(packet, nals_len + data_len) == 0) {
+                memcpy(packet->data, nals, nals_len);
+                memcpy(packet->data + nals_len, data, data_len);
+                packet->pts = pts;
+                packet->dts = pts;
+                packet->flags |= AV_PKT_FLAG_KEY;
+                queued = stream_recorder_queue(recorder, RECORDER_VIDEO, packet);
+            } else {
+                av_packet_free(&packet);
+            }
+            free(nals);
+            if (!queued) {
+                // the next IDR frame has to carry them instead
+                MUTEX_LOCK(recorder->mutex);
+                recorder->avcc_changed = true;
+                MUTEX_UNLOCK(recorder->mutex);
+            }
+            return;
+        }
+        free(nals);
+    } else {
+        // frames before the first IDR frame, or after a dropped one, cannot be decoded
+        MUTEX_LOCK(recorder->mutex);
+        bool wanted = recorder->video_started && !recorder->video_dropping;
+        if (!wanted && recorder->video_started) {
+            recorder->dropped[RECORDER_VIDEO]++;
+        }
+        MUTEX_UNLOCK(recorder->mutex);
+        if (!wanted) {
+            return;
+        }
+    }
+    AVPacket *packet = stream_recorder_packet(buf, data, data_len, pts);
+    if (packet) {
+        if (idr) {
+            packet->flags |= AV_PKT_FLAG_KEY;
+        }
+        stream_recorder_queue(recorder, RECORDER_VIDEO, packet);
+    }
+}
+
+void stream_recorder_video_part(stream_recorder_t *recorder, unsigned char *data, int data_len, uint64_t pts,
+                                bool first, bool last) {
+    if (first) {
+        recorder->part_len = 0;
+    }
+    if (recorder->part_len + data_len > recorder->part_size) {
+        int size = (recorder->part_len + data_len) * 2;
+        uint8_t *part = realloc(recorder->part, size);
+        if (!part) {
+            recorder->part_len = 0;
+            return;
+        }
+        recorder->part = part;
+        recorder->part_size = size;
+    }
+    memcpy(recorder->part + recorder->part_len, data, data_len);
+    recorder->part_len += data_len;
+    if (last && recorder->part_len > 0) {
+        MUTEX_LOCK(recorder->mutex);
+        bool avcc = recorder->avcc != NULL;
+        MUTEX_UNLOCK(recorder->mutex);
+        stream_recorder_video(recorder, NULL, recorder->part, recorder->part_len, pts,
+                              stream_recorder_is_idr(recorder->part, recorder->part_len, avcc));
+        recorder->part_len = 0;
+    }
+}
+
+void stream_recorder_audio(stream_recorder_t *recorder, refbuf_t *buf, unsigned char *data, int data_len, uint64_t pts) {
+    MUTEX_LOCK(recorder->mutex);
+    bool wanted = recorder->video_started;
+    MUTEX_UNLOCK(recorder->mutex);
+    if (!wanted) {
+        return;
+    }
+    AVPacket *packet = stream_recorder_packet(buf, data, data_len, pts);
+    if (packet) {
+        packet->flags |= AV_PKT_FLAG_KEY;
+        stream_recorder_queue(recorder, RECORDER_AUDIO, packet);
+    }
+}
+
+void stream_recorder_configure(stream_recorder_t *recorder, unsigned char *avcc, int avcc_len) {
+    uint8_t *copy = av_mallocz(avcc_len + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (!copy) {
+        return;
+    }
+    memcpy(copy, avcc, avcc_len);
+    MUTEX_LOCK(recorder->mutex);
+    if (recorder->avcc && (recorder->avcc_len != avcc_len || memcmp(recorder->avcc, avcc, avcc_len) != 0)) {
+        recorder->avcc_changed = true;
+    }
+    av_free(recorder->avcc);
+    recorder->avcc = copy;
+    recorder->avcc_len = avcc_len;
+    MUTEX_UNLOCK(recorder->mutex);
+}
+
+void stream_recorder_set_video_size(stream_recorder_t *recorder, int width, int height) {
+    MUTEX_LOCK(recorder->mutex);
+    recorder->width = width;
+    recorder->height = height;
+    MUTEX_UNLOCK(recorder->mutex);
+}
+
+void stream_recorder_set_audio_format(stream_recorder_t *recorder, audio_renderer_format_t format) {
+    MUTEX_LOCK(recorder->mutex);
+    recorder->audio_format = format;
+    recorder->has_audio_format = true;
+    MUTEX_UNLOCK(recorder->mutex);
+}
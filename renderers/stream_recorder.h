@@ -0,0 +1,78 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Stream recorder: muxes the decrypted H264 access units and the compressed audio packets
+ * (AAC-ELD, AAC-LC or ALAC) as they are received into a fragmented MP4 file, without
+ * re-encoding. The network threads only queue references to the payloads; muxing and file
+ * I/O happen on a writer thread. When more than max_queued bytes are waiting, new packets
+ * are dropped (video up to the next IDR frame) instead of holding up the stream.
+ */
+
+#ifndef STREAM_RECORDER_H
+#define STREAM_RECORDER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../lib/logger.h"
+#include "../lib/refbuf.h"
+#include "audio_renderer.h"
+
+typedef struct stream_recorder_s stream_recorder_t;
+
+/* The recording starts with the first IDR frame; max_queued bounds the bytes waiting for the writer */
+stream_recorder_t *stream_recorder_init(logger_t *logger, const char *path, int max_queued);
+
+/* Writes what is still queued and finishes the file */
+void stream_recorder_destroy(stream_recorder_t *recorder);
+
+/**
+ * Queue a video access unit
+ * @param buf if not NULL, holds data and is referenced instead of copying data
+ * @param pts local time (us), as in h264_decode_struct
+ * @param idr true for IDR frames; in Annex-B format these must carry SPS and PPS to start the recording
+ */
+void stream_recorder_video(stream_recorder_t *recorder, refbuf_t *buf, unsigned char *data, int data_len,
+                           uint64_t pts, bool idr);
+
+/* Queue a video access unit that is handed off in parts (see h264_nal_struct); parts are collected until the last */
+void stream_recorder_video_part(stream_recorder_t *recorder, unsigned char *data, int data_len, uint64_t pts,
+                                bool first, bool last);
+
+/* Set the parameter sets for AVCC input (see the "avccPassthrough" plist item) */
+void stream_recorder_configure(stream_recorder_t *recorder, unsigned char *avcc, int avcc_len);
+
+/* Size of the video, as announced by the client */
+void stream_recorder_set_video_size(stream_recorder_t *recorder, int width, int height);
+
+/* Audio packets are only recorded if the format is set before the recording starts */
+void stream_recorder_set_audio_format(stream_recorder_t *recorder, audio_renderer_format_t format);
+
+/* Queue an audio packet; pts is the local time (us), as ntp_time in audio_decode_struct */
+void stream_recorder_audio(stream_recorder_t *recorder, refbuf_t *buf, unsigned char *data, int data_len, uint64_t pts);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //STREAM_RECORDER_H
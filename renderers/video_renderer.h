@@ -34,6 +34,9 @@ extern "C" {
 #include <stdbool.h>
 #include "../lib/logger.h"
 #include "../lib/raop_ntp.h"
+#include "../lib/refbuf.h"
+#include "../lib/metrics.h"
+#include "../lib/stream.h"
 
 typedef enum background_mode_e {
     BACKGROUND_MODE_ON,   // Always show background
@@ -55,17 +58,38 @@ typedef enum flip_mode_e {
     FLIP_BOTH
 } flip_mode_t;
 
+/* Decoder settings, for renderers that decode in software (ffmpeg) */
+typedef enum decode_profile_e {
+    DECODE_PROFILE_LOWEST_LATENCY,  // slice threads, low delay
+    DECODE_PROFILE_THROUGHPUT,      // frame threads (one frame of delay per thread)
+    DECODE_PROFILE_WEAK_CPU         // slice threads, low delay, no deblocking
+} decode_profile_t;
+
 typedef struct video_renderer_config_s {
     background_mode_t background_mode;
     bool low_latency;
     int rotation;
     flip_mode_t flip;
+    decode_profile_t decode_profile;
+    decode_profile_t decode_profile_large;   // for videos of decode_switch_height lines or more
+    int decode_switch_height;                // 0: decode_profile for all sizes; switched when the resolution changes
+    int session;    // id of the session (connection) the renderer is created for, 0 for the one created at start
+    metrics_session_t *metrics;   // decode and present timings of the session go here (may be NULL)
 } video_renderer_config_t;
 
+/* Capability flags of a video renderer */
+#define VIDEO_RENDERER_CAP_AVCC 0x01   /* takes AVCC (length prefixed) NAL units, parameter sets through configure */
+
 typedef struct video_renderer_s video_renderer_t;
 
 typedef struct video_renderer_funcs_s {
     void (*start)(video_renderer_t *renderer);
+    /**
+     * Render an access unit
+     * @param renderer
+     * @param type H264_FRAME_* type of the access unit, as found by the library: an SPS comes only with
+     *        H264_FRAME_IDR (or H264_FRAME_UNKNOWN) data, so other data need not be searched for one
+     */
     void (*render_buffer)(video_renderer_t *renderer, raop_ntp_t *ntp, unsigned char *data, int data_len, uint64_t pts, int type);
     void (*flush)(video_renderer_t *renderer);
     void (*destroy)(video_renderer_t *renderer);
@@ -78,12 +102,45 @@ typedef struct video_renderer_funcs_s {
      *       -1: a connection lost
      */
     void (*update_background)(video_renderer_t *renderer, int type);
+    /**
+     * Render part of an access unit (low-latency mode); NULL if not supported
+     * @param renderer
+     * @param data one or more complete NAL units, in AVCC format (4-byte big-endian length prefixes) if the
+     *        renderer has VIDEO_RENDERER_CAP_AVCC, in Annex-B format otherwise
+     * @param type H264_FRAME_* type of the slices in this part (see h264_nal_struct)
+     * @param first true for the first part of an access unit
+     * @param last true if the access unit is complete after this part
+     */
+    void (*render_partial)(video_renderer_t *renderer, raop_ntp_t *ntp, unsigned char *data, int data_len, uint64_t pts,
+                           int type, bool first, bool last);
+    /**
+     * Set the parameter sets for AVCC input (VIDEO_RENDERER_CAP_AVCC); NULL if not supported
+     * @param renderer
+     * @param avcc AVCDecoderConfigurationRecord holding SPS and PPS
+     */
+    void (*configure)(video_renderer_t *renderer, unsigned char *avcc, int avcc_len);
+    /**
+     * Announce the size of the video the client is about to send; NULL if not used
+     * @param renderer
+     * @param width width of the decoded pictures
+     * @param height height of the decoded pictures
+     */
+    void (*report_size)(video_renderer_t *renderer, int width, int height);
+    /**
+     * Render a refcounted access unit, used instead of render_buffer if not NULL
+     * @param renderer
+     * @param buf the access unit in buf->data, followed by REFBUF_PADDING zero bytes;
+     *        take a reference with refbuf_ref to keep it after returning (e.g. in the decoder)
+     * @param type as for render_buffer
+     */
+    void (*render_refbuf)(video_renderer_t *renderer, raop_ntp_t *ntp, refbuf_t *buf, uint64_t pts, int type);
 } video_renderer_funcs_t;
 
 typedef struct video_renderer_s {
     video_renderer_funcs_t const *funcs;
     logger_t *logger;
     video_renderer_type_t type;
+    int caps;   /* VIDEO_RENDERER_CAP_* flags */
 } video_renderer_t;
 
 video_renderer_t *video_renderer_dummy_init(logger_t *logger, video_renderer_config_t const *config);
@@ -42,6 +42,7 @@ video_renderer_t *video_renderer_dummy_init(logger_t *logger, video_renderer_con
     renderer->base.logger = logger;
     renderer->base.funcs = &video_renderer_dummy_funcs;
     renderer->base.type = VIDEO_RENDERER_DUMMY;
+    renderer->base.caps = VIDEO_RENDERER_CAP_AVCC;
     return &renderer->base;
 }
 
@@ -51,6 +52,13 @@ static void video_renderer_dummy_start(video_renderer_t *renderer) {
 static void video_renderer_dummy_render_buffer(video_renderer_t *renderer, raop_ntp_t *ntp, unsigned char *data, int data_len, uint64_t pts, int type) {
 }
 
+static void video_renderer_dummy_render_partial(video_renderer_t *renderer, raop_ntp_t *ntp, unsigned char *data, int data_len, uint64_t pts,
+                                                int type, bool first, bool last) {
+}
+
+static void video_renderer_dummy_configure(video_renderer_t *renderer, unsigned char *avcc, int avcc_len) {
+}
+
 static void video_renderer_dummy_flush(video_renderer_t *renderer) {
 }
 
@@ -70,4 +78,6 @@ static const video_renderer_funcs_t video_renderer_dummy_funcs = {
     .flush = video_renderer_dummy_flush,
     .destroy = video_renderer_dummy_destroy,
     .update_background = video_renderer_dummy_update_background,
+    .render_partial = video_renderer_dummy_render_partial,
+    .configure = video_renderer_dummy_configure,
 };
@@ -18,6 +18,7 @@
  */
 
 #include "video_renderer.h"
+#include "h264_params.h"
 #include <assert.h>
 #include <gst/gst.h>
 #include <gst/app/gstappsrc.h>
@@ -26,6 +27,8 @@
 typedef struct video_renderer_gstreamer_s {
     video_renderer_t base;
     GstElement *appsrc, *pipeline, *sink;
+    h264_params_t *params;
+    bool avcc;
 } video_renderer_gstreamer_t;
 
 static const video_renderer_funcs_t video_renderer_gstreamer_funcs;
@@ -64,6 +67,9 @@ video_renderer_t *video_renderer_gstreamer_init(logger_t *logger, video_renderer
     renderer->base.logger = logger;
     renderer->base.funcs = &video_renderer_gstreamer_funcs;
     renderer->base.type = VIDEO_RENDERER_GSTREAMER;
+    renderer->base.caps = VIDEO_RENDERER_CAP_AVCC;
+    renderer->params = h264_params_init(logger, true);
+    assert(renderer->params);
 
     assert(check_plugins());
 
@@ -88,6 +94,7 @@ video_renderer_t *video_renderer_gstreamer_init(logger_t *logger, video_renderer
         default:
             printf("Error: Rotation must be +/- 0,90,180,270\n");
             g_string_free(launch, TRUE);
+            h264_params_destroy(renderer->params);
             free(renderer);
             return NULL;
         }
@@ -135,6 +142,11 @@ static void video_renderer_gstreamer_render_buffer(video_renderer_t *renderer, r
 
     assert(data_len != 0);
 
+    if (!r->avcc && (type == H264_FRAME_IDR || type == H264_FRAME_UNKNOWN)) {
+        // Annex-B input may carry a new SPS, which gets the low-latency VUI
+        data = h264_params_process(r->params, data, data_len, &data_len);
+    }
+
     buffer = gst_buffer_new_and_alloc(data_len);
     assert(buffer != NULL);
     GST_BUFFER_DTS(buffer) = (GstClockTime)pts;
@@ -142,6 +154,53 @@ static void video_renderer_gstreamer_render_buffer(video_renderer_t *renderer, r
     gst_app_src_push_buffer(GST_APP_SRC(r->appsrc), buffer);
 }
 
+static void video_renderer_gstreamer_render_refbuf(video_renderer_t *renderer, raop_ntp_t *ntp, refbuf_t *buf, uint64_t pts, int type) {
+    video_renderer_gstreamer_t *r = (video_renderer_gstreamer_t *)renderer;
+    unsigned char *data = buf->data;
+    int data_len = buf->size;
+    GstBuffer *buffer;
+
+    assert(data_len != 0);
+
+    if (!r->avcc && (type == H264_FRAME_IDR || type == H264_FRAME_UNKNOWN)) {
+        data = h264_params_process(r->params, data, data_len, &data_len);
+    }
+
+    if (data == buf->data) {
+        // The pipeline keeps a reference to the received data instead of a copy
+        buffer = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, buf->data, buf->size, 0, buf->size,
+                                             refbuf_ref(buf), (GDestroyNotify) refbuf_unref);
+    } else {
+        // The SPS was rewritten into a new access unit, which has to be copied
+        buffer = gst_buffer_new_and_alloc(data_len);
+        if (buffer) gst_buffer_fill(buffer, 0, data, data_len);
+    }
+    assert(buffer != NULL);
+    GST_BUFFER_DTS(buffer) = (GstClockTime)pts;
+    gst_app_src_push_buffer(GST_APP_SRC(r->appsrc), buffer);
+}
+
+static void video_renderer_gstreamer_configure(video_renderer_t *renderer, unsigned char *avcc, int avcc_len) {
+    video_renderer_gstreamer_t *r = (video_renderer_gstreamer_t *)renderer;
+    GstBuffer *codec_data;
+    GstCaps *caps;
+
+    avcc = h264_params_process_avcc(r->params, avcc, avcc_len, &avcc_len);
+    r->avcc = true;
+
+    // decodebin takes AVCC input directly, with the avcC record as codec_data
+    codec_data = gst_buffer_new_and_alloc(avcc_len);
+    assert(codec_data != NULL);
+    gst_buffer_fill(codec_data, 0, avcc, avcc_len);
+    caps = gst_caps_new_simple("video/x-h264",
+                               "stream-format", G_TYPE_STRING, "avc",
+                               "alignment", G_TYPE_STRING, "au",
+                               "codec_data", GST_TYPE_BUFFER, codec_data, NULL);
+    gst_app_src_set_caps(GST_APP_SRC(r->appsrc), caps);
+    gst_caps_unref(caps);
+    gst_buffer_unref(codec_data);
+}
+
 void video_renderer_gstreamer_flush(video_renderer_t *renderer) {
 
 }
@@ -151,6 +210,7 @@ void video_renderer_gstreamer_destroy(video_renderer_t *renderer) {
     gst_app_src_end_of_stream(GST_APP_SRC(r->appsrc));
     gst_element_set_state(r->pipeline, GST_STATE_NULL);
     gst_object_unref(r->pipeline);
+    h264_params_destroy(r->params);
     if (renderer) {
         free(renderer);
     }
@@ -166,4 +226,6 @@ static const video_renderer_funcs_t video_renderer_gstreamer_funcs = {
     .flush = video_renderer_gstreamer_flush,
     .destroy = video_renderer_gstreamer_destroy,
     .update_background = video_renderer_gstreamer_update_background,
+    .configure = video_renderer_gstreamer_configure,
+    .render_refbuf = video_renderer_gstreamer_render_refbuf,
 };
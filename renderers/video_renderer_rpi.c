@@ -29,7 +29,7 @@
 #include "bcm_host.h"
 #include "ilclient.h"
 #include "../lib/threads.h"
-#include "h264-bitstream/h264_stream.h"
+#include "h264_params.h"
 
 /*
  * H264 renderer using OpenMAX for hardware accelerated decoding
@@ -57,6 +57,8 @@ typedef struct video_renderer_rpi_s {
     COMPONENT_T *components[5];
     TUNNEL_T tunnels[4];
 
+    h264_params_t *params;
+
     uint64_t first_packet_time;
     uint64_t input_frames;
 } video_renderer_rpi_t;
@@ -359,8 +361,10 @@ video_renderer_t *video_renderer_rpi_init(logger_t *logger, video_renderer_confi
 
     renderer->first_packet_time = 0;
     renderer->input_frames = 0;
+    renderer->params = h264_params_init(logger, true);
 
-    if (video_renderer_rpi_init_decoder(renderer) != 1) {
+    if (!renderer->params || video_renderer_rpi_init_decoder(renderer) != 1) {
+        h264_params_destroy(renderer->params);
         free(renderer);
         renderer = NULL;
     }
@@ -393,40 +397,11 @@ static void video_renderer_rpi_render_buffer(video_renderer_t *renderer, raop_nt
     logger_log(renderer->logger, LOGGER_DEBUG, "Got h264 data of %d bytes", data_len);
     r->input_frames++;
 
-    uint8_t *modified_data = NULL;
-
-    if (type == 0) {
+    if (type == H264_FRAME_IDR || type == H264_FRAME_UNKNOWN) {
         // This reduces the Raspberry Pi H264 decode pipeline delay from about 11 to 6 frames for RPiPlay.
         // Described at https://www.raspberrypi.org/forums/viewtopic.php?t=41053
-        logger_log(renderer->logger, LOGGER_DEBUG, "Injecting max_dec_frame_buffering");
-        int sps_start, sps_end;
-        int sps_size = find_nal_unit(data, data_len, &sps_start, &sps_end);
-        if (sps_size > 0) {
-            const int sps_wiggle_room = 12;
-            const unsigned char nal_marker[] = { 0x0, 0x0, 0x0, 0x1 };
-            int modified_data_len = data_len + sps_wiggle_room + sizeof(nal_marker);
-            modified_data = malloc(modified_data_len);
-
-            h264_stream_t *h = h264_new();
-            h->nal->nal_unit_type = NAL_UNIT_TYPE_SPS;
-            h->sps->vui.bitstream_restriction_flag = 1;
-            h->sps->vui.max_dec_frame_buffering = 4;
-
-            int new_sps_size = write_nal_unit(h, modified_data + sps_start, sps_wiggle_room);
-            if (new_sps_size > 0 && new_sps_size <= sps_wiggle_room) {
-                memcpy(modified_data, data, sps_start);
-                memcpy(modified_data + sps_start + new_sps_size, nal_marker, sizeof(nal_marker));
-                memcpy(modified_data + sps_start + new_sps_size + sizeof(nal_marker), data + sps_start, data_len - sps_start);
-                data = modified_data;
-                data_len = data_len + new_sps_size + sizeof(nal_marker);
-            } else {
-                free(modified_data);
-                modified_data = NULL;
-            }
-            h264_free(h);
-        } else {
-            logger_log(renderer->logger, LOGGER_ERR, "Could not find sps boundaries");
-        }
+        // The SPS gets a bitstream restriction with the smallest max_dec_frame_buffering and no reordering.
+        data = h264_params_process(r->params, data, data_len, &data_len);
     }
 
     if (ilclient_remove_event(r->video_decoder, OMX_EventPortSettingsChanged, 131, 0, 0, 1) == 0) {
@@ -488,11 +463,6 @@ static void video_renderer_rpi_render_buffer(video_renderer_t *renderer, raop_nt
 
     }
 
-    if (modified_data) {
-        // We overwrote the data buffer to inject the max_dec_frame_buffering before,
-        // so we need to free the data buffer here
-        free(modified_data);
-    }
 }
 
 static void video_renderer_rpi_flush(video_renderer_t *renderer) {
@@ -522,6 +492,7 @@ static void video_renderer_rpi_destroy(video_renderer_t *renderer) {
         // Only flush if data was sent through, gets stuck otherwise
         if (r->first_packet_time) video_renderer_rpi_flush(renderer);
         video_renderer_rpi_destroy_decoder(r);
+        h264_params_destroy(r->params);
         free(renderer);
     }
 }
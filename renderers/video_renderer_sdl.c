@@ -19,6 +19,10 @@
 
 
 #include "video_renderer.h"
+#include "h264_params.h"
+#include "decode_profile.h"
+#include "decode_control.h"
+#include "../lib/trace.h"
 
 #include <stdlib.h>
 #include <assert.h>
@@ -28,22 +32,107 @@
 #include <SDL.h>
 #include <libavcodec/avcodec.h>
 #include <libavutil/time.h>
+#include <libavutil/imgutils.h>
 #ifndef WIN32
 #include <unistd.h>
 #endif
+/* Triple buffer handing decoded frames from the decode thread to the render thread without locks
+ * or copies: the decode thread fills the back frame and swaps it with the middle one, the render
+ * thread swaps the middle frame with its front frame when a new one has arrived. A frame that is
+ * replaced in the middle before the render thread took it has been superseded. */
+#define MAILBOX_FRESH 0x4
+
+/* ms the render thread sleeps without events, and the largest pts lead (us) it waits for */
+#define SDL_RENDER_IDLE_WAIT 500
+#define SDL_RENDER_MAX_EARLY 200000
+typedef struct frame_mailbox_s {
+	AVFrame* frames[3];
+	SDL_atomic_t middle;	/* index of the middle frame, | MAILBOX_FRESH until it is taken */
+	int back;				/* only used by the decode thread */
+	int front;				/* only used by the render thread */
+} frame_mailbox_t;
+
+/* what happened to a window and its render thread since the render thread last looked */
+typedef struct sdl_event_state_s {
+	bool woken;		/* a frame was decoded, the window changed, or the renderer is ending */
+	bool redraw;
+	int width;		/* new size of the window, or 0 */
+	int height;
+} sdl_event_state_t;
+
+/* window requests of a render thread to the event thread */
+#define SDL_WINDOW_REQUEST_CREATE 1
+#define SDL_WINDOW_REQUEST_DESTROY 2
+
+typedef struct packet_node_s {
+	AVPacket* packet;
+	int profile;	/* decode profile to reopen the decoder with before this packet, or -1 */
+	bool resume;	/* holds an IDR slice or parameter sets: decoding can start over here */
+	struct packet_node_s* next;
+} packet_node_t;
+
 typedef struct video_renderer_sdl_s {
     video_renderer_t base;
 	AVCodecContext* h264ctx;
 	SDL_Thread* renderthread;
-	AVFrame* renderframe;
+	SDL_Thread* decodethread;
+	frame_mailbox_t mailbox;
 	bool endrender;
+	bool enddecode;
+	/* packets waiting for the decode thread, protected by mutex */
+	packet_node_t* packets;
+	packet_node_t* packets_tail;
+	int packets_queued;
+	SDL_cond* packetcond;
 	SDL_mutex* mutex;
+	SDL_atomic_t frames_decoded;
+	SDL_atomic_t frames_shown;
+	SDL_atomic_t frames_superseded;
+	/* size announced by report_size (width << 16 | height), textures are created for it in advance */
+	SDL_atomic_t reported_size;
+	/* shared with the event thread, under sdl_events.mutex */
+	SDL_cond* eventcond;
+	SDL_Window* window;
+	Uint32 windowid;
+	int windowrequest;		/* SDL_WINDOW_REQUEST_*, 0 once the event thread has done it */
+	sdl_event_state_t events;
+	struct video_renderer_sdl_s* nextwindow;
 	video_renderer_config_t config;
+	uint8_t* avcc;
+	int avcc_len;
+	bool avcc_pending;
+	h264_params_t* params;
+	/* profile the decoder runs with (decode thread), and the one for the queued packets (network thread) */
+	decode_profile_t profile;
+	decode_profile_t queued_profile;
+	int profile_switch;
+	/* degrades decoding while the decode thread is behind, and limits the packet queue (under mutex) */
+	decode_control_t control;
+	/* after a decoding error, packets are skipped up to the next resume point (decode thread) */
+	bool skip_to_idr;
+	int decode_errors;
+	int packets_skipped;
 } video_renderer_sdl_t;
 
 static const video_renderer_funcs_t video_renderer_sdl_funcs;
 
-int video_render_sdl_init_decoder(video_renderer_sdl_t* render)
+/* One event thread creates, pumps and destroys the windows of all renderer instances (one per session):
+ * on Windows the messages of a window only reach the thread that created it. It hands the events of
+ * a window to the render thread of that window; decoded frames wake a render thread directly. */
+static struct {
+	SDL_SpinLock initlock;	/* for creating the mutexes */
+	SDL_mutex* usersmutex;	/* starting and stopping the thread */
+	int users;
+	SDL_Thread* thread;
+	SDL_mutex* mutex;		/* the rest, and the window state of the renderers */
+	Uint32 request_event;	/* wakes the thread for window requests, 0 until registered */
+	bool end;
+	video_renderer_sdl_t* renderers;	/* with a window or a window request, linked by nextwindow */
+} sdl_events;
+
+static void video_renderer_sdl_wake(video_renderer_sdl_t* renderer);
+
+int video_render_sdl_init_decoder(video_renderer_sdl_t* render, decode_profile_t profile)
 {
 	int ret = 0;
 	const AVCodec* codec = avcodec_find_decoder(AV_CODEC_ID_H264);
@@ -54,12 +143,163 @@ int video_render_sdl_init_decoder(video_renderer_sdl_t* render)
 		ret = AVERROR(ENOMEM);
 	}
 	else {
+		/* in low-latency mode access units may arrive in parts (render_partial) */
+		decode_profile_apply(render->h264ctx, profile, render->config.low_latency);
+		/* frames decoded against missing references are not shown: no smeared pictures until the next key frame */
+		render->h264ctx->flags &= ~AV_CODEC_FLAG_OUTPUT_CORRUPT;
 		ret = avcodec_open2(render->h264ctx, codec, NULL);
+		decode_control_attach(&render->control, render->h264ctx);
+		render->profile = profile;
+		logger_log(render->base.logger, LOGGER_INFO, "SDL video: decoding with the %s profile, %d threads%s",
+			decode_profile_name(profile), render->h264ctx->thread_count,
+			profile == DECODE_PROFILE_THROUGHPUT && render->config.low_latency ? " (no frame threads in low-latency mode)" : "");
 	}
-	render->renderframe = av_frame_alloc();
 
 	return ret;
 }
+
+static void frame_mailbox_init(frame_mailbox_t* mailbox)
+{
+	for (int i = 0; i < 3; i++)
+	{
+		mailbox->frames[i] = av_frame_alloc();
+	}
+	mailbox->back = 0;
+	SDL_AtomicSet(&mailbox->middle, 1);
+	mailbox->front = 2;
+}
+
+static void frame_mailbox_destroy(frame_mailbox_t* mailbox)
+{
+	for (int i = 0; i < 3; i++)
+	{
+		av_frame_free(&mailbox->frames[i]);
+	}
+}
+
+/* decode thread: takes over the reference of frame; returns true if the previous frame was never taken */
+static bool frame_mailbox_publish(frame_mailbox_t* mailbox, AVFrame* frame)
+{
+	AVFrame* back = mailbox->frames[mailbox->back];
+	av_frame_unref(back);
+	av_frame_move_ref(back, frame);
+	int old = SDL_AtomicSet(&mailbox->middle, mailbox->back | MAILBOX_FRESH);
+	mailbox->back = old & 0x3;
+	return (old & MAILBOX_FRESH) != 0;
+}
+
+/* render thread: returns the newest frame, which stays valid until the next call, or NULL if there is none */
+static AVFrame* frame_mailbox_take(frame_mailbox_t* mailbox)
+{
+	if (!(SDL_AtomicGet(&mailbox->middle) & MAILBOX_FRESH))
+	{
+		return NULL;
+	}
+	int old = SDL_AtomicSet(&mailbox->middle, mailbox->front);
+	mailbox->front = old & 0x3;
+	return mailbox->frames[mailbox->front];
+}
+
+int SDLCALL video_renderer_sdl_decode_thread(void *data)
+{
+	video_renderer_sdl_t* renderer = data;
+	AVFrame* frame = av_frame_alloc();
+	char name[32];
+	snprintf(name, sizeof(name), "SDL decode %d", renderer->config.session);
+	trace_set_thread_name(name);
+	while (1)
+	{
+		SDL_LockMutex(renderer->mutex);
+		while (!renderer->packets && !renderer->enddecode)
+		{
+			SDL_CondWait(renderer->packetcond, renderer->mutex);
+		}
+		if (renderer->enddecode)
+		{
+			SDL_UnlockMutex(renderer->mutex);
+			break;
+		}
+		packet_node_t* node = renderer->packets;
+		renderer->packets = node->next;
+		if (!renderer->packets)
+		{
+			renderer->packets_tail = NULL;
+		}
+		int queued = --renderer->packets_queued;
+		SDL_UnlockMutex(renderer->mutex);
+		metrics_set(renderer->config.metrics, METRICS_VIDEO_QUEUE, queued);
+
+		if (node->profile >= 0 && node->profile != renderer->profile)
+		{
+			/* new video size: drain the old decoder, its frames were complete */
+			avcodec_send_packet(renderer->h264ctx, NULL);
+			while (avcodec_receive_frame(renderer->h264ctx, frame) == 0)
+			{
+				SDL_AtomicAdd(&renderer->frames_decoded, 1);
+				if (frame_mailbox_publish(&renderer->mailbox, frame))
+				{
+					SDL_AtomicAdd(&renderer->frames_superseded, 1);
+				}
+				else
+				{
+					video_renderer_sdl_wake(renderer);
+				}
+			}
+			avcodec_free_context(&renderer->h264ctx);
+			video_render_sdl_init_decoder(renderer, node->profile);
+		}
+		if (renderer->skip_to_idr)
+		{
+			if (!node->resume)
+			{
+				/* would only be decoded against broken references */
+				renderer->packets_skipped++;
+				av_packet_free(&node->packet);
+				free(node);
+				continue;
+			}
+			renderer->skip_to_idr = false;
+			logger_log(renderer->base.logger, LOGGER_INFO, "SDL video: decoding resumes at a key frame");
+		}
+		int64_t pts = node->packet->pts;
+		bool key_frame = false;
+		uint64_t decodestart = metrics_stage_begin(renderer->config.metrics);
+		uint64_t spanstart = TRACE_BEGIN();
+		int ret = avcodec_send_packet(renderer->h264ctx, node->packet);
+		av_packet_free(&node->packet);
+		free(node);
+		if (ret < 0 && ret != AVERROR(EAGAIN))
+		{
+			renderer->decode_errors++;
+			renderer->skip_to_idr = true;
+			logger_log(renderer->base.logger, LOGGER_WARNING, "SDL video: decoding error %d, skipping packets until the next key frame", ret);
+		}
+		while (avcodec_receive_frame(renderer->h264ctx, frame) == 0)
+		{
+			key_frame |= frame->key_frame;
+			SDL_AtomicAdd(&renderer->frames_decoded, 1);
+			if (frame_mailbox_publish(&renderer->mailbox, frame))
+			{
+				/* the render thread has not taken the previous frame, so it has been woken up already */
+				SDL_AtomicAdd(&renderer->frames_superseded, 1);
+			}
+			else
+			{
+				video_renderer_sdl_wake(renderer);
+			}
+		}
+		metrics_stage_end(renderer->config.metrics, METRICS_VIDEO_DECODE, decodestart);
+		TRACE_END("video", "decode", pts, spanstart);
+		if (pts != AV_NOPTS_VALUE)
+		{
+			/* how far decoding is behind the stream */
+			uint64_t now = raop_ntp_get_local_time(NULL);
+			decode_control_update(&renderer->control, renderer->h264ctx, (int64_t) now - pts, key_frame, now);
+		}
+	}
+	av_frame_free(&frame);
+	return 0;
+}
 static SDL_Rect calplay(int left,int top, int width, int height, int picwidth, int picheight)
 {
 	SDL_Rect rect;
@@ -81,6 +321,252 @@ static SDL_Rect calplay(int left,int top, int width, int height, int picwidth, i
 	return rect;
 }
 
+/* texture format the decoded frames can be copied into directly, or SDL_PIXELFORMAT_UNKNOWN */
+static Uint32 video_renderer_sdl_texture_format(int format)
+{
+	switch (format)
+	{
+		case AV_PIX_FMT_YUV420P:
+		case AV_PIX_FMT_YUVJ420P:
+			return SDL_PIXELFORMAT_IYUV;
+		case AV_PIX_FMT_NV12:
+			return SDL_PIXELFORMAT_NV12;
+		default:
+			return SDL_PIXELFORMAT_UNKNOWN;
+	}
+}
+
+/* copy the planes of frame straight into the locked streaming texture; returns the number of planes copied, or -1 */
+static int video_renderer_sdl_upload(SDL_Texture* texture, Uint32 format, AVFrame* frame)
+{
+	void* pixels;
+	int pitch;
+	if (SDL_LockTexture(texture, NULL, &pixels, &pitch) != 0)
+	{
+		return -1;
+	}
+	int chromaheight = (frame->height + 1) / 2;
+	uint8_t* dst = pixels;
+	av_image_copy_plane(dst, pitch, frame->data[0], frame->linesize[0], frame->width, frame->height);
+	dst += pitch * frame->height;
+	int copies = 1;
+	if (format == SDL_PIXELFORMAT_NV12)
+	{
+		/* interleaved UV plane, same pitch as luma */
+		av_image_copy_plane(dst, 2 * ((pitch + 1) / 2), frame->data[1], frame->linesize[1], 2 * ((frame->width + 1) / 2), chromaheight);
+		copies++;
+	}
+	else
+	{
+		/* U then V, each at half the luma pitch */
+		int chromapitch = (pitch + 1) / 2;
+		av_image_copy_plane(dst, chromapitch, frame->data[1], frame->linesize[1], (frame->width + 1) / 2, chromaheight);
+		dst += chromapitch * chromaheight;
+		av_image_copy_plane(dst, chromapitch, frame->data[2], frame->linesize[2], (frame->width + 1) / 2, chromaheight);
+		copies += 2;
+	}
+	SDL_UnlockTexture(texture);
+	return copies;
+}
+
+/* for the event thread, under sdl_events.mutex: hands a window event to the render thread of its window */
+static void video_renderer_sdl_dispatch_event(SDL_Event* event)
+{
+	for (video_renderer_sdl_t* r = sdl_events.renderers; r; r = r->nextwindow)
+	{
+		if (!r->window || r->windowid != event->window.windowID)
+		{
+			continue;
+		}
+		switch (event->window.event)
+		{
+			case SDL_WINDOWEVENT_SIZE_CHANGED:
+				r->events.width = event->window.data1;
+				r->events.height = event->window.data2;
+			case SDL_WINDOWEVENT_EXPOSED:
+				r->events.redraw = true;
+				break;
+			default:
+				break;
+		}
+		r->events.woken = true;
+		SDL_CondSignal(r->eventcond);
+		return;
+	}
+}
+
+/* for the event thread, under sdl_events.mutex */
+static void video_renderer_sdl_handle_requests(void)
+{
+	video_renderer_sdl_t** link = &sdl_events.renderers;
+	while (*link)
+	{
+		video_renderer_sdl_t* r = *link;
+		if (r->windowrequest == SDL_WINDOW_REQUEST_CREATE)
+		{
+			char title[32];
+			if (r->config.session > 0)
+			{
+				snprintf(title, sizeof(title), "RPiPlay - session %d", r->config.session);
+			}
+			else
+			{
+				snprintf(title, sizeof(title), "RPiPlay");
+			}
+			r->window = SDL_CreateWindow(title, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 1280, 720, SDL_WINDOW_RESIZABLE);
+			r->windowid = r->window ? SDL_GetWindowID(r->window) : 0;
+		}
+		else if (r->windowrequest == SDL_WINDOW_REQUEST_DESTROY)
+		{
+			if (r->window)
+			{
+				SDL_DestroyWindow(r->window);
+			}
+			r->window = NULL;
+			*link = r->nextwindow;
+		}
+		if (r->windowrequest)
+		{
+			r->windowrequest = 0;
+			SDL_CondSignal(r->eventcond);
+		}
+		if (*link == r)
+		{
+			link = &r->nextwindow;
+		}
+	}
+}
+
+int SDLCALL video_renderer_sdl_event_thread(void *data)
+{
+	trace_set_thread_name("SDL events");
+	SDL_Init(SDL_INIT_VIDEO);
+	SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
+	SDL_LockMutex(sdl_events.mutex);
+	if (!sdl_events.request_event)
+	{
+		sdl_events.request_event = SDL_RegisterEvents(1);
+	}
+	while (1)
+	{
+		video_renderer_sdl_handle_requests();
+		if (sdl_events.end)
+		{
+			break;
+		}
+		SDL_UnlockMutex(sdl_events.mutex);
+		/* pumps the messages of all windows; sleeps until there is an event or a request */
+		SDL_Event event;
+		int received = SDL_WaitEventTimeout(&event, SDL_RENDER_IDLE_WAIT);
+		SDL_LockMutex(sdl_events.mutex);
+		/* input and application events are not used */
+		if (received && event.type == SDL_WINDOWEVENT)
+		{
+			video_renderer_sdl_dispatch_event(&event);
+		}
+	}
+	SDL_UnlockMutex(sdl_events.mutex);
+	SDL_QuitSubSystem(SDL_INIT_VIDEO);
+	return 0;
+}
+
+/* under sdl_events.mutex */
+static void video_renderer_sdl_wake_event_thread(void)
+{
+	if (sdl_events.request_event && sdl_events.request_event != (Uint32) -1)
+	{
+		SDL_Event event;
+		SDL_zero(event);
+		event.type = sdl_events.request_event;
+		SDL_PushEvent(&event);
+	}
+}
+
+/* the first renderer instance starts the event thread; returns false if it could not */
+static bool video_renderer_sdl_events_start(void)
+{
+	SDL_AtomicLock(&sdl_events.initlock);
+	if (!sdl_events.mutex)
+	{
+		sdl_events.mutex = SDL_CreateMutex();
+		sdl_events.usersmutex = SDL_CreateMutex();
+	}
+	SDL_AtomicUnlock(&sdl_events.initlock);
+	if (!sdl_events.mutex || !sdl_events.usersmutex)
+	{
+		return false;
+	}
+	SDL_LockMutex(sdl_events.usersmutex);
+	if (sdl_events.users == 0)
+	{
+		sdl_events.end = false;
+		sdl_events.thread = SDL_CreateThread(video_renderer_sdl_event_thread, "sdl_eventthread", NULL);
+	}
+	bool started = sdl_events.thread != NULL;
+	if (started)
+	{
+		sdl_events.users++;
+	}
+	SDL_UnlockMutex(sdl_events.usersmutex);
+	return started;
+}
+
+/* the last renderer instance stops the event thread */
+static void video_renderer_sdl_events_stop(void)
+{
+	SDL_LockMutex(sdl_events.usersmutex);
+	if (--sdl_events.users == 0)
+	{
+		SDL_LockMutex(sdl_events.mutex);
+		sdl_events.end = true;
+		video_renderer_sdl_wake_event_thread();
+		SDL_UnlockMutex(sdl_events.mutex);
+		SDL_WaitThread(sdl_events.thread, NULL);
+		sdl_events.thread = NULL;
+	}
+	SDL_UnlockMutex(sdl_events.usersmutex);
+}
+
+/* render thread: has the event thread create or destroy the window of this instance, and waits until it has */
+static void video_renderer_sdl_request_window(video_renderer_sdl_t* renderer, int request)
+{
+	SDL_LockMutex(sdl_events.mutex);
+	renderer->windowrequest = request;
+	if (request == SDL_WINDOW_REQUEST_CREATE)
+	{
+		renderer->nextwindow = sdl_events.renderers;
+		sdl_events.renderers = renderer;
+	}
+	video_renderer_sdl_wake_event_thread();
+	while (renderer->windowrequest)
+	{
+		SDL_CondWait(renderer->eventcond, sdl_events.mutex);
+	}
+	SDL_UnlockMutex(sdl_events.mutex);
+}
+
+/* wakes the render thread, e.g. for a new frame */
+static void video_renderer_sdl_wake(video_renderer_sdl_t* renderer)
+{
+	SDL_LockMutex(sdl_events.mutex);
+	renderer->events.woken = true;
+	SDL_CondSignal(renderer->eventcond);
+	SDL_UnlockMutex(sdl_events.mutex);
+}
+
+/* render thread: waits up to waittime ms to be woken, and takes what happened since the last call */
+static void video_renderer_sdl_wait_events(video_renderer_sdl_t* renderer, sdl_event_state_t* state, int waittime)
+{
+	SDL_LockMutex(sdl_events.mutex);
+	if (!renderer->events.woken)
+	{
+		SDL_CondWaitTimeout(renderer->eventcond, sdl_events.mutex, waittime);
+	}
+	*state = renderer->events;
+	SDL_zero(renderer->events);
+	SDL_UnlockMutex(sdl_events.mutex);
+}
+
 int SDLCALL video_renderer_sdl_thread (void *data)
 {
 	video_renderer_sdl_t* renderer = data;
@@ -88,11 +574,17 @@ int SDLCALL video_renderer_sdl_thread (void *data)
 	SDL_Window* sdlwnd=NULL;
 	SDL_Renderer* sdlrender=NULL;
 	SDL_Texture* sdltexture=NULL;
-	SDL_Event event;
+	sdl_event_state_t events;
+	char name[32];
 
-	SDL_Init(SDL_INIT_VIDEO);
-	SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
-	sdlwnd= SDL_CreateWindow("RPiPlay", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 1280, 720, SDL_WINDOW_RESIZABLE);
+	snprintf(name, sizeof(name), "SDL render %d", renderer->config.session);
+	trace_set_thread_name(name);
+	video_renderer_sdl_request_window(renderer, SDL_WINDOW_REQUEST_CREATE);
+	sdlwnd = renderer->window;
+	if (!sdlwnd)
+	{
+		logger_log(renderer->base.logger, LOGGER_ERR, "SDL video: could not create a window: %s", SDL_GetError());
+	}
 	sdlrender= SDL_CreateRenderer(sdlwnd, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
 	if (!sdlrender)
 	{
@@ -102,75 +594,137 @@ int SDLCALL video_renderer_sdl_thread (void *data)
 	int height = 0;
 	int sdlwidth = 1280;
 	int sdlheight = 720;
-	int64_t lasttime = 0;
-	bool flush = false;
+	SDL_DisplayMode mode;
+	int64_t frameinterval = AV_TIME_BASE / 60;
+	if (SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(sdlwnd), &mode) == 0 && mode.refresh_rate > 0)
+	{
+		frameinterval = AV_TIME_BASE / mode.refresh_rate;
+	}
+	AVFrame* pendingframe = NULL;
+	int waittime = SDL_RENDER_IDLE_WAIT;
+	/* format and size the texture was created with */
+	Uint32 texformat = SDL_PIXELFORMAT_UNKNOWN;
+	int texwidth = 0;
+	int texheight = 0;
+	bool texfilled = false;
+	int reportedsize = 0;
+	int uploads = 0;
+	int64_t planecopies = 0;
+	int64_t uploadtime = 0;
+	bool formatwarned = false;
 	while (!renderer->endrender)
 	{
-		SDL_LockMutex(renderer->mutex);
-		renderframe = av_frame_clone(renderer->renderframe);
-		av_frame_unref(renderer->renderframe);
-		SDL_UnlockMutex(renderer->mutex);
+		/* sleep until a frame has been decoded or the window needs to be redrawn */
+		video_renderer_sdl_wait_events(renderer, &events, waittime);
+		bool flush = events.redraw;
+		if (events.width > 0)
+		{
+			sdlwidth = events.width;
+			sdlheight = events.height;
+		}
 
-		SDL_PumpEvents();
-		while (!SDL_PeepEvents(&event, 1, SDL_GETEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT))
+		/* create the texture for an announced size before the first frame of that size is decoded */
+		int size = SDL_AtomicGet(&renderer->reported_size);
+		if (size != reportedsize)
 		{
-			if (renderer->endrender)
-				break;
-			int64_t nowtime = av_gettime_relative();
-			if ( nowtime - lasttime > AV_TIME_BASE/100)
+			reportedsize = size;
+			int w = size >> 16;
+			int h = size & 0xffff;
+			/* the decoder's output format is only known from the frames; until then assume planar 4:2:0 */
+			Uint32 preformat = texformat != SDL_PIXELFORMAT_UNKNOWN ? texformat : SDL_PIXELFORMAT_IYUV;
+			if (w > 0 && h > 0 && (w != texwidth || h != texheight || preformat != texformat))
 			{
-				flush = true;
-				break;
+				if (sdltexture)
+				{
+					SDL_DestroyTexture(sdltexture);
+				}
+				sdltexture = SDL_CreateTexture(sdlrender, preformat, SDL_TEXTUREACCESS_STREAMING, w, h);
+				texformat = sdltexture ? preformat : SDL_PIXELFORMAT_UNKNOWN;
+				texwidth = w;
+				texheight = h;
+				texfilled = false;
+				logger_log(renderer->base.logger, LOGGER_DEBUG, "SDL video: texture preallocated for %dx%d", w, h);
 			}
-			SDL_PumpEvents();
 		}
-		switch (event.type)
+
+		/* a frame waiting for its pts is kept; newer frames supersede each other in the mailbox meanwhile */
+		if (!pendingframe)
+		{
+			pendingframe = frame_mailbox_take(&renderer->mailbox);
+		}
+		renderframe = pendingframe;
+		waittime = SDL_RENDER_IDLE_WAIT;
+		if (pendingframe && !renderer->config.low_latency && pendingframe->pts != AV_NOPTS_VALUE)
 		{
-			case SDL_WINDOWEVENT:
+			/* with the render clock, a frame is not shown before the vsync closest to its pts */
+			int64_t early = (int64_t) pendingframe->pts - (int64_t) raop_ntp_get_local_time(NULL);
+			if (early > frameinterval / 2 && early < SDL_RENDER_MAX_EARLY)
 			{
-				switch (event.window.event)
+				waittime = (int) ((early - frameinterval / 2) / 1000) + 1;
+				renderframe = NULL;
+			}
+		}
+
+		Uint32 format = SDL_PIXELFORMAT_UNKNOWN;
+		/* set when a new frame is shown in this iteration, for the present timing and latency */
+		uint64_t presentstart = 0;
+		uint64_t presenttimer = 0;
+		uint64_t spanstart = 0;
+		int64_t presentpts = AV_NOPTS_VALUE;
+		if (renderframe)
+		{
+			pendingframe = NULL;
+			format = video_renderer_sdl_texture_format(renderframe->format);
+			if (format == SDL_PIXELFORMAT_UNKNOWN)
+			{
+				if (!formatwarned)
 				{
-					case SDL_WINDOWEVENT_SIZE_CHANGED:
-						sdlwidth = event.window.data1;
-						sdlheight = event.window.data2;
-					case SDL_WINDOWEVENT_EXPOSED:
-						flush = true;
-						break;
-					default:
-						break;
+					logger_log(renderer->base.logger, LOGGER_WARNING, "SDL video: cannot show frames in pixel format %d", renderframe->format);
+					formatwarned = true;
 				}
-				break;
+				renderframe = NULL;
 			}
-			default:
-				break;
 		}
 
-
 		if (renderframe)
 		{
-			if (renderframe->width != width || renderframe->height != height)
+			width = renderframe->width;
+			height = renderframe->height;
+			if (format != texformat || width != texwidth || height != texheight)
 			{
-				width = renderframe->width;
-				height = renderframe->height;
 				if (sdltexture)
 				{
 					SDL_DestroyTexture(sdltexture);
 				}
-				sdltexture = SDL_CreateTexture(sdlrender, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING, width, height);
+				sdltexture = SDL_CreateTexture(sdlrender, format, SDL_TEXTUREACCESS_STREAMING, width, height);
+				texformat = sdltexture ? format : SDL_PIXELFORMAT_UNKNOWN;
+				texwidth = width;
+				texheight = height;
+				texfilled = false;
 			}
-			SDL_UpdateYUVTexture(sdltexture, NULL, renderframe->data[0], renderframe->linesize[0],
-				renderframe->data[1], renderframe->linesize[1],
-				renderframe->data[2], renderframe->linesize[2]
-			);
-
-			av_frame_free(&renderframe);
+			int64_t start = av_gettime_relative();
+			uint64_t now = raop_ntp_get_local_time(NULL);
+			presenttimer = metrics_stage_begin(renderer->config.metrics);
+			spanstart = TRACE_BEGIN();
+			int copies = sdltexture ? video_renderer_sdl_upload(sdltexture, texformat, renderframe) : -1;
+			if (copies > 0)
+			{
+				presentstart = now;
+				presentpts = renderframe->pts;
+				uploadtime += av_gettime_relative() - start;
+				planecopies += copies;
+				uploads++;
+				texfilled = true;
+				SDL_AtomicAdd(&renderer->frames_shown, 1);
+			}
+			flush = true;
 		}
 
 		if (flush)
 		{
 			SDL_SetRenderDrawColor(sdlrender, 0, 0, 0, 255);
 			SDL_RenderClear(sdlrender);
-			if (sdltexture)
+			if (sdltexture && texfilled)
 			{
 				SDL_Rect rect;
 				int picwidth=width;
@@ -225,31 +779,70 @@ int SDLCALL video_renderer_sdl_thread (void *data)
 				SDL_RenderCopyEx(sdlrender, sdltexture, NULL, &rect,renderer->config.rotation,NULL, SDL_FLIP_NONE);
 			}
 			SDL_RenderPresent(sdlrender);
+			if (presentstart)
+			{
+				uint64_t now = raop_ntp_get_local_time(NULL);
+				metrics_stage_end(renderer->config.metrics, METRICS_VIDEO_PRESENT, presenttimer);
+				TRACE_END("video", "present", presentpts, spanstart);
+				if (presentpts != AV_NOPTS_VALUE)
+				{
+					metrics_record(renderer->config.metrics, METRICS_VIDEO_LATENCY_PRESENTED, (int64_t) now - presentpts);
+				}
+			}
 		}
 	}
-	SDL_DestroyTexture(sdltexture);
-	SDL_DestroyRenderer(sdlrender);
-	SDL_DestroyWindow(sdlwnd);
-	av_frame_free(&renderframe);
-	SDL_QuitSubSystem(SDL_INIT_VIDEO);
+	if (uploads > 0)
+	{
+		logger_log(renderer->base.logger, LOGGER_INFO, "SDL video: %d frames uploaded, %.1f plane copies and %.3f ms per frame",
+			uploads, (double) planecopies / uploads, (double) uploadtime / uploads / 1000);
+	}
+	if (sdltexture)
+	{
+		SDL_DestroyTexture(sdltexture);
+	}
+	if (sdlrender)
+	{
+		SDL_DestroyRenderer(sdlrender);
+	}
+	video_renderer_sdl_request_window(renderer, SDL_WINDOW_REQUEST_DESTROY);
 	return 0;
 }
 
 video_renderer_t *video_renderer_sdl_init(logger_t *logger, video_renderer_config_t const *config) {
     video_renderer_sdl_t *renderer;
     renderer = calloc(1, sizeof(video_renderer_sdl_t));
-	memset(renderer, 0, sizeof(video_renderer_sdl_t));
     if (!renderer) {
         return NULL;
     }
     renderer->base.logger = logger;
     renderer->base.funcs = &video_renderer_sdl_funcs;
     renderer->base.type = VIDEO_RENDERER_SDL;
+    renderer->base.caps = VIDEO_RENDERER_CAP_AVCC;
+	renderer->params = h264_params_init(logger, true);
+	if (!renderer->params)
+	{
+		free(renderer);
+		return NULL;
+	}
+	if (!video_renderer_sdl_events_start())
+	{
+		h264_params_destroy(renderer->params);
+		free(renderer);
+		return NULL;
+	}
 	renderer->mutex = SDL_CreateMutex();
+	renderer->packetcond = SDL_CreateCond();
+	renderer->eventcond = SDL_CreateCond();
 	renderer->endrender = false;
-	video_render_sdl_init_decoder(renderer);
-	renderer->renderthread = SDL_CreateThread(video_renderer_sdl_thread, "sdl_renderthread", renderer);
+	renderer->enddecode = false;
 	renderer->config = *config;
+	frame_mailbox_init(&renderer->mailbox);
+	decode_control_init(&renderer->control, logger, config->metrics);
+	renderer->queued_profile = decode_profile_resolve(config, 0);
+	renderer->profile_switch = -1;
+	video_render_sdl_init_decoder(renderer, renderer->queued_profile);
+	renderer->decodethread = SDL_CreateThread(video_renderer_sdl_decode_thread, "sdl_decodethread", renderer);
+	renderer->renderthread = SDL_CreateThread(video_renderer_sdl_thread, "sdl_renderthread", renderer);
     return &renderer->base;
 }
 
@@ -258,27 +851,166 @@ static void video_renderer_sdl_start(video_renderer_t *renderer) {
 
 }
 
-static void video_renderer_sdl_render_buffer(video_renderer_t *renderer, raop_ntp_t *ntp, unsigned char *data, int data_len, uint64_t pts, int type) {
-	video_renderer_sdl_t *r = (video_renderer_sdl_t*)renderer;
+static void video_renderer_sdl_release_refbuf(void *opaque, uint8_t *data) {
+	refbuf_unref(opaque);
+}
 
+/* buf, if not NULL, holds data; the packet then references it instead of a copy. type is the H264_FRAME_* of data,
+ * first is false for the later parts of an access unit, which follow what was decided for its first part */
+static void video_renderer_sdl_queue_packet(video_renderer_sdl_t *r, unsigned char *data, int data_len, uint64_t pts, refbuf_t *buf,
+											int type, bool first) {
+		/* new parameter sets (AVCC) come with an IDR frame; the library tells the frame type, no need to search the NAL units */
+		bool resume = type == H264_FRAME_IDR || r->profile_switch >= 0 || (r->avcc && r->avcc_pending);
+		packet_node_t* stale = NULL;
+		SDL_LockMutex(r->mutex);
+		decode_queue_action_t action = decode_control_queue(&r->control, r->packets_queued, first, resume,
+															 raop_ntp_get_local_time(NULL));
+		if (action == DECODE_QUEUE_FLUSH)
+		{
+			stale = r->packets;
+			r->packets = NULL;
+			r->packets_tail = NULL;
+			r->packets_queued = 0;
+		}
+		SDL_UnlockMutex(r->mutex);
+		while (stale)
+		{
+			packet_node_t* node = stale;
+			stale = node->next;
+			/* a decoder switch or parameter sets in a dropped packet go with this one instead */
+			if (node->profile >= 0 && r->profile_switch < 0)
+			{
+				r->profile_switch = r->queued_profile;
+			}
+			if (r->avcc && av_packet_get_side_data(node->packet, AV_PKT_DATA_NEW_EXTRADATA, NULL))
+			{
+				r->avcc_pending = true;
+			}
+			av_packet_free(&node->packet);
+			free(node);
+		}
+		if (action == DECODE_QUEUE_DROP)
+		{
+			return;
+		}
 
-		AVFrame* pFrame = av_frame_alloc();
+		if (!r->avcc && (type == H264_FRAME_IDR || type == H264_FRAME_UNKNOWN))
+		{
+			/* Annex-B input may carry a new SPS, which gets the low-latency VUI */
+			data = h264_params_process(r->params, data, data_len, &data_len);
+		}
 		AVPacket* packet = av_packet_alloc();
 		packet->pts = pts;
-		av_new_packet(packet, data_len);
-		memcpy(packet->data, data, data_len);
-		avcodec_send_packet(r->h264ctx, packet);
-		if (avcodec_receive_frame(r->h264ctx, pFrame)==0)
-		{
-			SDL_LockMutex(r->mutex);
-			av_frame_unref(r->renderframe);
-			av_frame_move_ref(r->renderframe, pFrame);
-			SDL_UnlockMutex(r->mutex);
-		}
-		av_frame_free(&pFrame);
-		av_packet_free(&packet);
-	
+		int profile = r->profile_switch;
+		if (profile >= 0 && r->avcc)
+		{
+			/* the new decoder needs the parameter sets again */
+			r->avcc_pending = true;
+		}
+		if (buf && data == buf->data && data_len == buf->size)
+		{
+			/* refbuf data is padded like av_new_packet does, the decoder can read it as it is */
+			packet->buf = av_buffer_create(buf->data, buf->size, video_renderer_sdl_release_refbuf, refbuf_ref(buf), AV_BUFFER_FLAG_READONLY);
+			if (!packet->buf)
+			{
+				refbuf_unref(buf);
+				av_packet_free(&packet);
+				return;
+			}
+			packet->data = buf->data;
+			packet->size = buf->size;
+		}
+		else
+		{
+			av_new_packet(packet, data_len);
+			memcpy(packet->data, data, data_len);
+		}
+		if (r->avcc_pending)
+		{
+			/* new parameter sets from configure; the h264 decoder switches to AVCC input with them */
+			uint8_t* extradata = av_packet_new_side_data(packet, AV_PKT_DATA_NEW_EXTRADATA, r->avcc_len);
+			if (extradata)
+			{
+				memcpy(extradata, r->avcc, r->avcc_len);
+				r->avcc_pending = false;
+			}
+		}
+		packet_node_t* node = malloc(sizeof(packet_node_t));
+		if (!node)
+		{
+			av_packet_free(&packet);
+			return;
+		}
+		node->packet = packet;
+		node->profile = profile;
+		node->resume = resume || av_packet_get_side_data(packet, AV_PKT_DATA_NEW_EXTRADATA, NULL);
+		node->next = NULL;
+		r->profile_switch = -1;
 
+		/* decoding happens on the decode thread, the caller (network thread) only queues the packet */
+		SDL_LockMutex(r->mutex);
+		if (r->packets_tail)
+		{
+			r->packets_tail->next = node;
+		}
+		else
+		{
+			r->packets = node;
+		}
+		r->packets_tail = node;
+		r->packets_queued++;
+		SDL_CondSignal(r->packetcond);
+		SDL_UnlockMutex(r->mutex);
+}
+
+static void video_renderer_sdl_render_buffer(video_renderer_t *renderer, raop_ntp_t *ntp, unsigned char *data, int data_len, uint64_t pts, int type) {
+	video_renderer_sdl_t *r = (video_renderer_sdl_t*)renderer;
+	video_renderer_sdl_queue_packet(r, data, data_len, pts, NULL, type, true);
+}
+
+static void video_renderer_sdl_render_refbuf(video_renderer_t *renderer, raop_ntp_t *ntp, refbuf_t *buf, uint64_t pts, int type) {
+	video_renderer_sdl_t *r = (video_renderer_sdl_t*)renderer;
+	video_renderer_sdl_queue_packet(r, buf->data, buf->size, pts, buf, type, true);
+}
+
+static void video_renderer_sdl_render_partial(video_renderer_t *renderer, raop_ntp_t *ntp, unsigned char *data, int data_len, uint64_t pts,
+											  int type, bool first, bool last) {
+	video_renderer_sdl_t *r = (video_renderer_sdl_t*)renderer;
+	if (data_len > 0)
+	{
+		video_renderer_sdl_queue_packet(r, data, data_len, pts, NULL, type, first);
+	}
+}
+
+static void video_renderer_sdl_configure(video_renderer_t *renderer, unsigned char *avcc, int avcc_len) {
+	video_renderer_sdl_t *r = (video_renderer_sdl_t*)renderer;
+	avcc = h264_params_process_avcc(r->params, avcc, avcc_len, &avcc_len);
+	av_free(r->avcc);
+	r->avcc = av_malloc(avcc_len);
+	if (!r->avcc)
+	{
+		r->avcc_len = 0;
+		return;
+	}
+	memcpy(r->avcc, avcc, avcc_len);
+	r->avcc_len = avcc_len;
+	r->avcc_pending = true;
+}
+
+static void video_renderer_sdl_report_size(video_renderer_t *renderer, int width, int height) {
+	video_renderer_sdl_t *r = (video_renderer_sdl_t*)renderer;
+	if (width > 0 && width <= 0x7fff && height > 0 && height <= 0xffff)
+	{
+		SDL_AtomicSet(&r->reported_size, width << 16 | height);
+		/* with a switch height (-dp), the profile depends on the size; the decoder is reopened before the next packet */
+		decode_profile_t profile = decode_profile_resolve(&r->config, height);
+		if (profile != r->queued_profile)
+		{
+			r->queued_profile = profile;
+			r->profile_switch = profile;
+		}
+		video_renderer_sdl_wake(r);
+	}
 }
 
 static void video_renderer_sdl_flush(video_renderer_t *renderer) {
@@ -288,10 +1020,39 @@ static void video_renderer_sdl_destroy(video_renderer_t *renderer) {
 	video_renderer_sdl_t *r = (video_renderer_sdl_t *)renderer;
 	int state;
 	if (renderer) {
+		SDL_LockMutex(r->mutex);
+		r->enddecode = true;
+		SDL_CondSignal(r->packetcond);
+		SDL_UnlockMutex(r->mutex);
+		SDL_WaitThread(r->decodethread, &state);
 
 		avcodec_free_context(&r->h264ctx);
 		r->endrender = true;
+		video_renderer_sdl_wake(r);
 		SDL_WaitThread(r->renderthread,&state);
+		video_renderer_sdl_events_stop();
+		logger_log(renderer->logger, LOGGER_INFO, "SDL video: %d frames decoded, %d shown, %d superseded",
+			SDL_AtomicGet(&r->frames_decoded), SDL_AtomicGet(&r->frames_shown), SDL_AtomicGet(&r->frames_superseded));
+		decode_control_log_stats(&r->control);
+		if (r->decode_errors)
+		{
+			logger_log(renderer->logger, LOGGER_INFO, "SDL video: %d decoding errors, %d packets skipped after them",
+				r->decode_errors, r->packets_skipped);
+		}
+
+		while (r->packets)
+		{
+			packet_node_t* node = r->packets;
+			r->packets = node->next;
+			av_packet_free(&node->packet);
+			free(node);
+		}
+		frame_mailbox_destroy(&r->mailbox);
+		SDL_DestroyCond(r->packetcond);
+		SDL_DestroyCond(r->eventcond);
+		SDL_DestroyMutex(r->mutex);
+		av_free(r->avcc);
+		h264_params_destroy(r->params);
         free(renderer);
     }
 }
@@ -306,4 +1067,8 @@ static const video_renderer_funcs_t video_renderer_sdl_funcs = {
     .flush = video_renderer_sdl_flush,
     .destroy = video_renderer_sdl_destroy,
     .update_background = video_renderer_sdl_update_background,
+    .render_partial = video_renderer_sdl_render_partial,
+    .configure = video_renderer_sdl_configure,
+    .report_size = video_renderer_sdl_report_size,
+    .render_refbuf = video_renderer_sdl_render_refbuf,
 };
@@ -34,6 +34,7 @@
 #include <netpacket/packet.h>
 #elif WIN32
 #include <windows.h>
+#include <conio.h>
 #else
 #include <net/if_dl.h>   /* macOS and *BSD */
 #endif
@@ -43,8 +44,15 @@
 #include "lib/stream.h"
 #include "lib/logger.h"
 #include "lib/dnssd.h"
+#include "lib/trace.h"
 #include "renderers/video_renderer.h"
 #include "renderers/audio_renderer.h"
+#if defined(HAS_PREVIEW_TAP)
+#include "renderers/preview_tap.h"
+#endif
+#if defined(HAS_STREAM_RECORDER)
+#include "renderers/stream_recorder.h"
+#endif
 
 #define VERSION "1.2"
 
@@ -55,10 +63,19 @@
 #define DEFAULT_DEBUG_LOG false
 #define DEFAULT_ROTATE 0
 #define DEFAULT_FLIP FLIP_NONE
+#define DEFAULT_DECODE_PROFILE DECODE_PROFILE_LOWEST_LATENCY
+#define DEFAULT_MAX_VIDEO_LATENCY 0
+#define DEFAULT_MAX_SESSIONS 1
+#define DEFAULT_PREVIEW_INTERVAL 1000
+#define DEFAULT_PREVIEW_WIDTH 320
+#define DEFAULT_PREVIEW_HEIGHT 240
+#define DEFAULT_RECORDER_QUEUE (32 * 1024 * 1024)
 #define DEFAULT_HW_ADDRESS { (char) 0x48, (char) 0x5d, (char) 0x60, (char) 0x7c, (char) 0xee, (char) 0x22 }
 
-int start_server(std::vector<char> hw_addr, std::string name, bool debug_log,
-                 video_renderer_config_t const *video_config, audio_renderer_config_t const *audio_config);
+int start_server(std::vector<char> hw_addr, std::string name, bool debug_log, int max_video_latency, int max_sessions,
+                 std::string preview_path, std::string record_path, std::string capture_path, int metrics_port,
+                 video_renderer_config_t const *video_config,
+                 audio_renderer_config_t const *audio_config);
 
 int stop_server();
 
@@ -78,6 +95,7 @@ typedef struct audio_renderer_list_entry_s {
 } audio_renderer_list_entry_t;
 
 static bool running = false;
+static volatile sig_atomic_t dump_trace = 0;
 static dnssd_t *dnssd = NULL;
 static raop_t *raop = NULL;
 static video_init_func_t video_init_func = NULL;
@@ -85,6 +103,35 @@ static audio_init_func_t audio_init_func = NULL;
 static video_renderer_t *video_renderer = NULL;
 static audio_renderer_t *audio_renderer = NULL;
 static logger_t *render_logger = NULL;
+static metrics_session_t *render_metrics = NULL;    /* of the renderers created at start (session 0) */
+
+/* Every connection is a session with its own renderers: the first one gets those created at start,
+ * the others new instances, up to max_sessions at a time. Sessions are created and destroyed on
+ * the raop httpd thread. */
+typedef struct session_s {
+    int id;
+    bool primary;   /* has the renderers created at start, feeds the recording */
+    video_renderer_t *video_renderer;
+    audio_renderer_t *audio_renderer;
+#if defined(HAS_PREVIEW_TAP)
+    preview_tap_t *preview_tap;     /* the one created at start for the primary session, else its own */
+#endif
+    metrics_session_t *metrics;     /* of the session's own renderers, shared with its streams */
+} session_t;
+
+static session_t *primary_session = NULL;
+static session_t no_session;    /* for connections a session could not be allocated for */
+static int session_count = 0;   /* sessions with renderers */
+static int max_sessions = DEFAULT_MAX_SESSIONS;
+static video_renderer_config_t session_video_config;
+static audio_renderer_config_t session_audio_config;
+#if defined(HAS_PREVIEW_TAP)
+static preview_tap_t *preview_tap = NULL;
+static std::string session_preview_path;
+#endif
+#if defined(HAS_STREAM_RECORDER)
+static stream_recorder_t *stream_recorder = NULL;
+#endif
 
 static const video_renderer_list_entry_t video_renderers[] = {
 #if defined(HAS_RPI_RENDERER)
@@ -125,6 +172,11 @@ static void signal_handler(int sig) {
         case SIGTERM:
             running = 0;
             break;
+#ifndef WIN32
+        case SIGUSR1:
+            dump_trace = 1;
+            break;
+#endif
     }
 }
 
@@ -140,6 +192,7 @@ static void init_signals(void) {
     sigact.sa_flags = 0;
     sigaction(SIGINT, &sigact, NULL);
     sigaction(SIGTERM, &sigact, NULL);
+    sigaction(SIGUSR1, &sigact, NULL);
     #endif
 }
 
@@ -150,6 +203,20 @@ static int parse_hw_addr(std::string str, std::vector<char> &hw_addr) {
     return 0;
 }
 
+static void write_trace(std::string path) {
+    if (trace_dump(path.c_str()) < 0) {
+        LOGE("Could not write trace to %s", path.c_str());
+    } else {
+        LOGI("Trace written to %s", path.c_str());
+    }
+}
+
+static decode_profile_t parse_decode_profile(std::string name) {
+    return name == "throughput" ? DECODE_PROFILE_THROUGHPUT :
+           name == "weak" ? DECODE_PROFILE_WEAK_CPU :
+           DECODE_PROFILE_LOWEST_LATENCY;
+}
+
 static std::string find_mac () {
     #ifdef WIN32
         return std::string();
@@ -214,13 +281,39 @@ static audio_init_func_t find_audio_init_func(const char *name) {
 
 void print_info(char *name) {
     printf("RPiPlay %s: An open-source AirPlay mirroring server for Raspberry Pi\n", VERSION);
-    printf("Usage: %s [-n name] [-b (on|auto|off)] [-r (90|180|270)] [-l] [-a (hdmi|analog|off)] [-vr renderer] [-ar renderer]\n", name);
+    printf("Usage: %s [-n name] [-b (on|auto|off)] [-r (90|180|270)] [-l] [-dp profile] [-ms n] [-vl ms] [-pv file] [-rec file] [-cap file] [-mx port] [-tr file] [-a (hdmi|analog|off)] [-vr renderer] [-ar renderer]\n", name);
     printf("Options:\n");
     printf("-n name               Specify the network name of the AirPlay server\n");
     printf("-b (on|auto|off)      Show black background always, only during active connection, or never\n");
     printf("-r (90|180|270)       Specify image rotation in multiples of 90 degrees\n");
     printf("-f (horiz|vert|both)  Specify image flipping (horiz = horizontal, vert = vertical, both = both)\n");
-    printf("-l                    Enable low-latency mode (disables render clock)\n");
+    printf("-l                    Enable low-latency mode (disables render clock, hands off NAL units early)\n");
+    printf("-dp profile[,profile@lines]\n");
+    printf("                      Set the software decoder profile: latency (slice threads with low delay),\n");
+    printf("                      throughput (frame threads) or weak (low delay without deblocking for weak\n");
+    printf("                      CPUs); the second one is used for videos of at least the given number of\n");
+    printf("                      lines, e.g. latency,throughput@1440 [Default: latency]\n");
+    printf("-ms n                 Mirror up to n clients at a time, each with its own renderers [Default: 1]\n");
+    printf("-vl ms                Drop video frames that arrive more than ms milliseconds late: non-reference\n");
+    printf("                      frames alone, reference frames with the rest of their GOP [Default: never]\n");
+#if defined(HAS_PREVIEW_TAP)
+    printf("-pv file              Write a small preview of the mirrored screen to file (PPM) about once a\n");
+    printf("                      second, decoded from IDR frames only; with -ms, the sessions after the first\n");
+    printf("                      write to file-<session id> (before the extension)\n");
+#endif
+#if defined(HAS_STREAM_RECORDER)
+    printf("-rec file             Record the mirrored video and audio to file (fragmented MP4, not re-encoded);\n");
+    printf("                      with -ms, only the first session is recorded\n");
+#endif
+    printf("-cap file             Capture the received streams and session keys to file, for bench/raop_replay\n");
+    printf("-mx port              Serve metrics as Prometheus text on http://127.0.0.1:port/metrics\n");
+    printf("-tr file              Trace the stages of each frame, written to file (Chrome trace-event JSON)\n");
+#ifdef WIN32
+    printf("                      on exit, on the t key in the console and when the event\n");
+    printf("                      RPiPlay-trace-<pid> is set\n");
+#else
+    printf("                      on exit and on SIGUSR1\n");
+#endif
     printf("-a (hdmi|analog|off)  Set audio output device\n");
     printf("-vr renderer          Set video renderer to use. Available renderers:\n");
     for (int i = 0; i < sizeof(video_renderers)/sizeof(video_renderers[0]); i++) {
@@ -240,12 +333,23 @@ int main(int argc, char *argv[]) {
     std::string server_name = DEFAULT_NAME;
     std::vector<char> server_hw_addr = DEFAULT_HW_ADDRESS;
     bool debug_log = DEFAULT_DEBUG_LOG;
+    int max_video_latency = DEFAULT_MAX_VIDEO_LATENCY;
+    std::string preview_path;
+    std::string record_path;
+    std::string capture_path;
+    int metrics_port = -1;
+    std::string trace_path;
 
     video_renderer_config_t video_config;
     video_config.background_mode = DEFAULT_BACKGROUND_MODE;
     video_config.low_latency = DEFAULT_LOW_LATENCY;
     video_config.rotation = DEFAULT_ROTATE;
     video_config.flip = DEFAULT_FLIP;
+    video_config.decode_profile = DEFAULT_DECODE_PROFILE;
+    video_config.decode_profile_large = DEFAULT_DECODE_PROFILE;
+    video_config.decode_switch_height = 0;
+    video_config.session = 0;
+    video_config.metrics = NULL;
     
     audio_renderer_config_t audio_config;
     audio_config.device = DEFAULT_AUDIO_DEVICE;
@@ -290,6 +394,46 @@ int main(int argc, char *argv[]) {
                                 flip_type == "vert" ? FLIP_VERTICAL :
                                 flip_type == "both" ? FLIP_BOTH :
                                 FLIP_NONE;
+        } else if (arg == "-dp") {
+            if (i == argc - 1) continue;
+            std::string decode_profile(argv[++i]);
+            // profile, or profile,large_profile@lines to switch by resolution
+            size_t comma = decode_profile.find(',');
+            size_t at = decode_profile.find('@');
+            video_config.decode_profile = parse_decode_profile(decode_profile.substr(0, comma));
+            if (comma != std::string::npos && at != std::string::npos && at > comma) {
+                video_config.decode_profile_large = parse_decode_profile(decode_profile.substr(comma + 1, at - comma - 1));
+                video_config.decode_switch_height = atoi(decode_profile.c_str() + at + 1);
+            } else {
+                video_config.decode_profile_large = video_config.decode_profile;
+                video_config.decode_switch_height = 0;
+            }
+        } else if (arg == "-ms") {
+            if (i == argc - 1) continue;
+            max_sessions = atoi(argv[++i]);
+            if (max_sessions < 1) max_sessions = 1;
+        } else if (arg == "-vl") {
+            if (i == argc - 1) continue;
+            max_video_latency = atoi(argv[++i]);
+        } else if (arg == "-pv") {
+            if (i == argc - 1) continue;
+            preview_path = std::string(argv[++i]);
+        } else if (arg == "-rec") {
+            if (i == argc - 1) continue;
+            record_path = std::string(argv[++i]);
+        } else if (arg == "-cap") {
+            if (i == argc - 1) continue;
+            capture_path = std::string(argv[++i]);
+        } else if (arg == "-tr") {
+            if (i == argc - 1) continue;
+            trace_path = std::string(argv[++i]);
+        } else if (arg == "-mx") {
+            if (i == argc - 1) continue;
+            metrics_port = atoi(argv[++i]);
+            if (metrics_port < 0 || metrics_port > 65535) {
+                fprintf(stderr, "Error: -mx takes a port number, 0 for any free port.\n");
+                exit(1);
+            }
         } else if (arg == "-d") {
             debug_log = !debug_log;
         } else if (arg == "-vr") {
@@ -324,60 +468,282 @@ int main(int argc, char *argv[]) {
         parse_hw_addr(mac_address, server_hw_addr);
     }
 
-    if (start_server(server_hw_addr, server_name, debug_log, &video_config, &audio_config) != 0) {
+    if (!trace_path.empty()) {
+        trace_start();
+    }
+
+    if (start_server(server_hw_addr, server_name, debug_log, max_video_latency, max_sessions, preview_path, record_path, capture_path, metrics_port, &video_config, &audio_config) != 0) {
         return 1;
     }
 
+#ifdef WIN32
+    /* There is no SIGUSR1: the trace is also written when another process sets this event
+     * (e.g. [Threading.EventWaitHandle]::OpenExisting("RPiPlay-trace-<pid>").Set() in
+     * PowerShell), or on the t key in the console */
+    HANDLE trace_event = NULL;
+    if (!trace_path.empty()) {
+        std::string event_name = "RPiPlay-trace-" + std::to_string(GetCurrentProcessId());
+        trace_event = CreateEventA(NULL, FALSE, FALSE, event_name.c_str());
+        if (trace_event) {
+            LOGI("Press t or set the event %s to write the trace", event_name.c_str());
+        }
+    }
+#endif
+
     running = true;
     while (running) {
         #ifdef WIN32
-            Sleep(1000);
+            if (trace_event) {
+                if (WaitForSingleObject(trace_event, 1000) == WAIT_OBJECT_0) {
+                    dump_trace = 1;
+                }
+            } else {
+                Sleep(1000);
+            }
+            while (_kbhit()) {
+                int key = _getch();
+                if (key == 't' || key == 'T') {
+                    dump_trace = 1;
+                }
+            }
         #else
             sleep(1);
         #endif
+        if (dump_trace) {
+            dump_trace = 0;
+            if (trace_path.empty()) {
+                LOGW("No trace to write, see -tr");
+            } else {
+                write_trace(trace_path);
+            }
+        }
     }
 
     LOGI("Stopping...");
+#ifdef WIN32
+    if (trace_event) {
+        CloseHandle(trace_event);
+    }
+#endif
     stop_server();
+    if (!trace_path.empty()) {
+        trace_stop();
+        write_trace(trace_path);
+    }
+}
+
+#if defined(HAS_PREVIEW_TAP)
+static preview_tap_t *preview_init(std::string const &path) {
+    preview_tap_config_t preview_config;
+    preview_config.max_width = DEFAULT_PREVIEW_WIDTH;
+    preview_config.max_height = DEFAULT_PREVIEW_HEIGHT;
+    preview_config.interval_ms = DEFAULT_PREVIEW_INTERVAL;
+    preview_config.path = path.c_str();
+    return preview_tap_init(render_logger, &preview_config);
 }
 
+/* The sessions after the first write their previews next to its file: "preview.ppm" becomes "preview-<id>.ppm" */
+static preview_tap_t *session_preview_init(int session_id) {
+    std::string path = session_preview_path;
+    size_t dot = path.find_last_of('.');
+    size_t separator = path.find_last_of("/\\");
+    if (dot == std::string::npos || (separator != std::string::npos && dot < separator)) {
+        dot = path.size();
+    }
+    path.insert(dot, "-" + std::to_string(session_id));
+    return preview_init(path);
+}
+#endif
+
 // Server callbacks
+extern "C" void *session_init(void *cls, int session_id, const unsigned char *remote, int remote_len) {
+    session_t *session = (session_t *) calloc(1, sizeof(session_t));
+    if (!session) {
+        return &no_session;
+    }
+    session->id = session_id;
+    if (!primary_session) {
+        session->primary = true;
+        session->video_renderer = video_renderer;
+        session->audio_renderer = audio_renderer;
+#if defined(HAS_PREVIEW_TAP)
+        session->preview_tap = preview_tap;
+#endif
+        primary_session = session;
+        session_count++;
+    } else if (session_count < max_sessions) {
+        video_renderer_config_t video_config = session_video_config;
+        video_config.session = session_id;
+        video_config.metrics = session->metrics = metrics_session_open(raop_get_metrics(raop), session_id);
+        if ((session->video_renderer = video_init_func(render_logger, &video_config)) == NULL) {
+            LOGE("Session %d: could not init video renderer", session_id);
+        } else if (session_audio_config.device != AUDIO_DEVICE_NONE &&
+                   (session->audio_renderer = audio_init_func(render_logger, session->video_renderer,
+                                                              &session_audio_config)) == NULL) {
+            LOGE("Session %d: could not init audio renderer", session_id);
+        }
+        if (session->video_renderer) {
+            session->video_renderer->funcs->start(session->video_renderer);
+            if (session->audio_renderer) session->audio_renderer->funcs->start(session->audio_renderer);
+#if defined(HAS_PREVIEW_TAP)
+            if (!session_preview_path.empty()) session->preview_tap = session_preview_init(session_id);
+#endif
+            // session_destroy gives the slot back only for sessions with a video renderer
+            session_count++;
+            LOGI("Session %d: %d sessions mirrored", session_id, session_count);
+        }
+    } else {
+        LOGW("Session %d: already mirroring %d sessions, not showing this one (see -ms)", session_id, session_count);
+    }
+    return session;
+}
+
+extern "C" void session_destroy(void *cls, void *ptr) {
+    session_t *session = (session_t *) ptr;
+    if (session == &no_session) {
+        return;
+    }
+    if (session->primary) {
+        primary_session = NULL;
+        session_count--;
+    } else if (session->video_renderer) {
+        // If we don't destroy these two in the correct order, we get a deadlock from the ilclient library
+        if (session->audio_renderer) session->audio_renderer->funcs->destroy(session->audio_renderer);
+        session->video_renderer->funcs->destroy(session->video_renderer);
+#if defined(HAS_PREVIEW_TAP)
+        preview_tap_destroy(session->preview_tap);
+#endif
+        session_count--;
+    }
+    if (session->metrics) metrics_session_close(session->metrics);
+    free(session);
+}
+
 extern "C" void conn_init(void *cls) {
-    if (video_renderer) video_renderer->funcs->update_background(video_renderer, 1);
+    session_t *session = (session_t *) cls;
+    if (session->video_renderer) session->video_renderer->funcs->update_background(session->video_renderer, 1);
 }
 
 extern "C" void conn_destroy(void *cls) {
-    if (video_renderer) video_renderer->funcs->update_background(video_renderer, -1);
+    session_t *session = (session_t *) cls;
+    if (session->video_renderer) session->video_renderer->funcs->update_background(session->video_renderer, -1);
 }
 
 extern "C" void audio_process(void *cls, raop_ntp_t *ntp, audio_decode_struct *data) {
+    session_t *session = (session_t *) cls;
+    audio_renderer_t *audio_renderer = session->audio_renderer;
+#if defined(HAS_STREAM_RECORDER)
+    if (stream_recorder && session->primary) {
+        stream_recorder_audio(stream_recorder, data->buf, data->data, data->data_len, data->ntp_time);
+    }
+#endif
     if (audio_renderer != NULL) {
-        audio_renderer->funcs->render_buffer(audio_renderer, ntp, data->data, data->data_len, data->rtp_time);
+        if (audio_renderer->funcs->render_refbuf && data->buf) {
+            audio_renderer->funcs->render_refbuf(audio_renderer, ntp, data->buf, data->rtp_time);
+        } else {
+            audio_renderer->funcs->render_buffer(audio_renderer, ntp, data->data, data->data_len, data->rtp_time);
+        }
     }
 }
 
 extern "C" void video_process(void *cls, raop_ntp_t *ntp, h264_decode_struct *data) {
-    if (video_renderer != NULL) {
-        video_renderer->funcs->render_buffer(video_renderer, ntp, data->data, data->data_len, data->pts, 0);
+    session_t *session = (session_t *) cls;
+    video_renderer_t *video_renderer = session->video_renderer;
+#if defined(HAS_PREVIEW_TAP)
+    if (session->preview_tap && data->frame_type == H264_FRAME_IDR && data->validity == H264_DATA_VALID) {
+        preview_tap_submit(session->preview_tap, data->buf, data->data, data->data_len, data->pts);
+    }
+#endif
+#if defined(HAS_STREAM_RECORDER)
+    if (stream_recorder && session->primary && data->validity == H264_DATA_VALID) {
+        stream_recorder_video(stream_recorder, data->buf, data->data, data->data_len, data->pts,
+                              data->frame_type == H264_FRAME_IDR);
+    }
+#endif
+    if (video_renderer != NULL && data->validity == H264_DATA_VALID) {
+        if (video_renderer->funcs->render_refbuf && data->buf) {
+            video_renderer->funcs->render_refbuf(video_renderer, ntp, data->buf, data->pts, data->frame_type);
+        } else {
+            video_renderer->funcs->render_buffer(video_renderer, ntp, data->data, data->data_len, data->pts,
+                                                 data->frame_type);
+        }
+    }
+}
+
+extern "C" void video_process_nal(void *cls, raop_ntp_t *ntp, h264_nal_struct *data) {
+    session_t *session = (session_t *) cls;
+#if defined(HAS_PREVIEW_TAP)
+    /* a corrupt part ends the access unit early: it is not passed on, the next first part starts over */
+    if (session->preview_tap && data->validity == H264_DATA_VALID) {
+        preview_tap_submit_part(session->preview_tap, data->data, data->data_len, data->pts, data->frame_type,
+                                data->first, data->last);
+    }
+#endif
+#if defined(HAS_STREAM_RECORDER)
+    if (stream_recorder && session->primary) {
+        stream_recorder_video_part(stream_recorder, data->data, data->data_len, data->pts, data->first, data->last);
+    }
+#endif
+    if (session->video_renderer != NULL) {
+        session->video_renderer->funcs->render_partial(session->video_renderer, ntp, data->data, data->data_len, data->pts,
+                                                       data->frame_type, data->first, data->last);
+    }
+}
+
+extern "C" void video_configure(void *cls, raop_ntp_t *ntp, h264_config_struct *data) {
+    session_t *session = (session_t *) cls;
+#if defined(HAS_PREVIEW_TAP)
+    if (session->preview_tap) preview_tap_configure(session->preview_tap, data->avcc, data->avcc_len);
+#endif
+#if defined(HAS_STREAM_RECORDER)
+    if (stream_recorder && session->primary) stream_recorder_configure(stream_recorder, data->avcc, data->avcc_len);
+#endif
+    if (session->video_renderer != NULL) {
+        session->video_renderer->funcs->configure(session->video_renderer, data->avcc, data->avcc_len);
+    }
+}
+
+extern "C" void video_report_size(void *cls, float *width_source, float *height_source, float *width, float *height) {
+    session_t *session = (session_t *) cls;
+#if defined(HAS_STREAM_RECORDER)
+    if (stream_recorder && session->primary) stream_recorder_set_video_size(stream_recorder, (int) *width, (int) *height);
+#endif
+    if (session->video_renderer != NULL && session->video_renderer->funcs->report_size) {
+        session->video_renderer->funcs->report_size(session->video_renderer, (int) *width, (int) *height);
+    }
+}
+
+extern "C" void video_format_changed(void *cls, raop_ntp_t *ntp, h264_format_struct *format) {
+    session_t *session = (session_t *) cls;
+    /* the size coded in the new SPS replaces the one reported from the stream header */
+#if defined(HAS_STREAM_RECORDER)
+    if (stream_recorder && session->primary) stream_recorder_set_video_size(stream_recorder, format->width, format->height);
+#endif
+    if (session->video_renderer != NULL && session->video_renderer->funcs->report_size) {
+        session->video_renderer->funcs->report_size(session->video_renderer, format->width, format->height);
     }
 }
 
 extern "C" void audio_flush(void *cls) {
-    if (audio_renderer) audio_renderer->funcs->flush(audio_renderer);
+    session_t *session = (session_t *) cls;
+    if (session->audio_renderer) session->audio_renderer->funcs->flush(session->audio_renderer);
 }
 
 extern "C" void video_flush(void *cls) {
-    if (video_renderer) video_renderer->funcs->flush(video_renderer);
+    session_t *session = (session_t *) cls;
+    if (session->video_renderer) session->video_renderer->funcs->flush(session->video_renderer);
 }
 
 extern "C" void audio_set_volume(void *cls, float volume) {
-    if (audio_renderer != NULL) {
-        audio_renderer->funcs->set_volume(audio_renderer, volume);
+    session_t *session = (session_t *) cls;
+    if (session->audio_renderer != NULL) {
+        session->audio_renderer->funcs->set_volume(session->audio_renderer, volume);
     }
 }
 
 extern "C" void audio_get_format(void *cls, unsigned char *ct, unsigned short *spf, bool *usingScreen, bool *isMedia, uint64_t *audioFormat)
 {
+    session_t *session = (session_t *) cls;
     audio_renderer_format_t fmt;
     switch (*ct) {
     case 2:
@@ -392,9 +758,12 @@ extern "C" void audio_get_format(void *cls, unsigned char *ct, unsigned short *s
     default:
         break;
     }
-    if (audio_renderer != NULL) {
-        audio_renderer->funcs->setformat(audio_renderer,fmt);
+    if (session->audio_renderer != NULL) {
+        session->audio_renderer->funcs->setformat(session->audio_renderer, fmt);
     }
+#if defined(HAS_STREAM_RECORDER)
+    if (stream_recorder && session->primary) stream_recorder_set_audio_format(stream_recorder, fmt);
+#endif
 }
 
 extern "C" void log_callback(void *cls, int level, const char *msg) {
@@ -421,15 +790,23 @@ extern "C" void log_callback(void *cls, int level, const char *msg) {
 
 }
 
-int start_server(std::vector<char> hw_addr, std::string name, bool debug_log,
-                 video_renderer_config_t const *video_config, audio_renderer_config_t const *audio_config) {
+int start_server(std::vector<char> hw_addr, std::string name, bool debug_log, int max_video_latency, int max_sessions,
+                 std::string preview_path, std::string record_path, std::string capture_path, int metrics_port,
+                 video_renderer_config_t const *video_config,
+                 audio_renderer_config_t const *audio_config) {
     raop_callbacks_t raop_cbs;
     memset(&raop_cbs, 0, sizeof(raop_cbs));
-    //如果要做多投 这块要扩展身份处理 不然不知道是谁的数据
+    raop_cbs.cls = &no_session;
+    raop_cbs.session_init = session_init;   // each connection gets its own session_t as cls
+    raop_cbs.session_destroy = session_destroy;
     raop_cbs.conn_init = conn_init;//这个跟http的conn_init不是一回事
     raop_cbs.conn_destroy = conn_destroy;//同理
     raop_cbs.audio_process = audio_process;
     raop_cbs.video_process = video_process;
+    raop_cbs.video_process_nal = video_process_nal;
+    raop_cbs.video_configure = video_configure;
+    raop_cbs.video_report_size = video_report_size;
+    raop_cbs.video_format_changed = video_format_changed;
     raop_cbs.audio_flush = audio_flush;
     raop_cbs.video_flush = video_flush;
     raop_cbs.audio_set_volume = audio_set_volume;
@@ -442,6 +819,10 @@ int start_server(std::vector<char> hw_addr, std::string name, bool debug_log,
 
     raop_set_log_callback(raop, log_callback, NULL);
     raop_set_log_level(raop, debug_log ? RAOP_LOG_DEBUG : LOGGER_INFO);
+    if (!capture_path.empty() && raop_set_capture(raop, capture_path.c_str()) < 0) {
+        LOGE("Could not open capture file %s", capture_path.c_str());
+        return -1;
+    }
 
     render_logger = logger_init();
     logger_set_callback(render_logger, log_callback, NULL);
@@ -449,11 +830,39 @@ int start_server(std::vector<char> hw_addr, std::string name, bool debug_log,
 
     if (video_config->low_latency) logger_log(render_logger, LOGGER_INFO, "Using low-latency mode");
 
-    if ((video_renderer = video_init_func(render_logger, video_config)) == NULL) {
+    ::max_sessions = max_sessions;
+    session_video_config = *video_config;
+    session_audio_config = *audio_config;
+    video_renderer_config_t primary_video_config = *video_config;
+    primary_video_config.metrics = render_metrics = metrics_session_open(raop_get_metrics(raop), 0);
+    if ((video_renderer = video_init_func(render_logger, &primary_video_config)) == NULL) {
         LOGE("Could not init video renderer");
         return -1;
     }
 
+    if (video_config->low_latency && video_renderer->funcs->render_partial) {
+        /* hand off NAL units to the renderer as soon as they are received */
+        raop_set_plist(raop, "nalHandoff", 1);
+    }
+    if ((video_renderer->caps & VIDEO_RENDERER_CAP_AVCC) && video_renderer->funcs->configure) {
+        /* the renderer takes length prefixed NAL units, with SPS and PPS passed in once */
+        raop_set_plist(raop, "avccPassthrough", 1);
+    }
+    if (max_video_latency > 0) {
+        raop_set_plist(raop, "maxVideoLatency", max_video_latency);
+    }
+#if defined(HAS_PREVIEW_TAP)
+    session_preview_path = preview_path;
+    if (!preview_path.empty()) {
+        preview_tap = preview_init(preview_path);
+    }
+#endif
+#if defined(HAS_STREAM_RECORDER)
+    if (!record_path.empty()) {
+        stream_recorder = stream_recorder_init(render_logger, record_path.c_str(), DEFAULT_RECORDER_QUEUE);
+    }
+#endif
+
     if (audio_config->device == AUDIO_DEVICE_NONE) {
         LOGI("Audio disabled");
     } else if ((audio_renderer = audio_init_func(render_logger, video_renderer, audio_config)) ==
@@ -469,6 +878,13 @@ int start_server(std::vector<char> hw_addr, std::string name, bool debug_log,
     raop_start(raop, &port);
     raop_set_port(raop, port);
 
+    if (metrics_port >= 0) {
+        unsigned short mport = (unsigned short) metrics_port;
+        if (raop_start_metrics(raop, &mport) <= 0) {
+            LOGE("Could not serve metrics on port %d", metrics_port);
+        }
+    }
+
     int error;
     dnssd = dnssd_init(name.c_str(), strlen(name.c_str()), hw_addr.data(), hw_addr.size(), &error);
     if (error) {
@@ -485,12 +901,24 @@ int start_server(std::vector<char> hw_addr, std::string name, bool debug_log,
 }
 
 int stop_server() {
-    raop_destroy(raop);
+    // The sessions end first; the renderers report to the metrics of raop until they are destroyed
+    raop_stop(raop);
     dnssd_unregister_raop(dnssd);
     dnssd_unregister_airplay(dnssd);
     // If we don't destroy these two in the correct order, we get a deadlock from the ilclient library
     if (audio_renderer) audio_renderer->funcs->destroy(audio_renderer);
     if (video_renderer) video_renderer->funcs->destroy(video_renderer);
+    if (render_metrics) metrics_session_close(render_metrics);
+    render_metrics = NULL;
+    raop_destroy(raop);
+#if defined(HAS_PREVIEW_TAP)
+    preview_tap_destroy(preview_tap);
+    preview_tap = NULL;
+#endif
+#if defined(HAS_STREAM_RECORDER)
+    stream_recorder_destroy(stream_recorder);
+    stream_recorder = NULL;
+#endif
     logger_destroy(render_logger);
     return 0;
 }